@@ -8,6 +8,14 @@
 #include "openai_processor.h"
 #include "config.h"
 #include "prompts_manager.h"
+#include "heap_profiler.h"
+#include "trace.h"
+#include "prompt_store.h"
+#include "capture_task.h"
+#include "local_planner.h"
+#include "planner_gateway.h"
+#include "skill_library.h"
+#include "sensor_snapshot.h"
 
 // Pin definitions for motors
 #define IN1 16
@@ -21,8 +29,32 @@ PubSubClient client(espClient);
 // Declare the MQTT client as external for robot_tools.h
 extern PubSubClient client;
 
+// Id of the command being executed, echoed in status messages; "" between commands
+String currentCommandId = "";
+
+// The completion status carries the result line, not the planning summary,
+// so it fits the status document and the MQTT buffer
+#define STATUS_CONTENT_MAX_CHARS 96
+#define STATUS_RESULT_MAX_CHARS 160
+
+// Parsed MQTT command message
+struct CommandMessage {
+  String error;       // JSON parse error, empty if the payload parsed
+  bool fromRobot;     // Message was published by a robot (this one or another car)
+  bool forOtherRobot; // Message has a 'target' that isn't this robot
+  String tool;        // Direct tool invocation, empty for planning commands
+  String params;      // Parameters for the direct tool invocation
+  bool hasContent;    // Whether a 'content' field was present
+  String content;     // Natural language command
+  String sender;
+  String id;
+};
+
 // Function declarations for iterative planning
 String executeIterativePlanning(String objective);
+CommandMessage parseCommandMessage(const byte* payload, unsigned int length);
+String commandResultLine(const String& result);
+void sendCommandStatus(const String& message, const String& commandId);
 
 void setup() {
   // Initialize motor pins
@@ -38,20 +70,28 @@ void setup() {
   initRobotTools();
   
   // Initialize prompts manager
-  PromptsManager promptsManager;
   if (!promptsManager.begin()) {
     logToRobotLogs("Warning: Prompts Manager initialization failed");
   } else {
     promptsManager.logPromptInfo();
   }
   
+  // Load the skill library index
+  loadSkillLibrary();
+  
   // Connect to WiFi
   setupWiFi();
   
+  // Start background frame capture (fake camera frames need WiFi)
+  startCaptureTask();
+  
+  // Start the sensor task that reads the sonar while prompts are built
+  startSensorTask();
+  
   // Setup MQTT
   setupMQTT();
   
-  logToRobotLogs("Arduino Car MQTT Command Receiver Ready!");
+  logToRobotLogs("Arduino Car MQTT Command Receiver Ready! Robot id: " + getRobotId());
   logToRobotLogs("Listening for commands on topic: " + String(MQTT_TOPIC));
 }
 
@@ -83,19 +123,30 @@ void setupWiFi() {
 void setupMQTT() {
   client.setServer(MQTT_SERVER, MQTT_PORT);
   client.setCallback(callback);
+  
+  // Default 256-byte buffer drops prompt chunks and long status messages
+  client.setBufferSize(PROMPT_MQTT_BUFFER_SIZE);
 }
 
 void reconnect() {
   while (!client.connected()) {
     logToRobotLogs("Attempting MQTT connection...");
     
-    if (client.connect(MQTT_CLIENT_ID)) {
+    if (client.connect(getMqttClientId().c_str())) {
       logToRobotLogs("connected");
       
       // Subscribe to the robot command topic
       client.subscribe(MQTT_TOPIC);
       logToRobotLogs("Subscribed to topic: " + String(MQTT_TOPIC));
       
+      // Subscribe to prompt store updates
+      client.subscribe(PROMPT_TOPIC);
+      
+      // Subscribe to planning replies from the gateway
+      if (GATEWAY_ENABLED) {
+        client.subscribe(gatewayReplyTopic().c_str());
+      }
+      
       // Send initial status message
       sendStatusMessage("Robot connected and ready to receive commands");
       
@@ -108,51 +159,158 @@ void reconnect() {
 }
 
 void callback(char* topic, byte* payload, unsigned int length) {
+  // Prompt push/activate/rollback
+  if (String(topic) == PROMPT_TOPIC) {
+    handlePromptStoreMessage(payload, length);
+    return;
+  }
+  
+  // Planning replies while an objective runs on the gateway
+  if (GATEWAY_ENABLED && String(topic) == gatewayReplyTopic()) {
+    handleGatewayReply(payload, length);
+    return;
+  }
+  
   // Only process messages from the ajlisy/robot topic
   if (String(topic) != MQTT_TOPIC) {
     return; // Silently ignore messages from other topics
   }
   
-  
-  // Convert payload to string
-  String message = "";
-  for (int i = 0; i < length; i++) {
-    message += (char)payload[i];
+  // Waiting for the gateway pumps client.loop() from inside this callback;
+  // a command arriving then can't start another planning session
+  if (gatewayPumping) {
+    CommandMessage command = parseCommandMessage(payload, length);
+    if (command.error.length() == 0 && !command.fromRobot && !command.forOtherRobot) {
+      // Tagged with the ignored command's id; the running one is still going
+      sendCommandStatus("Busy: planning in progress, command " + command.id + " ignored", command.id);
+    }
+    return;
   }
   
-  // Parse JSON message
-  DynamicJsonDocument doc(1024);
-  DeserializationError error = deserializeJson(doc, message);
+  CommandMessage command = parseCommandMessage(payload, length);
   
-  if (error) {
+  if (command.error.length() > 0) {
     logToRobotLogs("JSON parsing failed: ");
-    logToRobotLogs(error.c_str());
+    logToRobotLogs(command.error);
     sendStatusMessage("Error: Invalid JSON format");
     return;
   }
   
-  // Check if this message is from the robot itself (ignore to prevent loops)
-  if (doc.containsKey("robot_id") && doc["robot_id"] == "arduino_car") {
+  // Ignore messages published by robots (prevents loops between cars sharing the topic)
+  if (command.fromRobot) {
     //logToRobotLogs("Ignoring message from self");
     return;
   }
   
+  // Ignore commands addressed to another car
+  if (command.forOtherRobot) {
+    return;
+  }
+  
+  // Every accepted command gets its own trace id; spans below are recorded
+  // under it. Echoes and other cars' traffic leave the last trace alone.
+  startTrace();
+  ScopedTrace span("mqtt_command");
+  
+  currentCommandId = command.id;
+  
+  // Direct tool invocation bypasses planning (diagnostics such as run_benchmarks)
+  // Format: {"tool": "run_benchmarks", "params": "200"}
+  if (command.tool.length() > 0) {
+    String result = executeTool(command.tool, command.params);
+    sendStatusMessage("Tool executed: " + command.tool + " | Result: " + result);
+    currentCommandId = "";
+    return;
+  }
+  
   // Extract command content
-  if (!doc.containsKey("content")) {
+  if (!command.hasContent) {
     sendStatusMessage("Error: No 'content' field in JSON");
+    currentCommandId = "";
     return;
   }
   
-  String content = doc["content"].as<String>();
-  String sender = doc.containsKey("sender") ? doc["sender"].as<String>() : "unknown";
-  String id = doc.containsKey("id") ? doc["id"].as<String>() : "unknown";
-  
+  String content = command.content;
   
   // Execute the command
   String result = executeCommand(content);
   
-  // Send response back
-  sendStatusMessage("Command executed: " + content + " | Result: " + result);
+  // Send response back; the full summary is in the robot logs
+  if (content.length() > STATUS_CONTENT_MAX_CHARS) {
+    content = content.substring(0, STATUS_CONTENT_MAX_CHARS) + "...";
+  }
+  sendStatusMessage("Command executed: " + content + " | Result: " + commandResultLine(result));
+  currentCommandId = "";
+}
+
+/**
+ * Short result for the completion status
+ * @param result executeCommand() summary
+ * @return Its "Final result:" line (or first line), at most STATUS_RESULT_MAX_CHARS
+ */
+String commandResultLine(const String& result) {
+  int start = result.indexOf("Final result: ");
+  start = start == -1 ? 0 : start + 14;
+  int end = result.indexOf('\n', start);
+  String line = result.substring(start, end == -1 ? result.length() : end);
+  if (line.length() > STATUS_RESULT_MAX_CHARS) {
+    line = line.substring(0, STATUS_RESULT_MAX_CHARS) + "...";
+  }
+  return line;
+}
+
+/**
+ * Parse a raw MQTT command payload without executing anything
+ * @param payload Raw message bytes
+ * @param length Payload length
+ * @return CommandMessage with error set if the JSON was invalid
+ */
+CommandMessage parseCommandMessage(const byte* payload, unsigned int length) {
+  CommandMessage command;
+  command.error = "";
+  command.fromRobot = false;
+  command.forOtherRobot = false;
+  command.tool = "";
+  command.params = "";
+  command.hasContent = false;
+  command.content = "";
+  command.sender = "unknown";
+  command.id = "unknown";
+  
+  // Parse JSON message straight from the payload bytes
+  DynamicJsonDocument doc(1024);
+  heapProfileAlloc("mqtt_command_doc", 1024);
+  DeserializationError error = deserializeJson(doc, payload, length);
+  
+  if (error) {
+    command.error = error.c_str();
+    return command;
+  }
+  
+  if (doc.containsKey("robot_id")) {
+    command.fromRobot = true;
+    return command;
+  }
+  
+  // Optional addressing: {"target": "car_a1b2c3", "content": "..."}
+  if (doc.containsKey("target") && doc["target"].as<String>() != getRobotId()) {
+    command.forOtherRobot = true;
+    return command;
+  }
+  
+  if (doc.containsKey("tool")) {
+    command.tool = doc["tool"].as<String>();
+    command.params = doc.containsKey("params") ? doc["params"].as<String>() : "";
+  }
+  
+  command.hasContent = doc.containsKey("content");
+  if (command.hasContent) {
+    command.content = doc["content"].as<String>();
+  }
+  command.sender = doc.containsKey("sender") ? doc["sender"].as<String>() : "unknown";
+  command.id = doc.containsKey("id") ? doc["id"].as<String>() : "unknown";
+  
+  return command;
 }
 
 String executeCommand(String command) {
@@ -171,12 +329,29 @@ String executeCommand(String command) {
 
 
 void sendStatusMessage(String message) {
+  sendCommandStatus(message, currentCommandId);
+}
+
+/**
+ * Send a status message about a specific command
+ * @param message Status text
+ * @param commandId Id echoed as command_id, "" for none
+ */
+void sendCommandStatus(const String& message, const String& commandId) {
+  ScopedTrace span("mqtt_status");
+  
   if (client.connected()) {
     // Create JSON response
     DynamicJsonDocument doc(512);
-    doc["robot_id"] = "arduino_car";
+    doc["robot_id"] = getRobotId();
     doc["status"] = message;
     doc["timestamp"] = String(millis());
+    doc["trace_id"] = getCurrentTraceId();
+    doc["prompt_version"] = promptsManager.getActivePromptVersion();
+    doc["planner"] = activePlannerName();
+    if (commandId.length() > 0) {
+      doc["command_id"] = commandId;
+    }
     
     String jsonString;
     serializeJson(doc, jsonString);
@@ -0,0 +1,56 @@
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+#include <Arduino.h>
+#include "openai_processor.h"
+
+// Allocation counts need the core built with standalone heap tracing
+#if defined(CONFIG_HEAP_TRACING_STANDALONE)
+#define BENCH_HEAP_TRACE 1
+#else
+#define BENCH_HEAP_TRACE 0
+#endif
+#define BENCH_TRACE_RECORDS 128   // Allocations recorded per operation; more are reported as truncated
+
+// Peak usage needs the local minimum-free monitor (ESP-IDF 5.1+)
+#if __has_include(<esp_idf_version.h>)
+#include <esp_idf_version.h>
+#endif
+#if defined(ESP_IDF_VERSION_VAL)
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+#define BENCH_HEAP_PEAK 1
+#endif
+#endif
+#ifndef BENCH_HEAP_PEAK
+#define BENCH_HEAP_PEAK 0
+#endif
+
+// Result of one benchmark case
+struct BenchmarkResult {
+  String name;             // Benchmark name
+  int historySize;         // Iterations of execution history in the fixture
+  int iterations;          // Timed repetitions
+  unsigned long nsPerOp;   // Mean wall time per operation
+  long bytesPerOp;         // Heap bytes allocated during one operation, temporaries included (-1 without heap tracing)
+  long allocsPerOp;        // Allocations made during one operation (-1 without heap tracing)
+  bool allocsTruncated;    // More than BENCH_TRACE_RECORDS allocations; the counts are a lower bound
+  long peakBytesPerOp;     // Most heap in use above the starting point during one operation (-1 before IDF 5.1)
+  long liveBytesPerOp;     // Heap still allocated at the end of one operation, held by its result
+};
+
+// Fixtures shared with the heap soak test
+extern const char* BENCH_OPENAI_RESPONSE;
+extern const char* BENCH_OBJECTIVE;
+extern const char* BENCH_LATEST_RESULTS;
+
+// Function declarations
+String runBenchmarks(String params);
+void measureOpAllocations(String (*op)(), BenchmarkResult& result);
+long measureOpPeakBytes(String (*op)());
+BenchmarkResult runBenchmarkCase(const char* name, int historySize, int iterations, String (*op)());
+String formatBenchmarkResult(const BenchmarkResult& result);
+String buildBenchmarkHistory(int iterations);
+String measureJsonRepairCorpus();
+String measureLocalPlanCorpus();
+
+#endif // BENCHMARKS_H
@@ -0,0 +1,498 @@
+#include "benchmarks.h"
+#include "robot_tools.h"
+#include "inline_image_body.h"
+#include "json_repair.h"
+#include "world_state.h"
+#include "local_planner.h"
+#include <esp_heap_caps.h>
+#if BENCH_HEAP_TRACE
+#include <esp_heap_trace.h>
+#endif
+
+// ==========================================
+// BENCHMARK FIXTURES
+// ==========================================
+
+// Typical chat completion carrying a planning decision in a ```json block
+const char* BENCH_OPENAI_RESPONSE = R"({"id":"chatcmpl-bench","object":"chat.completion","created":1718000000,"model":"gpt-4o-mini","choices":[{"index":0,"message":{"role":"assistant","content":"```json\n{\n  \"tool_calls\": [\n    {\"tool\": \"move_car\", \"params\": \"forward 1000\", \"confidence\": 0.95},\n    {\"tool\": \"get_sonar_distance\", \"params\": \"\", \"confidence\": 0.98}\n  ],\n  \"should_continue\": true,\n  \"objective_complete\": false,\n  \"reasoning\": \"Obstacle is 45cm away, moving forward 1000ms then measuring again.\",\n  \"next_context\": \"Moved forward once, last distance 45cm, target 20cm\"\n}\n```"},"finish_reason":"stop"}],"usage":{"prompt_tokens":1650,"completion_tokens":120,"total_tokens":1770}})";
+
+const char* BENCH_OBJECTIVE = "Move forward until you are within 20cm of an obstacle";
+const char* BENCH_CONTEXT = "Moved forward once, last distance 45cm, target 20cm";
+const char* BENCH_DECISION_JSON = "{\"tool_calls\":[{\"tool\":\"move_car\",\"params\":\"forward 1000\",\"confidence\":0.95},{\"tool\":\"get_sonar_distance\",\"params\":\"\",\"confidence\":0.98}],\"should_continue\":true,\"objective_complete\":false,\"reasoning\":\"Obstacle is 45cm away, moving forward 1000ms then measuring again.\",\"next_context\":\"Moved forward once, last distance 45cm, target 20cm\"}";
+const char* BENCH_LATEST_RESULTS = "Iteration tool calls:\n[1] move_car: Car moved forward for 1000ms\n[2] get_sonar_distance: Distance: 45 cm (avg of 5 readings)\n";
+const char* BENCH_WORLD_STATE = "pose: x=66.4 cm, y=0.0 cm, heading=0 deg, stopped\ndistance ahead: 45 cm (1 reading, 0.3 s ago)\n"
+                                "last move: forward 1000\nprogress: 1 moves (66 cm), 0 turns (0 deg), 2 distance readings, 3 tool calls\nerrors: none";
+
+// Malformed decision content seen from models (message content, not the
+// whole response); every entry has at least one whole tool call to rescue
+const char* JSON_REPAIR_CORPUS[] = {
+  // Trailing commas
+  R"({"tool_calls": [{"tool": "move_car", "params": "forward 1000", "confidence": 0.95},], "should_continue": true, "objective_complete": false, "reasoning": "Moving closer",})",
+  // Prose around the object
+  R"(Sure! Here is the next step:
+{"tool_calls": [{"tool": "get_sonar_distance", "params": "", "confidence": 0.98}], "should_continue": true, "objective_complete": false, "reasoning": "Measure first"}
+Let me know if you need anything else.)",
+  // Comments
+  R"({
+  "tool_calls": [
+    {"tool": "move_car", "params": "left 90", "confidence": 0.96} // turn toward the door
+  ],
+  /* keep going */ "should_continue": true,
+  "objective_complete": false,
+  "reasoning": "Door is on the left"
+})",
+  // Cut off inside the second tool call
+  R"(```json
+{
+  "tool_calls": [
+    {"tool": "move_car", "params": "forward 1000", "confidence": 0.95},
+    {"tool": "get_sonar_dist)",
+  // Cut off in the reasoning
+  R"({"tool_calls": [{"tool": "move_car", "params": "backward 500", "confidence": 0.93}], "should_continue": true, "objective_complete": false, "reasoning": "Too close to the wa)",
+  // Single quotes and Python literals
+  R"({'tool_calls': [{'tool': 'move_car', 'params': 'right 45', 'confidence': 0.94}], 'should_continue': True, 'objective_complete': False, 'next_context': None})",
+  // Unquoted keys
+  R"({tool_calls: [{tool: "get_sonar_distance", params: "", confidence: 0.99}], should_continue: true, objective_complete: false, reasoning: "Check the gap"})",
+  // Plain fence, raw newline and unescaped quotes in a string
+  R"(```
+{"tool_calls": [{"tool": "move_car", "params": "forward 2000", "confidence": 0.95}], "should_continue": false, "objective_complete": true, "reasoning": "Reached the "wall"
+as asked"}
+```)",
+  // Fence never closed and the output cut off after the tool calls
+  R"(```json
+{"tool_calls": [{"tool": "move_car", "params": "stop", "confidence": 0.99}, {"tool": "get_sonar_distance", "params": "", "confidence": 0.97}], "should_conti)"
+};
+const int NUM_JSON_REPAIR_CORPUS = sizeof(JSON_REPAIR_CORPUS) / sizeof(JSON_REPAIR_CORPUS[0]);
+
+const char* BENCH_MOVE_PARAMS[] = {
+  "forward 1000",
+  "  backward 2000  ",
+  "left 90",
+  "RIGHT 180",
+  "stop"
+};
+const int NUM_BENCH_MOVE_PARAMS = sizeof(BENCH_MOVE_PARAMS) / sizeof(BENCH_MOVE_PARAMS[0]);
+
+// Objectives for the offline planner and the steps they must compile to
+struct LocalPlanCase {
+  const char* objective;
+  const char* steps;     // formatLocalStep() of each step, joined with "; "
+};
+const LocalPlanCase LOCAL_PLAN_CORPUS[] = {
+  {"measure the distance ahead", "measure distance"},
+  {"how far is the wall ahead", "measure distance"},
+  {"check the distance on the left", "measure distance"},
+  {"go straight ahead", "forward 1000 ms"},
+  {"move forward 2 seconds then measure the distance", "forward 2000 ms; measure distance"},
+  {"drive back 500 ms", "backward 500 ms"},
+  {"turn left 45 degrees and check the sonar", "turn left 45 degrees; measure distance"},
+  {"approach the wall until within 30 cm", "approach to 30 cm"}
+};
+const int NUM_LOCAL_PLAN_CORPUS = sizeof(LOCAL_PLAN_CORPUS) / sizeof(LOCAL_PLAN_CORPUS[0]);
+
+// History sizes (prior iterations) each history-dependent case is run at
+const int BENCH_HISTORY_SIZES[] = {0, 2, 5, 10};
+const int NUM_BENCH_HISTORY_SIZES = sizeof(BENCH_HISTORY_SIZES) / sizeof(BENCH_HISTORY_SIZES[0]);
+
+// Fixtures shared by the benchmark operations
+PlanningSession benchSession;
+PlanningDecision benchDecision;
+Conversation benchConversation;
+int benchMoveIndex = 0;
+int benchRepairIndex = 0;
+int benchLocalPlanIndex = 0;
+
+// Synthetic JPEG-sized frame for the base64 encoder (allocated for the run only)
+#define BENCH_FRAME_BYTES 24576
+#define BENCH_SOCKET_CHUNK 1460   // HTTPClient's send buffer size
+uint8_t* benchFrame = nullptr;
+
+/**
+ * Build an execution history that looks like N completed planning iterations
+ * @param iterations Number of iterations to synthesize
+ * @return History string in the format updatePlanningSession() produces
+ */
+String buildBenchmarkHistory(int iterations) {
+  String history = "";
+  for (int i = 1; i <= iterations; i++) {
+    if (history.length() > 0) {
+      history += "\n";
+    }
+    history += "--- Iteration " + String(i) + " ---\n";
+    history += "Reasoning: Obstacle still too far, moving forward 1000ms and measuring again.\n";
+    history += "Iteration tool calls:\n";
+    history += "[1] move_car: Car moved forward for 1000ms\n";
+    history += "[2] get_sonar_distance: Distance: " + String(120 - i * 8) + " cm (avg of 5 readings)\n";
+  }
+  return history;
+}
+
+// ==========================================
+// BENCHMARK OPERATIONS
+// ==========================================
+// Each operation returns a String so the result stays live while the heap is sampled
+
+String benchFormatPrompt() {
+  const String& prompt = buildIterativePlanningPrompt(benchSession);
+  return String(prompt.length());
+}
+
+String benchFormatPromptLegacy() {
+  return formatPlanningPrompt(benchSession.objective, benchSession.currentContext, benchSession.executionHistory,
+                              formatWorldState(worldState));
+}
+
+String benchBuildRequestBody() {
+  const String& prompt = buildIterativePlanningPrompt(benchSession);
+  buildChatRequestBody(openAIRequestBody, prompt);
+  return String(openAIRequestBody.length());
+}
+
+String benchBuildConversationBody() {
+  buildConversationRequestBody(openAIRequestBody, benchConversation, RESPONSE_TOKENS_MAX, nullptr, "", BENCH_WORLD_STATE);
+  return String(openAIRequestBody.length());
+}
+
+String benchEstimateTokens() {
+  const String& prompt = buildIterativePlanningPrompt(benchSession);
+  return String(estimateTokens(prompt));
+}
+
+String benchParseResponse() {
+  PlanningDecision decision = parsePlanningResponse(BENCH_OPENAI_RESPONSE);
+  return decision.reasoning;
+}
+
+String benchRepairDecision() {
+  String json;
+  int repairs;
+  repairDecisionJson(JSON_REPAIR_CORPUS[benchRepairIndex], json, repairs);
+  benchRepairIndex = (benchRepairIndex + 1) % NUM_JSON_REPAIR_CORPUS;
+  return json;
+}
+
+String benchParseLocalPlan() {
+  LocalPlan plan;
+  parseLocalPlan(LOCAL_PLAN_CORPUS[benchLocalPlanIndex].objective, plan);
+  benchLocalPlanIndex = (benchLocalPlanIndex + 1) % NUM_LOCAL_PLAN_CORPUS;
+  return plan.count > 0 ? formatLocalStep(plan.steps[0]) : "";
+}
+
+String benchEncodeImageStream() {
+  InlineImageBody body("{\"url\":\"data:image/jpeg;base64,", benchFrame, BENCH_FRAME_BYTES, "\"}");
+  char chunk[BENCH_SOCKET_CHUNK];
+  size_t total = 0;
+  size_t n;
+  while ((n = body.readBytes(chunk, sizeof(chunk))) > 0) {
+    total += n;
+  }
+  return String(total);
+}
+
+String benchEvaluateGoal() {
+  bool achieved = evaluateGoalCompletion(benchSession, BENCH_LATEST_RESULTS);
+  return achieved ? "achieved" : "pending";
+}
+
+String benchUpdateSession() {
+  PlanningSession session = benchSession;
+  updatePlanningSession(session, benchDecision, BENCH_LATEST_RESULTS);
+  return session.executionHistory;
+}
+
+String benchParseMove() {
+  MoveCommand move = parseMoveParams(BENCH_MOVE_PARAMS[benchMoveIndex]);
+  benchMoveIndex = (benchMoveIndex + 1) % NUM_BENCH_MOVE_PARAMS;
+  return move.command;
+}
+
+// ==========================================
+// BENCHMARK RUNNER
+// ==========================================
+
+#if BENCH_HEAP_TRACE
+heap_trace_record_t benchTraceRecords[BENCH_TRACE_RECORDS];
+bool benchTraceReady = false;
+#endif
+
+/**
+ * Count the allocations one call of an operation makes
+ * Uses the heap tracer in HEAP_TRACE_ALL mode, so blocks freed before the
+ * operation returns are counted too. Allocations by other tasks during the
+ * call land in the same trace.
+ * @param op Operation to run
+ * @param result Receives bytesPerOp, allocsPerOp and allocsTruncated
+ */
+void measureOpAllocations(String (*op)(), BenchmarkResult& result) {
+  result.bytesPerOp = -1;
+  result.allocsPerOp = -1;
+  result.allocsTruncated = false;
+#if BENCH_HEAP_TRACE
+  if (!benchTraceReady) {
+    benchTraceReady = heap_trace_init_standalone(benchTraceRecords, BENCH_TRACE_RECORDS) == ESP_OK;
+  }
+  if (!benchTraceReady || heap_trace_start(HEAP_TRACE_ALL) != ESP_OK) {
+    return;
+  }
+  {
+    String out = op();
+  }
+  heap_trace_stop();
+
+  size_t count = heap_trace_get_count();
+  long bytes = 0;
+  for (size_t i = 0; i < count; i++) {
+    heap_trace_record_t record;
+    if (heap_trace_get(i, &record) == ESP_OK) {
+      bytes += record.size;
+    }
+  }
+  result.bytesPerOp = bytes;
+  result.allocsPerOp = count;
+  result.allocsTruncated = count >= BENCH_TRACE_RECORDS;
+#endif
+}
+
+/**
+ * Measure the peak heap use of one call of an operation
+ * The local minimum-free monitor catches the low point reached inside the
+ * call, temporaries included.
+ * @param op Operation to run
+ * @return Bytes in use above the starting point at the peak, -1 if unsupported
+ */
+long measureOpPeakBytes(String (*op)()) {
+#if BENCH_HEAP_PEAK
+  size_t freeBefore = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+  if (heap_caps_monitor_local_minimum_free_size_start() != ESP_OK) {
+    return -1;
+  }
+  {
+    String out = op();
+  }
+  long peak = (long)freeBefore - (long)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+  heap_caps_monitor_local_minimum_free_size_stop();
+  return peak;
+#else
+  return -1;
+#endif
+}
+
+/**
+ * Time an operation and measure its heap cost
+ * Allocation counts and peak use cover everything the operation allocates,
+ * including temporaries freed before it returns; the live figure is what its
+ * result still holds.
+ * @param name Benchmark name
+ * @param historySize History size of the current fixture
+ * @param iterations Number of timed repetitions
+ * @param op Operation to run
+ * @return BenchmarkResult for this case
+ */
+BenchmarkResult runBenchmarkCase(const char* name, int historySize, int iterations, String (*op)()) {
+  BenchmarkResult result;
+  result.name = name;
+  result.historySize = historySize;
+  result.iterations = iterations;
+
+  // Warm up once so one-time allocations don't skew the numbers
+  op();
+
+  measureOpAllocations(op, result);
+  result.peakBytesPerOp = measureOpPeakBytes(op);
+
+  multi_heap_info_t before;
+  multi_heap_info_t after;
+  heap_caps_get_info(&before, MALLOC_CAP_8BIT);
+  {
+    String live = op();
+    heap_caps_get_info(&after, MALLOC_CAP_8BIT);
+  }
+  result.liveBytesPerOp = (long)after.total_allocated_bytes - (long)before.total_allocated_bytes;
+
+  unsigned long start = micros();
+  for (int i = 0; i < iterations; i++) {
+    op();
+  }
+  unsigned long elapsed = micros() - start;
+  result.nsPerOp = (unsigned long)(((unsigned long long)elapsed * 1000ULL) / iterations);
+
+  return result;
+}
+
+/**
+ * Format a benchmark result as one JSON line
+ * @param result Result to format
+ * @return JSON object string
+ */
+String formatBenchmarkResult(const BenchmarkResult& result) {
+  DynamicJsonDocument doc(384);
+  doc["bench"] = result.name;
+  doc["history"] = result.historySize;
+  doc["iters"] = result.iterations;
+  doc["ns_per_op"] = result.nsPerOp;
+  // Figures the build can't measure are left out rather than logged as 0
+  if (result.allocsPerOp >= 0) {
+    doc["bytes_per_op"] = result.bytesPerOp;
+    doc["allocs_per_op"] = result.allocsPerOp;
+    if (result.allocsTruncated) {
+      doc["allocs_truncated"] = true;
+    }
+  }
+  if (result.peakBytesPerOp >= 0) {
+    doc["peak_bytes_per_op"] = result.peakBytesPerOp;
+  }
+  doc["live_bytes_per_op"] = result.liveBytesPerOp;
+
+  String line;
+  serializeJson(doc, line);
+  return line;
+}
+
+/**
+ * Tool: Run Benchmarks
+ * Runs the planning hot-path benchmarks and logs one JSON line per case
+ * (prefixed with [BENCH]) so runs can be diffed between firmware versions.
+ * @param params Optional number of timed iterations per case (default 100)
+ * @return String summarizing the run
+ */
+String runBenchmarks(String params) {
+  int iterations = params.toInt();
+  if (iterations <= 0) {
+    iterations = 100;
+  }
+
+  logToRobotLogs("=== RUNNING BENCHMARKS ===");
+  logToRobotLogs("Iterations per case: " + String(iterations));
+
+  String header = "{\"bench_run\":\"planning_hot_path\",\"build\":\"" + String(__DATE__) + " " + String(__TIME__) +
+                  "\",\"cpu_mhz\":" + String(ESP.getCpuFreqMHz()) + ",\"free_heap\":" + String(ESP.getFreeHeap()) +
+                  ",\"alloc_trace\":" + String(BENCH_HEAP_TRACE ? "true" : "false") +
+                  ",\"peak_monitor\":" + String(BENCH_HEAP_PEAK ? "true" : "false") + "}";
+  logToRobotLogs("[BENCH] " + header);
+
+  benchDecision.numToolCalls = 0;
+  benchDecision.shouldContinue = true;
+  benchDecision.objectiveComplete = false;
+  benchDecision.reasoning = "Obstacle is 45cm away, moving forward 1000ms then measuring again.";
+  benchDecision.nextContext = BENCH_CONTEXT;
+
+  BenchmarkResult results[NUM_BENCH_HISTORY_SIZES * 7 + 4];
+  int numResults = 0;
+
+  // Keep the benchmarks from measuring Serial and MQTT logging
+  robotLogsMuted = true;
+
+  for (int h = 0; h < NUM_BENCH_HISTORY_SIZES; h++) {
+    int historySize = BENCH_HISTORY_SIZES[h];
+    benchSession.objective = BENCH_OBJECTIVE;
+    benchSession.currentContext = BENCH_CONTEXT;
+    benchSession.executionHistory = buildBenchmarkHistory(historySize);
+    benchSession.iterationCount = historySize + 1;
+    benchSession.isComplete = false;
+    benchSession.finalResult = "";
+    benchSession.startTime = millis();
+    benchSession.lastIterationTime = millis();
+
+    beginConversation(benchConversation, BENCH_OBJECTIVE, BENCH_CONTEXT);
+    for (int i = 1; i <= historySize && conversationTurnCount(benchConversation) < MAX_CONVERSATION_TURNS; i++) {
+      appendConversationTurn(benchConversation, i, BENCH_DECISION_JSON, BENCH_LATEST_RESULTS, BENCH_CONTEXT);
+    }
+
+    results[numResults++] = runBenchmarkCase("format_planning_prompt", historySize, iterations, benchFormatPrompt);
+    results[numResults++] = runBenchmarkCase("format_planning_prompt_legacy", historySize, iterations, benchFormatPromptLegacy);
+    results[numResults++] = runBenchmarkCase("build_request_body", historySize, iterations, benchBuildRequestBody);
+    results[numResults++] = runBenchmarkCase("build_conversation_body", historySize, iterations, benchBuildConversationBody);
+    results[numResults++] = runBenchmarkCase("estimate_prompt_tokens", historySize, iterations, benchEstimateTokens);
+    results[numResults++] = runBenchmarkCase("evaluate_goal_completion", historySize, iterations, benchEvaluateGoal);
+    results[numResults++] = runBenchmarkCase("update_planning_session", historySize, iterations, benchUpdateSession);
+  }
+
+  results[numResults++] = runBenchmarkCase("parse_planning_response", 0, iterations, benchParseResponse);
+  results[numResults++] = runBenchmarkCase("parse_move_params", 0, iterations, benchParseMove);
+  results[numResults++] = runBenchmarkCase("repair_decision_json", 0, iterations, benchRepairDecision);
+  results[numResults++] = runBenchmarkCase("parse_local_plan", 0, iterations, benchParseLocalPlan);
+
+  // Encoder throughput: drain an inline-image body in socket-sized chunks
+  BenchmarkResult encodeResult;
+  encodeResult.nsPerOp = 0;
+  benchFrame = (uint8_t*)malloc(BENCH_FRAME_BYTES);
+  if (benchFrame != nullptr) {
+    uint32_t seed = 0x2545F491;
+    for (int i = 0; i < BENCH_FRAME_BYTES; i++) {
+      seed = seed * 1103515245 + 12345;
+      benchFrame[i] = seed >> 24;
+    }
+    encodeResult = runBenchmarkCase("base64_encode_stream", 0, iterations, benchEncodeImageStream);
+    results[numResults++] = encodeResult;
+    free(benchFrame);
+    benchFrame = nullptr;
+  }
+
+  robotLogsMuted = false;
+
+  for (int i = 0; i < numResults; i++) {
+    logToRobotLogs("[BENCH] " + formatBenchmarkResult(results[i]));
+  }
+
+  if (encodeResult.nsPerOp > 0) {
+    float mbPerSec = (float)BENCH_FRAME_BYTES * 1000.0 / encodeResult.nsPerOp;
+    logToRobotLogs("[BENCH] {\"bench\":\"base64_encode_stream\",\"frame_bytes\":" + String(BENCH_FRAME_BYTES) +
+                   ",\"chunk_bytes\":" + String(BENCH_SOCKET_CHUNK) + ",\"input_mb_per_s\":" + String(mbPerSec, 2) + "}");
+  }
+
+  logToRobotLogs("[BENCH] " + measureJsonRepairCorpus());
+  logToRobotLogs("[BENCH] " + measureLocalPlanCorpus());
+
+  logToRobotLogs("=== BENCHMARKS COMPLETE ===");
+  return "Benchmarks complete: " + String(numResults) + " cases, " + String(iterations) + " iterations each (results logged as [BENCH] lines)";
+}
+
+/**
+ * Parse every JSON_REPAIR_CORPUS entry as a planning decision
+ * Counts what a strict parse accepts against what repair rescues.
+ * @return JSON line, e.g. {"bench":"json_repair_corpus","cases":9,"strict_ok":1,"repaired_ok":9,"tool_calls":10}
+ */
+String measureJsonRepairCorpus() {
+  int strictOk = 0;
+  int repairedOk = 0;
+  int toolCalls = 0;
+  DynamicJsonDocument doc(1024);
+  for (int i = 0; i < NUM_JSON_REPAIR_CORPUS; i++) {
+    String content = JSON_REPAIR_CORPUS[i];
+    if (!deserializeJson(doc, extractFencedJson(content))) {
+      strictOk++;
+    }
+    String json;
+    int repairs;
+    if (repairDecisionJson(content, json, repairs) && !deserializeJson(doc, json)) {
+      repairedOk++;
+      toolCalls += doc["tool_calls"].size();
+    }
+  }
+  return "{\"bench\":\"json_repair_corpus\",\"cases\":" + String(NUM_JSON_REPAIR_CORPUS) + ",\"strict_ok\":" + String(strictOk) +
+         ",\"repaired_ok\":" + String(repairedOk) + ",\"tool_calls\":" + String(toolCalls) + "}";
+}
+
+/**
+ * Compile every LOCAL_PLAN_CORPUS objective with the offline planner
+ * @return JSON line, e.g. {"bench":"local_plan_corpus","cases":8,"ok":8,"failed":""}
+ */
+String measureLocalPlanCorpus() {
+  int ok = 0;
+  String failed = "";
+  LocalPlan plan;
+  for (int i = 0; i < NUM_LOCAL_PLAN_CORPUS; i++) {
+    parseLocalPlan(LOCAL_PLAN_CORPUS[i].objective, plan);
+    String steps = "";
+    for (int j = 0; j < plan.count; j++) {
+      steps += String(j > 0 ? "; " : "") + formatLocalStep(plan.steps[j]);
+    }
+    if (steps == LOCAL_PLAN_CORPUS[i].steps) {
+      ok++;
+    } else {
+      failed += String(failed.length() > 0 ? ", " : "") + String(i);
+    }
+  }
+  return "{\"bench\":\"local_plan_corpus\",\"cases\":" + String(NUM_LOCAL_PLAN_CORPUS) + ",\"ok\":" + String(ok) +
+         ",\"failed\":\"" + failed + "\"}";
+}
@@ -0,0 +1,77 @@
+#ifndef CAMERA_TOOLS_H
+#define CAMERA_TOOLS_H
+
+#include <Arduino.h>
+
+// Set to 1 on boards with an OV2640 camera (AI-Thinker ESP32-CAM pinout below).
+// Those pins overlap the motor driver (IN3/IN4 on GPIO 18/19) and the sonar
+// (GPIO 22/23), so the car's current wiring has to move before enabling it.
+// With 0, frames are fetched from CAMERA_FAKE_SOURCE_URL instead.
+#define CAMERA_ENABLED 0
+
+#if CAMERA_ENABLED
+#include "esp_camera.h"
+
+#define PWDN_GPIO_NUM     32
+#define RESET_GPIO_NUM    -1
+#define XCLK_GPIO_NUM      0
+#define SIOD_GPIO_NUM     26
+#define SIOC_GPIO_NUM     27
+#define Y9_GPIO_NUM       35
+#define Y8_GPIO_NUM       34
+#define Y7_GPIO_NUM       39
+#define Y6_GPIO_NUM       36
+#define Y5_GPIO_NUM       21
+#define Y4_GPIO_NUM       19
+#define Y3_GPIO_NUM       18
+#define Y2_GPIO_NUM        5
+#define VSYNC_GPIO_NUM    25
+#define HREF_GPIO_NUM     23
+#define PCLK_GPIO_NUM     22
+#endif
+
+#define CAMERA_MAX_FRAME_BYTES 200000   // Largest fake-source frame accepted
+#define VISION_MAX_TOKENS 200           // Completion limit for image descriptions
+#define VISION_REQUEST_SUFFIX ",\"detail\":\"low\"}}]}]}"  // Closes the body after the image URL
+
+// Where a frame's buffer lives, which decides how releaseFrame() frees it
+enum FrameSource {
+  FRAME_NONE,
+  FRAME_DRIVER,    // Camera driver frame buffer (handle is the camera_fb_t*)
+  FRAME_HEAP,      // malloc'd copy of a fake-source frame
+  FRAME_SHARED     // Capture task's front buffer (capture_task.h)
+};
+
+// A captured JPEG frame
+// Every frame must be released with releaseFrame(); driver and shared frames
+// hold a buffer the next capture needs.
+struct CameraFrame {
+  uint8_t* buf;
+  size_t len;
+  void* handle;    // camera_fb_t* for driver frames, nullptr otherwise
+  FrameSource source;
+};
+
+// Latency of one capture_image call
+struct CaptureTiming {
+  unsigned long captureMs;
+  unsigned long preprocessMs;
+  unsigned long uploadMs;    // 0 when the frame is sent inline with the vision request
+  unsigned long visionMs;
+  size_t bytes;
+};
+
+// Function declarations
+bool initCamera();
+bool grabFrame(CameraFrame& frame, String& error);
+bool grabFrameInto(uint8_t* buf, size_t capacity, size_t& len, String& error);
+bool captureFrame(CameraFrame& frame);
+void releaseFrame(CameraFrame& frame);
+String uploadFrame(const CameraFrame& frame);
+String visionRequestPrefix(const String& question);
+String parseVisionResponse(const String& response);
+String describeImage(const String& imageUrl, const String& question);
+String describeFrameInline(const CameraFrame& frame, const String& question);
+String captureImage(String params);
+
+#endif // CAMERA_TOOLS_H
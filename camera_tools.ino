@@ -0,0 +1,443 @@
+#include "camera_tools.h"
+#include "inline_image_body.h"
+#include "image_preprocess.h"
+#include "capture_task.h"
+#include "odometry.h"
+#include "openai_processor.h"
+#include "llm_provider.h"
+#include "robot_tools.h"
+#include "trace.h"
+
+bool cameraReady = false;
+
+/**
+ * Initialize the camera in JPEG mode
+ * Without CAMERA_ENABLED there is nothing to initialize; frames come
+ * from CAMERA_FAKE_SOURCE_URL.
+ * @return true if frames can be captured
+ */
+bool initCamera() {
+#if CAMERA_ENABLED
+  if (cameraReady) {
+    return true;
+  }
+
+  camera_config_t config;
+  config.ledc_channel    = LEDC_CHANNEL_0;
+  config.ledc_timer      = LEDC_TIMER_0;
+  config.pin_d0          = Y2_GPIO_NUM;
+  config.pin_d1          = Y3_GPIO_NUM;
+  config.pin_d2          = Y4_GPIO_NUM;
+  config.pin_d3          = Y5_GPIO_NUM;
+  config.pin_d4          = Y6_GPIO_NUM;
+  config.pin_d5          = Y7_GPIO_NUM;
+  config.pin_d6          = Y8_GPIO_NUM;
+  config.pin_d7          = Y9_GPIO_NUM;
+  config.pin_xclk        = XCLK_GPIO_NUM;
+  config.pin_pclk        = PCLK_GPIO_NUM;
+  config.pin_vsync       = VSYNC_GPIO_NUM;
+  config.pin_href        = HREF_GPIO_NUM;
+  config.pin_sccb_sda    = SIOD_GPIO_NUM;
+  config.pin_sccb_scl    = SIOC_GPIO_NUM;
+  config.pin_pwdn        = PWDN_GPIO_NUM;
+  config.pin_reset       = RESET_GPIO_NUM;
+
+  config.xclk_freq_hz    = 20000000;
+  config.pixel_format    = PIXFORMAT_JPEG;
+
+  if (psramFound()) {
+    config.frame_size    = FRAMESIZE_VGA;
+    config.jpeg_quality  = 12;
+    config.fb_count      = 2;
+    config.fb_location   = CAMERA_FB_IN_PSRAM;
+    config.grab_mode     = CAMERA_GRAB_LATEST;  // Don't hand out a frame exposed before the last move
+  } else {
+    config.frame_size    = FRAMESIZE_QVGA;
+    config.jpeg_quality  = 20;
+    config.fb_count      = 1;
+    config.fb_location   = CAMERA_FB_IN_DRAM;
+    config.grab_mode     = CAMERA_GRAB_WHEN_EMPTY;
+  }
+
+  esp_err_t err = esp_camera_init(&config);
+  if (err != ESP_OK) {
+    logToRobotLogs("Camera init failed with error 0x" + String(err, HEX));
+    return false;
+  }
+
+  cameraReady = true;
+  logToRobotLogs("Camera initialized");
+  return true;
+#else
+  cameraReady = true;
+  return true;
+#endif
+}
+
+/**
+ * Capture one JPEG frame without logging or tracing
+ * Safe to call from the capture task.
+ * @param frame Receives the frame; release it with releaseFrame()
+ * @param error Receives the reason on failure
+ * @return false if no frame could be captured
+ */
+bool grabFrame(CameraFrame& frame, String& error) {
+  frame.buf = nullptr;
+  frame.len = 0;
+  frame.handle = nullptr;
+  frame.source = FRAME_NONE;
+
+#if CAMERA_ENABLED
+  camera_fb_t* fb = esp_camera_fb_get();
+  if (!fb) {
+    error = "Camera capture failed";
+    return false;
+  }
+  frame.buf = fb->buf;
+  frame.len = fb->len;
+  frame.handle = fb;
+  frame.source = FRAME_DRIVER;
+  return true;
+#else
+  // Fake camera: fetch a JPEG from the configured source
+  HTTPClient http;
+  http.setTimeout(5000);
+  http.begin(CAMERA_FAKE_SOURCE_URL);
+  int httpCode = http.GET();
+  int size = http.getSize();
+
+  if (httpCode != HTTP_CODE_OK || size <= 0 || size > CAMERA_MAX_FRAME_BYTES) {
+    error = "Fake camera fetch failed: HTTP " + String(httpCode) + ", " + String(size) + " bytes";
+    http.end();
+    return false;
+  }
+
+  frame.buf = (uint8_t*)(psramFound() ? ps_malloc(size) : malloc(size));
+  if (frame.buf == nullptr) {
+    error = "Fake camera: no memory for " + String(size) + " byte frame";
+    http.end();
+    return false;
+  }
+  frame.source = FRAME_HEAP;
+
+  frame.len = http.getStreamPtr()->readBytes(frame.buf, size);
+  http.end();
+
+  if (frame.len != (size_t)size) {
+    releaseFrame(frame);
+    error = "Fake camera: short read";
+    return false;
+  }
+  return true;
+#endif
+}
+
+/**
+ * Capture one JPEG frame straight into a caller's buffer
+ * Fake-source frames are read from the socket into it, with no heap copy.
+ * Safe to call from the capture task.
+ * @param buf Buffer to fill
+ * @param capacity Its size
+ * @param len Receives the frame length; larger than capacity if the frame didn't fit
+ * @param error Receives the reason on failure
+ * @return false if no frame could be captured or it didn't fit
+ */
+bool grabFrameInto(uint8_t* buf, size_t capacity, size_t& len, String& error) {
+  len = 0;
+
+#if CAMERA_ENABLED
+  camera_fb_t* fb = esp_camera_fb_get();
+  if (!fb) {
+    error = "Camera capture failed";
+    return false;
+  }
+  len = fb->len;
+  bool fits = len <= capacity;
+  if (fits) {
+    memcpy(buf, fb->buf, len);
+  } else {
+    error = "Frame of " + String(len) + " bytes doesn't fit";
+  }
+  esp_camera_fb_return(fb);
+  return fits;
+#else
+  HTTPClient http;
+  http.setTimeout(5000);
+  http.begin(CAMERA_FAKE_SOURCE_URL);
+  int httpCode = http.GET();
+  int size = http.getSize();
+
+  if (httpCode != HTTP_CODE_OK || size <= 0 || (size_t)size > capacity) {
+    error = "Fake camera fetch failed: HTTP " + String(httpCode) + ", " + String(size) + " bytes";
+    len = size > 0 ? size : 0;
+    http.end();
+    return false;
+  }
+
+  len = http.getStreamPtr()->readBytes(buf, size);
+  http.end();
+  if (len != (size_t)size) {
+    error = "Fake camera: short read";
+    len = 0;
+    return false;
+  }
+  return true;
+#endif
+}
+
+/**
+ * Capture one JPEG frame
+ * @param frame Receives the frame; release it with releaseFrame()
+ * @return false if no frame could be captured
+ */
+bool captureFrame(CameraFrame& frame) {
+  ScopedTrace span("camera_capture");
+
+  if (!initCamera()) {
+    frame.source = FRAME_NONE;
+    return false;
+  }
+
+  String error;
+  if (!grabFrame(frame, error)) {
+    logToRobotLogs(error);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Return a frame's buffer to wherever it came from
+ */
+void releaseFrame(CameraFrame& frame) {
+  switch (frame.source) {
+    case FRAME_DRIVER:
+#if CAMERA_ENABLED
+      esp_camera_fb_return((camera_fb_t*)frame.handle);
+#endif
+      break;
+    case FRAME_HEAP:
+      free(frame.buf);
+      break;
+    case FRAME_SHARED:
+      releaseLatestFrame();
+      break;
+    default:
+      break;
+  }
+  frame.buf = nullptr;
+  frame.len = 0;
+  frame.handle = nullptr;
+  frame.source = FRAME_NONE;
+}
+
+/**
+ * Upload a frame to VISION_UPLOAD_URL
+ * The body is sent straight from the frame buffer; nothing is copied.
+ * @return Image URL from the response (plain text or {"url": ...}), empty on failure
+ */
+String uploadFrame(const CameraFrame& frame) {
+  ScopedTrace span("camera_upload");
+
+  HTTPClient http;
+  http.setTimeout(10000);
+  http.begin(VISION_UPLOAD_URL);
+  http.addHeader("Content-Type", "image/jpeg");
+
+  int httpCode = http.POST(frame.buf, frame.len);
+  String response = httpCode > 0 ? http.getString() : "";
+  http.end();
+
+  if (httpCode < 200 || httpCode >= 300) {
+    logToRobotLogs("Image upload failed: HTTP " + String(httpCode));
+    return "";
+  }
+
+  response.trim();
+  if (response.startsWith("http")) {
+    return response;
+  }
+
+  DynamicJsonDocument doc(512);
+  if (deserializeJson(doc, response) || !doc.containsKey("url")) {
+    logToRobotLogs("Image upload: no URL in response: " + response);
+    return "";
+  }
+  return doc["url"].as<String>();
+}
+
+/**
+ * Start of a vision request body, up to and including "url":
+ * The image URL (quoted) and VISION_REQUEST_SUFFIX follow. Uses the
+ * current LLM provider's vision model.
+ * @param question What to look for
+ */
+String visionRequestPrefix(const String& question) {
+  String prefix;
+  prefix.reserve(question.length() + 384);
+  appendLlmRequestOptions(prefix, VISION_MAX_TOKENS, true);
+  appendChatMessage(prefix, "system", "You are the eyes of a small ground robot with a forward-facing camera. "
+                                      "Answer briefly and concretely, giving approximate distances in cm where you can.");
+  prefix += ",{\"role\":\"user\",\"content\":[{\"type\":\"text\",\"text\":";
+  appendJsonString(prefix, question);
+  prefix += "},{\"type\":\"image_url\",\"image_url\":{\"url\":";
+  return prefix;
+}
+
+/**
+ * Extract the description from a vision response
+ * @return Model's description, or a string starting with "Error"
+ */
+String parseVisionResponse(const String& response) {
+  DynamicJsonDocument doc(2048);
+  DeserializationError error = deserializeJson(doc, response);
+  if (error) {
+    return "Error: Vision response parsing failed: " + String(error.c_str());
+  }
+  if (doc.containsKey("error")) {
+    return "Error: Vision request failed: " + doc["error"].as<String>();
+  }
+  if (!doc.containsKey("choices") || !doc["choices"][0]["message"].containsKey("content")) {
+    return "Error: No content in vision response";
+  }
+  return doc["choices"][0]["message"]["content"].as<String>();
+}
+
+/**
+ * Ask the vision model about an uploaded image
+ * @param imageUrl URL returned by uploadFrame()
+ * @param question What to look for
+ * @return Model's description, or a string starting with "Error"
+ */
+String describeImage(const String& imageUrl, const String& question) {
+  ScopedTrace span("vision_request");
+  chooseLlmProvider();
+
+  String body = visionRequestPrefix(question);
+  appendJsonString(body, imageUrl);
+  body += VISION_REQUEST_SUFFIX;
+
+  return parseVisionResponse(makeOpenAIRequestBody(body));
+}
+
+/**
+ * Ask the vision model about a frame sent inline as a base64 data URL
+ * The frame is encoded while the request is being sent, so neither its
+ * base64 copy nor the full JSON body is ever held in RAM.
+ * @param frame Captured frame; must stay valid until this returns
+ * @param question What to look for
+ * @return Model's description, or a string starting with "Error"
+ */
+String describeFrameInline(const CameraFrame& frame, const String& question) {
+  ScopedTrace span("vision_request");
+  chooseLlmProvider();
+
+  InlineImageBody body(visionRequestPrefix(question) + "\"data:image/jpeg;base64,",
+                       frame.buf, frame.len, "\"" VISION_REQUEST_SUFFIX);
+
+  return parseVisionResponse(makeOpenAIRequestStream(body, body.length()));
+}
+
+/**
+ * Tool: Capture Image
+ * Captures a frame and asks the vision model what it shows. If the frame
+ * barely differs from the last one sent and the question is the same, the
+ * previous description is returned without a vision call.
+ * @param params Optional question about the image
+ * @return String with the description and capture/upload/vision latency
+ */
+String captureImage(String params) {
+  params.trim();
+  String question = params.length() > 0 ? params :
+    "Describe what is directly in front of the robot: obstacles, their approximate distance and position "
+    "(left, center, right), and which directions look open.";
+
+  CaptureTiming timing;
+  timing.uploadMs = 0;
+  timing.visionMs = 0;
+  unsigned long start = millis();
+
+  // Prefer the capture task's buffered frame, as long as it was taken after
+  // the car last stopped; otherwise capture now
+  CameraFrame frame;
+  FrameInfo info;
+  bool buffered = acquireLatestFrame(frame, info, getLastMotionEnd(), CAPTURE_WAIT_MS);
+  if (!buffered) {
+    info.sequence = 0;
+    info.timestamp = millis();
+    info.pose = getPose();
+    info.moving = isMoving();
+    if (!captureFrame(frame)) {
+      return "Error: Image capture failed";
+    }
+  }
+  timing.captureMs = millis() - start;
+  unsigned long ageMs = millis() - info.timestamp;
+  timing.bytes = frame.len;
+  visionStats.captured++;
+
+  start = millis();
+  FrameThumbnail thumb;
+  makeThumbnail(frame, thumb);
+  FrameChange change;
+  bool reuse = canReuseVision(thumb, question, change);
+  timing.preprocessMs = millis() - start;
+  visionStats.preprocessMs += timing.preprocessMs;
+
+  String changeJson = ",\"diff\":" + String(change.changedFraction, 3) + ",\"hist\":" + String(change.histogramDistance, 3) +
+                      ",\"buffered\":" + String(buffered ? "true" : "false") + ",\"age_ms\":" + String(ageMs) +
+                      ",\"pose\":[" + String(info.pose.x, 1) + "," + String(info.pose.y, 1) + "," + String(info.pose.heading, 1) + "]";
+  String frameText = " at " + formatPose(info.pose) + ", " + String(ageMs) + " ms old";
+
+  if (reuse) {
+    releaseFrame(frame);
+    visionStats.reused++;
+    visionStats.bytesSkipped += timing.bytes;
+    logToRobotLogs("[CAMERA] {\"bytes\":" + String(timing.bytes) + ",\"sent\":false" + changeJson +
+                   ",\"capture_ms\":" + String(timing.captureMs) + ",\"preprocess_ms\":" + String(timing.preprocessMs) + "}");
+    return "Image unchanged (" + String(change.changedFraction * 100, 1) + "% of pixels changed" + frameText + "), previous view " +
+           String((millis() - visionCache.time) / 1000) + " s ago: " + visionCache.description +
+           " [capture " + String(timing.captureMs) + " ms, preprocess " + String(timing.preprocessMs) + " ms]";
+  }
+
+  String description;
+  if (VISION_INLINE_IMAGES) {
+    // Upload and vision happen in the same request
+    start = millis();
+    description = describeFrameInline(frame, question);
+    timing.visionMs = millis() - start;
+    releaseFrame(frame);
+  } else {
+    start = millis();
+    String imageUrl = uploadFrame(frame);
+    timing.uploadMs = millis() - start;
+    releaseFrame(frame);
+
+    if (imageUrl.length() == 0) {
+      return "Error: Image upload failed";
+    }
+
+    start = millis();
+    description = describeImage(imageUrl, question);
+    timing.visionMs = millis() - start;
+  }
+
+  visionStats.sent++;
+  visionStats.bytesSent += timing.bytes;
+  visionStats.visionMs += timing.uploadMs + timing.visionMs;
+
+  if (description.startsWith("Error")) {
+    visionCache.thumbnail.valid = false;
+  } else {
+    rememberVision(thumb, question, description, timing.bytes);
+  }
+  applyCameraProfile(chooseCameraProfile(thumb, timing.bytes));
+
+  logToRobotLogs("[CAMERA] {\"bytes\":" + String(timing.bytes) + ",\"sent\":true,\"inline\":" + String(VISION_INLINE_IMAGES ? "true" : "false") +
+                 changeJson + ",\"capture_ms\":" + String(timing.captureMs) + ",\"preprocess_ms\":" + String(timing.preprocessMs) +
+                 ",\"upload_ms\":" + String(timing.uploadMs) + ",\"vision_ms\":" + String(timing.visionMs) + "}");
+
+  return "Image (" + String(timing.bytes) + " bytes" + frameText + "): " + description +
+         " [capture " + String(timing.captureMs) + " ms, upload " + String(timing.uploadMs) +
+         " ms, vision " + String(timing.visionMs) + " ms]";
+}
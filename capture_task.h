@@ -0,0 +1,41 @@
+#ifndef CAPTURE_TASK_H
+#define CAPTURE_TASK_H
+
+#include <Arduino.h>
+#include "camera_tools.h"
+#include "odometry.h"
+
+#define CAPTURE_TASK_STACK 6144
+#define CAPTURE_TASK_PRIORITY 1     // Below the WiFi/lwIP tasks
+#define CAPTURE_TASK_CORE 0         // loop() runs on core 1
+#define CAPTURE_WAIT_POLL_MS 10
+
+// When and where a buffered frame was taken
+struct FrameInfo {
+  uint32_t sequence;
+  unsigned long timestamp;  // millis() when the grab started
+  Pose pose;                // Dead-reckoned pose at that moment
+  bool moving;              // Taken while the motors were running
+};
+
+// Capture task counters
+struct CaptureTaskStats {
+  uint32_t captured;
+  uint32_t failed;
+  uint32_t oversized;
+  uint32_t served;          // Frames handed out by acquireLatestFrame()
+  unsigned long lastGrabMs;
+};
+
+extern CaptureTaskStats captureTaskStats;
+
+// Function declarations
+bool startCaptureTask();
+bool captureTaskRunning();
+void requestFreshFrame();
+void setCaptureActive(bool active);
+bool acquireLatestFrame(CameraFrame& frame, FrameInfo& info, unsigned long notBefore, unsigned long waitMs);
+void releaseLatestFrame();
+String formatCaptureTaskStats();
+
+#endif // CAPTURE_TASK_H
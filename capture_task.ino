@@ -0,0 +1,210 @@
+#include "capture_task.h"
+#include "robot_tools.h"
+
+// Two PSRAM frame buffers: the front one holds the newest complete frame and
+// may be lent to a reader; the task always writes into the other one.
+struct FrameSlot {
+  uint8_t* buf;
+  size_t len;
+  FrameInfo info;
+};
+
+FrameSlot captureSlots[2];
+int captureFront = -1;            // Slot with the newest complete frame, -1 before the first
+bool captureFrontLent = false;    // A reader holds the front slot
+bool captureWriting = false;      // The task is filling the back slot
+bool captureBackReady = false;    // Back slot holds a newer frame waiting for the reader to finish
+bool captureActive = false;       // An objective is running; no grabs outside one
+SemaphoreHandle_t captureMutex = nullptr;
+TaskHandle_t captureTaskHandle = nullptr;
+CaptureTaskStats captureTaskStats;
+
+/**
+ * Capture task body
+ * While an objective runs, grabs a frame when woken by requestFreshFrame()
+ * and, with the on-board camera, every CAPTURE_INTERVAL_MS. The fake source
+ * is an HTTP fetch that would compete with the LLM connection, so it is only
+ * fetched when woken. The frame goes into the back slot with its timestamp
+ * and pose and is published as the front slot.
+ */
+void captureTaskLoop(void* arg) {
+  uint32_t sequence = 0;
+  for (;;) {
+    bool periodic = CAMERA_ENABLED && captureActive;
+    ulTaskNotifyTake(pdTRUE, periodic ? pdMS_TO_TICKS(CAPTURE_INTERVAL_MS) : portMAX_DELAY);
+    if (!captureActive) {
+      continue;
+    }
+
+    xSemaphoreTake(captureMutex, portMAX_DELAY);
+    int back = captureFront == 0 ? 1 : 0;
+    captureWriting = true;
+    xSemaphoreGive(captureMutex);
+
+    FrameInfo info;
+    info.timestamp = millis();
+    info.pose = getPose();
+    info.moving = isMoving();
+
+    size_t len;
+    String error;
+    bool ok = grabFrameInto(captureSlots[back].buf, CAMERA_MAX_FRAME_BYTES, len, error);
+    captureTaskStats.lastGrabMs = millis() - info.timestamp;
+
+    if (ok) {
+      captureSlots[back].len = len;
+      info.sequence = ++sequence;
+      captureSlots[back].info = info;
+      captureTaskStats.captured++;
+    } else if (len > CAMERA_MAX_FRAME_BYTES) {
+      captureTaskStats.oversized++;
+    } else {
+      captureTaskStats.failed++;
+    }
+
+    xSemaphoreTake(captureMutex, portMAX_DELAY);
+    captureWriting = false;
+    if (ok) {
+      if (captureFrontLent) {
+        captureBackReady = true;
+      } else {
+        captureFront = back;
+        captureBackReady = false;
+      }
+    }
+    xSemaphoreGive(captureMutex);
+  }
+}
+
+/**
+ * Allocate the frame buffers and start the capture task
+ * Needs PSRAM for the two CAMERA_MAX_FRAME_BYTES buffers; without it frames
+ * are captured on demand as before.
+ * @return true if the task is running
+ */
+bool startCaptureTask() {
+  if (captureTaskHandle != nullptr) {
+    return true;
+  }
+  if (!CAPTURE_TASK_ENABLED) {
+    return false;
+  }
+  if (!psramFound()) {
+    logToRobotLogs("Capture task: no PSRAM, frames will be captured on demand");
+    return false;
+  }
+  if (!initCamera()) {
+    return false;
+  }
+
+  for (int i = 0; i < 2; i++) {
+    captureSlots[i].buf = (uint8_t*)ps_malloc(CAMERA_MAX_FRAME_BYTES);
+    captureSlots[i].len = 0;
+    if (captureSlots[i].buf == nullptr) {
+      logToRobotLogs("Capture task: frame buffer allocation failed");
+      for (int j = 0; j < i; j++) {
+        free(captureSlots[j].buf);
+        captureSlots[j].buf = nullptr;
+      }
+      return false;
+    }
+  }
+
+  captureMutex = xSemaphoreCreateMutex();
+  if (xTaskCreatePinnedToCore(captureTaskLoop, "capture", CAPTURE_TASK_STACK, nullptr,
+                              CAPTURE_TASK_PRIORITY, &captureTaskHandle, CAPTURE_TASK_CORE) != pdPASS) {
+    logToRobotLogs("Capture task: task creation failed");
+    captureTaskHandle = nullptr;
+    return false;
+  }
+
+  String when = CAMERA_ENABLED ? "every " + String(CAPTURE_INTERVAL_MS) + " ms" : String("when the car stops");
+  logToRobotLogs("Capture task started (" + when + " during objectives, 2 x " +
+                 String(CAMERA_MAX_FRAME_BYTES / 1024) + " KB PSRAM buffers)");
+  return true;
+}
+
+bool captureTaskRunning() {
+  return captureTaskHandle != nullptr;
+}
+
+/**
+ * Wake the capture task for an immediate grab (e.g. when the car stops)
+ * Ignored outside an objective.
+ */
+void requestFreshFrame() {
+  if (captureTaskHandle != nullptr && captureActive) {
+    xTaskNotifyGive(captureTaskHandle);
+  }
+}
+
+/**
+ * Let the capture task grab frames while an objective runs
+ * @param active true at the start of an objective, false at its end
+ */
+void setCaptureActive(bool active) {
+  captureActive = active;
+  if (active && CAMERA_ENABLED && captureTaskHandle != nullptr) {
+    xTaskNotifyGive(captureTaskHandle);
+  }
+}
+
+/**
+ * Borrow the newest buffered frame
+ * The frame stays valid until releaseFrame(); the task keeps capturing into
+ * the other buffer meanwhile.
+ * @param frame Receives the frame (source FRAME_SHARED)
+ * @param info Receives its timestamp and pose
+ * @param notBefore Only accept a frame whose grab started at or after this millis()
+ * @param waitMs How long to wait for such a frame
+ * @return false if the task isn't running, no objective is, or no suitable frame arrived in time
+ */
+bool acquireLatestFrame(CameraFrame& frame, FrameInfo& info, unsigned long notBefore, unsigned long waitMs) {
+  if (captureTaskHandle == nullptr || !captureActive) {
+    return false;
+  }
+
+  unsigned long start = millis();
+  for (;;) {
+    xSemaphoreTake(captureMutex, portMAX_DELAY);
+    if (captureFront >= 0 && (long)(captureSlots[captureFront].info.timestamp - notBefore) >= 0) {
+      FrameSlot& slot = captureSlots[captureFront];
+      captureFrontLent = true;
+      frame.buf = slot.buf;
+      frame.len = slot.len;
+      frame.handle = nullptr;
+      frame.source = FRAME_SHARED;
+      info = slot.info;
+      captureTaskStats.served++;
+      xSemaphoreGive(captureMutex);
+      return true;
+    }
+    xSemaphoreGive(captureMutex);
+
+    if (millis() - start >= waitMs) {
+      return false;
+    }
+    delay(CAPTURE_WAIT_POLL_MS);
+  }
+}
+
+/**
+ * Give the front buffer back to the capture task
+ * A frame finished while it was lent is published now, unless the task
+ * has already started overwriting it.
+ */
+void releaseLatestFrame() {
+  xSemaphoreTake(captureMutex, portMAX_DELAY);
+  captureFrontLent = false;
+  if (captureBackReady && !captureWriting) {
+    captureFront = captureFront == 0 ? 1 : 0;
+    captureBackReady = false;
+  }
+  xSemaphoreGive(captureMutex);
+}
+
+String formatCaptureTaskStats() {
+  return String(captureTaskStats.captured) + " captured, " + String(captureTaskStats.failed) + " failed, " +
+         String(captureTaskStats.oversized) + " oversized, " + String(captureTaskStats.served) + " served, last grab " +
+         String(captureTaskStats.lastGrabMs) + " ms";
+}
@@ -0,0 +1,42 @@
+#ifndef CONVERSATION_H
+#define CONVERSATION_H
+
+#include <Arduino.h>
+
+#define MAX_CONVERSATION_TURNS 8                              // Iterations kept verbatim in the transcript
+#define CONVERSATION_MAX_MESSAGES (2 + 2 * MAX_CONVERSATION_TURNS) // system + objective + assistant/user per turn
+#define CONVERSATION_KEEP_TURNS_AFTER_COMPACTION 3            // Turns left after compacting, so the prefix then stays stable for a while
+
+// One chat message
+struct ConversationMessage {
+  const char* role;   // "system", "user" or "assistant"
+  String content;
+  int tokens;         // Estimated when the message was added
+};
+
+// Chat transcript for one objective in conversation mode
+// messages[0] is the system prompt and messages[1] the objective; both are
+// fixed for the whole objective. Each iteration then adds the assistant's
+// decision and a user message with the tool results.
+struct Conversation {
+  ConversationMessage messages[CONVERSATION_MAX_MESSAGES];
+  int count;
+  String earlierSummary;  // One line per turn dropped from the transcript, sent after the objective
+  int summaryTokens;
+  int droppedTurns;
+};
+
+// Transcript used by the planner (conversation.ino)
+extern Conversation planningConversation;
+
+// Function declarations
+void setConversationMessage(ConversationMessage& message, const char* role, const String& content);
+void dropOldestConversationTurn(Conversation& conversation);
+void beginConversation(Conversation& conversation, const String& objective, const String& context);
+void appendConversationTurn(Conversation& conversation, int iteration, const String& decisionJson,
+                            const String& executionResults, const String& context);
+int conversationTokens(const Conversation& conversation);
+int compactConversation(Conversation& conversation, int targetTokens);
+int conversationTurnCount(const Conversation& conversation);
+
+#endif // CONVERSATION_H
@@ -0,0 +1,138 @@
+#include "conversation.h"
+#include "prompts_manager.h"
+#include "token_budget.h"
+#include "robot_tools.h"
+
+Conversation planningConversation;
+
+/**
+ * Set a message and estimate its tokens
+ */
+void setConversationMessage(ConversationMessage& message, const char* role, const String& content) {
+  message.role = role;
+  message.content = content;
+  message.tokens = estimateTokens(content) + TOKEN_MESSAGE_OVERHEAD;
+}
+
+/**
+ * Start the transcript for a new objective
+ * The system prompt is the planning template with its slots pointing at
+ * the conversation, so it is identical for every objective and the
+ * provider can cache it across commands.
+ * @param conversation Transcript to reset
+ * @param objective Objective text
+ * @param context Starting context
+ */
+void beginConversation(Conversation& conversation, const String& objective, const String& context) {
+  setConversationMessage(conversation.messages[0], "system", promptsManager.renderConversationSystemPrompt());
+  setConversationMessage(conversation.messages[1], "user", "ORIGINAL OBJECTIVE: " + objective + "\n\nCURRENT CONTEXT:\n" + context);
+  conversation.count = 2;
+  conversation.earlierSummary = "";
+  conversation.summaryTokens = 0;
+  conversation.droppedTurns = 0;
+
+  // Release the previous objective's turns
+  for (int i = 2; i < CONVERSATION_MAX_MESSAGES; i++) {
+    conversation.messages[i].content = String();
+  }
+}
+
+int conversationTurnCount(const Conversation& conversation) {
+  return (conversation.count - 2) / 2;
+}
+
+/**
+ * Drop the oldest turn, keeping one summary line for it
+ */
+void dropOldestConversationTurn(Conversation& conversation) {
+  const String& decision = conversation.messages[2].content;
+
+  String reasoning = "";
+  DynamicJsonDocument doc(1024);
+  if (!deserializeJson(doc, decision) && doc.containsKey("reasoning")) {
+    reasoning = doc["reasoning"].as<String>();
+    if (reasoning.length() > TOKEN_SUMMARY_REASONING_CHARS) {
+      reasoning = reasoning.substring(0, TOKEN_SUMMARY_REASONING_CHARS) + "...";
+    }
+  }
+
+  // Results messages start with "Iteration N results:"
+  const String& results = conversation.messages[3].content;
+  int labelEnd = results.indexOf(" results:");
+  String label = labelEnd > 0 ? results.substring(0, labelEnd) : "Iteration";
+
+  if (conversation.earlierSummary.length() == 0) {
+    conversation.earlierSummary = "Earlier iterations (summarized):\n";
+  }
+  conversation.earlierSummary += label + ": " + reasoning + "\n";
+  conversation.summaryTokens = estimateTokens(conversation.earlierSummary) + TOKEN_MESSAGE_OVERHEAD;
+
+  for (int i = 2; i + 2 < conversation.count; i++) {
+    conversation.messages[i].role = conversation.messages[i + 2].role;
+    conversation.messages[i].content = conversation.messages[i + 2].content;
+    conversation.messages[i].tokens = conversation.messages[i + 2].tokens;
+  }
+  conversation.count -= 2;
+  conversation.messages[conversation.count].content = String();
+  conversation.messages[conversation.count + 1].content = String();
+  conversation.droppedTurns++;
+}
+
+/**
+ * Add one iteration to the transcript
+ * The world state isn't part of it; each request sends the current one
+ * after the transcript.
+ * @param iteration Iteration number
+ * @param decisionJson Decision JSON the model returned
+ * @param executionResults Tool results for the iteration
+ * @param context Context for the next iteration
+ */
+void appendConversationTurn(Conversation& conversation, int iteration, const String& decisionJson,
+                            const String& executionResults, const String& context) {
+  if (conversation.count + 2 > CONVERSATION_MAX_MESSAGES) {
+    while (conversationTurnCount(conversation) > CONVERSATION_KEEP_TURNS_AFTER_COMPACTION) {
+      dropOldestConversationTurn(conversation);
+    }
+  }
+
+  setConversationMessage(conversation.messages[conversation.count++], "assistant", decisionJson);
+  setConversationMessage(conversation.messages[conversation.count++], "user",
+                         "Iteration " + String(iteration) + " results:\n" + executionResults +
+                         "\nCURRENT CONTEXT:\n" + context);
+}
+
+/**
+ * Estimated prompt tokens of the whole transcript
+ */
+int conversationTokens(const Conversation& conversation) {
+  int tokens = 3 + conversation.summaryTokens;
+  for (int i = 0; i < conversation.count; i++) {
+    tokens += conversation.messages[i].tokens;
+  }
+  return tokens;
+}
+
+/**
+ * Drop old turns if the transcript is over the token target
+ * Turns are dropped in one batch down to CONVERSATION_KEEP_TURNS_AFTER_COMPACTION
+ * (or fewer if still over), rather than one per iteration, so the cached
+ * prefix is invalidated once instead of on every request.
+ * @return Number of turns dropped
+ */
+int compactConversation(Conversation& conversation, int targetTokens) {
+  if (conversationTokens(conversation) <= targetTokens) {
+    return 0;
+  }
+
+  int dropped = 0;
+  while (conversationTurnCount(conversation) > 1 &&
+         (conversationTurnCount(conversation) > CONVERSATION_KEEP_TURNS_AFTER_COMPACTION ||
+          conversationTokens(conversation) > targetTokens)) {
+    dropOldestConversationTurn(conversation);
+    dropped++;
+  }
+
+  logToRobotLogs("Conversation compacted: dropped " + String(dropped) + " turns, ~" +
+                 String(conversationTokens(conversation)) + " tokens");
+  return dropped;
+}
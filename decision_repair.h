@@ -0,0 +1,18 @@
+#ifndef DECISION_REPAIR_H
+#define DECISION_REPAIR_H
+
+#include <Arduino.h>
+#include "openai_processor.h"
+
+#define DECISION_REPAIR_MAX_OUTPUT 1500      // Characters of the invalid reply sent back
+#define DECISION_REPAIR_MIN_REQUEST_MS 1000  // Don't start an attempt with less budget left than this
+
+// Function declarations
+String planningDecisionSchemaError(const PlanningDecision& decision);
+String decisionRepairPrompt(const PlanningDecision& decision);
+void buildDecisionRepairBody(String& body, const String& prompt, int maxTokens);
+PlanningDecision repairPlanningDecision(const PlanningDecision& decision, DecisionRepairStats& stats);
+void resetDecisionRepairStats(DecisionRepairStats& stats);
+String formatDecisionRepairStats(const DecisionRepairStats& stats);
+
+#endif // DECISION_REPAIR_H
@@ -0,0 +1,144 @@
+#include "decision_repair.h"
+#include "robot_tools.h"
+#include "llm_provider.h"
+#include "token_budget.h"
+#include "trace.h"
+
+// The whole repair prompt: schema only, no examples, objective or history
+const char* DECISION_REPAIR_SYSTEM_PROMPT =
+  "You fix robot planning replies. Reply with only the corrected JSON object, in this schema: "
+  "{\"tool_calls\":[{\"tool\":string,\"params\":string,\"confidence\":number}],"
+  "\"should_continue\":boolean,\"objective_complete\":boolean,\"reasoning\":string,\"next_context\":string}";
+
+/**
+ * Why a parsed decision can't run as is
+ * Checks the tool calls; parsePlanningResponse() reports content that
+ * doesn't parse at all.
+ * @param decision Decision parsed from the LLM's reply
+ * @return Error to send back with the reply, "" if the decision is usable
+ */
+String planningDecisionSchemaError(const PlanningDecision& decision) {
+  bool anyValid = false;
+  for (int i = 0; i < decision.numToolCalls; i++) {
+    const ToolCall& call = decision.toolCalls[i];
+    bool known = false;
+    String toolNames = "";
+    for (int t = 0; t < getToolCount() && !known; t++) {
+      Tool tool = getToolByIndex(t);
+      if (tool.directOnly) {
+        continue;
+      }
+      known = tool.name == call.tool;
+      toolNames += String(toolNames.length() > 0 ? ", " : "") + tool.name;
+    }
+    if (!known) {
+      return "tool_calls[" + String(i) + "].tool \"" + call.tool + "\" is not a tool. Tools: " + toolNames;
+    }
+    anyValid = anyValid || call.isValid;
+  }
+  if (decision.numToolCalls > 0 && !anyValid) {
+    return "every tool call has confidence 0.9 or below, so none of them will run. "
+           "Give the calls that should run a confidence above 0.9";
+  }
+  return "";
+}
+
+/**
+ * User message of a repair request: the invalid reply and its error, nothing else
+ * @param decision Invalid decision (rawContent and schemaError)
+ */
+String decisionRepairPrompt(const PlanningDecision& decision) {
+  return "Reply:\n" + decision.rawContent.substring(0, DECISION_REPAIR_MAX_OUTPUT) + "\n\nError: " + decision.schemaError;
+}
+
+/**
+ * Build a repair request body
+ * @param body Buffer to overwrite
+ * @param prompt decisionRepairPrompt()
+ * @param maxTokens Completion token limit
+ */
+void buildDecisionRepairBody(String& body, const String& prompt, int maxTokens) {
+  body = "";
+  body.reserve(prompt.length() + prompt.length() / 16 + strlen(DECISION_REPAIR_SYSTEM_PROMPT) + 192);
+  appendLlmRequestOptions(body, maxTokens);
+  appendChatMessage(body, "system", DECISION_REPAIR_SYSTEM_PROMPT);
+  body += ',';
+  appendChatMessage(body, "user", prompt);
+  body += "]}";
+}
+
+/**
+ * Ask the LLM to correct a decision that can't be used
+ * Sends buildDecisionRepairBody() up to DECISION_REPAIR_ATTEMPTS times, each
+ * with the latest invalid reply, and gives up once DECISION_REPAIR_BUDGET_MS
+ * has been spent. Requests, time and tokens go to stats, not to the
+ * session's iterations and planning tokens.
+ * @param decision Decision with a schemaError
+ * @param stats Repair stats to add to
+ * @return The corrected decision, or the original one if repair failed
+ */
+PlanningDecision repairPlanningDecision(const PlanningDecision& decision, DecisionRepairStats& stats) {
+  ScopedTrace span("repair_decision");
+  unsigned long start = millis();
+  stats.decisions++;
+
+  PlanningDecision current = decision;
+  bool fixed = false;
+  for (int attempt = 1; attempt <= DECISION_REPAIR_ATTEMPTS && !fixed; attempt++) {
+    if (chooseLlmProvider() < 0) {
+      break;
+    }
+    waitForLlmRateLimit();
+    unsigned long elapsed = millis() - start;
+    if (elapsed + DECISION_REPAIR_MIN_REQUEST_MS > DECISION_REPAIR_BUDGET_MS) {
+      break;
+    }
+
+    logToRobotLogs("Repairing decision (attempt " + String(attempt) + "): " + current.schemaError);
+    String prompt = decisionRepairPrompt(current);
+    buildDecisionRepairBody(openAIRequestBody, prompt, max(decision.maxTokens, RESPONSE_TOKENS_MIN));
+    int estimatedPromptTokens = estimateChatPromptTokens(DECISION_REPAIR_SYSTEM_PROMPT, prompt);
+    String response = makeOpenAIRequestBody(openAIRequestBody, DECISION_REPAIR_BUDGET_MS - elapsed);
+    stats.attempts++;
+
+    PlanningDecision repaired = parsePlanningResponse(response);
+    if (repaired.completionTokens > 0) {
+      recordTokenUsage(stats.tokens, estimatedPromptTokens, repaired.promptTokens, repaired.completionTokens);
+    }
+    if (repaired.requestFailed) {
+      break;
+    }
+    if (repaired.rawContent.length() > 0) {
+      fixed = repaired.schemaError.length() == 0;
+      current = repaired;
+    }
+  }
+
+  unsigned long ms = millis() - start;
+  stats.totalMs += ms;
+  stats.maxMs = max(stats.maxMs, ms);
+  if (!fixed) {
+    logToRobotLogs("Decision repair failed after " + String(ms) + " ms");
+    return decision;
+  }
+  stats.fixed++;
+  logToRobotLogs("Decision repaired in " + String(ms) + " ms");
+  return current;
+}
+
+void resetDecisionRepairStats(DecisionRepairStats& stats) {
+  stats.decisions = 0;
+  stats.attempts = 0;
+  stats.fixed = 0;
+  stats.totalMs = 0;
+  stats.maxMs = 0;
+  resetTokenUsage(stats.tokens);
+}
+
+/**
+ * One-line summary, e.g. "2 of 3 decisions fixed, 4 requests, 2400 ms (max 1300 ms); 410 prompt + 160 completion tokens over 4 requests, ~$0.00016"
+ */
+String formatDecisionRepairStats(const DecisionRepairStats& stats) {
+  return String(stats.fixed) + " of " + String(stats.decisions) + " decisions fixed, " + String(stats.attempts) + " requests, " +
+         String(stats.totalMs) + " ms (max " + String(stats.maxMs) + " ms); " + formatTokenUsage(stats.tokens);
+}
@@ -0,0 +1,32 @@
+#ifndef FUZZ_HARNESS_H
+#define FUZZ_HARNESS_H
+
+#include <Arduino.h>
+
+#define MAX_FUZZ_INPUT 4096   // Mutated inputs are capped at this many bytes
+#define MAX_FUZZ_SEEDS 8
+
+// A parser under test with its seed corpus
+struct FuzzTarget {
+  const char* name;
+  const char* seeds[MAX_FUZZ_SEEDS];
+  void (*run)(const String& input);
+};
+
+// Statistics collected for one target
+struct FuzzStats {
+  unsigned long execs;
+  unsigned long totalMicros;
+  unsigned long maxMicros;
+  unsigned long overBudget;
+  long worstHeapDelta;       // Largest free-heap drop left behind by a single input
+  String worstInput;         // Input that took longest
+};
+
+// Function declarations
+String fuzzParsers(String params);
+String mutateFuzzInput(const String& input, const FuzzTarget& target);
+uint32_t fuzzRandom();
+String escapeFuzzInput(const String& input, int maxLength);
+
+#endif // FUZZ_HARNESS_H
@@ -0,0 +1,295 @@
+#include "fuzz_harness.h"
+#include "robot_tools.h"
+#include "openai_processor.h"
+#include "heap_profiler.h"
+#include "json_repair.h"
+
+// ==========================================
+// FUZZ TARGETS
+// ==========================================
+
+void fuzzCommandMessage(const String& input) {
+  parseCommandMessage((const byte*)input.c_str(), input.length());
+}
+
+void fuzzPlanningResponse(const String& input) {
+  parsePlanningResponse(input);
+}
+
+void fuzzOpenAIResponse(const String& input) {
+  parseOpenAIResponse(input);
+}
+
+void fuzzJsonRepair(const String& input) {
+  String json;
+  int repairs;
+  repairDecisionJson(input, json, repairs);
+}
+
+void fuzzMoveParams(const String& input) {
+  parseMoveParams(input);
+}
+
+void fuzzFallbackResponse(const String& input) {
+  createFallbackResponse(input);
+}
+
+void fuzzTokenBudget(const String& input) {
+  String history = input;
+  fitHistoryToTokenBudget(history, 0, estimateTokens(input) / 3);
+}
+
+// Seed corpora follow the shape of real MQTT and OpenAI traffic
+FuzzTarget fuzzTargets[] = {
+  {"mqtt_command", {
+    "{\"content\":\"move forward 2 seconds\",\"sender\":\"web\",\"id\":\"42\"}",
+    "{\"content\":\"move forward until you are within 20cm of the wall then turn left 90 degrees\",\"sender\":\"cli\"}",
+    "{\"tool\":\"heap_report\",\"params\":\"reset\"}",
+    "{\"robot_id\":\"arduino_car\",\"status\":\"Robot connected and ready to receive commands\",\"timestamp\":\"1234\"}",
+    "{\"robot_id\":\"arduino_car\",\"message_type\":\"status_update\",\"content\":\"Sonar reading 1: 45 cm\"}",
+    nullptr}, fuzzCommandMessage},
+  {"planning_response", {
+    "{\"choices\":[{\"message\":{\"role\":\"assistant\",\"content\":\"```json\\n{\\\"tool_calls\\\":[{\\\"tool\\\":\\\"move_car\\\",\\\"params\\\":\\\"forward 1000\\\",\\\"confidence\\\":0.95}],\\\"should_continue\\\":true,\\\"objective_complete\\\":false,\\\"reasoning\\\":\\\"Moving closer\\\",\\\"next_context\\\":\\\"45cm away\\\"}\\n```\"},\"finish_reason\":\"stop\"}]}",
+    "{\"choices\":[{\"message\":{\"content\":\"{\\\"tool_calls\\\":[],\\\"should_continue\\\":false,\\\"objective_complete\\\":true,\\\"reasoning\\\":\\\"done\\\"}\"}}]}",
+    "{\"choices\":[{\"message\":{\"content\":\"```json\\n{\\\"tool_calls\\\": [{\\\"tool\\\": \\\"get_sonar_distance\\\", \\\"params\\\": \\\"\\\", \\\"confidence\\\": 0.98}], \\\"should_cont\"},\"finish_reason\":\"length\"}]}",
+    "{\"error\": {\"message\": \"Rate limit reached\", \"type\": \"requests\"}}",
+    "{\"choices\":[{\"message\":{\"content\":\"{\\\"tool_calls\\\":[],\\\"should_continue\\\":true}\"}}],\"usage\":{\"prompt_tokens\":1712,\"completion_tokens\":38,\"total_tokens\":1750}}",
+    "{\"choices\":[]}",
+    nullptr}, fuzzPlanningResponse},
+  {"openai_response", {
+    "{\"choices\":[{\"message\":{\"content\":\"{\\\"tool_calls\\\":[{\\\"tool\\\":\\\"move_car\\\",\\\"params\\\":\\\"left 90\\\",\\\"confidence\\\":0.97}],\\\"unknown_commands\\\":[\\\"dance\\\"]}\"}}]}",
+    "{\"choices\":[{\"message\":{\"content\":\"not json at all\"}}]}",
+    "{\"choices\":[{\"message\":{}}]}",
+    nullptr}, fuzzOpenAIResponse},
+  {"json_repair", {
+    "Here you go:\n{\"tool_calls\": [{\"tool\": \"move_car\", \"params\": \"forward 1000\", \"confidence\": 0.95},], \"should_continue\": true} // done",
+    "```json\n{\"tool_calls\": [{\"tool\": \"move_car\", \"params\": \"stop\", \"confidence\": 0.99}, {\"tool\": \"get_son",
+    "{'tool_calls': [{'tool': 'move_car', 'params': 'left 90', 'confidence': 0.9}], 'should_continue': True, 'next_context': None}",
+    "{tool_calls: [{tool: \"get_sonar_distance\", params: \"\"}], reasoning: \"said \"hi\"\nthen /* stop */\"}",
+    nullptr}, fuzzJsonRepair},
+  {"move_params", {
+    "forward 1000",
+    "  backward 2000  ",
+    "left 90",
+    "right 4294967296",
+    "stop",
+    nullptr}, fuzzMoveParams},
+  {"fallback_response", {
+    "move forward 3 seconds",
+    "go backward for 10 seconds then stop",
+    "measure the distance",
+    "turn left",
+    nullptr}, fuzzFallbackResponse},
+  {"token_budget", {
+    "--- Iteration 1 ---\nReasoning: Checking distance\nIteration tool calls:\n[1] get_sonar_distance: Sonar distance: 80 cm\n\n--- Iteration 2 ---\nReasoning: Moving closer\nIteration tool calls:\n[1] move_car: Moving forward for 1000 ms\n",
+    "Iteration 1 (summarized, 2 tools): Moving closer\n--- Iteration 3 ---\nReasoning: Stop\n",
+    "--- Iteration ---\n--- Iteration 12345678901 ---\nReasoning: \n",
+    nullptr}, fuzzTokenBudget}
+};
+
+const int NUM_FUZZ_TARGETS = sizeof(fuzzTargets) / sizeof(fuzzTargets[0]);
+
+// Tokens spliced into inputs to reach structural edge cases quickly
+const char* FUZZ_TOKENS[] = {
+  "{", "}", "[", "]", "\"", "\\", ":", ",", "```json", "```", "\\u00", "\\\"",
+  "999999999999", "-1", "0.9", "null", "true", "tool_calls", "content", " second", "within", "cm"
+};
+const int NUM_FUZZ_TOKENS = sizeof(FUZZ_TOKENS) / sizeof(FUZZ_TOKENS[0]);
+
+uint32_t fuzzRngState = 0x2545F491;
+
+/**
+ * xorshift32 PRNG so fuzz runs are reproducible from a seed
+ */
+uint32_t fuzzRandom() {
+  fuzzRngState ^= fuzzRngState << 13;
+  fuzzRngState ^= fuzzRngState >> 17;
+  fuzzRngState ^= fuzzRngState << 5;
+  return fuzzRngState;
+}
+
+/**
+ * Apply one to four random mutations to an input
+ * @param input Input to mutate
+ * @param target Target whose seeds are used for splicing
+ * @return Mutated input, capped at MAX_FUZZ_INPUT bytes
+ */
+String mutateFuzzInput(const String& input, const FuzzTarget& target) {
+  String out = input;
+  int mutations = 1 + fuzzRandom() % 4;
+
+  for (int m = 0; m < mutations; m++) {
+    int len = out.length();
+    int pos = len > 0 ? fuzzRandom() % (len + 1) : 0;
+
+    switch (fuzzRandom() % 7) {
+      case 0: // Flip a byte
+        if (len > 0) {
+          out.setCharAt(pos % len, (char)(fuzzRandom() & 0xFF));
+        }
+        break;
+      case 1: // Insert a random byte
+        out = out.substring(0, pos) + String((char)(1 + fuzzRandom() % 255)) + out.substring(pos);
+        break;
+      case 2: // Delete a range
+        if (len > 0) {
+          int count = 1 + fuzzRandom() % min(len, 16);
+          out.remove(pos % len, count);
+        }
+        break;
+      case 3: // Duplicate a range (grows nesting and repetition)
+        if (len > 0) {
+          int start = fuzzRandom() % len;
+          int count = 1 + fuzzRandom() % min(len - start, 64);
+          String chunk = out.substring(start, start + count);
+          int repeats = 1 + fuzzRandom() % 8;
+          String inserted = "";
+          for (int r = 0; r < repeats; r++) {
+            inserted += chunk;
+          }
+          out = out.substring(0, pos) + inserted + out.substring(pos);
+        }
+        break;
+      case 4: // Insert a structural token
+        out = out.substring(0, pos) + FUZZ_TOKENS[fuzzRandom() % NUM_FUZZ_TOKENS] + out.substring(pos);
+        break;
+      case 5: // Truncate
+        out = out.substring(0, pos);
+        break;
+      case 6: { // Splice with another seed
+        int numSeeds = 0;
+        while (numSeeds < MAX_FUZZ_SEEDS && target.seeds[numSeeds] != nullptr) {
+          numSeeds++;
+        }
+        String other = target.seeds[fuzzRandom() % numSeeds];
+        int cut = other.length() > 0 ? fuzzRandom() % other.length() : 0;
+        out = out.substring(0, pos) + other.substring(cut);
+        break;
+      }
+    }
+
+    if (out.length() > MAX_FUZZ_INPUT) {
+      out = out.substring(0, MAX_FUZZ_INPUT);
+    }
+  }
+
+  return out;
+}
+
+/**
+ * Make an input printable for logs
+ * @param input Raw input
+ * @param maxLength Truncate after this many characters
+ * @return Input with non-printable bytes as \xNN
+ */
+String escapeFuzzInput(const String& input, int maxLength) {
+  String out = "";
+  for (int i = 0; i < (int)input.length() && i < maxLength; i++) {
+    char c = input.charAt(i);
+    if (c >= 32 && c < 127 && c != '\\') {
+      out += c;
+    } else {
+      char hex[5];
+      sprintf(hex, "\\x%02X", (uint8_t)c);
+      out += hex;
+    }
+  }
+  if ((int)input.length() > maxLength) {
+    out += "...(" + String(input.length()) + " bytes)";
+  }
+  return out;
+}
+
+/**
+ * Tool: Fuzz Parsers
+ * Feeds mutated seed inputs to every untrusted-input parser, timing each
+ * input against a budget and watching for heap left behind. Logs one
+ * [FUZZ] JSON line per target plus the slowest input.
+ * @param params "iterations [budget_us] [seed]", defaults "500 20000 1"
+ * @return String summary of slow inputs per target
+ */
+String fuzzParsers(String params) {
+  params.trim();
+  int iterations = 500;
+  unsigned long budgetMicros = 20000;
+  uint32_t seed = 1;
+
+  int firstSpace = params.indexOf(' ');
+  int secondSpace = firstSpace != -1 ? params.indexOf(' ', firstSpace + 1) : -1;
+  if (params.length() > 0) {
+    iterations = params.substring(0, firstSpace != -1 ? firstSpace : params.length()).toInt();
+  }
+  if (firstSpace != -1) {
+    budgetMicros = params.substring(firstSpace + 1, secondSpace != -1 ? secondSpace : params.length()).toInt();
+  }
+  if (secondSpace != -1) {
+    seed = params.substring(secondSpace + 1).toInt();
+  }
+  if (iterations <= 0) iterations = 500;
+  if (budgetMicros == 0) budgetMicros = 20000;
+  fuzzRngState = seed != 0 ? seed : 1;
+
+  logToRobotLogs("=== FUZZING PARSERS ===");
+  logToRobotLogs("Iterations per target: " + String(iterations) + ", budget: " + String(budgetMicros) + "us, seed: " + String(seed));
+
+  String summary = "Fuzzing complete:";
+
+  for (int t = 0; t < NUM_FUZZ_TARGETS; t++) {
+    FuzzTarget& target = fuzzTargets[t];
+    FuzzStats stats;
+    stats.execs = 0;
+    stats.totalMicros = 0;
+    stats.maxMicros = 0;
+    stats.overBudget = 0;
+    stats.worstHeapDelta = 0;
+    stats.worstInput = "";
+
+    int numSeeds = 0;
+    while (numSeeds < MAX_FUZZ_SEEDS && target.seeds[numSeeds] != nullptr) {
+      numSeeds++;
+    }
+
+    robotLogsMuted = true;
+
+    for (int i = 0; i < iterations + numSeeds; i++) {
+      // Run every seed unmodified first, then mutations
+      String input = i < numSeeds ? String(target.seeds[i]) : mutateFuzzInput(target.seeds[fuzzRandom() % numSeeds], target);
+
+      uint32_t heapBefore = ESP.getFreeHeap();
+      unsigned long start = micros();
+      target.run(input);
+      unsigned long elapsed = micros() - start;
+      long heapDelta = (long)heapBefore - (long)ESP.getFreeHeap();
+
+      stats.execs++;
+      stats.totalMicros += elapsed;
+      if (elapsed > stats.maxMicros) {
+        stats.maxMicros = elapsed;
+        stats.worstInput = input;
+      }
+      if (elapsed > budgetMicros) {
+        stats.overBudget++;
+      }
+      if (heapDelta > stats.worstHeapDelta) {
+        stats.worstHeapDelta = heapDelta;
+      }
+
+      yield();
+    }
+
+    robotLogsMuted = false;
+
+    logToRobotLogs("[FUZZ] {\"target\":\"" + String(target.name) + "\",\"execs\":" + String(stats.execs) +
+                   ",\"mean_us\":" + String(stats.totalMicros / stats.execs) +
+                   ",\"max_us\":" + String(stats.maxMicros) +
+                   ",\"over_budget\":" + String(stats.overBudget) +
+                   ",\"worst_heap_delta\":" + String(stats.worstHeapDelta) +
+                   ",\"worst_len\":" + String(stats.worstInput.length()) + "}");
+    logToRobotLogs("[FUZZ] slowest " + String(target.name) + " input: " + escapeFuzzInput(stats.worstInput, 160));
+
+    summary += " " + String(target.name) + " max " + String(stats.maxMicros) + "us (" + String(stats.overBudget) + " over budget);";
+  }
+
+  logToRobotLogs("=== FUZZING COMPLETE ===");
+  return summary;
+}
@@ -0,0 +1,45 @@
+#ifndef HEAP_PROFILER_H
+#define HEAP_PROFILER_H
+
+#include <Arduino.h>
+
+#define MAX_HEAP_SITES 16
+#define MAX_HEAP_PHASES 12
+
+// Allocation accounting for one instrumented call site
+struct HeapSiteStats {
+  const char* site;        // Call site name, e.g. "openai_request_doc"
+  unsigned long count;     // Number of allocations recorded
+  unsigned long totalBytes; // Sum of requested sizes
+  unsigned long maxBytes;  // Largest single allocation
+};
+
+// Heap state observed at one planning phase
+struct HeapPhaseStats {
+  const char* phase;       // Phase name, e.g. "prompt_built"
+  unsigned long samples;   // Number of times the phase was reached
+  uint32_t minFree;        // Lowest free heap seen at this phase
+  uint32_t minLargestBlock; // Smallest largest-free-block seen at this phase
+  float maxFragmentation;  // Worst fragmentation ratio seen at this phase
+  uint32_t highWaterUsed;  // Most heap in use at this phase
+};
+
+// Point-in-time heap snapshot
+struct HeapSnapshot {
+  uint32_t freeBytes;      // Total free heap
+  uint32_t largestBlock;   // Largest allocatable block
+  uint32_t minFreeEver;    // Low-water mark since boot
+  uint32_t usedBytes;      // Heap in use
+  float fragmentation;     // 1 - largestBlock / freeBytes
+};
+
+// Function declarations
+HeapSnapshot takeHeapSnapshot();
+void heapProfileAlloc(const char* site, unsigned long bytes);
+void heapProfileMark(const char* phase);
+void resetHeapProfile();
+String heapSnapshotToJson(const HeapSnapshot& snapshot);
+String heapReport(String params);
+String heapSoak(String params);
+
+#endif // HEAP_PROFILER_H
@@ -0,0 +1,232 @@
+#include "heap_profiler.h"
+#include "benchmarks.h"
+#include "robot_tools.h"
+
+// Profiler tables
+HeapSiteStats heapSites[MAX_HEAP_SITES];
+int numHeapSites = 0;
+HeapPhaseStats heapPhases[MAX_HEAP_PHASES];
+int numHeapPhases = 0;
+
+/**
+ * Take a snapshot of the current heap state
+ * @return HeapSnapshot with free, largest block and fragmentation
+ */
+HeapSnapshot takeHeapSnapshot() {
+  HeapSnapshot snapshot;
+  snapshot.freeBytes = ESP.getFreeHeap();
+  snapshot.largestBlock = ESP.getMaxAllocHeap();
+  snapshot.minFreeEver = ESP.getMinFreeHeap();
+  snapshot.usedBytes = ESP.getHeapSize() - snapshot.freeBytes;
+  snapshot.fragmentation = snapshot.freeBytes > 0 ? 1.0 - (float)snapshot.largestBlock / (float)snapshot.freeBytes : 0.0;
+  return snapshot;
+}
+
+/**
+ * Record an allocation at a named call site
+ * @param site Static call site name
+ * @param bytes Requested size in bytes
+ */
+void heapProfileAlloc(const char* site, unsigned long bytes) {
+  for (int i = 0; i < numHeapSites; i++) {
+    if (strcmp(heapSites[i].site, site) == 0) {
+      heapSites[i].count++;
+      heapSites[i].totalBytes += bytes;
+      if (bytes > heapSites[i].maxBytes) {
+        heapSites[i].maxBytes = bytes;
+      }
+      return;
+    }
+  }
+
+  if (numHeapSites < MAX_HEAP_SITES) {
+    heapSites[numHeapSites].site = site;
+    heapSites[numHeapSites].count = 1;
+    heapSites[numHeapSites].totalBytes = bytes;
+    heapSites[numHeapSites].maxBytes = bytes;
+    numHeapSites++;
+  }
+}
+
+/**
+ * Record the heap state at a named planning phase
+ * @param phase Static phase name
+ */
+void heapProfileMark(const char* phase) {
+  HeapSnapshot snapshot = takeHeapSnapshot();
+
+  HeapPhaseStats* stats = nullptr;
+  for (int i = 0; i < numHeapPhases; i++) {
+    if (strcmp(heapPhases[i].phase, phase) == 0) {
+      stats = &heapPhases[i];
+      break;
+    }
+  }
+
+  if (stats == nullptr) {
+    if (numHeapPhases >= MAX_HEAP_PHASES) {
+      return;
+    }
+    stats = &heapPhases[numHeapPhases++];
+    stats->phase = phase;
+    stats->samples = 0;
+    stats->minFree = snapshot.freeBytes;
+    stats->minLargestBlock = snapshot.largestBlock;
+    stats->maxFragmentation = snapshot.fragmentation;
+    stats->highWaterUsed = snapshot.usedBytes;
+  }
+
+  stats->samples++;
+  if (snapshot.freeBytes < stats->minFree) stats->minFree = snapshot.freeBytes;
+  if (snapshot.largestBlock < stats->minLargestBlock) stats->minLargestBlock = snapshot.largestBlock;
+  if (snapshot.fragmentation > stats->maxFragmentation) stats->maxFragmentation = snapshot.fragmentation;
+  if (snapshot.usedBytes > stats->highWaterUsed) stats->highWaterUsed = snapshot.usedBytes;
+}
+
+/**
+ * Clear all site and phase statistics
+ */
+void resetHeapProfile() {
+  numHeapSites = 0;
+  numHeapPhases = 0;
+}
+
+/**
+ * Serialize a heap snapshot as a compact JSON object
+ */
+String heapSnapshotToJson(const HeapSnapshot& snapshot) {
+  return "{\"free\":" + String(snapshot.freeBytes) +
+         ",\"largest\":" + String(snapshot.largestBlock) +
+         ",\"min_free\":" + String(snapshot.minFreeEver) +
+         ",\"used\":" + String(snapshot.usedBytes) +
+         ",\"frag\":" + String(snapshot.fragmentation, 3) + "}";
+}
+
+/**
+ * Tool: Heap Report
+ * Logs the current heap state plus per-site and per-phase statistics
+ * as [HEAP] JSON lines
+ * @param params "reset" clears the statistics after reporting
+ * @return String summary of the current heap state
+ */
+String heapReport(String params) {
+  HeapSnapshot snapshot = takeHeapSnapshot();
+
+  logToRobotLogs("=== HEAP REPORT ===");
+  logToRobotLogs("[HEAP] {\"now\":" + heapSnapshotToJson(snapshot) + "}");
+
+  for (int i = 0; i < numHeapSites; i++) {
+    HeapSiteStats& site = heapSites[i];
+    logToRobotLogs("[HEAP] {\"site\":\"" + String(site.site) + "\",\"count\":" + String(site.count) +
+                   ",\"total_bytes\":" + String(site.totalBytes) +
+                   ",\"avg_bytes\":" + String(site.count > 0 ? site.totalBytes / site.count : 0) +
+                   ",\"max_bytes\":" + String(site.maxBytes) + "}");
+  }
+
+  for (int i = 0; i < numHeapPhases; i++) {
+    HeapPhaseStats& phase = heapPhases[i];
+    logToRobotLogs("[HEAP] {\"phase\":\"" + String(phase.phase) + "\",\"samples\":" + String(phase.samples) +
+                   ",\"min_free\":" + String(phase.minFree) +
+                   ",\"min_largest\":" + String(phase.minLargestBlock) +
+                   ",\"max_frag\":" + String(phase.maxFragmentation, 3) +
+                   ",\"high_water_used\":" + String(phase.highWaterUsed) + "}");
+  }
+
+  params.trim();
+  if (params == "reset") {
+    resetHeapProfile();
+    logToRobotLogs("Heap profile statistics reset");
+  }
+
+  return "Heap: free " + String(snapshot.freeBytes) + " bytes, largest block " + String(snapshot.largestBlock) +
+         " bytes, fragmentation " + String(snapshot.fragmentation * 100.0, 1) + "%, low-water " +
+         String(snapshot.minFreeEver) + " bytes";
+}
+
+/**
+ * Tool: Heap Soak
+ * Runs simulated planning commands (prompt build, response parse, session
+ * update) without the network or motors and logs the heap over time as
+ * [HEAP_SOAK] JSON lines, ending with a fragmentation sparkline.
+ * @param params Number of simulated commands (default 1000)
+ * @return String summary with start/end fragmentation and the sparkline
+ */
+String heapSoak(String params) {
+  int commands = params.toInt();
+  if (commands <= 0) {
+    commands = 1000;
+  }
+
+  const int SOAK_SAMPLES = 40;
+  const int ITERATIONS_PER_COMMAND = 5;
+  int sampleEvery = max(1, commands / SOAK_SAMPLES);
+
+  logToRobotLogs("=== HEAP SOAK ===");
+  logToRobotLogs("Simulating " + String(commands) + " commands, " + String(ITERATIONS_PER_COMMAND) + " iterations each");
+
+  HeapSnapshot start = takeHeapSnapshot();
+  logToRobotLogs("[HEAP_SOAK] {\"cmd\":0,\"heap\":" + heapSnapshotToJson(start) + "}");
+
+  float fragSeries[SOAK_SAMPLES + 1];
+  int numSamples = 0;
+  fragSeries[numSamples++] = start.fragmentation;
+
+  for (int cmd = 1; cmd <= commands; cmd++) {
+    robotLogsMuted = true;
+
+    PlanningSession session;
+    session.objective = BENCH_OBJECTIVE;
+    session.currentContext = "Starting fresh. Objective: " + String(BENCH_OBJECTIVE);
+    session.executionHistory = "";
+    session.iterationCount = 0;
+    session.isComplete = false;
+    session.finalResult = "";
+    session.startTime = millis();
+    session.lastIterationTime = millis();
+    resetTokenUsage(session.tokens);
+
+    // Vary the iteration count so allocations don't repeat in lockstep
+    int iterations = 1 + (cmd % ITERATIONS_PER_COMMAND);
+    for (int i = 0; i < iterations; i++) {
+      session.iterationCount++;
+      fitPlanningSessionToBudget(session);
+      String prompt = buildIterativePlanningPrompt(session);
+      PlanningDecision decision = parsePlanningResponse(BENCH_OPENAI_RESPONSE);
+      updatePlanningSession(session, decision, BENCH_LATEST_RESULTS);
+    }
+
+    robotLogsMuted = false;
+
+    if (cmd % sampleEvery == 0 || cmd == commands) {
+      HeapSnapshot snapshot = takeHeapSnapshot();
+      logToRobotLogs("[HEAP_SOAK] {\"cmd\":" + String(cmd) + ",\"heap\":" + heapSnapshotToJson(snapshot) + "}");
+      if (numSamples <= SOAK_SAMPLES) {
+        fragSeries[numSamples++] = snapshot.fragmentation;
+      }
+    }
+
+    yield();
+  }
+
+  // Sparkline of fragmentation over the run, scaled to the worst sample
+  const char* levels = " .:-=+*#%@";
+  float maxFrag = 0.001;
+  for (int i = 0; i < numSamples; i++) {
+    if (fragSeries[i] > maxFrag) maxFrag = fragSeries[i];
+  }
+  String sparkline = "";
+  for (int i = 0; i < numSamples; i++) {
+    int level = (int)(fragSeries[i] / maxFrag * 9.0 + 0.5);
+    sparkline += levels[constrain(level, 0, 9)];
+  }
+
+  HeapSnapshot end = takeHeapSnapshot();
+  String summary = "Heap soak complete: " + String(commands) + " commands, fragmentation " +
+                   String(start.fragmentation * 100.0, 1) + "% -> " + String(end.fragmentation * 100.0, 1) +
+                   "% (peak " + String(maxFrag * 100.0, 1) + "%), free " + String(start.freeBytes) + " -> " +
+                   String(end.freeBytes) + " bytes, low-water " + String(end.minFreeEver) + " bytes [" + sparkline + "]";
+
+  logToRobotLogs(summary);
+  logToRobotLogs("=== HEAP SOAK COMPLETE ===");
+  return summary;
+}
@@ -0,0 +1,76 @@
+#ifndef IMAGE_PREPROCESS_H
+#define IMAGE_PREPROCESS_H
+
+#include <Arduino.h>
+#include "camera_tools.h"
+
+#define THUMB_WIDTH 32                  // Grayscale thumbnail compared between frames
+#define THUMB_HEIGHT 24
+#define THUMB_PIXELS (THUMB_WIDTH * THUMB_HEIGHT)
+#define THUMB_HISTOGRAM_BINS 16
+#define THUMB_MAX_DECODE_BYTES 65536    // Largest scaled RGB565 decode (1/8 scale covers 1280x1024 JPEGs)
+#define PIXEL_CHANGE_THRESHOLD 24       // Grey levels a thumbnail pixel must move to count as changed
+#define DETAIL_LOW 6                    // Mean gradient below which a scene is plain (wall, floor)
+#define DETAIL_HIGH 14                  // Mean gradient above which a scene is busy
+#define CAMERA_QUALITY_MAX 40           // Coarsest JPEG quality the adaptive profile will use
+
+// Downscaled grayscale version of a frame
+struct FrameThumbnail {
+  uint8_t pixels[THUMB_PIXELS];
+  uint16_t histogram[THUMB_HISTOGRAM_BINS];
+  uint8_t detail;     // Mean absolute gradient, 0-255
+  bool valid;
+};
+
+// Difference between a frame and the last frame sent to the vision model
+struct FrameChange {
+  float meanDiff;            // Mean absolute pixel difference, 0-255
+  float changedFraction;     // Fraction of pixels that moved more than PIXEL_CHANGE_THRESHOLD
+  float histogramDistance;   // Half L1 distance of normalized histograms, 0-1
+  bool significant;
+};
+
+// Capture resolution and JPEG quality (lower number = better quality)
+struct CameraProfile {
+  int level;            // Index into CAMERA_PROFILES
+  const char* name;
+  int width;
+  int height;
+  int quality;
+};
+
+// Last frame sent to the vision model and what it said
+struct VisionCache {
+  FrameThumbnail thumbnail;
+  String question;
+  String description;
+  unsigned long time;
+  size_t bytes;
+};
+
+// Vision cost for the current objective
+struct VisionStats {
+  int captured;
+  int sent;
+  int reused;
+  unsigned long bytesSent;
+  unsigned long bytesSkipped;
+  unsigned long visionMs;       // Upload + vision request time of sent frames
+  unsigned long preprocessMs;
+};
+
+extern VisionCache visionCache;
+extern VisionStats visionStats;
+
+// Function declarations
+bool jpegDimensions(const uint8_t* buf, size_t len, int& width, int& height);
+bool makeThumbnail(const CameraFrame& frame, FrameThumbnail& thumb);
+FrameChange compareThumbnails(const FrameThumbnail& current, const FrameThumbnail& previous);
+bool canReuseVision(const FrameThumbnail& thumb, const String& question, FrameChange& change);
+void rememberVision(const FrameThumbnail& thumb, const String& question, const String& description, size_t bytes);
+CameraProfile chooseCameraProfile(const FrameThumbnail& thumb, size_t lastFrameBytes);
+void applyCameraProfile(const CameraProfile& profile);
+void resetVisionStats();
+String formatVisionStats();
+
+#endif // IMAGE_PREPROCESS_H
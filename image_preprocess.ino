@@ -0,0 +1,259 @@
+#include "image_preprocess.h"
+#include "robot_tools.h"
+#include "trace.h"
+#include "img_converters.h"
+
+VisionCache visionCache;
+VisionStats visionStats;
+
+// Resolution ladder for adaptive capture, coarsest first
+const CameraProfile CAMERA_PROFILES[] = {
+  {0, "QQVGA", 160, 120, 20},
+  {1, "QVGA", 320, 240, 16},
+  {2, "VGA", 640, 480, 12}
+};
+
+/**
+ * Read the image size from a JPEG's start-of-frame marker
+ * @return false if no SOF marker was found
+ */
+bool jpegDimensions(const uint8_t* buf, size_t len, int& width, int& height) {
+  if (len < 4 || buf[0] != 0xFF || buf[1] != 0xD8) {
+    return false;
+  }
+
+  size_t i = 2;
+  while (i + 9 < len) {
+    if (buf[i] != 0xFF) {
+      return false;
+    }
+    uint8_t marker = buf[i + 1];
+    if (marker == 0xFF) {
+      i++;            // Fill byte
+      continue;
+    }
+    if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+      i += 2;         // Markers without a length
+      continue;
+    }
+
+    // SOF0-SOF15, except DHT (C4), JPG (C8) and DAC (CC)
+    if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+      height = (buf[i + 5] << 8) | buf[i + 6];
+      width = (buf[i + 7] << 8) | buf[i + 8];
+      return width > 0 && height > 0;
+    }
+
+    size_t segmentLength = (buf[i + 2] << 8) | buf[i + 3];
+    i += 2 + segmentLength;
+  }
+  return false;
+}
+
+/**
+ * Build a grayscale thumbnail of a JPEG frame
+ * The JPEG is decoded at 1/8 scale (jpg2rgb565), or 1/4 when 1/8 would be
+ * smaller than the thumbnail (QQVGA), then box-averaged down to
+ * THUMB_WIDTH x THUMB_HEIGHT.
+ * @param frame Captured frame
+ * @param thumb Receives the thumbnail; thumb.valid is false on failure
+ * @return thumb.valid
+ */
+bool makeThumbnail(const CameraFrame& frame, FrameThumbnail& thumb) {
+  ScopedTrace span("frame_preprocess");
+  thumb.valid = false;
+
+  int width = 0;
+  int height = 0;
+  if (!jpegDimensions(frame.buf, frame.len, width, height)) {
+    return false;
+  }
+
+  int scale = width / 8 >= THUMB_WIDTH && height / 8 >= THUMB_HEIGHT ? 8 : 4;
+  int scaledWidth = width / scale;
+  int scaledHeight = height / scale;
+  size_t decodeBytes = (size_t)((width + scale - 1) / scale) * ((height + scale - 1) / scale) * 2;
+  if (scaledWidth < THUMB_WIDTH || scaledHeight < THUMB_HEIGHT || decodeBytes > THUMB_MAX_DECODE_BYTES) {
+    return false;
+  }
+
+  uint8_t* rgb = (uint8_t*)(psramFound() ? ps_malloc(decodeBytes) : malloc(decodeBytes));
+  if (rgb == nullptr) {
+    return false;
+  }
+  if (!jpg2rgb565(frame.buf, frame.len, rgb, scale == 8 ? JPG_SCALE_8X : JPG_SCALE_4X)) {
+    free(rgb);
+    return false;
+  }
+
+  memset(thumb.histogram, 0, sizeof(thumb.histogram));
+  for (int ty = 0; ty < THUMB_HEIGHT; ty++) {
+    int y0 = ty * scaledHeight / THUMB_HEIGHT;
+    int y1 = (ty + 1) * scaledHeight / THUMB_HEIGHT;
+    for (int tx = 0; tx < THUMB_WIDTH; tx++) {
+      int x0 = tx * scaledWidth / THUMB_WIDTH;
+      int x1 = (tx + 1) * scaledWidth / THUMB_WIDTH;
+
+      uint32_t sum = 0;
+      for (int y = y0; y < y1; y++) {
+        const uint8_t* row = rgb + (size_t)y * scaledWidth * 2;
+        for (int x = x0; x < x1; x++) {
+          // jpg2rgb565 writes big-endian pixels
+          uint16_t c = (row[x * 2] << 8) | row[x * 2 + 1];
+          uint32_t r = (c >> 11) << 3;
+          uint32_t g = ((c >> 5) & 0x3F) << 2;
+          uint32_t b = (c & 0x1F) << 3;
+          sum += (77 * r + 150 * g + 29 * b) >> 8;
+        }
+      }
+      uint8_t grey = sum / ((y1 - y0) * (x1 - x0));
+      thumb.pixels[ty * THUMB_WIDTH + tx] = grey;
+      thumb.histogram[grey >> 4]++;
+    }
+  }
+  free(rgb);
+
+  // Detail: mean absolute gradient to the right and below
+  uint32_t gradient = 0;
+  for (int y = 0; y < THUMB_HEIGHT - 1; y++) {
+    for (int x = 0; x < THUMB_WIDTH - 1; x++) {
+      int p = thumb.pixels[y * THUMB_WIDTH + x];
+      gradient += abs(p - thumb.pixels[y * THUMB_WIDTH + x + 1]);
+      gradient += abs(p - thumb.pixels[(y + 1) * THUMB_WIDTH + x]);
+    }
+  }
+  thumb.detail = min(255, (int)(gradient / (2 * (THUMB_WIDTH - 1) * (THUMB_HEIGHT - 1))));
+  thumb.valid = true;
+  return true;
+}
+
+/**
+ * Measure how much the scene changed between two thumbnails
+ * Pixel differences catch objects moving into view; the histogram catches
+ * lighting and framing changes that shift many pixels slightly.
+ */
+FrameChange compareThumbnails(const FrameThumbnail& current, const FrameThumbnail& previous) {
+  FrameChange change;
+  uint32_t diffSum = 0;
+  int changedPixels = 0;
+  for (int i = 0; i < THUMB_PIXELS; i++) {
+    int diff = abs((int)current.pixels[i] - (int)previous.pixels[i]);
+    diffSum += diff;
+    if (diff > PIXEL_CHANGE_THRESHOLD) {
+      changedPixels++;
+    }
+  }
+
+  uint32_t histogramDiff = 0;
+  for (int i = 0; i < THUMB_HISTOGRAM_BINS; i++) {
+    histogramDiff += abs((int)current.histogram[i] - (int)previous.histogram[i]);
+  }
+
+  change.meanDiff = (float)diffSum / THUMB_PIXELS;
+  change.changedFraction = (float)changedPixels / THUMB_PIXELS;
+  change.histogramDistance = (float)histogramDiff / (2 * THUMB_PIXELS);
+  change.significant = change.changedFraction > VISION_CHANGE_FRACTION ||
+                       change.histogramDistance > VISION_HISTOGRAM_CHANGE;
+  return change;
+}
+
+/**
+ * Decide whether the cached description still describes this frame
+ * @param thumb Thumbnail of the new frame
+ * @param question Question being asked
+ * @param change Receives the change against the cached frame (zeroed if there is none)
+ * @return true if the previous description can be returned instead of a vision call
+ */
+bool canReuseVision(const FrameThumbnail& thumb, const String& question, FrameChange& change) {
+  change.meanDiff = 0;
+  change.changedFraction = 0;
+  change.histogramDistance = 0;
+  change.significant = true;
+
+  if (!thumb.valid || !visionCache.thumbnail.valid) {
+    return false;
+  }
+  change = compareThumbnails(thumb, visionCache.thumbnail);
+
+  return !change.significant &&
+         question == visionCache.question &&
+         millis() - visionCache.time < VISION_MAX_REUSE_MS;
+}
+
+/**
+ * Cache the frame just sent and its description
+ * An invalid thumbnail (frame that couldn't be decoded) clears the cache.
+ */
+void rememberVision(const FrameThumbnail& thumb, const String& question, const String& description, size_t bytes) {
+  visionCache.thumbnail = thumb;
+  visionCache.question = question;
+  visionCache.description = description;
+  visionCache.time = millis();
+  visionCache.bytes = bytes;
+}
+
+/**
+ * Pick resolution and quality for the next capture
+ * Plain scenes (walls, floor) get the coarsest profile; busy scenes get more
+ * pixels. If the last frame came out over VISION_FRAME_BYTE_TARGET the JPEG
+ * quality is coarsened instead of dropping resolution.
+ * @param thumb Thumbnail of the latest frame
+ * @param lastFrameBytes Size of the latest frame
+ */
+CameraProfile chooseCameraProfile(const FrameThumbnail& thumb, size_t lastFrameBytes) {
+  int level = 1;
+  if (thumb.valid) {
+    if (thumb.detail < DETAIL_LOW) {
+      level = 0;
+    } else if (thumb.detail >= DETAIL_HIGH) {
+      level = 2;
+    }
+  }
+  // VGA needs the second frame buffer in PSRAM
+  if (!psramFound() && level > 1) {
+    level = 1;
+  }
+
+  CameraProfile profile = CAMERA_PROFILES[level];
+  if (lastFrameBytes > (size_t)VISION_FRAME_BYTE_TARGET) {
+    profile.quality = min(CAMERA_QUALITY_MAX, profile.quality + 8);
+  }
+  return profile;
+}
+
+/**
+ * Configure the sensor for the next capture
+ * Fake-source frames can't be resized; the profile is only logged.
+ */
+void applyCameraProfile(const CameraProfile& profile) {
+#if CAMERA_ENABLED
+  const framesize_t FRAMESIZES[] = {FRAMESIZE_QQVGA, FRAMESIZE_QVGA, FRAMESIZE_VGA};
+  sensor_t* sensor = esp_camera_sensor_get();
+  if (sensor != nullptr) {
+    sensor->set_framesize(sensor, FRAMESIZES[profile.level]);
+    sensor->set_quality(sensor, profile.quality);
+  }
+#endif
+  logToRobotLogs("Camera profile: " + String(profile.name) + " q" + String(profile.quality));
+}
+
+void resetVisionStats() {
+  visionStats.captured = 0;
+  visionStats.sent = 0;
+  visionStats.reused = 0;
+  visionStats.bytesSent = 0;
+  visionStats.bytesSkipped = 0;
+  visionStats.visionMs = 0;
+  visionStats.preprocessMs = 0;
+}
+
+/**
+ * One-line summary of vision cost, e.g.
+ * "3 captured, 1 sent, 2 reused, 18 KB sent, 36 KB skipped, vision 2400 ms, preprocess 90 ms"
+ */
+String formatVisionStats() {
+  return String(visionStats.captured) + " captured, " + String(visionStats.sent) + " sent, " +
+         String(visionStats.reused) + " reused, " + String(visionStats.bytesSent / 1024) + " KB sent, " +
+         String(visionStats.bytesSkipped / 1024) + " KB skipped, vision " + String(visionStats.visionMs) +
+         " ms, preprocess " + String(visionStats.preprocessMs) + " ms";
+}
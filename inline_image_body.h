@@ -0,0 +1,43 @@
+#ifndef INLINE_IMAGE_BODY_H
+#define INLINE_IMAGE_BODY_H
+
+#include <Arduino.h>
+
+// Base64 length of n input bytes, including padding
+#define BASE64_ENCODED_LENGTH(n) ((((n) + 2) / 3) * 4)
+
+// Request body of the form prefix + base64(image) + suffix, produced on demand
+// HTTPClient::sendRequest() pulls the body through readBytes() one socket
+// buffer at a time, so only the prefix and suffix are held in RAM; the image
+// is encoded straight from its buffer (usually the camera frame buffer) as
+// it is sent. Peak memory does not depend on the image size.
+class InlineImageBody : public Stream {
+public:
+  InlineImageBody(const String& prefix, const uint8_t* image, size_t imageLength, const String& suffix);
+
+  size_t length() const { return totalLength; }
+  void rewind() { position = 0; }
+
+  int available() override;
+  int read() override;
+  int peek() override;
+  size_t readBytes(char* buffer, size_t length) override;
+
+  // Read-only stream
+  size_t write(uint8_t) override { return 0; }
+  size_t write(const uint8_t*, size_t) override { return 0; }
+
+private:
+  int byteAt(size_t offset) const;
+  char base64CharAt(size_t index) const;
+
+  String prefix;
+  String suffix;
+  const uint8_t* image;
+  size_t imageLength;
+  size_t encodedLength;
+  size_t totalLength;
+  size_t position;
+};
+
+#endif // INLINE_IMAGE_BODY_H
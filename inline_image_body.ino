@@ -0,0 +1,111 @@
+#include "inline_image_body.h"
+
+static const char BASE64_ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+InlineImageBody::InlineImageBody(const String& prefix, const uint8_t* image, size_t imageLength, const String& suffix)
+  : prefix(prefix), suffix(suffix), image(image), imageLength(imageLength),
+    encodedLength(BASE64_ENCODED_LENGTH(imageLength)), position(0) {
+  totalLength = prefix.length() + encodedLength + suffix.length();
+}
+
+/**
+ * Base64 character at an index of the encoded image
+ */
+char InlineImageBody::base64CharAt(size_t index) const {
+  size_t group = (index / 4) * 3;
+  size_t remaining = imageLength - group;
+  int slot = index % 4;
+
+  // Padding of the last group
+  if (remaining < 3 && slot > (int)remaining) {
+    return '=';
+  }
+
+  uint32_t triple = (uint32_t)image[group] << 16;
+  if (remaining > 1) triple |= (uint32_t)image[group + 1] << 8;
+  if (remaining > 2) triple |= image[group + 2];
+  return BASE64_ALPHABET[(triple >> (18 - 6 * slot)) & 0x3F];
+}
+
+/**
+ * Byte at an offset of the whole body, or -1 past the end
+ */
+int InlineImageBody::byteAt(size_t offset) const {
+  if (offset < prefix.length()) {
+    return (uint8_t)prefix[offset];
+  }
+  offset -= prefix.length();
+  if (offset < encodedLength) {
+    return (uint8_t)base64CharAt(offset);
+  }
+  offset -= encodedLength;
+  if (offset < suffix.length()) {
+    return (uint8_t)suffix[offset];
+  }
+  return -1;
+}
+
+int InlineImageBody::available() {
+  return totalLength - position;
+}
+
+int InlineImageBody::read() {
+  int c = byteAt(position);
+  if (c >= 0) {
+    position++;
+  }
+  return c;
+}
+
+int InlineImageBody::peek() {
+  return byteAt(position);
+}
+
+/**
+ * Copy the next part of the body into a buffer
+ * The image is encoded a whole 3-byte group at a time; the
+ * per-character path only handles group boundaries split across
+ * calls and the padded last group.
+ * @param buffer Destination
+ * @param length Buffer size
+ * @return Bytes written (0 at the end of the body)
+ */
+size_t InlineImageBody::readBytes(char* buffer, size_t length) {
+  size_t written = 0;
+  size_t prefixLength = prefix.length();
+  size_t encodedEnd = prefixLength + encodedLength;
+
+  if (position < prefixLength && written < length) {
+    size_t n = min(prefixLength - position, length - written);
+    memcpy(buffer + written, prefix.c_str() + position, n);
+    written += n;
+    position += n;
+  }
+
+  while (position < encodedEnd && written < length) {
+    size_t index = position - prefixLength;
+    size_t group = (index / 4) * 3;
+
+    if (index % 4 == 0 && group + 3 <= imageLength && length - written >= 4) {
+      uint32_t triple = ((uint32_t)image[group] << 16) | ((uint32_t)image[group + 1] << 8) | image[group + 2];
+      buffer[written++] = BASE64_ALPHABET[(triple >> 18) & 0x3F];
+      buffer[written++] = BASE64_ALPHABET[(triple >> 12) & 0x3F];
+      buffer[written++] = BASE64_ALPHABET[(triple >> 6) & 0x3F];
+      buffer[written++] = BASE64_ALPHABET[triple & 0x3F];
+      position += 4;
+    } else {
+      buffer[written++] = base64CharAt(index);
+      position++;
+    }
+  }
+
+  if (position >= encodedEnd && position < totalLength && written < length) {
+    size_t offset = position - encodedEnd;
+    size_t n = min(suffix.length() - offset, length - written);
+    memcpy(buffer + written, suffix.c_str() + offset, n);
+    written += n;
+    position += n;
+  }
+
+  return written;
+}
@@ -0,0 +1,41 @@
+#ifndef JSON_REPAIR_H
+#define JSON_REPAIR_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#define JSON_REPAIR_MAX_DEPTH 16     // Deeper input is rejected
+#define JSON_REPAIR_SALVAGE_DEPTH 2  // Truncated output keeps whole values up to this depth (decision members, whole tool calls)
+
+// Defects fixed by repairDecisionJson(), as a bitmask
+#define JSON_REPAIR_PROSE            0x001  // Text or code fences around the object
+#define JSON_REPAIR_COMMENTS         0x002  // // and /* */ comments
+#define JSON_REPAIR_TRAILING_COMMAS  0x004  // ,] ,} and doubled commas
+#define JSON_REPAIR_SINGLE_QUOTES    0x008  // 'strings'
+#define JSON_REPAIR_LITERALS         0x010  // True/False/None and bare words
+#define JSON_REPAIR_UNQUOTED_KEYS    0x020  // {tool: ...}
+#define JSON_REPAIR_CONTROL_CHARS    0x040  // Raw newlines and tabs inside strings
+#define JSON_REPAIR_UNESCAPED_QUOTES 0x080  // "said "hi"" inside a string
+#define JSON_REPAIR_TRUNCATED        0x100  // Output cut off; incomplete values dropped and brackets closed
+#define JSON_REPAIR_KINDS 9
+
+// Decision parsing since boot
+struct JsonRepairStats {
+  unsigned long strict;     // Parsed as returned
+  unsigned long repaired;   // Parsed after repair (iterations rescued)
+  unsigned long truncated;  // Repaired responses that had been cut off
+  unsigned long failed;     // Not parseable even after repair
+};
+
+extern JsonRepairStats jsonRepairStats;
+
+// Function declarations
+bool parseDecisionContent(const String& content, JsonDocument& doc, String& json, int& repairs);
+String extractFencedJson(const String& content);
+int findDecisionStart(const String& content);
+bool repairDecisionJson(const String& content, String& out, int& repairs);
+int copyJsonString(const char* s, int n, int i, String& out, int& repairs);
+String formatJsonRepairs(int repairs);
+String formatJsonRepairStats();
+
+#endif // JSON_REPAIR_H
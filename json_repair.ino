@@ -0,0 +1,341 @@
+#include "json_repair.h"
+
+JsonRepairStats jsonRepairStats = {0, 0, 0, 0};
+
+const char* JSON_REPAIR_NAMES[JSON_REPAIR_KINDS] = {
+  "prose", "comments", "trailing commas", "single quotes", "literals",
+  "unquoted keys", "control chars", "unescaped quotes", "truncated"
+};
+
+/**
+ * Parse the planning decision out of the model's message content
+ * Content that parses as is (optionally inside a ```json block) is used
+ * directly; otherwise it goes through repairDecisionJson().
+ * @param content Message content
+ * @param doc Receives the decision object
+ * @param json Receives the JSON that was parsed (repaired if it needed it)
+ * @param repairs Receives the JSON_REPAIR_* defects fixed, 0 if none
+ * @return false if the content has no parseable decision object
+ */
+bool parseDecisionContent(const String& content, JsonDocument& doc, String& json, int& repairs) {
+  repairs = 0;
+  json = extractFencedJson(content);
+  if (!deserializeJson(doc, json) && doc.is<JsonObject>()) {
+    jsonRepairStats.strict++;
+    return true;
+  }
+
+  if (!repairDecisionJson(content, json, repairs) || deserializeJson(doc, json) || !doc.is<JsonObject>()) {
+    jsonRepairStats.failed++;
+    return false;
+  }
+  jsonRepairStats.repaired++;
+  if (repairs & JSON_REPAIR_TRUNCATED) {
+    jsonRepairStats.truncated++;
+  }
+  return true;
+}
+
+/**
+ * Contents of a ```json ... ``` block, or the whole content if there is none
+ */
+String extractFencedJson(const String& content) {
+  int fence = content.indexOf("```json");
+  if (fence == -1) {
+    return content;
+  }
+  int startIndex = fence + 7;
+  int endIndex = content.lastIndexOf("```");
+  return endIndex > startIndex ? content.substring(startIndex, endIndex) : content;
+}
+
+/**
+ * Find the opening brace of the decision object
+ * The brace before the first "tool_calls" or "should_continue" key, so an
+ * example object in the surrounding prose isn't taken for it.
+ * @return Index of '{', or -1 if there is none
+ */
+int findDecisionStart(const String& content) {
+  int key = content.indexOf("tool_calls");
+  int other = content.indexOf("should_continue");
+  if (key < 0 || (other >= 0 && other < key)) {
+    key = other;
+  }
+  if (key >= 0) {
+    int brace = content.lastIndexOf('{', key);
+    if (brace >= 0) {
+      return brace;
+    }
+  }
+  return content.indexOf('{');
+}
+
+/**
+ * Copy a string token as a JSON string
+ * Converts single quotes, escapes raw control characters, and keeps a
+ * double quote that isn't followed by , : } ] as part of the text.
+ * @param s Input
+ * @param n Input length
+ * @param i Index of the opening quote
+ * @param out Output to append to
+ * @param repairs JSON_REPAIR_* flags to add to
+ * @return Index after the closing quote, or -1 if the input ends first
+ */
+int copyJsonString(const char* s, int n, int i, String& out, int& repairs) {
+  char quote = s[i++];
+  if (quote == '\'') {
+    repairs |= JSON_REPAIR_SINGLE_QUOTES;
+  }
+  out += '"';
+  while (i < n) {
+    char c = s[i];
+    if (c == '\\') {
+      if (i + 1 >= n) {
+        return -1;
+      }
+      if (s[i + 1] == '\'') {
+        out += '\'';
+      } else {
+        out += c;
+        out += s[i + 1];
+      }
+      i += 2;
+      continue;
+    }
+    if (c == quote) {
+      int next = i + 1;
+      while (next < n && isspace((unsigned char)s[next])) {
+        next++;
+      }
+      if (next >= n || s[next] == ',' || s[next] == ':' || s[next] == '}' || s[next] == ']') {
+        out += '"';
+        return i + 1;
+      }
+      if (quote == '\'') {
+        out += '\'';
+      } else {
+        out += "\\\"";
+        repairs |= JSON_REPAIR_UNESCAPED_QUOTES;
+      }
+      i++;
+      continue;
+    }
+    if (c == '"') {
+      out += "\\\"";
+    } else if ((unsigned char)c < 0x20) {
+      repairs |= JSON_REPAIR_CONTROL_CHARS;
+      if (c == '\n') {
+        out += "\\n";
+      } else if (c == '\t') {
+        out += "\\t";
+      } else if (c != '\r') {
+        out += ' ';
+      }
+    } else {
+      out += c;
+    }
+    i++;
+  }
+  return -1;
+}
+
+/**
+ * Extract the decision object from arbitrary model output and repair it
+ * One pass over the content from findDecisionStart(): comments and text
+ * after the object are dropped, quotes, literals and commas are normalized
+ * (JSON_REPAIR_* lists the defects). If the output ends inside the object,
+ * it is cut back to the last value that was complete at depth
+ * JSON_REPAIR_SALVAGE_DEPTH or shallower, so only whole tool calls survive,
+ * and the open brackets are closed.
+ * @param content Model output
+ * @param out Receives the repaired JSON
+ * @param repairs Receives the JSON_REPAIR_* defects fixed
+ * @return false if no object (or nothing complete in it) was found
+ */
+bool repairDecisionJson(const String& content, String& out, int& repairs) {
+  repairs = 0;
+  int start = findDecisionStart(content);
+  if (start < 0) {
+    return false;
+  }
+  const char* s = content.c_str();
+  int n = content.length();
+  for (int i = 0; i < start; i++) {
+    if (!isspace((unsigned char)s[i])) {
+      repairs |= JSON_REPAIR_PROSE;
+      break;
+    }
+  }
+
+  char stack[JSON_REPAIR_MAX_DEPTH];
+  bool expectKey[JSON_REPAIR_MAX_DEPTH];
+  int depth = 0;
+  char safeStack[JSON_REPAIR_MAX_DEPTH];
+  int safeDepth = 0;
+  int safeLength = -1;
+  bool closed = false;
+
+  out = "";
+  out.reserve(n - start + 16);
+  int i = start;
+  while (i < n && !closed) {
+    char c = s[i];
+    bool recordSafe = false;
+
+    if (c == '"' || c == '\'') {
+      bool isKey = depth > 0 && stack[depth - 1] == '{' && expectKey[depth - 1];
+      int end = copyJsonString(s, n, i, out, repairs);
+      if (end < 0) {
+        break;
+      }
+      i = end;
+      recordSafe = !isKey;
+    } else if (c == '/' && i + 1 < n && (s[i + 1] == '/' || s[i + 1] == '*')) {
+      repairs |= JSON_REPAIR_COMMENTS;
+      if (s[i + 1] == '/') {
+        while (i < n && s[i] != '\n') {
+          i++;
+        }
+      } else {
+        int end = content.indexOf("*/", i + 2);
+        i = end < 0 ? n : end + 2;
+      }
+    } else if (c == '{' || c == '[') {
+      if (depth == JSON_REPAIR_MAX_DEPTH) {
+        return false;
+      }
+      stack[depth] = c;
+      expectKey[depth] = c == '{';
+      depth++;
+      out += c;
+      i++;
+    } else if (c == '}' || c == ']') {
+      if (depth == 0) {
+        break;
+      }
+      out.trim();
+      if (out.endsWith(",")) {
+        out.remove(out.length() - 1);
+        repairs |= JSON_REPAIR_TRAILING_COMMAS;
+      }
+      depth--;
+      out += stack[depth] == '{' ? '}' : ']';
+      i++;
+      closed = depth == 0;
+      recordSafe = true;
+    } else if (c == ',') {
+      out.trim();
+      char last = out.length() > 0 ? out[out.length() - 1] : '\0';
+      if (last == ',' || last == '[' || last == '{' || last == ':') {
+        repairs |= JSON_REPAIR_TRAILING_COMMAS;
+      } else {
+        if (depth > 0 && depth <= JSON_REPAIR_SALVAGE_DEPTH) {
+          safeLength = out.length();
+          safeDepth = depth;
+          memcpy(safeStack, stack, depth);
+        }
+        out += ',';
+      }
+      if (depth > 0 && stack[depth - 1] == '{') {
+        expectKey[depth - 1] = true;
+      }
+      i++;
+    } else if (c == ':') {
+      out += ':';
+      if (depth > 0 && stack[depth - 1] == '{') {
+        expectKey[depth - 1] = false;
+      }
+      i++;
+    } else if (isalpha((unsigned char)c) || c == '_') {
+      int end = i;
+      while (end < n && (isalnum((unsigned char)s[end]) || s[end] == '_')) {
+        end++;
+      }
+      if (end >= n) {
+        break;
+      }
+      String word = content.substring(i, end);
+      i = end;
+      if (depth > 0 && stack[depth - 1] == '{' && expectKey[depth - 1]) {
+        out += "\"" + word + "\"";
+        repairs |= JSON_REPAIR_UNQUOTED_KEYS;
+      } else if (word == "true" || word == "false" || word == "null") {
+        out += word;
+      } else {
+        repairs |= JSON_REPAIR_LITERALS;
+        if (word == "True" || word == "False") {
+          out += word == "True" ? "true" : "false";
+        } else if (word == "None" || word == "NULL") {
+          out += "null";
+        } else {
+          out += "\"" + word + "\"";
+        }
+      }
+    } else if (c == '-' || isdigit((unsigned char)c)) {
+      int end = i;
+      while (end < n && (isdigit((unsigned char)s[end]) || strchr("+-.eE", s[end]) != nullptr)) {
+        end++;
+      }
+      if (end >= n) {
+        break;
+      }
+      out += content.substring(i, end);
+      i = end;
+    } else if (c == '`') {
+      // Closing code fence while the object is still open: the output was cut off
+      break;
+    } else {
+      if (!isspace((unsigned char)c)) {
+        repairs |= JSON_REPAIR_PROSE;
+      }
+      i++;
+    }
+
+    if (recordSafe && depth > 0 && depth <= JSON_REPAIR_SALVAGE_DEPTH) {
+      safeLength = out.length();
+      safeDepth = depth;
+      memcpy(safeStack, stack, depth);
+    }
+  }
+
+  if (!closed) {
+    if (safeLength < 0) {
+      return false;
+    }
+    out.remove(safeLength);
+    for (int d = safeDepth - 1; d >= 0; d--) {
+      out += safeStack[d] == '{' ? '}' : ']';
+    }
+    repairs |= JSON_REPAIR_TRUNCATED;
+    return true;
+  }
+
+  for (; i < n; i++) {
+    if (!isspace((unsigned char)s[i]) && s[i] != '`') {
+      repairs |= JSON_REPAIR_PROSE;
+      break;
+    }
+  }
+  return true;
+}
+
+/**
+ * Names of the defects in a JSON_REPAIR_* mask, e.g. "trailing commas, truncated"
+ */
+String formatJsonRepairs(int repairs) {
+  String out = "";
+  for (int i = 0; i < JSON_REPAIR_KINDS; i++) {
+    if (repairs & (1 << i)) {
+      out += String(out.length() > 0 ? ", " : "") + JSON_REPAIR_NAMES[i];
+    }
+  }
+  return out.length() > 0 ? out : "none";
+}
+
+/**
+ * One-line summary, e.g. "120 parsed as is, 7 repaired (3 truncated), 1 failed"
+ */
+String formatJsonRepairStats() {
+  return String(jsonRepairStats.strict) + " parsed as is, " + String(jsonRepairStats.repaired) + " repaired (" +
+         String(jsonRepairStats.truncated) + " truncated), " + String(jsonRepairStats.failed) + " failed";
+}
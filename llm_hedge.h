@@ -0,0 +1,54 @@
+#ifndef LLM_HEDGE_H
+#define LLM_HEDGE_H
+
+#include <Arduino.h>
+
+#define LLM_HEDGE_SLOTS 2               // Primary + hedge
+#define LLM_HEDGE_TASK_STACK 8192       // HTTPClient + TLS handshake
+#define LLM_HEDGE_TASK_PRIORITY 1       // Below the WiFi/lwIP tasks
+#define LLM_HEDGE_POLL_MS 10            // Delay between checks while waiting for a response
+#define LLM_HEDGE_MIN_SAMPLES 5         // Latencies needed before the threshold is trusted
+#define LLM_HEDGE_MIN_DELAY_MS 300      // Never hedge earlier than this
+
+// One request running on a hedge task
+struct HedgeSlot {
+  TaskHandle_t task;
+  bool busy;                    // Request handed to the task and not reclaimed yet
+  bool done;                    // Task has finished the request
+  bool abandoned;               // Caller took the other response; reclaimed by the next request
+  bool hedge;                   // Sent as the duplicate, not the first request
+  int provider;
+  String body;
+  String promptVersion;
+  int httpCode;
+  String response;
+  unsigned long startedAt;
+  unsigned long finishedAt;
+  unsigned long winnerLatencyMs; // Abandoned slots: when the winning response arrived, from startedAt
+};
+
+// Hedging since boot
+struct HedgeStats {
+  unsigned long requests;       // Requests sent through the hedge tasks
+  unsigned long hedges;         // Duplicates sent
+  unsigned long hedgeWins;      // Duplicate answered first
+  unsigned long rescues;        // Duplicate answered a request whose first attempt failed
+  unsigned long overBudget;     // Hedges skipped because of LLM_HEDGE_BUDGET_PERCENT
+  unsigned long savedMs;        // Sum over measured wins of (first attempt's latency - winner's latency)
+  unsigned long savedSamples;   // Wins whose abandoned first attempt has finished and been measured
+};
+
+extern HedgeStats hedgeStats;
+
+// Function declarations
+bool startHedgeTasks();
+bool hedgeSlotsIdle();
+void releaseHedgeSlot(HedgeSlot& slot);
+void startHedgeSlot(HedgeSlot& slot, int provider, const String& body, bool hedge);
+void reclaimHedgeSlots();
+unsigned long hedgeDelayMs(int provider);
+int hedgeTargetProvider(int primary);
+String makeHedgedRequest(const String& body);
+String formatHedgeStats();
+
+#endif // LLM_HEDGE_H
@@ -0,0 +1,280 @@
+#include "llm_hedge.h"
+#include "llm_provider.h"
+#include "openai_processor.h"
+#include "prompts_manager.h"
+#include "heap_profiler.h"
+#include "trace.h"
+
+// Slot 0 carries the first request, slot 1 the duplicate. Bodies and
+// responses keep their capacity between requests, like openAIRequestBody.
+HedgeSlot hedgeSlots[LLM_HEDGE_SLOTS];
+SemaphoreHandle_t hedgeMutex = nullptr;
+bool hedgeTasksFailed = false;
+HedgeStats hedgeStats = {0, 0, 0, 0, 0, 0, 0};
+
+/**
+ * Hedge task body
+ * Waits for a request, sends it and stores the response. Doesn't log:
+ * logging isn't safe off the main task.
+ */
+void hedgeTaskLoop(void* arg) {
+  HedgeSlot& slot = *(HedgeSlot*)arg;
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    HTTPClient http;
+    beginLlmProviderRequest(http, slot.provider);
+    http.addHeader("X-Prompt-Version", slot.promptVersion);
+    int code = http.POST(slot.body);
+    String response = code > 0 ? http.getString() : "";
+    http.end();
+
+    xSemaphoreTake(hedgeMutex, portMAX_DELAY);
+    slot.httpCode = code;
+    slot.response = response;
+    slot.finishedAt = millis();
+    slot.done = true;
+    xSemaphoreGive(hedgeMutex);
+  }
+}
+
+/**
+ * Start the hedge tasks on first use
+ * @return false if they couldn't be created (requests are then sent directly)
+ */
+bool startHedgeTasks() {
+  if (hedgeMutex != nullptr) {
+    return true;
+  }
+  if (hedgeTasksFailed) {
+    return false;
+  }
+
+  hedgeMutex = xSemaphoreCreateMutex();
+  for (int i = 0; i < LLM_HEDGE_SLOTS; i++) {
+    HedgeSlot& slot = hedgeSlots[i];
+    slot.busy = false;
+    slot.done = false;
+    slot.abandoned = false;
+    if (xTaskCreatePinnedToCore(hedgeTaskLoop, "llm_hedge", LLM_HEDGE_TASK_STACK, &slot,
+                                LLM_HEDGE_TASK_PRIORITY, &slot.task, tskNO_AFFINITY) != pdPASS) {
+      logToRobotLogs("Hedged requests: task creation failed, sending requests directly");
+      hedgeTasksFailed = true;
+      return false;
+    }
+  }
+  logToRobotLogs("Hedged requests: " + String(LLM_HEDGE_SLOTS) + " request tasks started");
+  return true;
+}
+
+/**
+ * Free a slot whose response has been used or accounted for
+ */
+void releaseHedgeSlot(HedgeSlot& slot) {
+  slot.body = "";
+  slot.response = "";
+  slot.busy = false;
+  slot.done = false;
+  slot.abandoned = false;
+}
+
+/**
+ * Account for abandoned requests that have finished since
+ * Their outcome still feeds the provider's latency stats and breaker; an
+ * abandoned first attempt also measures how much the duplicate saved.
+ */
+void reclaimHedgeSlots() {
+  for (int i = 0; i < LLM_HEDGE_SLOTS; i++) {
+    HedgeSlot& slot = hedgeSlots[i];
+    xSemaphoreTake(hedgeMutex, portMAX_DELAY);
+    bool finished = slot.busy && slot.abandoned && slot.done;
+    xSemaphoreGive(hedgeMutex);
+    if (!finished) {
+      continue;
+    }
+
+    unsigned long latency = slot.finishedAt - slot.startedAt;
+    recordLlmProviderOutcome(slot.provider, slot.httpCode, latency);
+    if (!slot.hedge && latency > slot.winnerLatencyMs) {
+      hedgeStats.savedMs += latency - slot.winnerLatencyMs;
+      hedgeStats.savedSamples++;
+    }
+    releaseHedgeSlot(slot);
+  }
+}
+
+/**
+ * Whether the next request can go through the hedge tasks
+ * False while an abandoned request is still running: a third connection
+ * would need another TLS session's worth of heap.
+ */
+bool hedgeSlotsIdle() {
+  if (!startHedgeTasks()) {
+    return false;
+  }
+  reclaimHedgeSlots();
+  for (int i = 0; i < LLM_HEDGE_SLOTS; i++) {
+    if (hedgeSlots[i].busy) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * How long to wait for the first response before sending a duplicate
+ * The provider's LLM_HEDGE_PERCENTILE latency, at least LLM_HEDGE_MIN_DELAY_MS.
+ * @return ms, or 0 for no duplicate (too few latencies measured yet)
+ */
+unsigned long hedgeDelayMs(int provider) {
+  if (llmProviderStats[provider].latencyCount < LLM_HEDGE_MIN_SAMPLES) {
+    return 0;
+  }
+  return max(llmProviderLatencyPercentile(provider, LLM_HEDGE_PERCENTILE), (unsigned long)LLM_HEDGE_MIN_DELAY_MS);
+}
+
+/**
+ * Provider for the duplicate: the first other provider whose breaker is
+ * closed, otherwise the same one again
+ * @return Provider index, or -1 for no duplicate (the first request is a half-open probe)
+ */
+int hedgeTargetProvider(int primary) {
+  for (int i = 0; i < llmProviderCount(); i++) {
+    if (i != primary && llmProviderStats[i].breaker == LLM_BREAKER_CLOSED) {
+      return i;
+    }
+  }
+  return llmProviderStats[primary].breaker == LLM_BREAKER_CLOSED ? primary : -1;
+}
+
+/**
+ * Hand a request to a slot's task
+ */
+void startHedgeSlot(HedgeSlot& slot, int provider, const String& body, bool hedge) {
+  slot.provider = provider;
+  slot.body = body;
+  slot.promptVersion = String(promptsManager.getActivePromptVersion());
+  slot.hedge = hedge;
+  slot.httpCode = 0;
+  slot.response = "";
+  slot.done = false;
+  slot.abandoned = false;
+  slot.busy = true;
+  slot.startedAt = millis();
+  xTaskNotifyGive(slot.task);
+}
+
+/**
+ * POST a chat completions body to the current provider, with a duplicate if it's slow
+ * If no response has arrived after hedgeDelayMs(), the same request goes to
+ * hedgeTargetProvider() too, within LLM_HEDGE_BUDGET_PERCENT of requests. The
+ * first successful response is used; the other request is abandoned and
+ * accounted for by the next request (HTTPClient can't be cancelled from
+ * another task). Call only when hedgeSlotsIdle().
+ * @param body Serialized request JSON
+ * @return Raw response, or {"error": ...} on failure
+ */
+String makeHedgedRequest(const String& body) {
+  ScopedTrace span("llm_request");
+
+  String error;
+  if (!checkOpenAIRequest(error)) {
+    return error;
+  }
+
+  heapProfileAlloc("openai_payload", body.length());
+  logToRobotLogs("Sending OpenAI request (hedged)...");
+  logToRobotLogs("Payload: " + body);
+
+  int primary = activeLlmProvider;
+  unsigned long delayMs = hedgeDelayMs(primary);
+  HedgeSlot& first = hedgeSlots[0];
+  HedgeSlot& second = hedgeSlots[1];
+  bool hedged = false;
+  hedgeStats.requests++;
+  startHedgeSlot(first, primary, body, false);
+
+  traceBegin("llm_http_wait");
+  HedgeSlot* winner = nullptr;
+  while (winner == nullptr) {
+    delay(LLM_HEDGE_POLL_MS);
+
+    xSemaphoreTake(hedgeMutex, portMAX_DELAY);
+    bool firstDone = first.done;
+    bool secondDone = hedged && second.done;
+    xSemaphoreGive(hedgeMutex);
+    bool firstOk = firstDone && first.httpCode >= 200 && first.httpCode < 300;
+    bool secondOk = secondDone && second.httpCode >= 200 && second.httpCode < 300;
+
+    if (firstOk) {
+      winner = &first;
+    } else if (secondOk) {
+      winner = &second;
+    } else if (firstDone && (!hedged || secondDone)) {
+      winner = &first;
+    } else if (!hedged && !firstDone && delayMs > 0 && millis() - first.startedAt >= delayMs) {
+      int target = hedgeTargetProvider(primary);
+      if ((hedgeStats.hedges + 1) * 100 > (unsigned long)LLM_HEDGE_BUDGET_PERCENT * hedgeStats.requests) {
+        hedgeStats.overBudget++;
+      } else if (target >= 0) {
+        startHedgeSlot(second, target, target == primary ? body : retargetLlmRequest(body, target), true);
+        llmProviderStats[target].lastRequest = second.startedAt;
+        hedged = true;
+        hedgeStats.hedges++;
+        logToRobotLogs("No response after " + String(delayMs) + " ms: hedging to " + String(LLM_PROVIDERS[target].name));
+      }
+      delayMs = 0;
+    }
+  }
+  traceEnd();
+
+  recordLlmProviderOutcome(winner->provider, winner->httpCode, winner->finishedAt - winner->startedAt);
+  if (winner->hedge) {
+    hedgeStats.hedgeWins++;
+    if (first.done) {
+      hedgeStats.rescues++;
+    }
+  }
+
+  // The other request: account for it now if it's finished, otherwise let it run out
+  if (hedged) {
+    HedgeSlot& loser = winner == &first ? second : first;
+    xSemaphoreTake(hedgeMutex, portMAX_DELAY);
+    bool loserDone = loser.done;
+    if (!loserDone) {
+      loser.abandoned = true;
+      loser.winnerLatencyMs = winner->finishedAt - loser.startedAt;
+    }
+    xSemaphoreGive(hedgeMutex);
+    if (loserDone) {
+      recordLlmProviderOutcome(loser.provider, loser.httpCode, loser.finishedAt - loser.startedAt);
+      releaseHedgeSlot(loser);
+    }
+  }
+
+  int httpResponseCode = winner->httpCode;
+  String response = winner->response;
+  logToRobotLogs("HTTP Response Code: " + String(httpResponseCode) + " from " + String(LLM_PROVIDERS[winner->provider].name) +
+                 (winner->hedge ? " (hedge)" : ""));
+  releaseHedgeSlot(*winner);
+
+  if (httpResponseCode > 0) {
+    heapProfileAlloc("http_response", response.length());
+    logToRobotLogs("OpenAI Response: " + response);
+    return response;
+  }
+  String errorMsg = httpErrorMessage(httpResponseCode);
+  logToRobotLogs("OpenAI request failed: " + errorMsg);
+  return "{\"error\": \"" + errorMsg + "\"}";
+}
+
+/**
+ * One-line summary, e.g. "40 requests, 4 hedged (10%), 3 won, 1 rescued, 2 over budget, saved 5200 ms over 3 wins"
+ */
+String formatHedgeStats() {
+  unsigned long percent = hedgeStats.requests > 0 ? hedgeStats.hedges * 100 / hedgeStats.requests : 0;
+  return String(hedgeStats.requests) + " requests, " + String(hedgeStats.hedges) + " hedged (" + String(percent) + "%), " +
+         String(hedgeStats.hedgeWins) + " won, " + String(hedgeStats.rescues) + " rescued, " +
+         String(hedgeStats.overBudget) + " over budget, saved " + String(hedgeStats.savedMs) + " ms over " +
+         String(hedgeStats.savedSamples) + " wins";
+}
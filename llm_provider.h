@@ -0,0 +1,85 @@
+#ifndef LLM_PROVIDER_H
+#define LLM_PROVIDER_H
+
+#include <Arduino.h>
+#include <HTTPClient.h>
+
+#define LLM_MAX_PROVIDERS 4              // Entries of LLM_PROVIDERS used
+#define LLM_LATENCY_SAMPLES 16           // Latencies kept per provider for percentiles
+#define LLM_BREAKER_FAILURES 2           // Failed requests in a row that open a provider's breaker
+#define LLM_BREAKER_SLOW_RESPONSES 3     // Responses over LLM_LATENCY_SLO_MS in a row that open it
+#define LLM_BREAKER_MAX_COOLDOWN_MS 300000 // Cooldown doubles after each failed probe, up to this
+
+// How a provider expects the API key
+enum LlmAuthScheme {
+  LLM_AUTH_NONE,     // No key (LAN servers, llm_stub_server.py)
+  LLM_AUTH_BEARER,   // Authorization: Bearer <key> (OpenAI, vLLM, llama.cpp --api-key)
+  LLM_AUTH_API_KEY   // api-key: <key> (Azure OpenAI)
+};
+
+// Circuit breaker state of a provider
+enum LlmBreakerState {
+  LLM_BREAKER_CLOSED,    // Requests go through
+  LLM_BREAKER_OPEN,      // Requests fail fast until the cooldown has passed
+  LLM_BREAKER_HALF_OPEN  // One probe request (short timeout) decides: closed or open again
+};
+
+// One OpenAI-compatible chat completions endpoint (LLM_PROVIDERS in config.h)
+struct LlmProviderConfig {
+  const char* name;           // Short name for logs and stats
+  const char* url;            // Full chat completions URL
+  LlmAuthScheme auth;
+  const char* apiKey;
+  const char* model;
+  const char* visionModel;    // Model for capture_image; "" uses model
+  int connectTimeoutMs;
+  int timeoutMs;              // Read timeout, covers the whole generation
+  float temperature;
+  int maxTokensCap;           // Upper bound on max_tokens (0 = none), for small local models
+  bool jsonMode;              // Send response_format json_object
+  const char* extraParams;    // Raw JSON members added to every request, e.g. "\"cache_prompt\":true"
+};
+
+// Health and latency of one provider since boot
+struct LlmProviderStats {
+  unsigned long requests;
+  unsigned long failures;
+  int consecutiveFailures;
+  int slowResponses;          // Successful responses over LLM_LATENCY_SLO_MS in a row
+  int lastStatus;             // HTTP code of the last request (negative: transport error)
+  unsigned long lastRequest;  // For the per-provider rate limit
+  unsigned long lastFailure;
+  LlmBreakerState breaker;
+  unsigned long openedAt;
+  unsigned long cooldownMs;   // Current open period, 0 until the breaker first opens
+  unsigned long trips;        // Times the breaker opened
+  unsigned long probes;       // Half-open probe requests
+  float meanLatencyMs;        // Running average of successful requests
+  unsigned long latencies[LLM_LATENCY_SAMPLES]; // Newest successful requests, ring buffer
+  int latencyCount;
+  int latencyNext;
+};
+
+extern LlmProviderStats llmProviderStats[LLM_MAX_PROVIDERS];
+extern int activeLlmProvider;
+extern unsigned long llmFastFails;
+
+// Function declarations
+int llmProviderCount();
+const LlmProviderConfig& currentLlmProvider();
+bool llmProviderAllowsRequest(int index);
+bool llmBreakerOpen();
+unsigned long llmBreakerRetryInMs();
+void openLlmBreaker(int index, unsigned long cooldownMs);
+int selectLlmProvider(uint32_t excludeMask = 0);
+int chooseLlmProvider(uint32_t excludeMask = 0);
+void appendLlmRequestOptions(String& body, int maxTokens, bool vision = false);
+void appendLlmRequestOptionsFor(String& body, int index, int maxTokens, bool vision = false);
+String retargetLlmRequest(const String& body, int index);
+void beginLlmProviderRequest(HTTPClient& http, int index, int timeoutMs = 0);
+void recordLlmProviderOutcome(int index, int httpCode, unsigned long latencyMs);
+unsigned long llmProviderLatencyPercentile(int index, int percentile);
+String formatLlmProviderStats();
+const char* llmBreakerStateName(LlmBreakerState state);
+
+#endif // LLM_PROVIDER_H
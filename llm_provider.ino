@@ -0,0 +1,345 @@
+#include "llm_provider.h"
+#include "token_budget.h"
+
+LlmProviderStats llmProviderStats[LLM_MAX_PROVIDERS];
+
+// Provider the next request goes to, set by chooseLlmProvider()
+int activeLlmProvider = 0;
+
+// Requests refused because every provider's breaker was open
+unsigned long llmFastFails = 0;
+
+/**
+ * Number of configured providers (LLM_PROVIDERS beyond LLM_MAX_PROVIDERS are ignored)
+ */
+int llmProviderCount() {
+  return min(NUM_LLM_PROVIDERS, LLM_MAX_PROVIDERS);
+}
+
+/**
+ * Provider chosen for the request being built or sent
+ */
+const LlmProviderConfig& currentLlmProvider() {
+  return LLM_PROVIDERS[activeLlmProvider];
+}
+
+/**
+ * Whether a provider may take the next request
+ * Closed and half-open breakers allow it; an open one does once its cooldown
+ * has passed (the request becomes the half-open probe).
+ */
+bool llmProviderAllowsRequest(int index) {
+  const LlmProviderStats& stats = llmProviderStats[index];
+  return stats.breaker != LLM_BREAKER_OPEN || millis() - stats.openedAt >= stats.cooldownMs;
+}
+
+/**
+ * Whether every provider's breaker is open and still cooling down
+ * Requests then fail without touching the network.
+ */
+bool llmBreakerOpen() {
+  for (int i = 0; i < llmProviderCount(); i++) {
+    if (llmProviderAllowsRequest(i)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Time until the first open breaker lets a probe through
+ * @return ms, 0 if a provider allows requests now
+ */
+unsigned long llmBreakerRetryInMs() {
+  unsigned long soonest = 0;
+  for (int i = 0; i < llmProviderCount(); i++) {
+    const LlmProviderStats& stats = llmProviderStats[i];
+    if (llmProviderAllowsRequest(i)) {
+      return 0;
+    }
+    unsigned long remaining = stats.cooldownMs - (millis() - stats.openedAt);
+    if (soonest == 0 || remaining < soonest) {
+      soonest = remaining;
+    }
+  }
+  return soonest;
+}
+
+/**
+ * Open a provider's breaker
+ * @param cooldownMs How long requests to it fail fast
+ */
+void openLlmBreaker(int index, unsigned long cooldownMs) {
+  LlmProviderStats& stats = llmProviderStats[index];
+  stats.breaker = LLM_BREAKER_OPEN;
+  stats.openedAt = millis();
+  stats.cooldownMs = min(cooldownMs, (unsigned long)LLM_BREAKER_MAX_COOLDOWN_MS);
+  stats.trips++;
+  stats.consecutiveFailures = 0;
+  stats.slowResponses = 0;
+}
+
+/**
+ * Pick the provider for the next request
+ * Providers whose breaker allows a request are taken in LLM_PROVIDERS order,
+ * or by lowest mean latency with LLM_PROVIDER_PREFER_FASTEST (providers
+ * without a measurement first, so each gets one).
+ * @param excludeMask Bit i set: skip provider i (already tried for this request)
+ * @return Provider index, or -1 if none is left
+ */
+int selectLlmProvider(uint32_t excludeMask) {
+  int best = -1;
+  float bestLatency = 0;
+  for (int i = 0; i < llmProviderCount(); i++) {
+    if ((excludeMask & (1UL << i)) || !llmProviderAllowsRequest(i)) {
+      continue;
+    }
+    if (!LLM_PROVIDER_PREFER_FASTEST) {
+      return i;
+    }
+    float latency = llmProviderStats[i].latencyCount > 0 ? llmProviderStats[i].meanLatencyMs : 0;
+    if (best < 0 || latency < bestLatency) {
+      best = i;
+      bestLatency = latency;
+    }
+  }
+  return best;
+}
+
+/**
+ * Select the provider for the next request and make it current
+ * Call before building the request body; the body depends on the provider.
+ * An open breaker whose cooldown has passed goes half-open here.
+ * @return Provider index, or -1 if none is left (current provider unchanged;
+ *         beginOpenAIRequest() refuses it if its breaker is open)
+ */
+int chooseLlmProvider(uint32_t excludeMask) {
+  int index = selectLlmProvider(excludeMask);
+  if (index < 0) {
+    if (excludeMask == 0) {
+      llmFastFails++;
+    }
+    return -1;
+  }
+
+  activeLlmProvider = index;
+  LlmProviderStats& stats = llmProviderStats[index];
+  if (stats.breaker == LLM_BREAKER_OPEN) {
+    stats.breaker = LLM_BREAKER_HALF_OPEN;
+    stats.probes++;
+    logToRobotLogs("LLM provider " + String(LLM_PROVIDERS[index].name) + " half-open: sending a probe");
+  }
+  return index;
+}
+
+/**
+ * Append the provider's request options, up to and including "messages":[
+ * e.g. {"model":"gpt-4o-mini","max_tokens":300,"temperature":0.1,"messages":[
+ * @param body Buffer to append to (empty)
+ * @param maxTokens Completion token limit, lowered to the provider's cap
+ * @param vision Request carries an image; uses the vision model and no JSON mode
+ */
+void appendLlmRequestOptions(String& body, int maxTokens, bool vision) {
+  appendLlmRequestOptionsFor(body, activeLlmProvider, maxTokens, vision);
+}
+
+/**
+ * appendLlmRequestOptions() for a given provider
+ */
+void appendLlmRequestOptionsFor(String& body, int index, int maxTokens, bool vision) {
+  const LlmProviderConfig& provider = LLM_PROVIDERS[index];
+  if (provider.maxTokensCap > 0 && maxTokens > provider.maxTokensCap) {
+    maxTokens = provider.maxTokensCap;
+  }
+
+  body += "{\"model\":\"";
+  body += vision && provider.visionModel[0] != '\0' ? provider.visionModel : provider.model;
+  body += "\",\"max_tokens\":";
+  body += maxTokens;
+  body += ",\"temperature\":";
+  body += String(provider.temperature, 2);
+  if (provider.jsonMode && !vision) {
+    body += ",\"response_format\":{\"type\":\"json_object\"}";
+  }
+  if (provider.extraParams[0] != '\0') {
+    body += ',';
+    body += provider.extraParams;
+  }
+  body += ",\"messages\":[";
+}
+
+/**
+ * Rewrite a request body built for one provider for another
+ * Replaces everything before "messages":[ with the other provider's options,
+ * keeping max_tokens.
+ * @param body Body built with appendLlmRequestOptions()
+ * @param index Provider to send it to
+ * @return New body (body itself if it has no recognizable options)
+ */
+String retargetLlmRequest(const String& body, int index) {
+  int messages = body.indexOf("\"messages\":[");
+  int maxTokensAt = body.indexOf("\"max_tokens\":");
+  if (messages < 0 || maxTokensAt < 0 || maxTokensAt > messages) {
+    return body;
+  }
+
+  String out;
+  out.reserve(body.length() + 64);
+  appendLlmRequestOptionsFor(out, index, body.substring(maxTokensAt + 13, messages).toInt());
+  out += body.c_str() + messages + 12;
+  return out;
+}
+
+/**
+ * Open a request to a provider: URL, timeouts and auth header
+ * Half-open probes use LLM_BREAKER_PROBE_TIMEOUT_MS, so a dead provider
+ * doesn't hold up planning for its full timeout again. Doesn't log, so it can
+ * run on the hedge tasks.
+ * @param http Client to set up
+ * @param index Provider to send to
+ * @param timeoutMs Shorter timeout for this request, 0 for the provider's
+ */
+void beginLlmProviderRequest(HTTPClient& http, int index, int timeoutMs) {
+  const LlmProviderConfig& provider = LLM_PROVIDERS[index];
+  timeoutMs = timeoutMs > 0 ? min(timeoutMs, provider.timeoutMs) : provider.timeoutMs;
+  if (llmProviderStats[index].breaker == LLM_BREAKER_HALF_OPEN) {
+    timeoutMs = min(timeoutMs, (int)LLM_BREAKER_PROBE_TIMEOUT_MS);
+  }
+  http.setConnectTimeout(min(provider.connectTimeoutMs, timeoutMs));
+  http.setTimeout(timeoutMs);
+  http.begin(provider.url);
+  http.addHeader("Content-Type", "application/json");
+  switch (provider.auth) {
+    case LLM_AUTH_BEARER:
+      http.addHeader("Authorization", "Bearer " + String(provider.apiKey));
+      break;
+    case LLM_AUTH_API_KEY:
+      http.addHeader("api-key", provider.apiKey);
+      break;
+    case LLM_AUTH_NONE:
+      break;
+  }
+}
+
+/**
+ * Record the outcome of a request for selection, stats and the breaker
+ * The breaker opens after LLM_BREAKER_FAILURES failures or
+ * LLM_BREAKER_SLOW_RESPONSES responses over LLM_LATENCY_SLO_MS in a row.
+ * A half-open probe closes it if it's fast and successful; otherwise it opens
+ * again with twice the cooldown.
+ * @param index Provider the request went to
+ * @param httpCode Response code; anything but 2xx counts as a failure
+ * @param latencyMs Request start to response read
+ */
+void recordLlmProviderOutcome(int index, int httpCode, unsigned long latencyMs) {
+  LlmProviderStats& stats = llmProviderStats[index];
+  bool probe = stats.breaker == LLM_BREAKER_HALF_OPEN;
+  bool ok = httpCode >= 200 && httpCode < 300;
+  bool slow = latencyMs > LLM_LATENCY_SLO_MS;
+  stats.requests++;
+  stats.lastStatus = httpCode;
+
+  if (!ok) {
+    stats.failures++;
+    stats.consecutiveFailures++;
+    stats.lastFailure = millis();
+  } else {
+    stats.consecutiveFailures = 0;
+    stats.slowResponses = slow ? stats.slowResponses + 1 : 0;
+    stats.meanLatencyMs = stats.latencyCount == 0 ? latencyMs :
+                          TOKEN_EMA_WEIGHT * latencyMs + (1 - TOKEN_EMA_WEIGHT) * stats.meanLatencyMs;
+    stats.latencies[stats.latencyNext] = latencyMs;
+    stats.latencyNext = (stats.latencyNext + 1) % LLM_LATENCY_SAMPLES;
+    if (stats.latencyCount < LLM_LATENCY_SAMPLES) {
+      stats.latencyCount++;
+    }
+  }
+
+  String name = LLM_PROVIDERS[index].name;
+  if (probe) {
+    if (ok && !slow) {
+      stats.breaker = LLM_BREAKER_CLOSED;
+      stats.cooldownMs = 0;
+      logToRobotLogs("LLM provider " + name + " probe succeeded in " + String(latencyMs) + " ms: breaker closed");
+    } else {
+      openLlmBreaker(index, stats.cooldownMs * 2);
+      logToRobotLogs("LLM provider " + name + " probe failed (" + String(httpCode) + ", " + String(latencyMs) +
+                     " ms): breaker open for " + String(stats.cooldownMs / 1000) + " s");
+    }
+  } else if (stats.consecutiveFailures >= LLM_BREAKER_FAILURES || stats.slowResponses >= LLM_BREAKER_SLOW_RESPONSES) {
+    String reason = ok ? String(stats.slowResponses) + " responses over " + String(LLM_LATENCY_SLO_MS) + " ms" :
+                         String(stats.consecutiveFailures) + " failures";
+    openLlmBreaker(index, LLM_BREAKER_COOLDOWN_MS);
+    logToRobotLogs("LLM provider " + name + " breaker open for " + String(stats.cooldownMs / 1000) + " s after " + reason);
+  }
+}
+
+/**
+ * Latency percentile over the provider's last LLM_LATENCY_SAMPLES successful requests
+ * @param percentile 0-100
+ * @return Latency in ms, 0 if nothing was measured yet
+ */
+unsigned long llmProviderLatencyPercentile(int index, int percentile) {
+  const LlmProviderStats& stats = llmProviderStats[index];
+  if (stats.latencyCount == 0) {
+    return 0;
+  }
+
+  unsigned long sorted[LLM_LATENCY_SAMPLES];
+  for (int i = 0; i < stats.latencyCount; i++) {
+    sorted[i] = stats.latencies[i];
+  }
+  for (int i = 1; i < stats.latencyCount; i++) {
+    unsigned long value = sorted[i];
+    int j = i - 1;
+    while (j >= 0 && sorted[j] > value) {
+      sorted[j + 1] = sorted[j];
+      j--;
+    }
+    sorted[j + 1] = value;
+  }
+  int rank = (percentile * stats.latencyCount + 99) / 100;
+  return sorted[constrain(rank, 1, stats.latencyCount) - 1];
+}
+
+/**
+ * One entry per provider that was used, e.g.
+ * "openai 12 requests, 1 failures, mean 1430 ms, p90 2100 ms; lan 3 requests, 0 failures, mean 610 ms, p90 700 ms"
+ */
+String formatLlmProviderStats() {
+  String out = "";
+  for (int i = 0; i < llmProviderCount(); i++) {
+    const LlmProviderStats& stats = llmProviderStats[i];
+    if (stats.requests == 0) {
+      continue;
+    }
+    if (out.length() > 0) {
+      out += "; ";
+    }
+    out += String(LLM_PROVIDERS[i].name) + " " + String(stats.requests) + " requests, " +
+           String(stats.failures) + " failures, mean " + String((unsigned long)stats.meanLatencyMs) +
+           " ms, p90 " + String(llmProviderLatencyPercentile(i, 90)) + " ms";
+    if (stats.trips > 0) {
+      out += ", breaker " + String(llmBreakerStateName(stats.breaker)) + " (" + String(stats.trips) + " trips, " +
+             String(stats.probes) + " probes, last status " + String(stats.lastStatus) + ")";
+    }
+  }
+  if (llmFastFails > 0) {
+    out += String(out.length() > 0 ? "; " : "") + String(llmFastFails) + " requests failed fast";
+  }
+  return out.length() > 0 ? out : "no requests";
+}
+
+/**
+ * "closed", "open" or "half-open"
+ */
+const char* llmBreakerStateName(LlmBreakerState state) {
+  switch (state) {
+    case LLM_BREAKER_OPEN:
+      return "open";
+    case LLM_BREAKER_HALF_OPEN:
+      return "half-open";
+    default:
+      return "closed";
+  }
+}
@@ -0,0 +1,69 @@
+#ifndef LOCAL_PLANNER_H
+#define LOCAL_PLANNER_H
+
+#include <Arduino.h>
+#include "openai_processor.h"
+
+#define LOCAL_PLAN_MAX_STEPS 12
+#define LOCAL_PLANNER_MAX_ITERATIONS 40  // Conditional steps take one iteration per sonar check
+#define LOCAL_PLANNER_MAX_TIME_MS 120000
+#define LOCAL_MOVE_CHUNK_MS 600          // Longest forward move between obstacle checks
+#define LOCAL_MOVE_MIN_MS 100            // Shortest corrective move when approaching
+#define LOCAL_APPROACH_MAX_MOVES 15      // Give up an approach after this many moves
+#define LOCAL_SCAN_DIRECTIONS 4          // Scan in 90 degree steps
+#define LOCAL_DEFAULT_MOVE_MS 1000       // "forward" with no amount
+#define LOCAL_DEFAULT_APPROACH_CM 20     // "approach the wall" with no distance
+#define LOCAL_OUT_OF_RANGE_CM 400        // Distance assumed when sonar gets no echo
+
+enum LocalStepType {
+  STEP_MOVE,       // direction forward/backward, value in ms
+  STEP_TURN,       // direction left/right, value in degrees
+  STEP_APPROACH,   // Forward until within value cm
+  STEP_BACK_OFF,   // Backward until at least value cm away
+  STEP_SCAN,       // Sonar sweep in 90 degree steps; faceOpen turns to the most open direction
+  STEP_MEASURE,
+  STEP_STOP
+};
+
+struct LocalStep {
+  LocalStepType type;
+  String direction;
+  int value;
+  bool faceOpen;
+};
+
+// An objective compiled to steps, plus execution progress across iterations
+struct LocalPlan {
+  LocalStep steps[LOCAL_PLAN_MAX_STEPS];
+  int count;
+  int current;            // Step being executed
+  int phase;              // 0 = step not started; otherwise step-specific progress
+  int remainingMs;        // Forward move still to do (checked moves)
+  int moves;              // Moves made by the current approach/back-off
+  int stopDistanceCm;     // Forward moves halt when an obstacle is this close (0 = never)
+  int scanDistances[LOCAL_SCAN_DIRECTIONS];
+  bool failed;            // Stopped before finishing (obstacle, approach gave up)
+  String ignored;         // Clauses the grammar didn't understand
+  String log;             // One line per finished step, for the planning summary
+  bool active;            // Currently driving a planning session
+};
+
+extern LocalPlan localPlan;
+
+// Function declarations
+bool parseLocalPlan(const String& objective, LocalPlan& plan);
+bool beginLocalPlanning(const String& objective, const String& reason);
+bool parseLocalStep(const String& clause, LocalPlan& plan);
+bool findQuantity(const String& clause, float& value, String& unit);
+PlanningDecision nextLocalDecision(LocalPlan& plan, const String& latestResults);
+void addLocalToolCall(PlanningDecision& decision, const char* tool, const String& params);
+void finishLocalStep(LocalPlan& plan, const String& note);
+int parseDistanceResult(const String& results);
+int moveCarDuration(int ms);
+int turnDurationMs(int degrees);
+int moveDurationMs(float cm);
+String formatLocalStep(const LocalStep& step);
+bool connectivityPoor();
+String activePlannerName();
+
+#endif // LOCAL_PLANNER_H
@@ -0,0 +1,574 @@
+#include "local_planner.h"
+#include "robot_tools.h"
+#include "odometry.h"
+#include "planner_gateway.h"
+#include "llm_provider.h"
+#include "skill_library.h"
+
+LocalPlan localPlan;
+
+const char* SCAN_DIRECTION_NAMES[LOCAL_SCAN_DIRECTIONS] = {"front", "left", "back", "right"};
+
+/**
+ * Find the first number in a clause and the unit written after it
+ * Units are normalized to "ms", "s", "cm", "m" or "deg"; unit is "" when the
+ * number has none (or one that isn't recognized).
+ * @return false if the clause has no number
+ */
+bool findQuantity(const String& clause, float& value, String& unit) {
+  int start = -1;
+  for (int i = 0; i < clause.length(); i++) {
+    if (isDigit(clause.charAt(i))) {
+      start = i;
+      break;
+    }
+  }
+  if (start == -1) {
+    return false;
+  }
+
+  int end = start;
+  while (end < clause.length() && (isDigit(clause.charAt(end)) || clause.charAt(end) == '.')) {
+    end++;
+  }
+  value = clause.substring(start, end).toFloat();
+
+  while (end < clause.length() && clause.charAt(end) == ' ') {
+    end++;
+  }
+  int unitEnd = end;
+  while (unitEnd < clause.length() && isAlpha(clause.charAt(unitEnd))) {
+    unitEnd++;
+  }
+  String word = clause.substring(end, unitEnd);
+
+  if (word == "ms" || word.startsWith("milli") || word == "msec") {
+    unit = "ms";
+  } else if (word == "s" || word.startsWith("sec")) {
+    unit = "s";
+  } else if (word == "cm" || word.startsWith("centimet")) {
+    unit = "cm";
+  } else if (word == "m" || word.startsWith("meter") || word.startsWith("metre")) {
+    unit = "m";
+  } else if (word.startsWith("deg") || clause.indexOf("°") != -1) {
+    unit = "deg";
+  } else {
+    unit = "";
+  }
+  return true;
+}
+
+static bool hasWord(const String& clause, const char* word) {
+  return clause.indexOf(word) != -1;
+}
+
+static void addStep(LocalPlan& plan, LocalStepType type, const String& direction, int value, bool faceOpen) {
+  LocalStep& step = plan.steps[plan.count++];
+  step.type = type;
+  step.direction = direction;
+  step.value = value;
+  step.faceOpen = faceOpen;
+}
+
+/**
+ * Compile one clause of an objective into a step (or the plan's stop condition)
+ * @param clause Lowercase clause, e.g. "turn left 45 degrees"
+ * @return false if the clause isn't understood or the plan is full
+ */
+bool parseLocalStep(const String& clause, LocalPlan& plan) {
+  if (plan.count >= LOCAL_PLAN_MAX_STEPS) {
+    return false;
+  }
+
+  float value = 0;
+  String unit = "";
+  bool hasQuantity = findQuantity(clause, value, unit);
+  if (hasQuantity && value > 100000) {
+    return false;
+  }
+  float cm = unit == "m" ? value * 100 : value;
+  bool isDistance = hasQuantity && (unit == "cm" || unit == "m");
+  bool backward = hasWord(clause, "back") || hasWord(clause, "reverse");
+
+  // Vision needs the LLM
+  if (hasWord(clause, "photo") || hasWord(clause, "picture") || hasWord(clause, "image") ||
+      hasWord(clause, "camera") || hasWord(clause, "see ")) {
+    return false;
+  }
+
+  // Stop condition for the whole plan: "stop if closer than 20 cm"
+  if (isDistance && !hasWord(clause, "until") &&
+      (clause.startsWith(" stop") || clause.startsWith(" halt") ||
+       hasWord(clause, "closer") || hasWord(clause, "nearer"))) {
+    plan.stopDistanceCm = (int)cm;
+    return true;
+  }
+
+  // Distance-conditional approach: "approach until within 20 cm", "back up until 30 cm away"
+  if (hasWord(clause, "until") || hasWord(clause, "within") || hasWord(clause, "approach") ||
+      hasWord(clause, "up to") || hasWord(clause, "get close")) {
+    int target = isDistance ? (int)cm : LOCAL_DEFAULT_APPROACH_CM;
+    addStep(plan, backward ? STEP_BACK_OFF : STEP_APPROACH, backward ? "backward" : "forward", target, false);
+    return true;
+  }
+
+  if (hasWord(clause, "scan") || hasWord(clause, "look around") || hasWord(clause, "survey") ||
+      hasWord(clause, "sweep")) {
+    bool faceOpen = hasWord(clause, "open") || hasWord(clause, "clear") || hasWord(clause, "face");
+    addStep(plan, STEP_SCAN, "left", 90, faceOpen);
+    return true;
+  }
+
+  // "face the most open direction" after (or without) a scan
+  if (hasWord(clause, "most open") || hasWord(clause, "clearest") || hasWord(clause, "open direction") ||
+      hasWord(clause, "most space")) {
+    if (plan.count > 0 && plan.steps[plan.count - 1].type == STEP_SCAN) {
+      plan.steps[plan.count - 1].faceOpen = true;
+    } else {
+      addStep(plan, STEP_SCAN, "left", 90, true);
+    }
+    return true;
+  }
+
+  // "measure the distance ahead", "how far is the wall on the left": the
+  // direction says where to measure unless a motion verb asks to go there
+  bool motionVerb = hasWord(clause, "drive") || hasWord(clause, "move") || hasWord(clause, "go ") ||
+                    hasWord(clause, "turn") || hasWord(clause, "spin") || hasWord(clause, "reverse") ||
+                    hasWord(clause, "back up") || hasWord(clause, "backward");
+  if (!motionVerb && (hasWord(clause, "measure") || hasWord(clause, "distance") || hasWord(clause, "how far") ||
+                      hasWord(clause, "sonar") || hasWord(clause, "check"))) {
+    addStep(plan, STEP_MEASURE, "", 0, false);
+    return true;
+  }
+
+  if (hasWord(clause, "turn around") || hasWord(clause, "u-turn") || hasWord(clause, "about face")) {
+    addStep(plan, STEP_TURN, "left", 180, false);
+    return true;
+  }
+
+  if (hasWord(clause, "spin") || hasWord(clause, "left") || hasWord(clause, "right")) {
+    int degrees = hasWord(clause, "spin") ? 360 : 90;
+    if (hasQuantity) {
+      if (unit == "ms") {
+        degrees = (int)(value * ODOMETRY_DEG_PER_MS + 0.5);
+      } else if (unit == "s") {
+        degrees = (int)(value * 1000 * ODOMETRY_DEG_PER_MS + 0.5);
+      } else if (unit == "deg" || unit == "") {
+        degrees = (int)value;
+      }
+    }
+    if (degrees <= 0 || degrees > 720) {
+      return false;
+    }
+    addStep(plan, STEP_TURN, hasWord(clause, "right") ? "right" : "left", degrees, false);
+    return true;
+  }
+
+  if (backward || hasWord(clause, "forward") || hasWord(clause, "ahead") || hasWord(clause, "straight") ||
+      hasWord(clause, "drive") || hasWord(clause, "move") || hasWord(clause, "go ")) {
+    int ms = LOCAL_DEFAULT_MOVE_MS;
+    if (hasQuantity) {
+      if (isDistance) {
+        ms = moveDurationMs(cm);
+      } else if (unit == "s" || (unit == "" && value <= 10)) {
+        ms = (int)(value * 1000);
+      } else {
+        ms = (int)value;
+      }
+    }
+    if (ms <= 0) {
+      return false;
+    }
+    addStep(plan, STEP_MOVE, backward ? "backward" : "forward", ms, false);
+    return true;
+  }
+
+  if (hasWord(clause, "stop") || hasWord(clause, "halt")) {
+    addStep(plan, STEP_STOP, "", 0, false);
+    return true;
+  }
+
+  return false;
+}
+
+/**
+ * Compile an objective into a local plan
+ * Clauses are separated by "then", "and", commas and semicolons. Clauses the
+ * grammar doesn't understand are kept in plan.ignored.
+ * @return true if at least one step was understood
+ */
+bool parseLocalPlan(const String& objective, LocalPlan& plan) {
+  plan.count = 0;
+  plan.current = 0;
+  plan.phase = 0;
+  plan.remainingMs = 0;
+  plan.moves = 0;
+  plan.stopDistanceCm = LOCAL_SAFETY_STOP_CM;
+  plan.failed = false;
+  plan.ignored = "";
+  plan.log = "";
+  plan.active = false;
+
+  String text = " " + objective + " ";
+  text.toLowerCase();
+  text.replace(",", " then ");
+  text.replace(";", " then ");
+  text.replace(". ", " then ");
+  text.replace(" and ", " then ");
+  text.replace(" but ", " then ");
+  text.replace(" after that ", " then ");
+  text.replace(" finally ", " then ");
+
+  int start = 0;
+  while (start < text.length()) {
+    int end = text.indexOf(" then ", start);
+    if (end == -1) {
+      end = text.length();
+    }
+    String clause = text.substring(start, end);
+    clause.trim();
+    start = end + 6;
+    if (clause.startsWith("then ")) {
+      clause = clause.substring(5);   // "and then" became "then then"
+    }
+
+    if (clause.length() == 0 || clause == "then") {
+      continue;
+    }
+    if (!parseLocalStep(" " + clause + " ", plan)) {
+      if (plan.ignored.length() > 0) {
+        plan.ignored += "; ";
+      }
+      plan.ignored += clause;
+    }
+  }
+  return plan.count > 0;
+}
+
+/**
+ * Switch the current objective to the offline planner
+ * @param objective Objective being planned
+ * @param reason Why the LLM isn't used, for status messages
+ * @return false if the objective has no step the local grammar understands
+ */
+bool beginLocalPlanning(const String& objective, const String& reason) {
+  if (!parseLocalPlan(objective, localPlan)) {
+    logToRobotLogs("Local planner: no steps understood in '" + objective + "'");
+    sendMqttMessage("[LOCAL] LLM unreachable (" + reason + ") and the offline planner can't handle this objective");
+    return false;
+  }
+  localPlan.active = true;
+
+  String steps = "";
+  for (int i = 0; i < localPlan.count; i++) {
+    steps += String(i > 0 ? ", " : "") + formatLocalStep(localPlan.steps[i]);
+  }
+  logToRobotLogs("Local planner: " + steps + " (stop distance " + String(localPlan.stopDistanceCm) + " cm)");
+  String message = "[LOCAL] LLM unreachable (" + reason + ") - planning offline: " + steps;
+  if (localPlan.ignored.length() > 0) {
+    message += "; not understood: " + localPlan.ignored;
+  }
+  sendMqttMessage(message);
+  return true;
+}
+
+/**
+ * Distance from the last sonar reading in tool results
+ * @return Distance in cm, LOCAL_OUT_OF_RANGE_CM for no echo, -1 if there is no reading
+ */
+int parseDistanceResult(const String& results) {
+  int index = results.lastIndexOf("Distance: ");
+  if (index == -1) {
+    return -1;
+  }
+  String rest = results.substring(index + 10, index + 22);
+  if (rest.startsWith("Out of range")) {
+    return LOCAL_OUT_OF_RANGE_CM;
+  }
+  if (!isDigit(rest.charAt(0))) {
+    return -1;
+  }
+  return rest.toInt();
+}
+
+// moveCar() reads 90/180/270/360 as degrees, so durations must avoid them
+int moveCarDuration(int ms) {
+  if (ms == 90 || ms == 180 || ms == 270 || ms == 360) {
+    return ms + 1;
+  }
+  return ms;
+}
+
+/**
+ * Motor time for a turn, from the odometry calibration
+ */
+int turnDurationMs(int degrees) {
+  return moveCarDuration((int)(degrees / ODOMETRY_DEG_PER_MS + 0.5));
+}
+
+/**
+ * Motor time to drive a distance, from the odometry calibration
+ */
+int moveDurationMs(float cm) {
+  return moveCarDuration((int)(cm / ODOMETRY_CM_PER_MS + 0.5));
+}
+
+void addLocalToolCall(PlanningDecision& decision, const char* tool, const String& params) {
+  ToolCall& call = decision.toolCalls[decision.numToolCalls++];
+  call.tool = tool;
+  call.params = params;
+  call.confidence = 1.0;
+  call.isValid = true;
+}
+
+static void addTurn(PlanningDecision& decision, const String& direction, int degrees) {
+  // moveCar() has its own calibrated quarter turns
+  if (degrees == 90 || degrees == 180 || degrees == 270 || degrees == 360) {
+    addLocalToolCall(decision, "move_car", direction + " " + String(degrees));
+  } else {
+    addLocalToolCall(decision, "move_car", direction + " " + String(turnDurationMs(degrees)));
+  }
+}
+
+/**
+ * Move on to the next step of the plan
+ * @param note What the finished step did, added to plan.log
+ */
+void finishLocalStep(LocalPlan& plan, const String& note) {
+  plan.log += "Step " + String(plan.current + 1) + " (" + formatLocalStep(plan.steps[plan.current]) + "): " + note + "\n";
+  plan.current++;
+  plan.phase = 0;
+  plan.remainingMs = 0;
+  plan.moves = 0;
+}
+
+/**
+ * Next planning decision of a local plan
+ * Unconditional steps are batched into one decision. Steps that depend on the
+ * sonar (approach, back off, scan, forward moves with a stop condition) start
+ * by measuring and end the batch, so the next call can act on the reading.
+ * @param plan Plan from parseLocalPlan(); progress is kept in it
+ * @param latestResults Tool results of the previous decision
+ */
+PlanningDecision nextLocalDecision(LocalPlan& plan, const String& latestResults) {
+  PlanningDecision decision;
+  decision.numToolCalls = 0;
+  decision.shouldContinue = false;
+  decision.objectiveComplete = false;
+  decision.rawContent = "";
+  decision.estimatedPromptTokens = 0;
+  decision.promptTokens = -1;
+  decision.completionTokens = 0;
+  decision.requestFailed = false;
+  decision.fromLocalPlanner = true;
+  decision.fromSkill = false;
+  decision.jsonRepairs = 0;
+  decision.truncated = false;
+  decision.maxTokens = 0;
+  decision.generationMs = 0;
+  decision.lengthRetried = false;
+
+  const int maxCalls = sizeof(decision.toolCalls) / sizeof(decision.toolCalls[0]);
+  // Only the step that ended the last batch measured; later steps start fresh
+  int distance = plan.phase > 0 ? parseDistanceResult(latestResults) : -1;
+  String note = "";
+  bool waiting = false;
+
+  while (plan.current < plan.count && !waiting) {
+    LocalStep& step = plan.steps[plan.current];
+    int freeCalls = maxCalls - decision.numToolCalls;
+
+    switch (step.type) {
+      case STEP_MOVE:
+        if (step.direction == "backward" || plan.stopDistanceCm <= 0) {
+          addLocalToolCall(decision, "move_car", step.direction + " " + String(moveCarDuration(step.value)));
+          finishLocalStep(plan, "moved " + step.direction + " " + String(step.value) + " ms");
+          distance = -1;
+        } else if (plan.phase == 0) {
+          // Check the way is clear, then drive in chunks
+          addLocalToolCall(decision, "get_sonar_distance", "");
+          plan.phase = 1;
+          plan.remainingMs = step.value;
+          waiting = true;
+        } else if (distance >= 0 && distance <= plan.stopDistanceCm) {
+          addLocalToolCall(decision, "move_car", "stop");
+          note = "obstacle at " + String(distance) + " cm, stopped (stop distance " + String(plan.stopDistanceCm) + " cm)";
+          finishLocalStep(plan, note);
+          plan.failed = true;
+          plan.current = plan.count;
+          waiting = true;
+        } else if (plan.remainingMs <= 0) {
+          finishLocalStep(plan, "moved forward " + String(step.value) + " ms");
+          distance = -1;
+        } else if (freeCalls < 2) {
+          waiting = true;
+        } else {
+          int chunk = min(plan.remainingMs, LOCAL_MOVE_CHUNK_MS);
+          addLocalToolCall(decision, "move_car", "forward " + String(moveCarDuration(chunk)));
+          addLocalToolCall(decision, "get_sonar_distance", "");
+          plan.remainingMs -= chunk;
+          waiting = true;
+        }
+        break;
+
+      case STEP_TURN:
+        addTurn(decision, step.direction, step.value);
+        finishLocalStep(plan, "turned " + step.direction + " " + String(step.value) + " degrees");
+        distance = -1;
+        break;
+
+      case STEP_APPROACH:
+      case STEP_BACK_OFF: {
+        bool approach = step.type == STEP_APPROACH;
+        if (plan.phase == 0 || distance < 0) {
+          addLocalToolCall(decision, "get_sonar_distance", "");
+          plan.phase = 1;
+          waiting = true;
+        } else if (approach ? distance <= step.value : distance >= step.value) {
+          finishLocalStep(plan, "distance " + String(distance) + " cm after " + String(plan.moves) + " moves");
+          distance = -1;
+        } else if (plan.moves >= LOCAL_APPROACH_MAX_MOVES) {
+          addLocalToolCall(decision, "move_car", "stop");
+          note = "gave up at " + String(distance) + " cm after " + String(plan.moves) + " moves";
+          finishLocalStep(plan, note);
+          plan.failed = true;
+          plan.current = plan.count;
+          waiting = true;
+        } else if (freeCalls < 2) {
+          waiting = true;
+        } else {
+          // Drive most of the remaining gap, then measure again
+          int gapCm = abs(distance - step.value);
+          int ms = constrain(moveDurationMs(gapCm * 0.8), LOCAL_MOVE_MIN_MS, LOCAL_MOVE_CHUNK_MS);
+          addLocalToolCall(decision, "move_car", step.direction + " " + String(moveCarDuration(ms)));
+          addLocalToolCall(decision, "get_sonar_distance", "");
+          plan.moves++;
+          note = "distance " + String(distance) + " cm, target " + String(step.value) + " cm";
+          waiting = true;
+        }
+        break;
+      }
+
+      case STEP_SCAN:
+        if (plan.phase == 0) {
+          addLocalToolCall(decision, "get_sonar_distance", "");
+          plan.phase = 1;
+          waiting = true;
+          break;
+        }
+        if (freeCalls < 2) {
+          waiting = true;
+          break;
+        }
+        plan.scanDistances[plan.phase - 1] = distance < 0 ? 0 : distance;
+        if (plan.phase < LOCAL_SCAN_DIRECTIONS) {
+          addTurn(decision, "left", 90);
+          addLocalToolCall(decision, "get_sonar_distance", "");
+          plan.phase++;
+          waiting = true;
+        } else {
+          int best = 0;
+          String readings = "";
+          for (int i = 0; i < LOCAL_SCAN_DIRECTIONS; i++) {
+            if (plan.scanDistances[i] > plan.scanDistances[best]) {
+              best = i;
+            }
+            readings += String(i > 0 ? ", " : "") + SCAN_DIRECTION_NAMES[i] + " " + String(plan.scanDistances[i]) + " cm";
+          }
+          int target = step.faceOpen ? best : 0;
+
+          // The car faces the last direction measured; turn to the target
+          int leftDegrees = ((target - (LOCAL_SCAN_DIRECTIONS - 1)) * 90 + 360) % 360;
+          if (leftDegrees > 180) {
+            addTurn(decision, "right", 360 - leftDegrees);
+          } else if (leftDegrees > 0) {
+            addTurn(decision, "left", leftDegrees);
+          }
+          note = readings + (step.faceOpen ? "; facing " + String(SCAN_DIRECTION_NAMES[best]) : "");
+          finishLocalStep(plan, note);
+          distance = -1;
+        }
+        break;
+
+      case STEP_MEASURE:
+        addLocalToolCall(decision, "get_sonar_distance", "");
+        finishLocalStep(plan, "measured distance");
+        distance = -1;
+        break;
+
+      case STEP_STOP:
+        addLocalToolCall(decision, "move_car", "stop");
+        finishLocalStep(plan, "stopped");
+        distance = -1;
+        break;
+    }
+
+    if (decision.numToolCalls >= maxCalls) {
+      waiting = true;
+    }
+  }
+
+  bool finished = plan.current >= plan.count;
+  decision.shouldContinue = !finished;
+  decision.objectiveComplete = finished && !plan.failed;
+
+  if (finished) {
+    decision.reasoning = String(plan.failed ? "Local plan stopped early" : "Local plan complete") +
+                         " (" + String(plan.count) + " steps)";
+    if (plan.ignored.length() > 0) {
+      decision.reasoning += "; not understood offline: " + plan.ignored;
+    }
+  } else {
+    decision.reasoning = "Local step " + String(plan.current + 1) + "/" + String(plan.count) + ": " +
+                         formatLocalStep(plan.steps[plan.current]);
+    if (note.length() > 0) {
+      decision.reasoning += " - " + note;
+    }
+  }
+  decision.nextContext = "Local planner (LLM unreachable). " + decision.reasoning;
+  return decision;
+}
+
+/**
+ * Human-readable step, e.g. "approach to 20 cm"
+ */
+String formatLocalStep(const LocalStep& step) {
+  switch (step.type) {
+    case STEP_MOVE:
+      return step.direction + " " + String(step.value) + " ms";
+    case STEP_TURN:
+      return "turn " + step.direction + " " + String(step.value) + " degrees";
+    case STEP_APPROACH:
+      return "approach to " + String(step.value) + " cm";
+    case STEP_BACK_OFF:
+      return "back off to " + String(step.value) + " cm";
+    case STEP_SCAN:
+      return step.faceOpen ? "scan and face most open direction" : "scan";
+    case STEP_MEASURE:
+      return "measure distance";
+    case STEP_STOP:
+      return "stop";
+  }
+  return "";
+}
+
+/**
+ * Whether the LLM should be skipped in favour of the local planner
+ * True while WiFi is down, or while every provider's circuit breaker is open.
+ */
+bool connectivityPoor() {
+  return WiFi.status() != WL_CONNECTED || llmBreakerOpen();
+}
+
+/**
+ * Which planner is making decisions, for status messages
+ */
+String activePlannerName() {
+  if (localPlan.active) {
+    return "local";
+  }
+  if (skillReplay.active) {
+    return "skill";
+  }
+  return gatewayExchange.active ? "gateway" : "llm";
+}
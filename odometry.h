@@ -0,0 +1,38 @@
+#ifndef ODOMETRY_H
+#define ODOMETRY_H
+
+#include <Arduino.h>
+
+#define ODOMETRY_CM_PER_MS (132.7 / 2000.0)   // Forward/backward: 2000 ms ~ 132.7 cm
+#define ODOMETRY_DEG_PER_MS (90.0 / 570.0)    // Turning: 570 ms ~ 90 degrees
+
+// What the motors are doing
+enum MotionType {
+  MOTION_STOPPED,
+  MOTION_FORWARD,
+  MOTION_BACKWARD,
+  MOTION_LEFT,
+  MOTION_RIGHT
+};
+
+// Dead-reckoned pose relative to where the car was at boot (or last reset)
+// x is the initial forward direction, y is to the left; heading is in degrees,
+// counter-clockwise (left turns) positive, normalized to (-180, 180].
+struct Pose {
+  float x;
+  float y;
+  float heading;
+};
+
+// Function declarations
+float normalizeHeading(float heading);
+Pose advancePose(const Pose& start, MotionType motion, unsigned long elapsedMs);
+void beginMotion(MotionType type);
+void endMotion();
+Pose getPose();
+bool isMoving();
+unsigned long getLastMotionEnd();
+void resetPose();
+String formatPose(const Pose& pose);
+
+#endif // ODOMETRY_H
@@ -0,0 +1,113 @@
+#include "odometry.h"
+
+// Pose at the start of the current motion (or the current pose when stopped)
+Pose odometryBase = {0, 0, 0};
+MotionType odometryMotion = MOTION_STOPPED;
+unsigned long odometryMotionStart = 0;
+unsigned long odometryLastMotionEnd = 0;
+
+// The capture task reads the pose while the main task drives
+portMUX_TYPE odometryMux = portMUX_INITIALIZER_UNLOCKED;
+
+float normalizeHeading(float heading) {
+  while (heading > 180) heading -= 360;
+  while (heading <= -180) heading += 360;
+  return heading;
+}
+
+/**
+ * Pose after running a motion for some time from a starting pose
+ */
+Pose advancePose(const Pose& start, MotionType motion, unsigned long elapsedMs) {
+  Pose pose = start;
+  float radians = start.heading * PI / 180.0;
+  switch (motion) {
+    case MOTION_FORWARD:
+      pose.x += cos(radians) * elapsedMs * ODOMETRY_CM_PER_MS;
+      pose.y += sin(radians) * elapsedMs * ODOMETRY_CM_PER_MS;
+      break;
+    case MOTION_BACKWARD:
+      pose.x -= cos(radians) * elapsedMs * ODOMETRY_CM_PER_MS;
+      pose.y -= sin(radians) * elapsedMs * ODOMETRY_CM_PER_MS;
+      break;
+    case MOTION_LEFT:
+      pose.heading = normalizeHeading(start.heading + elapsedMs * ODOMETRY_DEG_PER_MS);
+      break;
+    case MOTION_RIGHT:
+      pose.heading = normalizeHeading(start.heading - elapsedMs * ODOMETRY_DEG_PER_MS);
+      break;
+    default:
+      break;
+  }
+  return pose;
+}
+
+/**
+ * Record that the motors started a motion
+ * Called right after the motor pins are set. Any motion still running is
+ * folded into the pose first.
+ */
+void beginMotion(MotionType type) {
+  unsigned long now = millis();
+  portENTER_CRITICAL(&odometryMux);
+  if (odometryMotion != MOTION_STOPPED) {
+    odometryBase = advancePose(odometryBase, odometryMotion, now - odometryMotionStart);
+  }
+  odometryMotion = type;
+  odometryMotionStart = now;
+  portEXIT_CRITICAL(&odometryMux);
+}
+
+/**
+ * Record that the motors stopped
+ */
+void endMotion() {
+  unsigned long now = millis();
+  portENTER_CRITICAL(&odometryMux);
+  if (odometryMotion != MOTION_STOPPED) {
+    odometryBase = advancePose(odometryBase, odometryMotion, now - odometryMotionStart);
+    odometryMotion = MOTION_STOPPED;
+    odometryLastMotionEnd = now;
+  }
+  portEXIT_CRITICAL(&odometryMux);
+}
+
+/**
+ * Current pose, including the part of a motion still in progress
+ */
+Pose getPose() {
+  unsigned long now = millis();
+  portENTER_CRITICAL(&odometryMux);
+  Pose base = odometryBase;
+  MotionType motion = odometryMotion;
+  unsigned long start = odometryMotionStart;
+  portEXIT_CRITICAL(&odometryMux);
+  return advancePose(base, motion, now - start);
+}
+
+bool isMoving() {
+  return odometryMotion != MOTION_STOPPED;
+}
+
+/**
+ * millis() when the last motion ended (0 if the car has not moved)
+ */
+unsigned long getLastMotionEnd() {
+  return odometryLastMotionEnd;
+}
+
+void resetPose() {
+  portENTER_CRITICAL(&odometryMux);
+  odometryBase.x = 0;
+  odometryBase.y = 0;
+  odometryBase.heading = 0;
+  odometryMotionStart = millis();
+  portEXIT_CRITICAL(&odometryMux);
+}
+
+/**
+ * Format a pose, e.g. "x=66.4 cm, y=0.0 cm, heading=90 deg"
+ */
+String formatPose(const Pose& pose) {
+  return "x=" + String(pose.x, 1) + " cm, y=" + String(pose.y, 1) + " cm, heading=" + String((int)round(pose.heading)) + " deg";
+}
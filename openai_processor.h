@@ -4,6 +4,8 @@
 #include <HTTPClient.h>
 #include <ArduinoJson.h>
 #include "config.h"
+#include "token_budget.h"
+#include "conversation.h"
 
 // Tool call structure
 struct ToolCall {
@@ -22,6 +24,16 @@ struct OpenAIResult {
   String error;
 };
 
+// Repair re-prompts over one objective (decision_repair.h)
+struct DecisionRepairStats {
+  int decisions;             // Invalid decisions sent back for repair
+  int attempts;              // Repair requests made
+  int fixed;                 // Decisions corrected
+  unsigned long totalMs;     // Time spent repairing
+  unsigned long maxMs;       // Longest repair of one decision
+  TokenUsage tokens;         // Repair requests only, not in the session's planning tokens
+};
+
 // Iterative planning session
 struct PlanningSession {
   String objective;           // Original objective
@@ -32,6 +44,20 @@ struct PlanningSession {
   String finalResult;        // Final summary when complete
   unsigned long startTime;   // When planning started
   unsigned long lastIterationTime; // Last iteration timestamp
+  unsigned long firstActionMs; // Start to first tool call executed (0 = none yet)
+  TokenUsage tokens;         // Token totals for this objective
+  int localIterations;       // Iterations decided by the offline planner
+  int gatewayIterations;     // Iterations decided by the planner gateway
+  int skillIterations;       // Iterations replayed from the skill library
+  int rescuedIterations;     // Iterations whose decision JSON needed repair
+  int jsonRepairs;           // JSON_REPAIR_* defects seen over the objective
+  DecisionRepairStats repairs; // Repair re-prompts, counted apart from iterations
+  ObjectiveKind objectiveKind; // For max_tokens sizing (token_budget.h)
+  bool terseResponse;        // Terse reasoning asked for this iteration
+  unsigned long generationMs; // Time waiting for planning decisions
+  int lengthRetries;         // Decisions asked for again after hitting max_tokens
+  String generationLog;      // One line per LLM iteration: time, tokens, max_tokens
+  bool conversationMode;     // Prompt is the chat transcript (off when planning started on the gateway)
 };
 
 // Planning decision result
@@ -42,15 +68,47 @@ struct PlanningDecision {
   bool objectiveComplete;    // Whether objective is achieved
   String reasoning;          // Why this decision was made
   String nextContext;        // Updated context for next iteration
+  String rawContent;         // Decision JSON as returned, replayed in conversation mode
+  int estimatedPromptTokens; // Prompt estimate made before sending
+  int promptTokens;          // usage.prompt_tokens, or -1 if not reported
+  int completionTokens;      // usage.completion_tokens, estimated if not reported; 0 if no response
+  bool requestFailed;        // The LLM couldn't be reached (no response to parse)
+  bool fromLocalPlanner;     // Made by the offline planner (local_planner.h), not the LLM
+  bool fromSkill;            // Replayed from the skill library (skill_library.h), not the LLM
+  int jsonRepairs;           // JSON_REPAIR_* defects fixed in the content (json_repair.h), 0 if parsed as is
+  String schemaError;        // Why the content can't be used as is, "" if it can (decision_repair.h)
+  bool truncated;            // finish_reason was "length": cut off at max_tokens
+  int maxTokens;             // max_tokens it was generated under, 0 if not from the LLM
+  unsigned long generationMs; // Time waiting for the LLM, including a length retry
+  bool lengthRetried;        // Asked for again with a bigger max_tokens after being cut off
 };
 
 
 
+// Reusable request body buffer (openai_processor.ino)
+extern String openAIRequestBody;
+
 // Function declarations for current system
 OpenAIResult processWithOpenAI(String content);
 String executeToolCalls(OpenAIResult result);
 String buildSystemPrompt();
-String makeOpenAIRequest(String prompt);
+String makeOpenAIRequest(const String& prompt, int maxTokens = RESPONSE_TOKENS_MAX);
+String makeOpenAIRequestBody(const String& body, int timeoutMs = 0);
+String makeOpenAIRequestStream(Stream& body, size_t length);
+bool checkOpenAIRequest(String& error);
+void waitForLlmRateLimit();
+bool beginOpenAIRequest(HTTPClient& http, String& error, int timeoutMs = 0);
+String finishOpenAIRequest(HTTPClient& http, int httpResponseCode);
+String httpErrorMessage(int httpResponseCode);
+void buildChatRequestBody(String& body, const String& userContent, int maxTokens = RESPONSE_TOKENS_MAX,
+                          const char* styleNote = nullptr, const String& sensorNote = "");
+void buildConversationRequestBody(String& body, const Conversation& conversation, int maxTokens = RESPONSE_TOKENS_MAX,
+                                  const char* styleNote = nullptr, const String& sensorNote = "",
+                                  const String& worldState = "");
+void appendChatMessage(String& body, const char* role, const String& content);
+void appendStyleNote(String& body, const char* styleNote);
+void appendSensorNote(String& body, const String& sensorNote);
+void appendJsonString(String& out, const String& text);
 OpenAIResult parseOpenAIResponse(String jsonResponse);
 bool testInternetConnectivity();
 OpenAIResult createFallbackResponse(String content);
@@ -60,8 +118,9 @@ bool initPromptsManager();
 
 // Iterative planning function declarations
 String executeIterativePlanning(String objective);
-PlanningDecision processObjectiveIteratively(PlanningSession session);
-String buildIterativePlanningPrompt(PlanningSession session);
+PlanningDecision processObjectiveIteratively(const PlanningSession& session);
+const String& buildIterativePlanningPrompt(const PlanningSession& session);
+void fitPlanningSessionToBudget(PlanningSession& session);
 PlanningDecision parsePlanningResponse(String jsonResponse);
 String executePlanningToolCalls(PlanningDecision decision);
 bool evaluateGoalCompletion(PlanningSession session, String latestResults);
@@ -1,14 +1,29 @@
 #include "openai_processor.h"
 #include "robot_tools.h"
 #include "prompts_manager.h"
+#include "heap_profiler.h"
+#include "trace.h"
+#include "image_preprocess.h"
+#include "local_planner.h"
+#include "planner_gateway.h"
+#include "llm_provider.h"
+#include "llm_hedge.h"
+#include "json_repair.h"
+#include "decision_repair.h"
+#include "skill_library.h"
+#include "world_state.h"
+#include "sensor_snapshot.h"
+#include "capture_task.h"
 
-// Rate limiting
-unsigned long lastOpenAIRequest = 0;
+// Rate limiting, per provider
 const unsigned long OPENAI_RATE_LIMIT_MS = 1000; // 1 second between requests
 
 // Global prompts manager
 PromptsManager promptsManager;
 
+// Reusable request body buffer; keeps its capacity between iterations
+String openAIRequestBody;
+
 /**
  * Build the system prompt for OpenAI
  * Note: This function is deprecated and will be removed in future versions
@@ -19,104 +34,339 @@ String buildSystemPrompt() {
   return "You are a robot assistant. All commands will be processed through the iterative planning system.";
 }
 
+/**
+ * Append text to a buffer as a quoted, escaped JSON string
+ * Safe runs are copied in one concat instead of per character.
+ * @param out Buffer to append to
+ * @param text Raw text
+ */
+void appendJsonString(String& out, const String& text) {
+  const char* s = text.c_str();
+  unsigned int length = text.length();
+  unsigned int runStart = 0;
+  
+  out += '"';
+  for (unsigned int i = 0; i < length; i++) {
+    unsigned char c = (unsigned char)s[i];
+    if (c >= 0x20 && c != '"' && c != '\\') {
+      continue;
+    }
+    
+    out.concat(s + runStart, i - runStart);
+    runStart = i + 1;
+    
+    switch (c) {
+      case '"':  out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      case '\t': out += "\\t"; break;
+      default: {
+        char escaped[7];
+        sprintf(escaped, "\\u%04x", c);
+        out += escaped;
+        break;
+      }
+    }
+  }
+  out.concat(s + runStart, length - runStart);
+  out += '"';
+}
+
+/**
+ * Build a chat completions request body into a reusable buffer
+ * Written directly instead of through a JsonDocument, so the prompt is
+ * escaped once straight into the body rather than copied into a document
+ * and serialized again.
+ * @param body Buffer to overwrite
+ * @param userContent User message content
+ * @param maxTokens Completion token limit
+ * @param styleNote Response style instruction sent last, nullptr for none
+ * @param sensorNote SENSORS message sent after the prompt, "" for none
+ */
+void buildChatRequestBody(String& body, const String& userContent, int maxTokens, const char* styleNote,
+                          const String& sensorNote) {
+  String systemPrompt = buildSystemPrompt();
+  
+  body = "";
+  body.reserve(userContent.length() + userContent.length() / 16 + systemPrompt.length() + sensorNote.length() + 192);
+  appendLlmRequestOptions(body, maxTokens);
+  appendChatMessage(body, "system", systemPrompt);
+  body += ',';
+  appendChatMessage(body, "user", userContent);
+  appendSensorNote(body, sensorNote);
+  appendStyleNote(body, styleNote);
+  body += "]}";
+}
+
+/**
+ * Build a chat completions request body from a conversation transcript
+ * Messages are written in transcript order, so consecutive requests for
+ * one objective share their prefix and grow only by the latest turn.
+ * @param body Buffer to overwrite
+ * @param conversation Transcript to send
+ * @param maxTokens Completion token limit
+ * @param styleNote Response style instruction sent after the transcript, nullptr for none
+ * @param sensorNote SENSORS message sent after the transcript, "" for none
+ * @param worldState formatWorldState() text sent after the transcript, "" for none
+ */
+void buildConversationRequestBody(String& body, const Conversation& conversation, int maxTokens, const char* styleNote,
+                                  const String& sensorNote, const String& worldState) {
+  unsigned int contentLength = conversation.earlierSummary.length() + sensorNote.length() + worldState.length();
+  for (int i = 0; i < conversation.count; i++) {
+    contentLength += conversation.messages[i].content.length();
+  }
+  
+  body = "";
+  body.reserve(contentLength + contentLength / 16 + 48 * (conversation.count + 2) + 96);
+  appendLlmRequestOptions(body, maxTokens);
+  for (int i = 0; i < conversation.count; i++) {
+    if (i > 0) {
+      body += ',';
+    }
+    appendChatMessage(body, conversation.messages[i].role, conversation.messages[i].content);
+    
+    // Summary of dropped turns goes right after the objective
+    if (i == 1 && conversation.earlierSummary.length() > 0) {
+      body += ',';
+      appendChatMessage(body, "user", conversation.earlierSummary);
+    }
+  }
+  // Only the current world state is sent; older ones would be stale
+  if (worldState.length() > 0) {
+    body += ',';
+    appendChatMessage(body, "user", "WORLD STATE:\n" + worldState);
+  }
+  appendSensorNote(body, sensorNote);
+  appendStyleNote(body, styleNote);
+  body += "]}";
+}
+
+/**
+ * Append a response style instruction as a final system message
+ * It goes last so the rest of the request stays a cacheable prefix.
+ */
+void appendStyleNote(String& body, const char* styleNote) {
+  if (styleNote != nullptr) {
+    body += ',';
+    appendChatMessage(body, "system", styleNote);
+  }
+}
+
+/**
+ * Append the sensor snapshot as a user message after the prompt
+ * Like the style note it isn't part of the transcript, so the cached prefix
+ * stays the same.
+ */
+void appendSensorNote(String& body, const String& sensorNote) {
+  if (sensorNote.length() > 0) {
+    body += ',';
+    appendChatMessage(body, "user", sensorNote);
+  }
+}
+
+/**
+ * Append one {"role":...,"content":...} message object
+ */
+void appendChatMessage(String& body, const char* role, const String& content) {
+  body += "{\"role\":\"";
+  body += role;
+  body += "\",\"content\":";
+  appendJsonString(body, content);
+  body += '}';
+}
+
 /**
  * Make HTTP request to OpenAI API
  */
-String makeOpenAIRequest(String prompt) {
+String makeOpenAIRequest(const String& prompt, int maxTokens) {
+  chooseLlmProvider();
+  buildChatRequestBody(openAIRequestBody, prompt, maxTokens);
+  return makeOpenAIRequestBody(openAIRequestBody);
+}
+
+/**
+ * Check the circuit breaker, rate limit and WiFi for a request to the current provider
+ * @param error Receives an {"error": ...} response if the request can't be sent
+ * @return true if the request can be sent
+ */
+bool checkOpenAIRequest(String& error) {
+  const LlmProviderConfig& provider = currentLlmProvider();
+  LlmProviderStats& stats = llmProviderStats[activeLlmProvider];
+  
+  // Fail fast while the provider's breaker is open (chooseLlmProvider() found none)
+  if (!llmProviderAllowsRequest(activeLlmProvider)) {
+    error = "{\"error\": \"LLM circuit open\"}";
+    return false;
+  }
+  
   // Rate limiting
   unsigned long currentTime = millis();
-  if (currentTime - lastOpenAIRequest < OPENAI_RATE_LIMIT_MS) {
-    return "{\"error\": \"Rate limit exceeded\"}";
+  if (currentTime - stats.lastRequest < OPENAI_RATE_LIMIT_MS) {
+    error = "{\"error\": \"Rate limit exceeded\"}";
+    return false;
   }
-  lastOpenAIRequest = currentTime;
+  stats.lastRequest = currentTime;
   
   if (WiFi.status() != WL_CONNECTED) {
-    return "{\"error\": \"WiFi not connected\"}";
+    error = "{\"error\": \"WiFi not connected\"}";
+    return false;
   }
   
-  HTTPClient http;
-  
-  // Add timeout and debugging
-  http.setTimeout(10000); // 10 second timeout
-  
-  logToRobotLogs("Connecting to OpenAI API...");
+  logToRobotLogs("Connecting to LLM provider " + String(provider.name) + " at " + String(provider.url) + "...");
   logToRobotLogs("WiFi Status: " + String(WiFi.status()));
   logToRobotLogs("WiFi RSSI: " + String(WiFi.RSSI()));
   logToRobotLogs("Local IP: " + WiFi.localIP().toString());
-  
-  http.begin("https://api.openai.com/v1/chat/completions");
-  http.addHeader("Content-Type", "application/json");
-  http.addHeader("Authorization", "Bearer " + String(OPENAI_API_KEY));
-  
-  // Build request payload
-  DynamicJsonDocument doc(2048);
-  doc["model"] = "gpt-4o-mini";
-  doc["max_tokens"] = 500;
-  doc["temperature"] = 0.1; // Low temperature for consistent parsing
-  
-  JsonArray messages = doc.createNestedArray("messages");
-  
-  JsonObject systemMsg = messages.createNestedObject();
-  systemMsg["role"] = "system";
-  systemMsg["content"] = buildSystemPrompt();
-  
-  JsonObject userMsg = messages.createNestedObject();
-  userMsg["role"] = "user";
-  userMsg["content"] = prompt;
-  
-  String jsonPayload;
-  serializeJson(doc, jsonPayload);
-  
-  logToRobotLogs("Sending OpenAI request...");
-  logToRobotLogs("Payload: " + jsonPayload);
-  
-  int httpResponseCode = http.POST(jsonPayload);
+  return true;
+}
+
+/**
+ * Wait until the current provider's rate limit allows another request
+ * For follow-up requests sent straight after a response.
+ */
+void waitForLlmRateLimit() {
+  unsigned long sinceLast = millis() - llmProviderStats[activeLlmProvider].lastRequest;
+  if (sinceLast < OPENAI_RATE_LIMIT_MS) {
+    delay(OPENAI_RATE_LIMIT_MS - sinceLast);
+  }
+}
+
+/**
+ * Check the request can be sent, then open it on the current provider
+ * @param http Client to set up
+ * @param error Receives an {"error": ...} response if the request can't be sent
+ * @param timeoutMs Shorter timeout for this request, 0 for the provider's
+ * @return true if the request can be sent
+ */
+bool beginOpenAIRequest(HTTPClient& http, String& error, int timeoutMs) {
+  if (!checkOpenAIRequest(error)) {
+    return false;
+  }
+  beginLlmProviderRequest(http, activeLlmProvider, timeoutMs);
+  http.addHeader("X-Prompt-Version", String(promptsManager.getActivePromptVersion()));
+  return true;
+}
+
+/**
+ * Read the response of a request started with beginOpenAIRequest()
+ * Ends the llm_http_wait span and closes the connection.
+ * @param http Client the request was sent on
+ * @param httpResponseCode Result of the POST
+ * @return Raw response, or {"error": ...} on failure
+ */
+String finishOpenAIRequest(HTTPClient& http, int httpResponseCode) {
   String response = "";
   
   logToRobotLogs("HTTP Response Code: " + String(httpResponseCode));
   
   if (httpResponseCode > 0) {
     response = http.getString();
+    traceEnd();
+    heapProfileAlloc("http_response", response.length());
     logToRobotLogs("OpenAI Response: " + response);
   } else {
-    // Provide more detailed error information
-    String errorMsg = "HTTP request failed: " + String(httpResponseCode);
-    
-    switch (httpResponseCode) {
-      case -1:
-        errorMsg += " (HTTPC_ERROR_CONNECTION_REFUSED)";
-        break;
-      case -2:
-        errorMsg += " (HTTPC_ERROR_SEND_HEADER_FAILED)";
-        break;
-      case -3:
-        errorMsg += " (HTTPC_ERROR_SEND_PAYLOAD_FAILED)";
-        break;
-      case -4:
-        errorMsg += " (HTTPC_ERROR_NOT_CONNECTED)";
-        break;
-      case -5:
-        errorMsg += " (HTTPC_ERROR_CONNECTION_LOST)";
-        break;
-      case -6:
-        errorMsg += " (HTTPC_ERROR_READ_TIMEOUT)";
-        break;
-      case -11:
-        errorMsg += " (HTTPC_ERROR_CONNECTION_REFUSED)";
-        break;
-      default:
-        errorMsg += " (Unknown error)";
-        break;
-    }
+    traceEnd();
     
+    String errorMsg = httpErrorMessage(httpResponseCode);
     response = "{\"error\": \"" + errorMsg + "\"}";
     logToRobotLogs("OpenAI request failed: " + errorMsg);
   }
   
   http.end();
+  recordLlmProviderOutcome(activeLlmProvider, httpResponseCode, millis() - llmProviderStats[activeLlmProvider].lastRequest);
   return response;
 }
 
+/**
+ * Describe a failed request, e.g. "HTTP request failed: -6 (HTTPC_ERROR_READ_TIMEOUT)"
+ * @param httpResponseCode Negative HTTPClient error code
+ */
+String httpErrorMessage(int httpResponseCode) {
+  String errorMsg = "HTTP request failed: " + String(httpResponseCode);
+  
+  switch (httpResponseCode) {
+    case -1:
+      errorMsg += " (HTTPC_ERROR_CONNECTION_REFUSED)";
+      break;
+    case -2:
+      errorMsg += " (HTTPC_ERROR_SEND_HEADER_FAILED)";
+      break;
+    case -3:
+      errorMsg += " (HTTPC_ERROR_SEND_PAYLOAD_FAILED)";
+      break;
+    case -4:
+      errorMsg += " (HTTPC_ERROR_NOT_CONNECTED)";
+      break;
+    case -5:
+      errorMsg += " (HTTPC_ERROR_CONNECTION_LOST)";
+      break;
+    case -6:
+      errorMsg += " (HTTPC_ERROR_READ_TIMEOUT)";
+      break;
+    case -11:
+      errorMsg += " (HTTPC_ERROR_CONNECTION_REFUSED)";
+      break;
+    default:
+      errorMsg += " (Unknown error)";
+      break;
+  }
+  return errorMsg;
+}
+
+/**
+ * POST a prepared chat completions body to the current LLM provider
+ * The body must have been built after chooseLlmProvider(). With
+ * LLM_HEDGING_ENABLED it's sent through makeHedgedRequest(), unless it has
+ * its own timeout.
+ * @param body Serialized request JSON
+ * @param timeoutMs Shorter timeout for this request, 0 for the provider's
+ * @return Raw response, or {"error": ...} on failure
+ */
+String makeOpenAIRequestBody(const String& body, int timeoutMs) {
+  if (LLM_HEDGING_ENABLED && timeoutMs == 0 && hedgeSlotsIdle()) {
+    return makeHedgedRequest(body);
+  }
+  
+  ScopedTrace span("llm_request");
+  
+  HTTPClient http;
+  String error;
+  if (!beginOpenAIRequest(http, error, timeoutMs)) {
+    return error;
+  }
+  
+  heapProfileAlloc("openai_payload", body.length());
+  
+  logToRobotLogs("Sending OpenAI request...");
+  logToRobotLogs("Payload: " + body);
+  
+  traceBegin("llm_http_wait");
+  return finishOpenAIRequest(http, http.POST(body));
+}
+
+/**
+ * POST a chat completions body produced by a stream to the current LLM provider
+ * The body is read in socket-sized chunks as it is sent, so it never has
+ * to exist in RAM as a whole (see InlineImageBody).
+ * @param body Stream positioned at the start of the body
+ * @param length Exact body length in bytes
+ * @return Raw response, or {"error": ...} on failure
+ */
+String makeOpenAIRequestStream(Stream& body, size_t length) {
+  ScopedTrace span("llm_request");
+  
+  HTTPClient http;
+  String error;
+  if (!beginOpenAIRequest(http, error)) {
+    return error;
+  }
+  
+  logToRobotLogs("Sending OpenAI request (streamed body, " + String(length) + " bytes)...");
+  
+  traceBegin("llm_http_wait");
+  return finishOpenAIRequest(http, http.sendRequest("POST", &body, length));
+}
+
 /**
  * Parse OpenAI JSON response into ToolCall array
  */
@@ -249,6 +499,11 @@ String executeToolCalls(OpenAIResult result) {
       continue;
     }
     
+    if (isDirectOnlyTool(call.tool)) {
+      executionResults += "[" + String(i + 1) + "] " + call.tool + ": Error: only available as a direct tool command\n";
+      continue;
+    }
+    
     logToRobotLogs("Executing tool: " + call.tool + " with params: '" + call.params + "'");
     String toolResult = executeTool(call.tool, call.params);
     
@@ -298,6 +553,9 @@ bool testInternetConnectivity() {
 
 /**
  * Fallback response when OpenAI is unavailable
+ * Uses the offline planner's grammar (local_planner.h). A one-shot response
+ * can't feed sonar readings back, so moves aren't obstacle-checked and the
+ * calls stop at the first step that needs a reading.
  */
 OpenAIResult createFallbackResponse(String content) {
   OpenAIResult result;
@@ -306,57 +564,18 @@ OpenAIResult createFallbackResponse(String content) {
   result.error = "OpenAI API unavailable - using fallback response";
   result.unknownCommands = content;
   
-  // Try to extract simple commands without AI
-  content.toLowerCase();
+  LocalPlan plan;
+  if (!parseLocalPlan(content, plan)) {
+    return result;
+  }
+  plan.stopDistanceCm = 0;
   
-  if (content.indexOf("forward") != -1 || content.indexOf("backward") != -1 || 
-      content.indexOf("left") != -1 || content.indexOf("right") != -1 || 
-      content.indexOf("stop") != -1) {
-    
-    // Extract movement command
-    String direction = "";
-    String duration = "1000"; // Default 1 second
-    
-    if (content.indexOf("forward") != -1) direction = "forward";
-    else if (content.indexOf("backward") != -1) direction = "backward";
-    else if (content.indexOf("left") != -1) direction = "left";
-    else if (content.indexOf("right") != -1) direction = "right";
-    else if (content.indexOf("stop") != -1) direction = "stop";
-    
-    // Try to extract duration
-    int secondsIndex = content.indexOf("second");
-    if (secondsIndex != -1) {
-      // Look for number before "second"
-      for (int i = secondsIndex - 1; i >= 0; i--) {
-        if (content.charAt(i) >= '0' && content.charAt(i) <= '9') {
-          // Found a number, extract it
-          int start = i;
-          while (start > 0 && content.charAt(start - 1) >= '0' && content.charAt(start - 1) <= '9') {
-            start--;
-          }
-          String numStr = content.substring(start, i + 1);
-          int seconds = numStr.toInt();
-          duration = String(seconds * 1000); // Convert to milliseconds
-          break;
-        }
-      }
-    }
-    
-    result.toolCalls[0].tool = "move_car";
-    result.toolCalls[0].params = direction + " " + duration;
-    result.toolCalls[0].confidence = 0.8;
-    result.toolCalls[0].isValid = true;
-    result.numToolCalls = 1;
-    result.success = true;
-    
-  } else if (content.indexOf("distance") != -1 || content.indexOf("measure") != -1) {
-    result.toolCalls[0].tool = "get_sonar_distance";
-    result.toolCalls[0].params = "";
-    result.toolCalls[0].confidence = 0.9;
-    result.toolCalls[0].isValid = true;
-    result.numToolCalls = 1;
-    result.success = true;
+  PlanningDecision decision = nextLocalDecision(plan, "");
+  for (int i = 0; i < decision.numToolCalls; i++) {
+    result.toolCalls[result.numToolCalls++] = decision.toolCalls[i];
   }
+  result.unknownCommands = plan.ignored;
+  result.success = result.numToolCalls > 0;
   
   return result;
 }
@@ -369,6 +588,8 @@ OpenAIResult createFallbackResponse(String content) {
  * Execute iterative planning for a complex objective
  */
 String executeIterativePlanning(String objective) {
+  ScopedTrace span("planning");
+  
   logToRobotLogs("=== STARTING ITERATIVE PLANNING ===");
   logToRobotLogs("Objective: " + objective);
   
@@ -384,17 +605,65 @@ String executeIterativePlanning(String objective) {
   session.isComplete = false;
   session.finalResult = "";
   session.startTime = millis();
+  session.firstActionMs = 0;
   session.lastIterationTime = millis();
+  resetTokenUsage(session.tokens);
+  session.localIterations = 0;
+  session.gatewayIterations = 0;
+  session.skillIterations = 0;
+  session.rescuedIterations = 0;
+  session.jsonRepairs = 0;
+  resetDecisionRepairStats(session.repairs);
+  session.objectiveKind = classifyObjective(objective);
+  session.terseResponse = false;
+  session.generationMs = 0;
+  session.lengthRetries = 0;
+  session.generationLog = "";
+  resetVisionStats();
+  resetSkillRecording(skillRecording);
+  resetWorldState(worldState);
+  resetSensorSnapshot();
+  setCaptureActive(true);
+  
+  // A stored skill for this objective replays without the LLM, from about
+  // the distance it was recorded at
+  if (SKILL_LIBRARY_ENABLED) {
+    skillRecording.startCm = readSkillStartDistance();
+  }
+  bool replaying = SKILL_LIBRARY_ENABLED && beginSkillReplay(objective, skillRecording.startCm);
+  
+  // Offload planning to the LAN gateway when it's answering; the gateway keeps
+  // the prompt and history, so the car only tracks its own execution history
+  bool useGateway = !replaying && gatewayAvailable();
+  if (useGateway) {
+    beginGatewaySession(getCurrentTraceId());
+  }
+  session.conversationMode = PLANNING_CONVERSATION_MODE && !useGateway;
+  if (session.conversationMode) {
+    beginConversation(planningConversation, objective, session.currentContext);
+  }
+  heapProfileMark("planning_start");
   
   const int MAX_ITERATIONS = 10; // Prevent infinite loops
   const unsigned long MAX_PLANNING_TIME = 60000; // 60 seconds max
   
+  // Skip the LLM when it's known to be unreachable
+  if (!replaying && !useGateway && LOCAL_PLANNER_ENABLED && connectivityPoor()) {
+    String reason = WiFi.status() != WL_CONNECTED ? "WiFi not connected" :
+                    "LLM circuit open, retry in " + String(llmBreakerRetryInMs() / 1000) + " s";
+    beginLocalPlanning(objective, reason);
+  }
+  String latestResults = "";
+  bool achieved = false;
+  
   while (!session.isComplete && 
-         session.iterationCount < MAX_ITERATIONS && 
-         (millis() - session.startTime) < MAX_PLANNING_TIME) {
+         session.iterationCount < (localPlan.active ? LOCAL_PLANNER_MAX_ITERATIONS : MAX_ITERATIONS) && 
+         (millis() - session.startTime) < (localPlan.active ? LOCAL_PLANNER_MAX_TIME_MS : MAX_PLANNING_TIME)) {
     
+    ScopedTrace iterationSpan("iteration");
     session.iterationCount++;
     session.lastIterationTime = millis();
+    worldState.iteration = session.iterationCount;
     
     logToRobotLogs("--- Iteration " + String(session.iterationCount) + " ---");
     logToRobotLogs("Current context: " + session.currentContext);
@@ -402,25 +671,123 @@ String executeIterativePlanning(String objective) {
     // Send iteration start update
     sendMqttMessage("Starting iteration " + String(session.iterationCount) + " - Context: " + session.currentContext);
     
-    // Get planning decision from OpenAI
-    PlanningDecision decision = processObjectiveIteratively(session);
+    // Read the sensors in the background while the prompt is prepared
+    if (SENSOR_SNAPSHOT_ENABLED && !skillReplay.active && !localPlan.active && !useGateway) {
+      requestSensorSnapshot();
+    }
+    
+    // Keep the prompt within the token target
+    if (session.conversationMode) {
+      // The world state is sent after the transcript, so it comes out of the same target
+      int worldTokens = estimateTokens(formatWorldState(worldState)) + TOKEN_MESSAGE_OVERHEAD;
+      session.tokens.historyCompactions += compactConversation(planningConversation, PROMPT_TOKEN_TARGET - worldTokens);
+    } else if (!useGateway && !localPlan.active) {
+      fitPlanningSessionToBudget(session);
+    }
+    
+    // Get planning decision from the skill library, the gateway, OpenAI or the offline planner
+    PlanningDecision decision;
+    bool decided = false;
+    if (skillReplay.active) {
+      decided = nextSkillDecision(skillReplay, latestResults, decision);
+      if (!decided) {
+        // Hand over to the on-car LLM; replayed iterations are in the history and transcript
+        session.currentContext = "A stored skill was replayed until a result deviated from its recording (" +
+                                 skillReplay.deviation + "). Plan the rest of the objective from here. " + session.currentContext;
+        sendMqttMessage("[SKILL] Result deviated from the recording (" + skillReplay.deviation + ") - asking the LLM");
+      }
+    } else if (localPlan.active) {
+      decision = nextLocalDecision(localPlan, latestResults);
+      decided = true;
+    } else if (useGateway) {
+      decision = requestGatewayDecision(session, latestResults);
+      if (decision.requestFailed) {
+        // Carry on with the on-car planner; its prompt includes the execution history so far
+        useGateway = false;
+        endGatewaySession();
+        sendMqttMessage("Gateway unavailable (" + decision.reasoning + ") - planning on the car");
+      } else {
+        decided = true;
+        session.gatewayIterations++;
+        if (decision.completionTokens > 0) {
+          recordTokenUsage(session.tokens, 0, decision.promptTokens, decision.completionTokens);
+        }
+      }
+    }
+    if (!decided) {
+      session.terseResponse = useTerseResponse(session.iterationCount, latestResults);
+      decision = processObjectiveIteratively(session);
+      if (decision.completionTokens > 0) {
+        recordTokenUsage(session.tokens, decision.estimatedPromptTokens, decision.promptTokens, decision.completionTokens);
+      }
+      if (!decision.requestFailed) {
+        session.generationMs += decision.generationMs;
+        if (decision.lengthRetried) {
+          session.lengthRetries++;
+          session.tokens.requests++;   // recordTokenUsage() counted the retry's tokens as one request
+        }
+        session.generationLog += "  " + String(session.iterationCount) + ": " + String(decision.generationMs) + " ms, " +
+                                 String(decision.completionTokens) + " tokens (max_tokens " + String(decision.maxTokens) +
+                                 (session.terseResponse ? ", terse" : "") + (decision.lengthRetried ? ", length retry" : "") + ")\n";
+        logToRobotLogs("Generation: " + String(decision.generationMs) + " ms, " + String(decision.completionTokens) +
+                       " completion tokens, max_tokens " + String(decision.maxTokens));
+      }
+      
+      // Send a decision that can't be used back for correction instead of losing the iteration
+      if (DECISION_REPAIR_ENABLED && decision.schemaError.length() > 0) {
+        sendMqttMessage("Repairing planning decision: " + decision.schemaError);
+        decision = repairPlanningDecision(decision, session.repairs);
+      }
+      
+      // Only take over while nothing has run; the local plan starts from the beginning
+      if (decision.requestFailed && LOCAL_PLANNER_ENABLED && session.executionHistory.length() == 0 &&
+          beginLocalPlanning(objective, decision.reasoning)) {
+        decision = nextLocalDecision(localPlan, "");
+      }
+    }
+    if (decision.fromLocalPlanner) {
+      session.localIterations++;
+    }
+    if (decision.fromSkill) {
+      session.skillIterations++;
+    }
+    if (decision.jsonRepairs != 0) {
+      session.rescuedIterations++;
+      session.jsonRepairs |= decision.jsonRepairs;
+    }
+    String plannerTag = decision.fromLocalPlanner ? "[LOCAL] " : decision.fromSkill ? "[SKILL] " : "";
     
     // Send planning decision update
-    sendMqttMessage("Planning decision: " + String(decision.numToolCalls) + " tool calls - " + decision.reasoning);
+    sendMqttMessage(plannerTag + "Planning decision: " + String(decision.numToolCalls) + " tool calls - " + decision.reasoning);
     
     // ALWAYS execute tool calls first, regardless of should_continue or objective_complete
     if (decision.numToolCalls > 0) {
+      if (session.firstActionMs == 0) {
+        session.firstActionMs = millis() - session.startTime;
+      }
       String executionResults = executePlanningToolCalls(decision);
+      heapProfileMark("tools_executed");
       sendMqttMessage("Execution complete: " + String(decision.numToolCalls) + " tools executed");
       
       // Update session with results
       updatePlanningSession(session, decision, executionResults);
+      latestResults = executionResults;
+      if (SKILL_LIBRARY_ENABLED) {
+        recordSkillIteration(skillRecording, decision, executionResults);
+      }
+      
+      if (session.conversationMode && !decision.fromLocalPlanner) {
+        appendConversationTurn(planningConversation, session.iterationCount, decision.rawContent, executionResults, session.currentContext);
+      }
+    } else if (session.conversationMode && decision.rawContent.length() > 0) {
+      appendConversationTurn(planningConversation, session.iterationCount, decision.rawContent, "No tool calls executed", session.currentContext);
     }
     
     // Now check if planning should continue or stop
     if (!decision.shouldContinue) {
       logToRobotLogs("Planning decision: Stop planning - final tool calls executed");
-      sendMqttMessage("Planning decision: Stop planning - final tool calls executed - " + decision.reasoning);
+      sendMqttMessage(plannerTag + "Planning decision: Stop planning - final tool calls executed - " + decision.reasoning);
+      achieved = decision.objectiveComplete || session.isComplete;
       session.isComplete = true;
       session.finalResult = decision.reasoning;
       break;
@@ -428,7 +795,8 @@ String executeIterativePlanning(String objective) {
     
     if (decision.objectiveComplete) {
       logToRobotLogs("Planning decision: Objective complete - all tool calls executed");
-      sendMqttMessage("Planning decision: Objective complete - all tool calls executed - " + decision.reasoning);
+      sendMqttMessage(plannerTag + "Planning decision: Objective complete - all tool calls executed - " + decision.reasoning);
+      achieved = true;
       session.isComplete = true;
       session.finalResult = decision.reasoning;
       break;
@@ -437,17 +805,21 @@ String executeIterativePlanning(String objective) {
     // Check if goal was achieved during session update
     if (session.isComplete) {
       sendMqttMessage("SUCCESS: Planning stopped - objective has been achieved!");
+      achieved = true;
       break;
     }
     
     // Small delay between iterations
-    delay(500);
+    {
+      ScopedTrace sleepSpan("sleep_iteration");
+      delay(500);
+    }
   }
   
   // Handle timeout or max iterations
   if (!session.isComplete) {
-    if (session.iterationCount >= MAX_ITERATIONS) {
-      session.finalResult = "Planning stopped: Maximum iterations reached (" + String(MAX_ITERATIONS) + ")";
+    if (session.iterationCount >= (localPlan.active ? LOCAL_PLANNER_MAX_ITERATIONS : MAX_ITERATIONS)) {
+      session.finalResult = "Planning stopped: Maximum iterations reached (" + String(session.iterationCount) + ")";
       sendMqttMessage("Planning stopped: Maximum iterations reached");
     } else {
       session.finalResult = "Planning stopped: Time limit reached";
@@ -455,11 +827,53 @@ String executeIterativePlanning(String objective) {
     }
   }
   
+  heapProfileMark("planning_end");
+  String skillNote = SKILL_LIBRARY_ENABLED ? finishSkillSession(objective, achieved, session.localIterations == 0) : "";
+  
   String summary = "=== ITERATIVE PLANNING COMPLETE ===\n";
   summary += "Objective: " + objective + "\n";
   summary += "Iterations: " + String(session.iterationCount) + "\n";
   summary += "Total time: " + String((millis() - session.startTime) / 1000) + " seconds\n";
+  summary += "Time to first action: " + String(session.firstActionMs) + " ms\n";
   summary += "Final result: " + session.finalResult + "\n";
+  summary += "Prompt version: " + String(promptsManager.getActivePromptVersion()) + "\n";
+  summary += "Tokens: " + formatTokenUsage(session.tokens) + "\n";
+  if (session.localIterations > 0) {
+    summary += "Planner: local for " + String(session.localIterations) + " of " + String(session.iterationCount) + " iterations (LLM unreachable)\n";
+    summary += localPlan.log;
+  } else if (session.gatewayIterations > 0) {
+    summary += "Planner: gateway for " + String(session.gatewayIterations) + " of " + String(session.iterationCount) + " iterations\n";
+    summary += "Gateway: " + formatGatewayStats() + "\n";
+  } else if (session.skillIterations > 0 && session.skillIterations == session.iterationCount) {
+    summary += "Planner: skill library, no LLM requests\n";
+  } else {
+    summary += session.skillIterations > 0 ? "Planner: skill for " + String(session.skillIterations) + " of " +
+                                             String(session.iterationCount) + " iterations, then LLM\n" : "Planner: LLM\n";
+    summary += "Providers: " + formatLlmProviderStats() + "\n";
+    if (hedgeStats.requests > 0) {
+      summary += "Hedging: " + formatHedgeStats() + "\n";
+    }
+  }
+  if (session.generationLog.length() > 0) {
+    summary += "Generation (" + String(objectiveKindName(session.objectiveKind)) + " objective): " +
+               String(session.generationMs) + " ms total, " + String(session.lengthRetries) + " length retries\n";
+    summary += session.generationLog;
+  }
+  if (session.repairs.decisions > 0) {
+    summary += "Repairs: " + formatDecisionRepairStats(session.repairs) + "\n";
+  }
+  if (session.rescuedIterations > 0) {
+    summary += "Rescued iterations: " + String(session.rescuedIterations) + " (" + formatJsonRepairs(session.jsonRepairs) + ")\n";
+  }
+  if (visionStats.captured > 0) {
+    summary += "Vision: " + formatVisionStats() + "\n";
+  }
+  if (sensorSnapshotStats.taken + sensorSnapshotStats.inlineReads > 0) {
+    summary += "Sensors: " + formatSensorSnapshotStats() + "\n";
+  }
+  if (skillNote.length() > 0) {
+    summary += "Skills: " + skillNote + "\n";
+  }
   summary += "Execution history:\n" + session.executionHistory;
   
   // Send final summary
@@ -468,6 +882,10 @@ String executeIterativePlanning(String objective) {
   } else {
     sendMqttMessage("Planning complete: " + String(session.iterationCount) + " iterations, " + String((millis() - session.startTime) / 1000) + " seconds - " + session.finalResult);
   }
+  sendMqttMessage("Token usage: " + formatTokenUsage(session.tokens));
+  localPlan.active = false;
+  endGatewaySession();
+  setCaptureActive(false);
   
   logToRobotLogs(summary);
   return summary;
@@ -476,12 +894,114 @@ String executeIterativePlanning(String objective) {
 /**
  * Process objective through OpenAI for iterative planning
  */
-PlanningDecision processObjectiveIteratively(PlanningSession session) {
+PlanningDecision processObjectiveIteratively(const PlanningSession& session) {
   logToRobotLogs("Processing objective iteratively...");
   
-  String prompt = buildIterativePlanningPrompt(session);
-  String response = makeOpenAIRequest(prompt);
-  PlanningDecision decision = parsePlanningResponse(response);
+  int maxTokens = chooseMaxTokens(session.objectiveKind, session.terseResponse);
+  const char* styleNote = responseStyleNote(session.terseResponse);
+  int estimatedPromptTokens = 0;
+  unsigned long generationStart = millis();
+  PlanningDecision decision;
+  PlanningDecision cutOff;   // Reply that hit max_tokens, kept in case its retry fails
+  bool lengthRetry = false;
+  String sensorNote = "";    // Same readings for a retry on another provider
+  bool sensorsCollected = false;
+  
+  // A failed request is retried on the next healthy provider; the body is
+  // rebuilt because model and request options differ between providers
+  uint32_t triedProviders = 0;
+  while (true) {
+    int provider = chooseLlmProvider(triedProviders);
+    if (provider < 0) {
+      if (triedProviders == 0) {
+        decision = parsePlanningResponse("{\"error\": \"LLM circuit open\"}");
+      }
+      break;
+    }
+    if (triedProviders != 0) {
+      logToRobotLogs("Retrying on LLM provider " + String(currentLlmProvider().name));
+    }
+    triedProviders |= 1UL << provider;
+    
+    String response;
+    if (session.conversationMode) {
+      // Transcript is kept up to date by executeIterativePlanning(); the
+      // snapshot was read while it was compacted and is collected before the
+      // world state is formatted
+      if (SENSOR_SNAPSHOT_ENABLED && !sensorsCollected) {
+        sensorNote = sensorSnapshotNote(worldState);
+        sensorsCollected = true;
+      }
+      String world = formatWorldState(worldState);
+      {
+        ScopedTrace span("build_prompt");
+        buildConversationRequestBody(openAIRequestBody, planningConversation, maxTokens, styleNote, sensorNote, world);
+      }
+      heapProfileAlloc("planning_prompt", openAIRequestBody.length());
+      heapProfileMark("prompt_built");
+      
+      estimatedPromptTokens = conversationTokens(planningConversation) + estimateTokens(world) + estimateTokens(sensorNote);
+      logToRobotLogs("Conversation: " + String(conversationTurnCount(planningConversation)) + " turns, " +
+                     String(openAIRequestBody.length()) + " bytes, ~" + String(estimatedPromptTokens) +
+                     " tokens, max_tokens: " + String(maxTokens));
+      
+      response = makeOpenAIRequestBody(openAIRequestBody);
+    } else {
+      // Snapshot was read while the history was fitted; collected before
+      // rendering so the prompt's world state has its distance
+      if (SENSOR_SNAPSHOT_ENABLED && !sensorsCollected) {
+        sensorNote = sensorSnapshotNote(worldState);
+        sensorsCollected = true;
+      }
+      
+      const String& prompt = buildIterativePlanningPrompt(session);
+      heapProfileAlloc("planning_prompt", prompt.length());
+      heapProfileMark("prompt_built");
+      
+      estimatedPromptTokens = estimateChatPromptTokens(buildSystemPrompt(), prompt) + estimateTokens(sensorNote);
+      logToRobotLogs("Prompt estimate: " + String(estimatedPromptTokens) + " tokens, max_tokens: " + String(maxTokens));
+      
+      buildChatRequestBody(openAIRequestBody, prompt, maxTokens, styleNote, sensorNote);
+      response = makeOpenAIRequestBody(openAIRequestBody);
+    }
+    heapProfileMark("llm_response");
+    
+    decision = parsePlanningResponse(response);
+    decision.maxTokens = maxTokens;
+    
+    // Ask once more with a bigger budget rather than act on a cut-off decision
+    if (decision.truncated && !lengthRetry && maxTokens < RESPONSE_TOKENS_RETRY_MAX) {
+      cutOff = decision;
+      lengthRetry = true;
+      maxTokens = min(maxTokens * 2, RESPONSE_TOKENS_RETRY_MAX);
+      logToRobotLogs("Decision cut off at max_tokens " + String(cutOff.maxTokens) + ", retrying with " + String(maxTokens));
+      triedProviders &= ~(1UL << provider);
+      waitForLlmRateLimit();
+      continue;
+    }
+    if (!decision.requestFailed || WiFi.status() != WL_CONNECTED) {
+      break;
+    }
+  }
+  
+  if (!decision.requestFailed && !decision.truncated) {
+    recordResponseTokens(session.objectiveKind, session.terseResponse, decision.completionTokens);
+  }
+  if (lengthRetry) {
+    if (decision.requestFailed) {
+      // Fall back to what json_repair salvaged from the cut-off reply
+      decision = cutOff;
+    } else {
+      // Same prompt twice: count both requests' tokens
+      decision.completionTokens += cutOff.completionTokens;
+      decision.promptTokens = decision.promptTokens > 0 && cutOff.promptTokens > 0 ? decision.promptTokens + cutOff.promptTokens : -1;
+      estimatedPromptTokens *= 2;
+    }
+    decision.lengthRetried = true;
+  }
+  decision.estimatedPromptTokens = estimatedPromptTokens;
+  decision.generationMs = millis() - generationStart;
+  heapProfileMark("response_parsed");
   
   logToRobotLogs("Planning decision - Continue: " + String(decision.shouldContinue ? "true" : "false"));
   logToRobotLogs("Planning decision - Complete: " + String(decision.objectiveComplete ? "true" : "false"));
@@ -494,32 +1014,69 @@ PlanningDecision processObjectiveIteratively(PlanningSession session) {
 /**
  * Build prompt for iterative planning
  */
-String buildIterativePlanningPrompt(PlanningSession session) {
-  return promptsManager.formatPlanningPrompt(
+const String& buildIterativePlanningPrompt(const PlanningSession& session) {
+  ScopedTrace span("build_prompt");
+  String world = formatWorldState(worldState);
+  return promptsManager.renderPlanningPrompt(
     session.objective,
     session.currentContext,
-    session.executionHistory
+    session.executionHistory,
+    world
   );
 }
 
+/**
+ * Summarize old iterations until the planning prompt fits PROMPT_TOKEN_TARGET
+ */
+void fitPlanningSessionToBudget(PlanningSession& session) {
+  if (session.executionHistory.length() == 0) {
+    return;
+  }
+  
+  const String& prompt = buildIterativePlanningPrompt(session);
+  int promptTokens = estimateChatPromptTokens(buildSystemPrompt(), prompt);
+  if (promptTokens <= PROMPT_TOKEN_TARGET) {
+    return;
+  }
+  
+  int fixedTokens = promptTokens - estimateTokens(session.executionHistory);
+  session.tokens.historyCompactions += fitHistoryToTokenBudget(session.executionHistory, fixedTokens, PROMPT_TOKEN_TARGET);
+}
+
 /**
  * Parse planning response from OpenAI
  */
 PlanningDecision parsePlanningResponse(String jsonResponse) {
+  ScopedTrace span("parse_response");
+  
   PlanningDecision decision;
   decision.numToolCalls = 0;
   decision.shouldContinue = false;
   decision.objectiveComplete = false;
   decision.reasoning = "";
   decision.nextContext = "";
+  decision.rawContent = "";
+  decision.estimatedPromptTokens = 0;
+  decision.promptTokens = -1;
+  decision.completionTokens = 0;
+  decision.requestFailed = false;
+  decision.fromLocalPlanner = false;
+  decision.fromSkill = false;
+  decision.jsonRepairs = 0;
+  decision.truncated = false;
+  decision.maxTokens = 0;
+  decision.generationMs = 0;
+  decision.lengthRetried = false;
   
   // Check for error
   if (jsonResponse.indexOf("\"error\"") != -1) {
     decision.reasoning = "OpenAI API error: " + jsonResponse;
+    decision.requestFailed = true;
     return decision;
   }
   
   DynamicJsonDocument doc(2048);
+  heapProfileAlloc("planning_response_doc", 2048);
   DeserializationError error = deserializeJson(doc, jsonResponse);
   
   if (error) {
@@ -542,29 +1099,41 @@ PlanningDecision parsePlanningResponse(String jsonResponse) {
   }
   
   logToRobotLogs("OpenAI Planning Content: " + content);
+  if (doc["choices"][0].containsKey("finish_reason")) {
+    decision.truncated = doc["choices"][0]["finish_reason"].as<String>() == "length";
+  }
   
-  // Extract JSON content from markdown code blocks if present
-  String jsonContent = content;
-  if (content.indexOf("```json") != -1) {
-    int startIndex = content.indexOf("```json") + 7; // Skip "```json"
-    int endIndex = content.lastIndexOf("```");
-    if (endIndex > startIndex) {
-      jsonContent = content.substring(startIndex, endIndex);
-      logToRobotLogs("Extracted JSON from code block: " + jsonContent);
+  // Token usage, estimated from the content if the server doesn't report it
+  if (doc.containsKey("usage")) {
+    JsonObject usage = doc["usage"];
+    if (usage.containsKey("prompt_tokens")) {
+      decision.promptTokens = usage["prompt_tokens"].as<int>();
+    }
+    if (usage.containsKey("completion_tokens")) {
+      decision.completionTokens = usage["completion_tokens"].as<int>();
     }
   }
+  if (decision.completionTokens <= 0) {
+    decision.completionTokens = estimateTokens(content) + TOKEN_MESSAGE_OVERHEAD;
+  }
   
-  // Parse the content as JSON
+  // Parse the decision, repairing malformed or truncated output
   DynamicJsonDocument contentDoc(1024);
-  DeserializationError contentError = deserializeJson(contentDoc, jsonContent);
-  
-  if (contentError) {
-    logToRobotLogs("JSON Parse Error: " + String(contentError.c_str()));
+  heapProfileAlloc("planning_content_doc", 1024);
+  String jsonContent;
+  if (!parseDecisionContent(content, contentDoc, jsonContent, decision.jsonRepairs)) {
     logToRobotLogs("Raw content: " + content);
-    logToRobotLogs("Extracted JSON content: " + jsonContent);
-    decision.reasoning = "Content JSON parsing failed: " + String(contentError.c_str());
+    decision.reasoning = "Content JSON parsing failed: no decision object found";
+    decision.rawContent = content;
+    decision.schemaError = "the reply is not a JSON object with tool_calls and should_continue";
     return decision;
   }
+  if (decision.jsonRepairs != 0) {
+    logToRobotLogs("Repaired decision JSON (" + formatJsonRepairs(decision.jsonRepairs) + "): " + jsonContent);
+  }
+  
+  jsonContent.trim();
+  decision.rawContent = jsonContent;
   
   // Extract tool calls
   if (contentDoc.containsKey("tool_calls")) {
@@ -582,10 +1151,13 @@ PlanningDecision parsePlanningResponse(String jsonResponse) {
   }
   
   // Extract planning decision
-  decision.shouldContinue = contentDoc.containsKey("should_continue") ? contentDoc["should_continue"].as<bool>() : false;
+  // A response cut off before should_continue still has work left to do
   decision.objectiveComplete = contentDoc.containsKey("objective_complete") ? contentDoc["objective_complete"].as<bool>() : false;
+  decision.shouldContinue = contentDoc.containsKey("should_continue") ? contentDoc["should_continue"].as<bool>()
+                            : (decision.jsonRepairs & JSON_REPAIR_TRUNCATED) && !decision.objectiveComplete;
   decision.reasoning = contentDoc.containsKey("reasoning") ? contentDoc["reasoning"].as<String>() : "";
   decision.nextContext = contentDoc.containsKey("next_context") ? contentDoc["next_context"].as<String>() : "";
+  decision.schemaError = planningDecisionSchemaError(decision);
   
   return decision;
 }
@@ -594,6 +1166,8 @@ PlanningDecision parsePlanningResponse(String jsonResponse) {
  * Execute tool calls from planning decision
  */
 String executePlanningToolCalls(PlanningDecision decision) {
+  ScopedTrace span("execute_tools");
+  
   if (decision.numToolCalls == 0) {
     return "No tool calls to execute in this iteration";
   }
@@ -608,13 +1182,22 @@ String executePlanningToolCalls(PlanningDecision decision) {
       continue;
     }
     
+    // Diagnostics and prompt/skill admin stay out of plans, whoever wrote them
+    if (isDirectOnlyTool(call.tool)) {
+      executionResults += "[" + String(i + 1) + "] " + call.tool + ": Error: only available as a direct tool command\n";
+      continue;
+    }
+    
     logToRobotLogs("Executing planning tool: " + call.tool + " with params: '" + call.params + "'");
+    Pose before = getPose();
     String toolResult = executeTool(call.tool, call.params);
+    recordWorldToolResult(worldState, call.tool, call.params, toolResult, before);
     
     executionResults += "[" + String(i + 1) + "] " + call.tool + ": " + toolResult + "\n";
     
     // 250ms delay between tool calls
     if (i < decision.numToolCalls - 1) {
+      ScopedTrace sleepSpan("sleep_between_tools");
       delay(250);
     }
   }
@@ -707,19 +1290,17 @@ void updatePlanningSession(PlanningSession &session, PlanningDecision decision,
   session.executionHistory += "Reasoning: " + decision.reasoning + "\n";
   session.executionHistory += executionResults;
   
-  // Evaluate if goal has been achieved
-  bool goalAchieved = evaluateGoalCompletion(session, executionResults);
+  // Evaluate if goal has been achieved (the offline planner tracks its own steps)
+  bool goalAchieved = !decision.fromLocalPlanner && evaluateGoalCompletion(session, executionResults);
   if (goalAchieved) {
     session.isComplete = true;
     session.finalResult = "Objective achieved based on goal evaluation";
     sendMqttMessage("SUCCESS: Goal evaluation indicates objective has been achieved!");
   }
   
-  // Update context for next iteration
+  // The planner's note for the next iteration; facts are kept in worldState
   if (decision.nextContext.length() > 0) {
     session.currentContext = decision.nextContext;
-  } else {
-    session.currentContext = "Completed iteration " + String(session.iterationCount) + ". " + session.currentContext;
   }
 }
 
@@ -0,0 +1,50 @@
+#ifndef PLANNER_GATEWAY_H
+#define PLANNER_GATEWAY_H
+
+#include <Arduino.h>
+#include "openai_processor.h"
+
+#define GATEWAY_REQUEST_TOPIC "ajlisy/robotplanner/request"     // Car -> gateway: state and tool results
+#define GATEWAY_REPLY_TOPIC_PREFIX "ajlisy/robotplanner/reply/" // Gateway -> car, followed by the robot id
+#define GATEWAY_MAX_RESULTS_CHARS 1500  // Tool results sent per request (the start is cut if longer)
+#define GATEWAY_REPLY_DOC_SIZE 1536     // Replies fit the 1024-byte MQTT buffer
+#define GATEWAY_POLL_MS 10              // Delay between client.loop() calls while waiting
+
+// The request waiting for a gateway reply
+struct GatewayExchange {
+  bool active;          // Current objective is planned by the gateway
+  uint32_t session;     // Trace id of the objective
+  int sequence;         // Iteration the request was sent for
+  bool replied;
+  unsigned long sentAt;
+  PlanningDecision decision;
+};
+
+// Gateway use since boot
+struct GatewayStats {
+  unsigned long requests;
+  unsigned long replies;
+  unsigned long failures;     // Timeouts, gateway errors and failed publishes
+  unsigned long lastFailure;
+  unsigned long totalWaitMs;  // Request to reply, replies only
+  unsigned long bytesSent;
+  unsigned long bytesReceived;
+};
+
+extern GatewayExchange gatewayExchange;
+extern GatewayStats gatewayStats;
+extern bool gatewayPumping;
+extern uint32_t gatewayBootId;
+
+// Function declarations
+String gatewayReplyTopic();
+bool gatewayAvailable();
+bool publishGatewayMessage(const String& json);
+bool publishGatewayRequest(const PlanningSession& session, const String& latestResults);
+bool handleGatewayReply(const byte* payload, unsigned int length);
+PlanningDecision requestGatewayDecision(const PlanningSession& session, const String& latestResults);
+void beginGatewaySession(uint32_t session);
+void endGatewaySession();
+String formatGatewayStats();
+
+#endif // PLANNER_GATEWAY_H
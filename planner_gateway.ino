@@ -0,0 +1,266 @@
+#include "planner_gateway.h"
+#include "robot_tools.h"
+#include "odometry.h"
+#include "trace.h"
+#include "world_state.h"
+#include "prompts_manager.h"
+
+GatewayExchange gatewayExchange;
+GatewayStats gatewayStats = {0, 0, 0, 0, 0, 0, 0};
+
+// True while requestGatewayDecision() pumps the MQTT client; commands that
+// arrive meanwhile must not start another planning session
+bool gatewayPumping = false;
+
+// Random per boot and sent with every message: session ids are trace ids,
+// which restart after a reboot, so the gateway keys sessions on both
+uint32_t gatewayBootId = 0;
+
+/**
+ * Topic the gateway publishes this car's replies on
+ */
+String gatewayReplyTopic() {
+  return String(GATEWAY_REPLY_TOPIC_PREFIX) + getRobotId();
+}
+
+/**
+ * Whether the next objective should be planned by the gateway
+ * After a failure the gateway is skipped for GATEWAY_RETRY_MS.
+ */
+bool gatewayAvailable() {
+  if (!GATEWAY_ENABLED || !client.connected()) {
+    return false;
+  }
+  return gatewayStats.failures == 0 || millis() - gatewayStats.lastFailure >= GATEWAY_RETRY_MS;
+}
+
+/**
+ * Publish on GATEWAY_REQUEST_TOPIC
+ * Streams the payload, so requests aren't limited by the MQTT buffer size.
+ */
+bool publishGatewayMessage(const String& json) {
+  if (!client.connected()) {
+    return false;
+  }
+  if (!client.beginPublish(GATEWAY_REQUEST_TOPIC, json.length(), false)) {
+    return false;
+  }
+  client.write((const uint8_t*)json.c_str(), json.length());
+  gatewayStats.bytesSent += json.length();
+  return client.endPublish() == 1;
+}
+
+/**
+ * Send the state for the next iteration to the gateway
+ * {"robot_id":"car_a1b2c3","boot":2739011,"session":123,"seq":2,"objective":"...",
+ *  "prompt_version":3,"prompt_crc":1234567,"results":"Iteration tool calls:\n[1] ...",
+ *  "pose":[12.5,0.0,90.0]}
+ * The gateway keeps the prompt and history; the car only sends what changed.
+ * It plans with the prompt whose CRC32 matches the car's active one, or
+ * replies with an error so the car plans on board.
+ * @param session Planning session; iterationCount is the sequence number
+ * @param latestResults Tool results of the previous batch ("" on the first iteration)
+ */
+bool publishGatewayRequest(const PlanningSession& session, const String& latestResults) {
+  Pose pose = getPose();
+  String results = latestResults;
+  if (results.length() > GATEWAY_MAX_RESULTS_CHARS) {
+    results = "..." + results.substring(results.length() - GATEWAY_MAX_RESULTS_CHARS);
+  }
+
+  String world = formatWorldState(worldState);
+  String json;
+  json.reserve(results.length() + session.objective.length() + world.length() + 224);
+  json += "{\"robot_id\":";
+  appendJsonString(json, getRobotId());
+  json += ",\"boot\":";
+  json += String(gatewayBootId);
+  json += ",\"session\":";
+  json += String(gatewayExchange.session);
+  json += ",\"seq\":";
+  json += String(session.iterationCount);
+  json += ",\"objective\":";
+  appendJsonString(json, session.objective);
+  json += ",\"prompt_version\":";
+  json += String(promptsManager.getActivePromptVersion());
+  json += ",\"prompt_crc\":";
+  json += String(promptsManager.getActivePromptCrc());
+  json += ",\"results\":";
+  appendJsonString(json, results);
+  json += ",\"world\":";
+  appendJsonString(json, world);
+  json += ",\"pose\":[" + String(pose.x, 1) + "," + String(pose.y, 1) + "," + String(pose.heading, 1) + "]}";
+
+  gatewayExchange.sequence = session.iterationCount;
+  gatewayExchange.replied = false;
+  gatewayExchange.sentAt = millis();
+  gatewayStats.requests++;
+  return publishGatewayMessage(json);
+}
+
+/**
+ * Handle a message on this car's reply topic
+ * {"session":123,"seq":2,"calls":[["move_car","forward 500",0.95]],
+ *  "continue":true,"complete":false,"reasoning":"...","context":"...",
+ *  "usage":{"prompt":1650,"completion":70}}
+ * or {"session":123,"seq":2,"error":"..."}. Replies to other requests are ignored.
+ * @return true if the reply answered the outstanding request
+ */
+bool handleGatewayReply(const byte* payload, unsigned int length) {
+  if (!gatewayExchange.active || gatewayExchange.replied) {
+    return false;
+  }
+
+  DynamicJsonDocument doc(GATEWAY_REPLY_DOC_SIZE);
+  if (deserializeJson(doc, payload, length)) {
+    return false;
+  }
+  if (doc["session"].as<uint32_t>() != gatewayExchange.session || doc["seq"].as<int>() != gatewayExchange.sequence) {
+    return false;
+  }
+
+  PlanningDecision& decision = gatewayExchange.decision;
+  decision.numToolCalls = 0;
+  decision.shouldContinue = false;
+  decision.objectiveComplete = false;
+  decision.reasoning = "";
+  decision.nextContext = "";
+  decision.rawContent = "";
+  decision.estimatedPromptTokens = 0;
+  decision.promptTokens = -1;
+  decision.completionTokens = 0;
+  decision.requestFailed = false;
+  decision.fromLocalPlanner = false;
+  decision.fromSkill = false;
+  decision.jsonRepairs = 0;
+  decision.truncated = false;
+  decision.maxTokens = 0;
+  decision.generationMs = 0;
+  decision.lengthRetried = false;
+
+  if (doc.containsKey("error")) {
+    decision.requestFailed = true;
+    decision.reasoning = "Gateway error: " + doc["error"].as<String>();
+  } else {
+    JsonArray calls = doc["calls"];
+    decision.numToolCalls = min((int)calls.size(), 5);
+    for (int i = 0; i < decision.numToolCalls; i++) {
+      JsonArray call = calls[i];
+      decision.toolCalls[i].tool = call[0].as<String>();
+      decision.toolCalls[i].params = call[1].as<String>();
+      decision.toolCalls[i].confidence = call[2].as<float>();
+      decision.toolCalls[i].isValid = decision.toolCalls[i].confidence > 0.9;
+    }
+    decision.shouldContinue = doc.containsKey("continue") ? doc["continue"].as<bool>() : false;
+    decision.objectiveComplete = doc.containsKey("complete") ? doc["complete"].as<bool>() : false;
+    decision.reasoning = doc.containsKey("reasoning") ? doc["reasoning"].as<String>() : "";
+    decision.nextContext = doc.containsKey("context") ? doc["context"].as<String>() : "";
+    if (doc.containsKey("usage")) {
+      JsonObject usage = doc["usage"];
+      if (usage.containsKey("prompt")) {
+        decision.promptTokens = usage["prompt"].as<int>();
+      }
+      if (usage.containsKey("completion")) {
+        decision.completionTokens = usage["completion"].as<int>();
+      }
+    }
+  }
+
+  gatewayExchange.replied = true;
+  gatewayStats.bytesReceived += length;
+  return true;
+}
+
+/**
+ * Get the next planning decision from the gateway
+ * Pumps the MQTT client until the reply arrives or GATEWAY_TIMEOUT_MS passes.
+ * @return Decision; requestFailed is set if the gateway didn't answer
+ */
+PlanningDecision requestGatewayDecision(const PlanningSession& session, const String& latestResults) {
+  ScopedTrace span("gateway_wait");
+
+  PlanningDecision failed;
+  failed.numToolCalls = 0;
+  failed.shouldContinue = false;
+  failed.objectiveComplete = false;
+  failed.nextContext = "";
+  failed.rawContent = "";
+  failed.estimatedPromptTokens = 0;
+  failed.promptTokens = -1;
+  failed.completionTokens = 0;
+  failed.requestFailed = true;
+  failed.fromLocalPlanner = false;
+  failed.fromSkill = false;
+  failed.jsonRepairs = 0;
+  failed.truncated = false;
+  failed.maxTokens = 0;
+  failed.generationMs = 0;
+  failed.lengthRetried = false;
+
+  if (!publishGatewayRequest(session, latestResults)) {
+    gatewayStats.failures++;
+    gatewayStats.lastFailure = millis();
+    failed.reasoning = "Gateway request could not be published";
+    return failed;
+  }
+
+  gatewayPumping = true;
+  while (!gatewayExchange.replied && millis() - gatewayExchange.sentAt < GATEWAY_TIMEOUT_MS && client.connected()) {
+    client.loop();
+    delay(GATEWAY_POLL_MS);
+  }
+  gatewayPumping = false;
+
+  unsigned long waitMs = millis() - gatewayExchange.sentAt;
+  if (!gatewayExchange.replied) {
+    gatewayStats.failures++;
+    gatewayStats.lastFailure = millis();
+    failed.reasoning = "No reply from gateway in " + String(waitMs) + " ms";
+    return failed;
+  }
+
+  gatewayStats.replies++;
+  gatewayStats.totalWaitMs += waitMs;
+  logToRobotLogs("Gateway reply in " + String(waitMs) + " ms: " + String(gatewayExchange.decision.numToolCalls) + " tool calls");
+  if (gatewayExchange.decision.requestFailed) {
+    gatewayStats.failures++;
+    gatewayStats.lastFailure = millis();
+  }
+  return gatewayExchange.decision;
+}
+
+/**
+ * Start planning an objective on the gateway
+ * @param session Session id, unique per objective (the trace id)
+ */
+void beginGatewaySession(uint32_t session) {
+  if (gatewayBootId == 0) {
+    gatewayBootId = esp_random() | 1;
+  }
+  gatewayExchange.active = true;
+  gatewayExchange.session = session;
+  gatewayExchange.sequence = 0;
+  gatewayExchange.replied = false;
+}
+
+/**
+ * Tell the gateway the objective is over so it can drop the session's history
+ */
+void endGatewaySession() {
+  if (!gatewayExchange.active) {
+    return;
+  }
+  gatewayExchange.active = false;
+  publishGatewayMessage("{\"robot_id\":\"" + getRobotId() + "\",\"boot\":" + String(gatewayBootId) + ",\"session\":" +
+                        String(gatewayExchange.session) + ",\"done\":true}");
+}
+
+/**
+ * One-line summary, e.g. "12 requests, 11 replies, 1 failures, mean wait 950 ms, 6 KB sent, 4 KB received"
+ */
+String formatGatewayStats() {
+  unsigned long meanWait = gatewayStats.replies > 0 ? gatewayStats.totalWaitMs / gatewayStats.replies : 0;
+  return String(gatewayStats.requests) + " requests, " + String(gatewayStats.replies) + " replies, " +
+         String(gatewayStats.failures) + " failures, mean wait " + String(meanWait) + " ms, " +
+         String(gatewayStats.bytesSent / 1024) + " KB sent, " + String(gatewayStats.bytesReceived / 1024) + " KB received";
+}
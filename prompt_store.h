@@ -0,0 +1,33 @@
+#ifndef PROMPT_STORE_H
+#define PROMPT_STORE_H
+
+#include <Arduino.h>
+#include <Preferences.h>
+
+#define PROMPT_TOPIC "ajlisy/robotprompt"   // MQTT topic for prompt push/activate/rollback
+#define PROMPT_STORE_NAMESPACE "prompts"    // Preferences (NVS) namespace
+#define PROMPT_STORE_SLOTS 3                // Versions kept in NVS besides the built-in one
+#define PROMPT_MAX_LENGTH 12000             // Largest template accepted over MQTT
+#define PROMPT_MQTT_BUFFER_SIZE 1024        // PubSubClient buffer, fits one chunk message
+#define PROMPT_BUILTIN_VERSION 0            // Version number of the prompt compiled into flash
+
+// Function declarations
+uint32_t crc32Update(uint32_t crc, const uint8_t* data, size_t length);
+uint32_t promptCrc32(const String& text);
+void promptSlotKey(char* key, size_t size, int slot, const char* field);
+int findPromptSlot(Preferences& prefs, uint32_t version);
+int choosePromptSlot(Preferences& prefs, uint32_t version);
+bool savePromptVersion(uint32_t version, const String& text);
+bool loadPromptVersion(uint32_t version, String& text);
+uint32_t loadActivePromptVersion();
+void saveActivePromptVersion(uint32_t active, uint32_t previous);
+uint32_t loadPreviousPromptVersion();
+String listPromptVersions();
+String worldStateSlotWarning(const String& text);
+String activatePromptVersion(uint32_t version);
+String rollbackPrompt();
+void publishPromptStoreReply(const String& op, uint32_t version, const String& message);
+String handlePromptStoreMessage(const byte* payload, unsigned int length);
+String promptStore(String params);
+
+#endif // PROMPT_STORE_H
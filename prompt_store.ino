@@ -0,0 +1,409 @@
+#include "prompt_store.h"
+#include "prompts_manager.h"
+#include "robot_tools.h"
+
+// Upload in progress, assembled from chunk messages until commit
+String promptUploadText = "";
+uint32_t promptUploadVersion = 0;
+uint32_t promptUploadLength = 0;
+uint32_t promptUploadCrc = 0;
+
+/**
+ * Update a CRC-32 (IEEE, same as zlib.crc32) with more data
+ * @param crc Running CRC, 0 to start
+ * @param data Bytes to add
+ * @param length Number of bytes
+ * @return Updated CRC
+ */
+uint32_t crc32Update(uint32_t crc, const uint8_t* data, size_t length) {
+  crc = ~crc;
+  for (size_t i = 0; i < length; i++) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+uint32_t promptCrc32(const String& text) {
+  return crc32Update(0, (const uint8_t*)text.c_str(), text.length());
+}
+
+/**
+ * Build the NVS key for a slot field, e.g. "s1_text"
+ */
+void promptSlotKey(char* key, size_t size, int slot, const char* field) {
+  snprintf(key, size, "s%d_%s", slot, field);
+}
+
+/**
+ * Find the NVS slot holding a version
+ * @return Slot index, or -1 if the version isn't stored
+ */
+int findPromptSlot(Preferences& prefs, uint32_t version) {
+  char key[16];
+  for (int slot = 0; slot < PROMPT_STORE_SLOTS; slot++) {
+    promptSlotKey(key, sizeof(key), slot, "ver");
+    if (prefs.getUInt(key, 0) == version) {
+      return slot;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Pick the slot a new version is written to: its existing slot, an empty
+ * one, or the oldest version that is neither active nor the rollback target
+ * @return Slot index, or -1 if every slot is in use
+ */
+int choosePromptSlot(Preferences& prefs, uint32_t version) {
+  int existing = findPromptSlot(prefs, version);
+  if (existing >= 0) {
+    return existing;
+  }
+
+  uint32_t active = prefs.getUInt("active", PROMPT_BUILTIN_VERSION);
+  uint32_t previous = prefs.getUInt("previous", PROMPT_BUILTIN_VERSION);
+  int victim = -1;
+  uint32_t victimVersion = 0xFFFFFFFF;
+  char key[16];
+
+  for (int slot = 0; slot < PROMPT_STORE_SLOTS; slot++) {
+    promptSlotKey(key, sizeof(key), slot, "ver");
+    uint32_t stored = prefs.getUInt(key, PROMPT_BUILTIN_VERSION);
+    if (stored == PROMPT_BUILTIN_VERSION) {
+      return slot;
+    }
+    if (stored != active && stored != previous && stored < victimVersion) {
+      victim = slot;
+      victimVersion = stored;
+    }
+  }
+
+  return victim;
+}
+
+/**
+ * Store a prompt version in NVS with its CRC
+ * The slot's version is cleared first, so an interrupted write never
+ * leaves a version pointing at half-written text.
+ * @return true if the text was written and reads back intact
+ */
+bool savePromptVersion(uint32_t version, const String& text) {
+  Preferences prefs;
+  if (!prefs.begin(PROMPT_STORE_NAMESPACE, false)) {
+    return false;
+  }
+
+  int slot = choosePromptSlot(prefs, version);
+  if (slot < 0) {
+    prefs.end();
+    return false;
+  }
+
+  char key[16];
+  promptSlotKey(key, sizeof(key), slot, "ver");
+  prefs.putUInt(key, PROMPT_BUILTIN_VERSION);
+
+  promptSlotKey(key, sizeof(key), slot, "text");
+  size_t written = prefs.putBytes(key, text.c_str(), text.length());
+  promptSlotKey(key, sizeof(key), slot, "crc");
+  prefs.putUInt(key, promptCrc32(text));
+
+  if (written != text.length()) {
+    prefs.end();
+    return false;
+  }
+
+  promptSlotKey(key, sizeof(key), slot, "ver");
+  prefs.putUInt(key, version);
+  prefs.end();
+
+  String check;
+  return loadPromptVersion(version, check);
+}
+
+/**
+ * Load a prompt version from NVS and verify its CRC
+ * @param version Version to load
+ * @param text Receives the template text
+ * @return false if the version is missing or corrupt
+ */
+bool loadPromptVersion(uint32_t version, String& text) {
+  Preferences prefs;
+  if (!prefs.begin(PROMPT_STORE_NAMESPACE, true)) {
+    return false;
+  }
+
+  int slot = findPromptSlot(prefs, version);
+  if (slot < 0) {
+    prefs.end();
+    return false;
+  }
+
+  char key[16];
+  promptSlotKey(key, sizeof(key), slot, "text");
+  size_t length = prefs.getBytesLength(key);
+  char* buffer = (char*)malloc(length + 1);
+  if (buffer == nullptr) {
+    prefs.end();
+    return false;
+  }
+  prefs.getBytes(key, buffer, length);
+  buffer[length] = '\0';
+
+  promptSlotKey(key, sizeof(key), slot, "crc");
+  uint32_t storedCrc = prefs.getUInt(key, 0);
+  prefs.end();
+
+  uint32_t crc = crc32Update(0, (const uint8_t*)buffer, length);
+  if (crc != storedCrc || strlen(buffer) != length) {
+    free(buffer);
+    logToRobotLogs("Prompt store: version " + String(version) + " failed CRC check");
+    return false;
+  }
+
+  text = buffer;
+  free(buffer);
+  return true;
+}
+
+uint32_t loadActivePromptVersion() {
+  Preferences prefs;
+  if (!prefs.begin(PROMPT_STORE_NAMESPACE, true)) {
+    return PROMPT_BUILTIN_VERSION;
+  }
+  uint32_t version = prefs.getUInt("active", PROMPT_BUILTIN_VERSION);
+  prefs.end();
+  return version;
+}
+
+uint32_t loadPreviousPromptVersion() {
+  Preferences prefs;
+  if (!prefs.begin(PROMPT_STORE_NAMESPACE, true)) {
+    return PROMPT_BUILTIN_VERSION;
+  }
+  uint32_t version = prefs.getUInt("previous", PROMPT_BUILTIN_VERSION);
+  prefs.end();
+  return version;
+}
+
+void saveActivePromptVersion(uint32_t active, uint32_t previous) {
+  Preferences prefs;
+  if (!prefs.begin(PROMPT_STORE_NAMESPACE, false)) {
+    return;
+  }
+  prefs.putUInt("active", active);
+  prefs.putUInt("previous", previous);
+  prefs.end();
+}
+
+/**
+ * List stored versions as "0 (built-in), 3, 4 (active)"
+ */
+String listPromptVersions() {
+  uint32_t active = promptsManager.getActivePromptVersion();
+  String list = "0 (built-in)";
+  if (active == PROMPT_BUILTIN_VERSION) {
+    list += " (active)";
+  }
+
+  Preferences prefs;
+  if (!prefs.begin(PROMPT_STORE_NAMESPACE, true)) {
+    return list;
+  }
+
+  char key[16];
+  for (int slot = 0; slot < PROMPT_STORE_SLOTS; slot++) {
+    promptSlotKey(key, sizeof(key), slot, "ver");
+    uint32_t version = prefs.getUInt(key, PROMPT_BUILTIN_VERSION);
+    if (version == PROMPT_BUILTIN_VERSION) {
+      continue;
+    }
+    list += ", " + String(version);
+    if (version == active) {
+      list += " (active)";
+    }
+  }
+  prefs.end();
+  return list;
+}
+
+/**
+ * Note for a template without a {{WORLD_STATE}} slot, "" if it has one
+ */
+String worldStateSlotWarning(const String& text) {
+  if (promptsManager.templateHasWorldState(text)) {
+    return "";
+  }
+  return "; warning: no {{WORLD_STATE}} placeholder, the world state is appended after the prompt";
+}
+
+/**
+ * Make a stored version the planning prompt and remember it across reboots
+ * @param version Version to activate, 0 for the built-in prompt
+ * @return Result message, starting with "Error" on failure
+ */
+String activatePromptVersion(uint32_t version) {
+  uint32_t current = promptsManager.getActivePromptVersion();
+  if (version == current) {
+    return "Prompt version " + String(version) + " is already active";
+  }
+
+  String text = "";
+  if (version != PROMPT_BUILTIN_VERSION && !loadPromptVersion(version, text)) {
+    return "Error: Prompt version " + String(version) + " is not stored or is corrupt";
+  }
+
+  if (!promptsManager.activateTemplate(version, text)) {
+    return "Error: Prompt version " + String(version) + " is not a valid planning template";
+  }
+
+  saveActivePromptVersion(version, current);
+  return "Activated prompt version " + String(version) + " (previous " + String(current) + ")" +
+         (version != PROMPT_BUILTIN_VERSION ? worldStateSlotWarning(text) : String(""));
+}
+
+/**
+ * Switch back to the previously active version
+ */
+String rollbackPrompt() {
+  return activatePromptVersion(loadPreviousPromptVersion());
+}
+
+/**
+ * Publish the result of a prompt store operation on PROMPT_TOPIC
+ */
+void publishPromptStoreReply(const String& op, uint32_t version, const String& message) {
+  if (!client.connected()) {
+    return;
+  }
+
+  DynamicJsonDocument doc(512);
+  doc["robot_id"] = getRobotId();
+  doc["op"] = op;
+  doc["version"] = version;
+  doc["ok"] = !message.startsWith("Error");
+  doc["active_version"] = promptsManager.getActivePromptVersion();
+  doc["message"] = message;
+
+  String jsonString;
+  serializeJson(doc, jsonString);
+  client.publish(PROMPT_TOPIC, jsonString.c_str());
+}
+
+/**
+ * Handle one message on PROMPT_TOPIC
+ * Upload: {"op":"begin","version":7,"length":4700,"crc32":123}, then
+ * {"op":"chunk","version":7,"offset":0,"data":"..."} in order, then
+ * {"op":"commit","version":7}. Commit verifies length and CRC, checks the
+ * template compiles and stores it; it does not activate it.
+ * Control: {"op":"activate","version":7}, {"op":"rollback"}, {"op":"list"}.
+ * An optional "target" addresses one car, so variants can be split across a fleet.
+ * @return Result message, empty if the message was not for this car
+ */
+String handlePromptStoreMessage(const byte* payload, unsigned int length) {
+  DynamicJsonDocument doc(PROMPT_MQTT_BUFFER_SIZE + 256);
+  DeserializationError error = deserializeJson(doc, payload, length);
+  if (error) {
+    return "Error: Invalid prompt store message: " + String(error.c_str());
+  }
+
+  // Replies from this or other cars
+  if (doc.containsKey("robot_id")) {
+    return "";
+  }
+  if (doc.containsKey("target") && doc["target"].as<String>() != getRobotId()) {
+    return "";
+  }
+
+  String op = doc["op"].as<String>();
+  uint32_t version = doc.containsKey("version") ? doc["version"].as<uint32_t>() : PROMPT_BUILTIN_VERSION;
+  String result;
+
+  if (op == "begin") {
+    uint32_t expectedLength = doc["length"].as<uint32_t>();
+    if (version == PROMPT_BUILTIN_VERSION) {
+      result = "Error: Version 0 is reserved for the built-in prompt";
+    } else if (expectedLength == 0 || expectedLength > PROMPT_MAX_LENGTH) {
+      result = "Error: Prompt length must be 1-" + String(PROMPT_MAX_LENGTH) + " bytes";
+    } else {
+      promptUploadText = "";
+      promptUploadText.reserve(expectedLength);
+      promptUploadVersion = version;
+      promptUploadLength = expectedLength;
+      promptUploadCrc = doc["crc32"].as<uint32_t>();
+      result = "Receiving prompt version " + String(version) + " (" + String(expectedLength) + " bytes)";
+    }
+  } else if (op == "chunk") {
+    uint32_t offset = doc["offset"].as<uint32_t>();
+    if (version != promptUploadVersion || promptUploadVersion == PROMPT_BUILTIN_VERSION) {
+      result = "Error: No upload in progress for version " + String(version);
+    } else if (offset != promptUploadText.length()) {
+      result = "Error: Expected offset " + String(promptUploadText.length()) + ", got " + String(offset);
+    } else {
+      promptUploadText += doc["data"].as<String>();
+      if (promptUploadText.length() > promptUploadLength) {
+        result = "Error: Upload exceeds declared length";
+        promptUploadVersion = PROMPT_BUILTIN_VERSION;
+        promptUploadText = "";
+      } else {
+        // Chunks are acknowledged only on error, to keep the topic quiet
+        return "Chunk at " + String(offset) + " received";
+      }
+    }
+  } else if (op == "commit") {
+    if (version != promptUploadVersion || promptUploadVersion == PROMPT_BUILTIN_VERSION) {
+      result = "Error: No upload in progress for version " + String(version);
+    } else if (promptUploadText.length() != promptUploadLength) {
+      result = "Error: Received " + String(promptUploadText.length()) + " of " + String(promptUploadLength) + " bytes";
+    } else if (promptCrc32(promptUploadText) != promptUploadCrc) {
+      result = "Error: CRC mismatch, upload discarded";
+    } else if (!promptsManager.isValidPlanningTemplate(promptUploadText)) {
+      result = "Error: Template needs {{OBJECTIVE}} and {{EXECUTION_HISTORY}} placeholders";
+    } else if (!savePromptVersion(version, promptUploadText)) {
+      result = "Error: Could not write prompt version " + String(version) + " to NVS";
+    } else {
+      result = "Stored prompt version " + String(version) + " (" + String(promptUploadLength) + " bytes)" +
+               worldStateSlotWarning(promptUploadText);
+    }
+    promptUploadVersion = PROMPT_BUILTIN_VERSION;
+    promptUploadText = "";
+  } else if (op == "activate") {
+    result = activatePromptVersion(version);
+  } else if (op == "rollback") {
+    result = rollbackPrompt();
+    version = promptsManager.getActivePromptVersion();
+  } else if (op == "list") {
+    result = "Prompt versions: " + listPromptVersions();
+  } else {
+    result = "Error: Unknown prompt store op '" + op + "'";
+  }
+
+  logToRobotLogs("Prompt store: " + result);
+  publishPromptStoreReply(op, version, result);
+  return result;
+}
+
+/**
+ * Tool: Prompt Store
+ * Manages stored planning prompt versions. Uploads go over PROMPT_TOPIC.
+ * @param params "list", "activate <version>" or "rollback"
+ * @return String result
+ */
+String promptStore(String params) {
+  params.trim();
+
+  if (params == "" || params == "list") {
+    return "Prompt versions: " + listPromptVersions();
+  }
+  if (params == "rollback") {
+    return rollbackPrompt();
+  }
+  if (params.startsWith("activate ")) {
+    return activatePromptVersion(params.substring(9).toInt());
+  }
+
+  return "Error: Usage 'list', 'activate <version>' or 'rollback'";
+}
@@ -0,0 +1,159 @@
+#ifndef PROMPT_TEMPLATE_H
+#define PROMPT_TEMPLATE_H
+
+#include <Arduino.h>
+
+#define MAX_PROMPT_SEGMENTS 16
+
+// Named slots a template can reference as {{NAME}}
+enum PromptSlot {
+  SLOT_OBJECTIVE = 0,
+  SLOT_CONTEXT,
+  SLOT_EXECUTION_HISTORY,
+  SLOT_WORLD_STATE,
+  NUM_PROMPT_SLOTS
+};
+
+const char* const PROMPT_SLOT_NAMES[NUM_PROMPT_SLOTS] = {
+  "OBJECTIVE",
+  "CONTEXT",
+  "EXECUTION_HISTORY",
+  "WORLD_STATE"
+};
+
+// A literal run of template text, optionally followed by a slot
+struct PromptSegment {
+  const char* text;     // Points into the template source (not copied)
+  uint16_t length;
+  int8_t slot;          // PromptSlot to insert after the text, or -1
+};
+
+/**
+ * Prompt template split into literal segments and slots once, so each
+ * render is a single pass with one allocation into a reusable buffer.
+ * The source text must outlive the template.
+ */
+class PromptTemplate {
+public:
+  PromptTemplate() : numSegments(0), literalBytes(0) {}
+
+  /**
+   * Split a template at its {{NAME}} placeholders
+   * Unknown placeholders are kept as literal text.
+   * @param text Template source
+   * @return false if the template has more than MAX_PROMPT_SEGMENTS slots
+   */
+  bool compile(const char* text) {
+    numSegments = 0;
+    literalBytes = 0;
+
+    const char* literalStart = text;
+    const char* cursor = text;
+
+    while (*cursor) {
+      if (cursor[0] == '{' && cursor[1] == '{') {
+        int slot = matchSlot(cursor + 2);
+        if (slot >= 0) {
+          if (!addSegment(literalStart, cursor - literalStart, slot)) {
+            return false;
+          }
+          cursor += 2 + strlen(PROMPT_SLOT_NAMES[slot]) + 2;
+          literalStart = cursor;
+          continue;
+        }
+      }
+      cursor++;
+    }
+
+    return addSegment(literalStart, cursor - literalStart, -1);
+  }
+
+  /**
+   * Render the template into a buffer
+   * @param out Buffer to overwrite; its capacity is kept between calls
+   * @param values Slot values indexed by PromptSlot
+   */
+  void render(String& out, const String* const values[NUM_PROMPT_SLOTS]) const {
+    out = "";
+    out.reserve(renderedLength(values));
+    append(out, values);
+  }
+
+  /**
+   * Append the rendered template to a buffer without clearing it
+   */
+  void append(String& out, const String* const values[NUM_PROMPT_SLOTS]) const {
+    for (int i = 0; i < numSegments; i++) {
+      out.concat(segments[i].text, segments[i].length);
+      if (segments[i].slot >= 0 && values[segments[i].slot] != nullptr) {
+        out += *values[segments[i].slot];
+      }
+    }
+  }
+
+  /**
+   * Exact length of the rendered output
+   */
+  size_t renderedLength(const String* const values[NUM_PROMPT_SLOTS]) const {
+    size_t length = literalBytes;
+    for (int i = 0; i < numSegments; i++) {
+      if (segments[i].slot >= 0 && values[segments[i].slot] != nullptr) {
+        length += values[segments[i].slot]->length();
+      }
+    }
+    return length;
+  }
+
+  /**
+   * Whether any segment inserts the given slot
+   */
+  bool usesSlot(int slot) const {
+    for (int i = 0; i < numSegments; i++) {
+      if (segments[i].slot == slot) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool isCompiled() const {
+    return numSegments > 0;
+  }
+
+  int segmentCount() const {
+    return numSegments;
+  }
+
+  size_t literalLength() const {
+    return literalBytes;
+  }
+
+private:
+  PromptSegment segments[MAX_PROMPT_SEGMENTS];
+  int numSegments;
+  size_t literalBytes;
+
+  int matchSlot(const char* name) const {
+    for (int slot = 0; slot < NUM_PROMPT_SLOTS; slot++) {
+      size_t len = strlen(PROMPT_SLOT_NAMES[slot]);
+      if (strncmp(name, PROMPT_SLOT_NAMES[slot], len) == 0 && name[len] == '}' && name[len + 1] == '}') {
+        return slot;
+      }
+    }
+    return -1;
+  }
+
+  bool addSegment(const char* text, size_t length, int slot) {
+    if (numSegments >= MAX_PROMPT_SEGMENTS) {
+      return false;
+    }
+    segments[numSegments].text = text;
+    segments[numSegments].length = length;
+    segments[numSegments].slot = slot;
+    literalBytes += length;
+    numSegments++;
+    return true;
+  }
+};
+
+#endif // PROMPT_TEMPLATE_H
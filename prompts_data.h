@@ -25,6 +25,9 @@ ORIGINAL OBJECTIVE: {{OBJECTIVE}}
 CURRENT CONTEXT:
 {{CONTEXT}}
 
+WORLD STATE (kept by the car from tool results and odometry):
+{{WORLD_STATE}}
+
 PREVIOUS EXECUTION RESULTS:
 {{EXECUTION_HISTORY}}
 
@@ -35,6 +38,7 @@ PREVIOUS EXECUTION RESULTS:
 - **test_sonar**: Tests ultrasonic sensor
 - **get_environment_info**: Gathers current environment information
 - **send_mqtt_message**: Sends status updates over MQTT
+- **capture_image**: Takes a photo and describes what is ahead (optional question); slower than sonar, use it when you need to recognize objects
 
 ## Movement Reference
 
@@ -47,6 +51,7 @@ These conversion factors can be used to estimate distances and angles when plann
 ## Planning Rules
 
 - Consider the original objective and current progress
+- Take distances, pose and progress from WORLD STATE and the latest SENSORS message when there is one (read just before this request); measure again only after moving or turning, or when neither has a distance
 - Use tools strategically to gather information or make progress
 - Only include tools with confidence > 0.9
 - Be precise with parameters
@@ -70,7 +75,7 @@ These conversion factors can be used to estimate distances and angles when plann
   "should_continue": true/false,
   "objective_complete": true/false,
   "reasoning": "explanation of decision",
-  "next_context": "updated context for next iteration"
+  "next_context": "short note on what you are doing next; facts are kept in WORLD STATE"
 }
 ```
 
@@ -95,20 +100,7 @@ These conversion factors can be used to estimate distances and angles when plann
 
 ### Example 2: Move forward until within 20cm of obstacle
 
-**Step 1**: 
-```json
-{
-  "tool_calls": [
-    {"tool": "get_sonar_distance", "params": "", "confidence": 0.98}
-  ], 
-  "should_continue": true, 
-  "objective_complete": false, 
-  "reasoning": "Checking current distance to obstacle", 
-  "next_context": "Measuring distance before moving"
-}
-```
-
-**Step 2**: 
+**Step 1** (SENSORS: sonar 80 cm): 
 ```json
 {
   "tool_calls": [
@@ -117,12 +109,12 @@ These conversion factors can be used to estimate distances and angles when plann
   ], 
   "should_continue": true, 
   "objective_complete": false, 
-  "reasoning": "Moving forward and checking new distance", 
+  "reasoning": "80cm ahead; moving forward and checking new distance", 
   "next_context": "Moving toward obstacle"
 }
 ```
 
-**Step 3**: 
+**Step 2**: 
 ```json
 {
   "tool_calls": [
@@ -177,15 +169,18 @@ These conversion factors can be used to estimate distances and angles when plann
  * @param objective The objective to achieve
  * @param context Current context information
  * @param executionHistory Previous execution results
+ * @param worldState formatWorldState() text
  * @return Formatted prompt string
  */
-String formatPlanningPrompt(const String& objective, const String& context, const String& executionHistory) {
+String formatPlanningPrompt(const String& objective, const String& context, const String& executionHistory,
+                            const String& worldState) {
   String prompt = String(ITERATIVE_PLANNING_PROMPT);
   
   // Replace placeholders with actual values
   prompt.replace("{{OBJECTIVE}}", objective);
   prompt.replace("{{CONTEXT}}", context);
   prompt.replace("{{EXECUTION_HISTORY}}", executionHistory);
+  prompt.replace("{{WORLD_STATE}}", worldState);
   
   return prompt;
 }
@@ -4,35 +4,160 @@
 #include <Arduino.h>
 #include "robot_tools.h"
 #include "prompts_data.h"
+#include "prompt_template.h"
+#include "prompt_store.h"
 
 class PromptsManager {
 public:
-  PromptsManager() {}
+  PromptsManager() : activeVersion(PROMPT_BUILTIN_VERSION), activeCrc(0) {}
   
   /**
    * Initialize the prompts manager
-   * Note: No SPIFFS initialization needed anymore
+   * Activates the prompt version stored in NVS, falling back to the
+   * built-in prompt if it is missing or fails its CRC check.
    */
   bool begin() {
+    if (!planningTemplate.compile(ITERATIVE_PLANNING_PROMPT)) {
+      logToRobotLogs("Error: Planning prompt has too many placeholders");
+      return false;
+    }
+    activeCrc = builtinPromptCrc();
+    
+    uint32_t storedVersion = loadActivePromptVersion();
+    if (storedVersion != PROMPT_BUILTIN_VERSION) {
+      String text;
+      if (loadPromptVersion(storedVersion, text) && activateTemplate(storedVersion, text)) {
+        logToRobotLogs("Using stored prompt version " + String(storedVersion));
+        if (!templateHasWorldState(text)) {
+          logToRobotLogs("Warning: Prompt version " + String(storedVersion) + " has no {{WORLD_STATE}} placeholder, appending the world state");
+        }
+      } else {
+        logToRobotLogs("Warning: Stored prompt version " + String(storedVersion) + " unusable, using built-in prompt");
+      }
+    }
+    
     logToRobotLogs("Prompts Manager initialized successfully");
-    logToRobotLogs("All prompts are now embedded in code - no file system needed");
     return true;
   }
   
+  /**
+   * Check that text compiles into a usable planning template
+   */
+  bool isValidPlanningTemplate(const String& text) {
+    PromptTemplate candidate;
+    return candidate.compile(text.c_str()) &&
+           candidate.usesSlot(SLOT_OBJECTIVE) &&
+           candidate.usesSlot(SLOT_EXECUTION_HISTORY);
+  }
+  
+  /**
+   * Check whether a template has a {{WORLD_STATE}} slot
+   * Versions uploaded before the slot existed don't; renderPlanningPrompt()
+   * appends the world state to them instead.
+   */
+  bool templateHasWorldState(const String& text) {
+    PromptTemplate candidate;
+    return candidate.compile(text.c_str()) && candidate.usesSlot(SLOT_WORLD_STATE);
+  }
+  
+  /**
+   * Switch the planning prompt to another version and recompile it
+   * @param version Version number, PROMPT_BUILTIN_VERSION for the prompt in flash
+   * @param text Template text; ignored for the built-in version
+   * @return false (and the current prompt kept) if the text isn't a valid template
+   */
+  bool activateTemplate(uint32_t version, const String& text) {
+    if (version == PROMPT_BUILTIN_VERSION) {
+      activeText = "";
+      planningTemplate.compile(ITERATIVE_PLANNING_PROMPT);
+      activeVersion = version;
+      activeCrc = builtinPromptCrc();
+      return true;
+    }
+    
+    if (!isValidPlanningTemplate(text)) {
+      return false;
+    }
+    
+    // The template points into activeText, so recompile after every assignment
+    activeText = text;
+    planningTemplate.compile(activeText.c_str());
+    activeVersion = version;
+    activeCrc = promptCrc32(activeText);
+    return true;
+  }
+  
+  /**
+   * Version of the active planning prompt, tagged on every planning request
+   */
+  uint32_t getActivePromptVersion() {
+    return activeVersion;
+  }
+  
+  /**
+   * CRC32 of the active template text, so the planner gateway can tell
+   * whether it has the same prompt
+   */
+  uint32_t getActivePromptCrc() {
+    return activeCrc;
+  }
+  
   /**
    * Get the planning prompt template
    * Now returns the embedded prompt directly
    */
   String getPlanningPromptTemplate() {
-    return String(ITERATIVE_PLANNING_PROMPT);
+    return activeVersion == PROMPT_BUILTIN_VERSION ? String(ITERATIVE_PLANNING_PROMPT) : activeText;
   }
   
   /**
    * Format the planning prompt with session data
    * Uses the embedded prompt from prompts_data.h
    */
-  String formatPlanningPrompt(const String& objective, const String& context, const String& executionHistory) {
-    return ::formatPlanningPrompt(objective, context, executionHistory);
+  String formatPlanningPrompt(const String& objective, const String& context, const String& executionHistory,
+                              const String& worldState) {
+    return ::formatPlanningPrompt(objective, context, executionHistory, worldState);
+  }
+  
+  /**
+   * Render the planning prompt into the manager's reusable buffer
+   * Single pass over the precompiled template; the buffer keeps its
+   * capacity between iterations so steady-state renders don't allocate.
+   * A template without a {{WORLD_STATE}} slot gets the world state appended.
+   * @return Reference valid until the next render
+   */
+  const String& renderPlanningPrompt(const String& objective, const String& context, const String& executionHistory,
+                                     const String& worldState) {
+    if (!planningTemplate.isCompiled()) {
+      planningTemplate.compile(ITERATIVE_PLANNING_PROMPT);
+    }
+    
+    const String* values[NUM_PROMPT_SLOTS];
+    values[SLOT_OBJECTIVE] = &objective;
+    values[SLOT_CONTEXT] = &context;
+    values[SLOT_EXECUTION_HISTORY] = &executionHistory;
+    values[SLOT_WORLD_STATE] = &worldState;
+    
+    planningTemplate.render(promptBuffer, values);
+    if (!planningTemplate.usesSlot(SLOT_WORLD_STATE) && worldState.length() > 0) {
+      promptBuffer += "\n\nWORLD STATE:\n";
+      promptBuffer += worldState;
+    }
+    return promptBuffer;
+  }
+  
+  /**
+   * Render the planning template as a conversation system prompt
+   * The slots refer to the transcript instead of holding session data, so
+   * the result depends only on the active prompt version.
+   * @return Reference valid until the next render
+   */
+  const String& renderConversationSystemPrompt() {
+    static const String objective = "(given in the first user message)";
+    static const String context = "(given in the latest user message)";
+    static const String history = "(previous iterations follow as assistant decisions and user tool results)";
+    static const String worldState = "(given after the transcript, current as of this request)";
+    return renderPlanningPrompt(objective, context, history, worldState);
   }
   
   /**
@@ -47,9 +172,26 @@ public:
    * Get prompt information for debugging
    */
   void logPromptInfo() {
-    logToRobotLogs("Prompts Manager: All prompts embedded in code");
-    logToRobotLogs("Planning prompt length: " + String(strlen(ITERATIVE_PLANNING_PROMPT)) + " characters");
+    logToRobotLogs("Prompts Manager: planning prompt version " + String(activeVersion) +
+                   (activeVersion == PROMPT_BUILTIN_VERSION ? " (built-in)" : " (from NVS)"));
+    logToRobotLogs("Planning prompt length: " + String(getPlanningPromptTemplate().length()) + " characters");
+    logToRobotLogs("Planning prompt segments: " + String(planningTemplate.segmentCount()) +
+                   ", literal bytes: " + String(planningTemplate.literalLength()));
   }
+  
+private:
+  uint32_t builtinPromptCrc() {
+    return crc32Update(0, (const uint8_t*)ITERATIVE_PLANNING_PROMPT, strlen(ITERATIVE_PLANNING_PROMPT));
+  }
+  
+  PromptTemplate planningTemplate;
+  String promptBuffer;
+  String activeText;       // Template source for stored versions; planningTemplate points into it
+  uint32_t activeVersion;
+  uint32_t activeCrc;      // promptCrc32() of the active template text
 };
 
+// Global prompts manager, defined in openai_processor.ino
+extern PromptsManager promptsManager;
+
 #endif // PROMPTS_MANAGER_H
@@ -19,30 +19,46 @@
 #define ECHO_PIN 23
 #define MAX_DISTANCE 400
 
-// Global sonar object
+// Global sonar object; ping it through pingSonar(), the sensor task shares it
 extern NewPing sonar;
 
 // Global MQTT client (optional, for logging)
 extern PubSubClient client;
 
+// Parsed move_car parameters
+struct MoveCommand {
+  String command;   // Lowercase direction: forward/backward/left/right/stop
+  String valueStr;  // Raw value text after the command
+  int value;        // Duration in milliseconds or degrees
+};
+
+// When true, logToRobotLogs() is silenced (used by benchmarks and fuzzing)
+extern bool robotLogsMuted;
+
 // Tool structure definition
 struct Tool {
   String name;
   String description;
   String (*execute)(String params);
+  bool directOnly;  // Diagnostics and admin: run from a direct MQTT tool command, never from a plan
 };
 
 // Function declarations
+int pingSonar();
 String getSonarDistance(String params);
 String moveCar(String params);
+MoveCommand parseMoveParams(String params);
 String testSonar(String params);
 String getEnvironmentInfo(String params);
 String sendMqttMessage(String params);
 String logToRobotLogs(String message);
+String getRobotId();
+String getMqttClientId();
 String listTools();
 String executeTool(String toolName, String params = "");
 int getToolCount();
 Tool getToolByIndex(int index);
+bool isDirectOnlyTool(String toolName);
 void initRobotTools();
 
 // Motor control function declarations
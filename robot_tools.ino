@@ -1,15 +1,37 @@
 #include "robot_tools.h"
+#include "benchmarks.h"
+#include "heap_profiler.h"
+#include "fuzz_harness.h"
+#include "trace.h"
+#include "prompts_manager.h"
+#include "camera_tools.h"
+#include "odometry.h"
+#include "capture_task.h"
+#include "local_planner.h"
+#include "skill_library.h"
 
 // Global sonar object
 NewPing sonar(TRIGGER_PIN, ECHO_PIN, MAX_DISTANCE);
+SemaphoreHandle_t sonarMutex = nullptr;  // One ping at a time across the planning and sensor tasks
+
+// Log muting for benchmarks and fuzzing
+bool robotLogsMuted = false;
 
 // Array of available tools
 Tool tools[] = {
-  {"get_sonar_distance", "Measures distance using ultrasonic sensor in centimeters", getSonarDistance},
-  {"move_car", "Controls car movement. Format: 'direction duration' or 'direction degrees'. Examples: 'forward 1000', 'backward 2000', 'left 90', 'right 180', 'stop'", moveCar},
-  {"test_sonar", "Tests ultrasonic sensor with detailed diagnostics", testSonar},
-  {"get_environment_info", "Gathers current environment information (distance, position, etc.) for planning", getEnvironmentInfo},
-  {"send_mqtt_message", "Sends a message over MQTT. Format: 'message text'. Example: 'send_mqtt_message Planning next step...'", sendMqttMessage}
+  {"get_sonar_distance", "Measures distance using ultrasonic sensor in centimeters", getSonarDistance, false},
+  {"move_car", "Controls car movement. Format: 'direction duration' or 'direction degrees'. Examples: 'forward 1000', 'backward 2000', 'left 90', 'right 180', 'stop'", moveCar, false},
+  {"test_sonar", "Tests ultrasonic sensor with detailed diagnostics", testSonar, false},
+  {"get_environment_info", "Gathers current environment information (distance, position, etc.) for planning", getEnvironmentInfo, false},
+  {"send_mqtt_message", "Sends a message over MQTT. Format: 'message text'. Example: 'send_mqtt_message Planning next step...'", sendMqttMessage, false},
+  {"run_benchmarks", "Benchmarks the planning hot path (prompt formatting, response parsing, goal evaluation, session update, move parsing). Format: 'iterations'. Example: '200'", runBenchmarks, true},
+  {"heap_report", "Reports free heap, largest free block, fragmentation and per-site/per-phase allocation statistics. Format: '' or 'reset'", heapReport, true},
+  {"heap_soak", "Runs simulated planning commands offline and logs heap fragmentation over time. Format: 'commands'. Example: '2000'", heapSoak, true},
+  {"fuzz_parsers", "Fuzzes the MQTT command and LLM response parsers with mutated inputs under a per-input time budget. Format: 'iterations [budget_us] [seed]'. Example: '1000 20000 7'", fuzzParsers, true},
+  {"dump_trace", "Dumps command timing spans in Chrome trace-event format to serial and MQTT. Format: '' (previous command), 'trace id' or 'all'", dumpTrace, true},
+  {"prompt_store", "Lists, activates or rolls back stored planning prompt versions. Format: 'list', 'activate version' or 'rollback'. Example: 'activate 3'", promptStore, true},
+  {"skill_library", "Lists or removes the tool sequences stored for repeated objectives. Format: 'list', 'forget slot' or 'clear'. Example: 'forget 2'", skillLibrary, true},
+  {"capture_image", "Captures a camera frame and asks the vision model about it. Format: '' or 'question'. Example: 'Is there a doorway ahead?'", captureImage, false}
 };
 
 const int NUM_TOOLS = sizeof(tools) / sizeof(tools[0]);
@@ -40,6 +62,7 @@ String executeTool(String toolName, String params) {
   for (int i = 0; i < NUM_TOOLS; i++) {
     if (tools[i].name == toolName) {
       logToRobotLogs("Executing tool: " + toolName);
+      ScopedTrace span(tools[i].name.c_str());
       return tools[i].execute(params);
     }
   }
@@ -65,14 +88,46 @@ Tool getToolByIndex(int index) {
     return tools[index];
   }
   
-  Tool emptyTool = {"", "", nullptr};
+  Tool emptyTool = {"", "", nullptr, false};
   return emptyTool;
 }
 
+/**
+ * Check whether a tool is kept out of plans
+ * Plans come from the LLM, gateway and skill library; direct-only tools run
+ * only when a direct MQTT tool command names them.
+ * @param toolName Name of the tool
+ * @return true if the tool exists and is direct-only
+ */
+bool isDirectOnlyTool(String toolName) {
+  for (int i = 0; i < NUM_TOOLS; i++) {
+    if (tools[i].name == toolName) {
+      return tools[i].directOnly;
+    }
+  }
+  return false;
+}
+
 // ==========================================
 // TOOL IMPLEMENTATIONS
 // ==========================================
 
+/**
+ * One sonar ping
+ * Pings from the sensor task and the tools would garble each other's echo
+ * timing, so they take turns.
+ * @return Distance in cm, 0 for no echo
+ */
+int pingSonar() {
+  if (sonarMutex == nullptr) {
+    return sonar.ping_cm();
+  }
+  xSemaphoreTake(sonarMutex, portMAX_DELAY);
+  int cm = sonar.ping_cm();
+  xSemaphoreGive(sonarMutex);
+  return cm;
+}
+
 /**
  * Tool: Get Sonar Distance
  * Measures distance using the ultrasonic sensor
@@ -80,6 +135,7 @@ Tool getToolByIndex(int index) {
  * @return String containing distance measurement
  */
 String getSonarDistance(String params) {
+  ScopedTrace span("sonar_distance");
   logToRobotLogs("=== GET SONAR DISTANCE ===");
   
   // Send MQTT update that we're starting distance measurement
@@ -92,7 +148,7 @@ String getSonarDistance(String params) {
   logToRobotLogs("Taking 5 distance readings...");
   
   for (int i = 0; i < 5; i++) {
-    int reading = sonar.ping_cm();
+    int reading = pingSonar();
     logToRobotLogs("Reading " + String(i + 1) + ": " + String(reading) + " cm");
     
     // Send individual reading over MQTT
@@ -154,6 +210,10 @@ void stopWheels() {
   digitalWrite(IN2, LOW);
   digitalWrite(IN3, LOW);
   digitalWrite(IN4, LOW);
+  endMotion();
+  
+  // Wake the capture task so a still frame is ready as soon as the car stops
+  requestFreshFrame();
 }
 
 /**
@@ -161,6 +221,7 @@ void stopWheels() {
  * @param milliseconds Duration in milliseconds
  */
 void goForward(int milliseconds) {
+  ScopedTrace span("motor_forward");
   logToRobotLogs("=== GO FORWARD EXECUTING ===");
   logToRobotLogs("Duration: " + String(milliseconds) + "ms");
   logToRobotLogs("Setting IN1=HIGH, IN2=LOW, IN3=HIGH, IN4=LOW");
@@ -170,6 +231,8 @@ void goForward(int milliseconds) {
   digitalWrite(IN3, HIGH);
   digitalWrite(IN4, LOW);
   
+  beginMotion(MOTION_FORWARD);
+  
   logToRobotLogs("Motors activated, waiting " + String(milliseconds) + "ms...");
   delay(milliseconds);
   
@@ -183,6 +246,7 @@ void goForward(int milliseconds) {
  * @param milliseconds Duration in milliseconds
  */
 void goBackward(int milliseconds) {
+  ScopedTrace span("motor_backward");
   logToRobotLogs("=== GO BACKWARD EXECUTING ===");
   logToRobotLogs("Duration: " + String(milliseconds) + "ms");
   logToRobotLogs("Setting IN1=LOW, IN2=HIGH, IN3=LOW, IN4=HIGH");
@@ -192,6 +256,8 @@ void goBackward(int milliseconds) {
   digitalWrite(IN3, LOW);
   digitalWrite(IN4, HIGH);
   
+  beginMotion(MOTION_BACKWARD);
+  
   logToRobotLogs("Motors activated, waiting " + String(milliseconds) + "ms...");
   delay(milliseconds);
   
@@ -205,6 +271,7 @@ void goBackward(int milliseconds) {
  * @param milliseconds Duration in milliseconds
  */
 void turnLeft(int milliseconds) {
+  ScopedTrace span("motor_left");
   logToRobotLogs("=== TURN LEFT EXECUTING ===");
   logToRobotLogs("Duration: " + String(milliseconds) + "ms");
   logToRobotLogs("Setting IN1=HIGH, IN2=LOW, IN3=LOW, IN4=HIGH");
@@ -214,6 +281,8 @@ void turnLeft(int milliseconds) {
   digitalWrite(IN3, LOW);
   digitalWrite(IN4, HIGH);
   
+  beginMotion(MOTION_LEFT);
+  
   logToRobotLogs("Motors activated, waiting " + String(milliseconds) + "ms...");
   delay(milliseconds);
   
@@ -227,6 +296,7 @@ void turnLeft(int milliseconds) {
  * @param milliseconds Duration in milliseconds
  */
 void turnRight(int milliseconds) {
+  ScopedTrace span("motor_right");
   logToRobotLogs("=== TURN RIGHT EXECUTING ===");
   logToRobotLogs("Duration: " + String(milliseconds) + "ms");
   logToRobotLogs("Setting IN1=LOW, IN2=HIGH, IN3=HIGH, IN4=LOW");
@@ -236,6 +306,8 @@ void turnRight(int milliseconds) {
   digitalWrite(IN3, HIGH);
   digitalWrite(IN4, LOW);
   
+  beginMotion(MOTION_RIGHT);
+  
   logToRobotLogs("Motors activated, waiting " + String(milliseconds) + "ms...");
   delay(milliseconds);
   
@@ -283,30 +355,19 @@ String moveCar(String params) {
   logToRobotLogs("=== MOVE CAR TOOL CALLED ===");
   logToRobotLogs("Raw params: '" + params + "'");
   
-  params.trim();
-  logToRobotLogs("Trimmed params: '" + params + "'");
+  MoveCommand move = parseMoveParams(params);
   
-  if (params.length() == 0) {
+  if (move.command.length() == 0) {
     logToRobotLogs("Error: No movement command provided");
     return "Error: No movement command provided. Use: forward/backward/left/right/stop + value";
   }
   
-  // Find the first space to separate command from value
-  int spaceIndex = params.indexOf(' ');
-  String command = params;
-  String valueStr = "";
-  
-  if (spaceIndex != -1) {
-    command = params.substring(0, spaceIndex);
-    valueStr = params.substring(spaceIndex + 1);
-  }
+  String command = move.command;
+  String valueStr = move.valueStr;
   
   logToRobotLogs("Parsed command: '" + command + "'");
   logToRobotLogs("Parsed value: '" + valueStr + "'");
   
-  command.toLowerCase();
-  logToRobotLogs("Lowercase command: '" + command + "'");
-  
   String result = "";
   
   if (command == "stop") {
@@ -317,7 +378,7 @@ String moveCar(String params) {
     if (valueStr.length() == 0) {
       return "Error: Forward command requires duration in milliseconds";
     }
-    int duration = valueStr.toInt();
+    int duration = move.value;
     if (duration <= 0) {
       return "Error: Duration must be positive";
     }
@@ -328,7 +389,7 @@ String moveCar(String params) {
     if (valueStr.length() == 0) {
       return "Error: Backward command requires duration in milliseconds";
     }
-    int duration = valueStr.toInt();
+    int duration = move.value;
     if (duration <= 0) {
       return "Error: Duration must be positive";
     }
@@ -339,7 +400,7 @@ String moveCar(String params) {
     if (valueStr.length() == 0) {
       return "Error: Left command requires degrees or duration";
     }
-    int value = valueStr.toInt();
+    int value = move.value;
     if (value <= 0) {
       return "Error: Value must be positive";
     }
@@ -357,7 +418,7 @@ String moveCar(String params) {
     if (valueStr.length() == 0) {
       return "Error: Right command requires degrees or duration";
     }
-    int value = valueStr.toInt();
+    int value = move.value;
     if (value <= 0) {
       return "Error: Value must be positive";
     }
@@ -386,6 +447,36 @@ String moveCar(String params) {
   return result;
 }
 
+/**
+ * Parse move_car parameters without touching the motors
+ * @param params Movement command in format: "direction value"
+ * @return MoveCommand with an empty command if params were blank
+ */
+MoveCommand parseMoveParams(String params) {
+  MoveCommand move;
+  move.command = "";
+  move.valueStr = "";
+  move.value = 0;
+  
+  params.trim();
+  if (params.length() == 0) {
+    return move;
+  }
+  
+  // Find the first space to separate command from value
+  int spaceIndex = params.indexOf(' ');
+  move.command = params;
+  
+  if (spaceIndex != -1) {
+    move.command = params.substring(0, spaceIndex);
+    move.valueStr = params.substring(spaceIndex + 1);
+  }
+  
+  move.command.toLowerCase();
+  move.value = move.valueStr.toInt();
+  return move;
+}
+
 /**
  * Tool: Test Sonar
  * Comprehensive test of the ultrasonic sensor
@@ -415,7 +506,7 @@ String testSonar(String params) {
   int invalidCount = 0;
   
   for (int i = 0; i < 10; i++) {
-    int reading = sonar.ping_cm();
+    int reading = pingSonar();
     readings[i] = reading;
     
     if (reading > 0 && reading <= 400) {
@@ -505,7 +596,7 @@ String getEnvironmentInfo(String params) {
   
   // Get distance reading
   logToRobotLogs("Getting distance reading...");
-  int distance = sonar.ping_cm();
+  int distance = pingSonar();
   info += "Distance ahead: " + String(distance) + " cm";
   
   // Send distance reading over MQTT
@@ -531,12 +622,19 @@ String getEnvironmentInfo(String params) {
     sendMqttMessage("Environment MQTT: Disconnected");
   }
   
+  // Dead-reckoned position since boot
+  info += "Estimated pose: " + formatPose(getPose()) + "\n";
+  
   // Get system uptime
   unsigned long uptime = millis() / 1000; // Convert to seconds
   info += "Uptime: " + String(uptime) + " seconds\n";
   
-  // Get free memory
-  info += "Free memory: " + String(ESP.getFreeHeap()) + " bytes\n";
+  // Get free memory and fragmentation
+  HeapSnapshot heap = takeHeapSnapshot();
+  info += "Free memory: " + String(heap.freeBytes) + " bytes\n";
+  info += "Largest free block: " + String(heap.largestBlock) + " bytes\n";
+  info += "Heap fragmentation: " + String(heap.fragmentation * 100.0, 1) + "%\n";
+  info += "Minimum free memory since boot: " + String(heap.minFreeEver) + " bytes\n";
   
   sendMqttMessage("Environment system: Uptime " + String(uptime) + "s, Free memory " + String(ESP.getFreeHeap()) + " bytes");
   
@@ -553,6 +651,7 @@ String getEnvironmentInfo(String params) {
  * @return String confirmation of message sent
  */
 String sendMqttMessage(String params) {
+  ScopedTrace span("mqtt_publish");
   logToRobotLogs("=== SEND MQTT MESSAGE ===");
   logToRobotLogs("Message: " + params);
   
@@ -566,10 +665,13 @@ String sendMqttMessage(String params) {
   
   // Create JSON message
   DynamicJsonDocument doc(512);
-  doc["robot_id"] = "arduino_car";
+  doc["robot_id"] = getRobotId();
   doc["message_type"] = "status_update";
   doc["content"] = params;
   doc["timestamp"] = String(millis());
+  doc["trace_id"] = getCurrentTraceId();
+  doc["prompt_version"] = promptsManager.getActivePromptVersion();
+  doc["planner"] = activePlannerName();
   
   String jsonString;
   serializeJson(doc, jsonString);
@@ -592,6 +694,10 @@ String sendMqttMessage(String params) {
  * @return String confirmation of message logged
  */
 String logToRobotLogs(String message) {
+  if (robotLogsMuted) {
+    return "";
+  }
+  
   if (message.length() == 0) {
     return "Error: No message provided";
   }
@@ -608,11 +714,45 @@ String logToRobotLogs(String message) {
   return "Log message printed to serial: " + message;
 }
 
+/**
+ * Get this car's robot id
+ * Uses ROBOT_ID from config.h, or "car_" plus the low 3 bytes of the chip MAC
+ * @return Robot id used in every published message
+ */
+String getRobotId() {
+  static String robotId = "";
+  
+  if (robotId.length() == 0) {
+    if (strlen(ROBOT_ID) > 0) {
+      robotId = ROBOT_ID;
+    } else {
+      uint64_t mac = ESP.getEfuseMac();
+      char id[16];
+      sprintf(id, "car_%06x", (unsigned int)((mac >> 24) & 0xFFFFFF));
+      robotId = id;
+    }
+  }
+  
+  return robotId;
+}
+
+/**
+ * Get the MQTT client id
+ * @return MQTT_CLIENT_ID from config.h, or "<robot id>_client"
+ */
+String getMqttClientId() {
+  if (strlen(MQTT_CLIENT_ID) > 0) {
+    return String(MQTT_CLIENT_ID);
+  }
+  return getRobotId() + "_client";
+}
+
 /**
  * Initialize the robot tools system
  * Call this from setup()
  */
 void initRobotTools() {
+  sonarMutex = xSemaphoreCreateMutex();
   logToRobotLogs("Robot Tools System Initialized");
   logToRobotLogs("Use listTools() to see available tools");
   logToRobotLogs(listTools());
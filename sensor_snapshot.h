@@ -0,0 +1,49 @@
+#ifndef SENSOR_SNAPSHOT_H
+#define SENSOR_SNAPSHOT_H
+
+#include <Arduino.h>
+#include "odometry.h"
+#include "world_state.h"
+
+#define SENSOR_TASK_STACK 4096
+#define SENSOR_TASK_PRIORITY 1            // Below the WiFi/lwIP tasks
+#define SENSOR_TASK_CORE 0                // loop() runs on core 1
+#define SENSOR_SNAPSHOT_PINGS 3           // Sonar pings per snapshot; the median is kept
+#define SENSOR_SNAPSHOT_PING_GAP_MS 30    // Between pings, so echoes don't overlap
+#define SENSOR_SNAPSHOT_WAIT_MS 400       // Longest the request waits for the task's readings
+#define SENSOR_SNAPSHOT_POLL_MS 5
+
+// Sensor readings taken just before an LLM request
+struct SensorSnapshot {
+  unsigned long timestamp;  // millis() when the readings started
+  int distanceCm;           // Median of the pings, LOCAL_OUT_OF_RANGE_CM for no echo
+  int rssi;                 // dBm, 0 when WiFi is down
+  uint32_t freeHeap;
+  bool moving;
+  Pose pose;
+};
+
+// Snapshot counters for the current objective
+struct SensorSnapshotStats {
+  uint32_t taken;           // By the task, while the prompt was built
+  uint32_t inlineReads;     // Read on the planning task (no task, or no request pending)
+  uint32_t late;            // The task's readings didn't arrive in time; the request went without
+  uint32_t fieldsSent;
+  uint32_t fieldsOmitted;   // Shown by the world state sent with the same request
+  unsigned long readMs;     // Total time spent reading
+};
+
+extern SensorSnapshotStats sensorSnapshotStats;
+
+// Function declarations
+bool startSensorTask();
+bool sensorTaskRunning();
+void readSensorSnapshot(SensorSnapshot& snapshot);
+void requestSensorSnapshot();
+bool collectSensorSnapshot(SensorSnapshot& snapshot, unsigned long waitMs);
+String formatSensorSnapshot(const SensorSnapshot& snapshot, bool distanceInWorldState);
+String sensorSnapshotNote(WorldState& state);
+void resetSensorSnapshot();
+String formatSensorSnapshotStats();
+
+#endif // SENSOR_SNAPSHOT_H
@@ -0,0 +1,212 @@
+#include "sensor_snapshot.h"
+#include "robot_tools.h"
+#include "local_planner.h"
+#include "trace.h"
+
+SensorSnapshot sensorLatest;          // Newest snapshot taken by the task
+unsigned long sensorRequestedAt = 0;  // millis() of the pending request; older readings don't answer it
+bool sensorRequestPending = false;
+SemaphoreHandle_t sensorMutex = nullptr;
+TaskHandle_t sensorTaskHandle = nullptr;
+SensorSnapshotStats sensorSnapshotStats;
+
+/**
+ * Take one set of readings on the calling task
+ * Blocks for SENSOR_SNAPSHOT_PINGS sonar pings, about 100 ms.
+ */
+void readSensorSnapshot(SensorSnapshot& snapshot) {
+  snapshot.timestamp = millis();
+  snapshot.pose = getPose();
+  snapshot.moving = isMoving();
+  snapshot.rssi = WiFi.status() == WL_CONNECTED ? WiFi.RSSI() : 0;
+  snapshot.freeHeap = ESP.getFreeHeap();
+
+  // Median of the pings; 0 means no echo
+  int pings[SENSOR_SNAPSHOT_PINGS];
+  for (int i = 0; i < SENSOR_SNAPSHOT_PINGS; i++) {
+    if (i > 0) {
+      delay(SENSOR_SNAPSHOT_PING_GAP_MS);
+    }
+    int cm = pingSonar();
+    pings[i] = cm > 0 ? cm : LOCAL_OUT_OF_RANGE_CM;
+    for (int j = i; j > 0 && pings[j] < pings[j - 1]; j--) {
+      int swap = pings[j];
+      pings[j] = pings[j - 1];
+      pings[j - 1] = swap;
+    }
+  }
+  snapshot.distanceCm = pings[SENSOR_SNAPSHOT_PINGS / 2];
+}
+
+/**
+ * Sensor task body
+ * Sleeps until requestSensorSnapshot() wakes it, then publishes one snapshot.
+ */
+void sensorTaskLoop(void* arg) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    SensorSnapshot snapshot;
+    readSensorSnapshot(snapshot);
+    unsigned long ms = millis() - snapshot.timestamp;
+
+    xSemaphoreTake(sensorMutex, portMAX_DELAY);
+    sensorLatest = snapshot;
+    sensorSnapshotStats.readMs += ms;
+    xSemaphoreGive(sensorMutex);
+  }
+}
+
+/**
+ * Start the sensor task
+ * Without it snapshots are read on the planning task instead, before the
+ * prompt is built.
+ * @return true if the task is running
+ */
+bool startSensorTask() {
+  if (sensorTaskHandle != nullptr) {
+    return true;
+  }
+  if (!SENSOR_SNAPSHOT_ENABLED) {
+    return false;
+  }
+
+  sensorLatest.timestamp = 0;
+  sensorMutex = xSemaphoreCreateMutex();
+  if (xTaskCreatePinnedToCore(sensorTaskLoop, "sensors", SENSOR_TASK_STACK, nullptr,
+                              SENSOR_TASK_PRIORITY, &sensorTaskHandle, SENSOR_TASK_CORE) != pdPASS) {
+    logToRobotLogs("Sensor task: task creation failed, snapshots will be read inline");
+    sensorTaskHandle = nullptr;
+    return false;
+  }
+
+  logToRobotLogs("Sensor task started (" + String(SENSOR_SNAPSHOT_PINGS) + " pings per snapshot)");
+  return true;
+}
+
+bool sensorTaskRunning() {
+  return sensorTaskHandle != nullptr;
+}
+
+/**
+ * Wake the sensor task so its readings are ready when the request is built
+ * Its pings take turns with the tools' through pingSonar();
+ * collectSensorSnapshot() ends the request.
+ */
+void requestSensorSnapshot() {
+  if (sensorTaskHandle == nullptr) {
+    return;
+  }
+  sensorRequestedAt = millis();
+  sensorRequestPending = true;
+  xTaskNotifyGive(sensorTaskHandle);
+}
+
+/**
+ * Get the snapshot for the request being built
+ * Takes the one requested with requestSensorSnapshot(), or reads the
+ * sensors now when none was requested.
+ * @param snapshot Receives the readings
+ * @param waitMs How long to wait for the task's readings
+ * @return false if the requested readings didn't arrive in time
+ */
+bool collectSensorSnapshot(SensorSnapshot& snapshot, unsigned long waitMs) {
+  if (!sensorRequestPending) {
+    readSensorSnapshot(snapshot);
+    sensorSnapshotStats.inlineReads++;
+    sensorSnapshotStats.readMs += millis() - snapshot.timestamp;
+    return true;
+  }
+
+  unsigned long start = millis();
+  for (;;) {
+    xSemaphoreTake(sensorMutex, portMAX_DELAY);
+    bool ready = (long)(sensorLatest.timestamp - sensorRequestedAt) >= 0;
+    if (ready) {
+      snapshot = sensorLatest;
+    }
+    xSemaphoreGive(sensorMutex);
+
+    if (ready) {
+      sensorRequestPending = false;
+      sensorSnapshotStats.taken++;
+      return true;
+    }
+    if (millis() - start >= waitMs) {
+      // Still pending: readings that land now are too old for the next
+      // request. The task may still be pinging; pingSonar() keeps the tools
+      // from pinging at the same time.
+      sensorSnapshotStats.late++;
+      return false;
+    }
+    delay(SENSOR_SNAPSHOT_POLL_MS);
+  }
+}
+
+/**
+ * Compact text for the SENSORS message, e.g.
+ * SENSORS at 12.3 s: wifi -61 dBm, free heap 142 KB (sonar and motion in WORLD STATE)
+ * SENSORS at 15.0 s: sonar 31 cm, wifi -60 dBm, free heap 140 KB (motion in WORLD STATE)
+ * The message isn't kept in the transcript or history, so it is only diffed
+ * against the world state sent with the same request: fields that shows are
+ * left out, the rest are always sent.
+ * @param snapshot Readings to send
+ * @param distanceInWorldState The distance was merged into the world state
+ */
+String formatSensorSnapshot(const SensorSnapshot& snapshot, bool distanceInWorldState) {
+  String out = "SENSORS at " + String(snapshot.timestamp / 1000.0, 1) + " s: ";
+  if (!distanceInWorldState) {
+    out += snapshot.distanceCm >= LOCAL_OUT_OF_RANGE_CM ? String("sonar out of range, ") :
+                                                         "sonar " + String(snapshot.distanceCm) + " cm, ";
+  }
+  out += snapshot.rssi == 0 ? String("wifi down") : "wifi " + String(snapshot.rssi) + " dBm";
+  out += ", free heap " + String(snapshot.freeHeap / 1024) + " KB";
+  out += distanceInWorldState ? " (sonar and motion in WORLD STATE)" : " (motion in WORLD STATE)";
+
+  int omitted = distanceInWorldState ? 2 : 1;
+  sensorSnapshotStats.fieldsSent += 4 - omitted;
+  sensorSnapshotStats.fieldsOmitted += omitted;
+  return out;
+}
+
+/**
+ * SENSORS message for the request being built
+ * A reading taken while stopped goes into the world state instead, so call
+ * this before the request's world state is formatted.
+ * @param state World state of the objective
+ * @return formatSensorSnapshot() text, "" if the readings were late
+ */
+String sensorSnapshotNote(WorldState& state) {
+  ScopedTrace span("sensor_snapshot");
+  SensorSnapshot snapshot;
+  if (!collectSensorSnapshot(snapshot, SENSOR_SNAPSHOT_WAIT_MS)) {
+    logToRobotLogs("Sensor snapshot late, sending the request without it");
+    return "";
+  }
+  if (!snapshot.moving) {
+    recordWorldDistance(state, snapshot.distanceCm, snapshot.pose, snapshot.timestamp);
+  }
+  return formatSensorSnapshot(snapshot, !snapshot.moving);
+}
+
+/**
+ * Start an objective's snapshot counters
+ */
+void resetSensorSnapshot() {
+  sensorSnapshotStats.taken = 0;
+  sensorSnapshotStats.inlineReads = 0;
+  sensorSnapshotStats.late = 0;
+  sensorSnapshotStats.fieldsSent = 0;
+  sensorSnapshotStats.fieldsOmitted = 0;
+  sensorSnapshotStats.readMs = 0;
+}
+
+/**
+ * One-line summary, e.g. "4 snapshots (3 while building the prompt, 1 inline, 0 late), 310 ms reading; 10 fields sent, 6 in the world state"
+ */
+String formatSensorSnapshotStats() {
+  return String(sensorSnapshotStats.taken + sensorSnapshotStats.inlineReads) + " snapshots (" +
+         String(sensorSnapshotStats.taken) + " while building the prompt, " + String(sensorSnapshotStats.inlineReads) +
+         " inline, " + String(sensorSnapshotStats.late) + " late), " + String(sensorSnapshotStats.readMs) + " ms reading; " +
+         String(sensorSnapshotStats.fieldsSent) + " fields sent, " + String(sensorSnapshotStats.fieldsOmitted) + " in the world state";
+}
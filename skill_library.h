@@ -0,0 +1,111 @@
+#ifndef SKILL_LIBRARY_H
+#define SKILL_LIBRARY_H
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include "openai_processor.h"
+
+#define SKILL_NAMESPACE "skills"      // Preferences (NVS) namespace
+#define SKILL_LIBRARY_SLOTS 8         // Skills kept in NVS; the least used one makes room for a new one
+#define SKILL_MAX_STEPS 24            // Longest tool sequence stored
+#define SKILL_MAX_GROUPS 8            // Iterations in a skill; replay plus the final check fits the planning loop
+#define SKILL_MAX_PARAMS 4            // Numbers in an objective that can become parameters
+#define SKILL_SIGNATURE_WORDS 8       // 256-bit trigram signature
+#define SKILL_DOC_SIZE 6144           // JsonDocument for a stored skill's steps
+
+// One recorded tool call
+struct SkillStep {
+  int group;       // Iteration it was made in; a group replays as one decision
+  String tool;
+  String params;   // Stored skills: numbers taken from the objective are {N} or {N*factor} placeholders
+  int expectCm;    // Sonar distance in the result when recorded, -1 if the result had none
+};
+
+// Numbers in an objective, in order, with the unit written after each
+struct SkillParams {
+  float values[SKILL_MAX_PARAMS];
+  String units[SKILL_MAX_PARAMS];   // "ms", "s", "cm", "m", "deg" or ""
+  bool travel[SKILL_MAX_PARAMS];    // Distance to drive ("forward 50 cm")
+  int count;
+  float conditionCm;                // First distance condition ("within 20 cm"), kept in the pattern, -1 if none
+  bool conditionAtLeast;            // Ends at least conditionCm away ("back up until 30 cm away"), not within it
+};
+
+// In-memory index of the stored skills; steps stay in NVS until replayed
+struct SkillIndexEntry {
+  String pattern;    // normalizeObjective() of the recorded objective
+  String shape;      // Directions and parameter units; must match exactly
+  uint32_t signature[SKILL_SIGNATURE_WORDS];
+  uint32_t uses;     // Replays completed without the LLM
+  bool stored;
+};
+
+// A stored skill being replayed
+struct SkillReplay {
+  int slot;
+  String objective;      // Objective the skill was recorded for
+  SkillStep steps[SKILL_MAX_STEPS];
+  int count;
+  int next;              // First step not replayed yet
+  int groupStart;        // Steps of the decision whose results are checked next
+  int groupEnd;
+  SkillParams params;    // Of the objective being replayed
+  int startCm;           // Sonar distance when the skill was recorded, -1 if not recorded
+  int lastCm;            // Latest distance read during the replay, -1 before the first
+  String deviation;      // Why replay handed over to the LLM, "" if it didn't
+  bool active;
+};
+
+// Tool calls of the objective being planned, recorded for the library
+struct SkillRecording {
+  SkillStep steps[SKILL_MAX_STEPS];
+  int count;
+  int groups;
+  bool overflow;         // More steps than SKILL_MAX_STEPS
+  int startCm;           // Sonar distance when the objective started, -1 if not read
+};
+
+// Skill library use since boot
+struct SkillStats {
+  unsigned long matches;      // Objectives that started a replay
+  unsigned long completed;    // Replays that finished the objective without the LLM
+  unsigned long deviations;   // Replays handed over to the LLM
+  unsigned long savedRequests; // Decisions replayed instead of requested
+  unsigned long recorded;     // Skills written to NVS
+};
+
+extern SkillIndexEntry skillIndex[SKILL_LIBRARY_SLOTS];
+extern SkillReplay skillReplay;
+extern SkillRecording skillRecording;
+extern SkillStats skillStats;
+
+// Function declarations
+String normalizeObjective(const String& objective, SkillParams& params);
+String skillShape(const String& pattern);
+void skillSignature(const String& pattern, uint32_t* signature);
+float skillSimilarity(const uint32_t* a, const uint32_t* b);
+void skillSlotKey(char* key, size_t size, char field, int slot);
+void loadSkillLibrary();
+int findSkill(const String& pattern);
+int chooseSkillSlot(const String& pattern);
+bool loadSkillSteps(int slot, SkillReplay& replay);
+int readSkillStartDistance();
+bool beginSkillReplay(const String& objective, int startCm);
+bool nextSkillDecision(SkillReplay& replay, const String& latestResults, PlanningDecision& decision);
+String checkSkillResults(const SkillReplay& replay, const String& latestResults);
+bool skillConditionMet(const SkillParams& params, int cm);
+String skillResultLine(const String& results, int index, const String& tool);
+String fillSkillParams(const String& params, const SkillParams& values);
+String parameterizeSkillParams(const String& tool, const String& params, const SkillParams& values);
+void resetSkillRecording(SkillRecording& recording);
+void recordSkillIteration(SkillRecording& recording, const PlanningDecision& decision, const String& executionResults);
+bool saveSkill(const String& objective, const SkillRecording& recording, String& note);
+String skillDecisionJson(const PlanningDecision& decision);
+String formatSkillFactor(float factor);
+String finishSkillSession(const String& objective, bool achieved, bool recordable);
+String listSkills();
+String forgetSkill(int slot);
+String formatSkillStats();
+String skillLibrary(String params);
+
+#endif // SKILL_LIBRARY_H
@@ -0,0 +1,881 @@
+#include "skill_library.h"
+#include "robot_tools.h"
+#include "local_planner.h"
+#include "prompt_store.h"
+
+SkillIndexEntry skillIndex[SKILL_LIBRARY_SLOTS];
+SkillReplay skillReplay;
+SkillRecording skillRecording;
+SkillStats skillStats = {0, 0, 0, 0, 0};
+
+// Dropped from objectives before matching
+const char* SKILL_FILLER_WORDS[] = {"the", "a", "an", "please", "and", "then", "for", "of", "your", "car", "robot"};
+// A distance after one of these is a condition ("within 20 cm"), not a distance to drive
+const char* SKILL_CONDITION_WORDS[] = {"within", "than", "to", "at", "under", "below", "until", "stop"};
+// A distance condition with one of these words is met at or beyond the distance, not within it
+const char* SKILL_AWAY_WORDS[] = {"away", "back", "backward", "reverse", "more", "farther", "further"};
+// Objectives only match when these appear in the same order
+const char* SKILL_DIRECTION_WORDS[] = {"forward", "backward", "back", "reverse", "ahead", "left", "right", "around"};
+// Tools a skill may contain; anything else (vision, diagnostics) needs the LLM every time
+const char* SKILL_TOOLS[] = {"get_sonar_distance", "move_car", "test_sonar", "get_environment_info", "send_mqtt_message"};
+
+static bool isSkillWord(const String& word, const char* const* words, int count) {
+  for (int i = 0; i < count; i++) {
+    if (word == words[i]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void appendSkillToken(String& pattern, const String& token) {
+  if (pattern.length() > 0) {
+    pattern += ' ';
+  }
+  pattern += token;
+}
+
+/**
+ * Normalize an objective for matching
+ * Lowercase words without punctuation or filler words; each number becomes
+ * '#' followed by its unit ("ms", "s", "cm", "m", "deg"), e.g. "Please
+ * drive forward 50 centimeters." gives "drive forward # cm". Distance
+ * conditions are kept as written ("approach wall until within 20 cm"): a
+ * skill ends at its recorded distance, so only the same condition matches.
+ * Numbers past SKILL_MAX_PARAMS are kept as written too.
+ * @param objective Objective as received
+ * @param params Receives the numbers replaced by '#'
+ * @return Pattern
+ */
+String normalizeObjective(const String& objective, SkillParams& params) {
+  String text = objective;
+  text.toLowerCase();
+  params.count = 0;
+  params.conditionCm = -1;
+  params.conditionAtLeast = false;
+
+  String pattern = "";
+  String lastWord = "";
+  int n = text.length();
+  int i = 0;
+  while (i < n) {
+    char c = text.charAt(i);
+    if (isDigit(c)) {
+      float value;
+      String unit;
+      findQuantity(text.substring(i), value, unit);
+      int end = i;
+      while (end < n && (isDigit(text.charAt(end)) || text.charAt(end) == '.')) {
+        end++;
+      }
+      String number = text.substring(i, end);
+      if (unit.length() > 0) {
+        int wordStart = end;
+        while (wordStart < n && text.charAt(wordStart) == ' ') {
+          wordStart++;
+        }
+        int wordEnd = wordStart;
+        while (wordEnd < n && isAlpha(text.charAt(wordEnd))) {
+          wordEnd++;
+        }
+        if (wordEnd > wordStart) {
+          end = wordEnd;
+        }
+      }
+
+      bool distance = unit == "cm" || unit == "m";
+      bool condition = distance &&
+                       isSkillWord(lastWord, SKILL_CONDITION_WORDS, sizeof(SKILL_CONDITION_WORDS) / sizeof(SKILL_CONDITION_WORDS[0]));
+      if (condition) {
+        appendSkillToken(pattern, number);
+        if (params.conditionCm < 0) {
+          params.conditionCm = unit == "m" ? value * 100 : value;
+        }
+      } else if (params.count < SKILL_MAX_PARAMS) {
+        params.values[params.count] = value;
+        params.units[params.count] = unit;
+        params.travel[params.count] = distance;
+        params.count++;
+        appendSkillToken(pattern, "#");
+      } else {
+        appendSkillToken(pattern, number);
+      }
+      if (unit.length() > 0) {
+        appendSkillToken(pattern, unit);
+      }
+      lastWord = "#";
+      i = end;
+    } else if (isAlpha(c)) {
+      int end = i;
+      while (end < n && isAlpha(text.charAt(end))) {
+        end++;
+      }
+      String word = text.substring(i, end);
+      if (!isSkillWord(word, SKILL_FILLER_WORDS, sizeof(SKILL_FILLER_WORDS) / sizeof(SKILL_FILLER_WORDS[0]))) {
+        appendSkillToken(pattern, word);
+      }
+      if (isSkillWord(word, SKILL_AWAY_WORDS, sizeof(SKILL_AWAY_WORDS) / sizeof(SKILL_AWAY_WORDS[0]))) {
+        params.conditionAtLeast = true;
+      }
+      lastWord = word;
+      i = end;
+    } else {
+      i++;
+    }
+  }
+  return pattern;
+}
+
+/**
+ * The part of a pattern that has to match exactly: direction words,
+ * parameter units and numbers kept as written, in order, e.g.
+ * "forward #cm left #deg" or "until 20cm"
+ */
+String skillShape(const String& pattern) {
+  String shape = "";
+  int start = 0;
+  while (start < pattern.length()) {
+    int end = pattern.indexOf(' ', start);
+    if (end < 0) {
+      end = pattern.length();
+    }
+    String token = pattern.substring(start, end);
+    if (token == "#" || isDigit(token.charAt(0))) {
+      String unit = "";
+      int next = pattern.indexOf(' ', end + 1);
+      if (end < pattern.length()) {
+        unit = pattern.substring(end + 1, next < 0 ? pattern.length() : next);
+      }
+      if (unit == "ms" || unit == "s" || unit == "cm" || unit == "m" || unit == "deg") {
+        appendSkillToken(shape, token + unit);
+      } else {
+        appendSkillToken(shape, token);
+      }
+    } else if (isSkillWord(token, SKILL_DIRECTION_WORDS, sizeof(SKILL_DIRECTION_WORDS) / sizeof(SKILL_DIRECTION_WORDS[0]))) {
+      appendSkillToken(shape, token);
+    }
+    start = end + 1;
+  }
+  return shape;
+}
+
+/**
+ * Set one bit per character trigram of a pattern (FNV-1a, folded to 256 bits)
+ */
+void skillSignature(const String& pattern, uint32_t* signature) {
+  memset(signature, 0, SKILL_SIGNATURE_WORDS * sizeof(uint32_t));
+  String padded = " " + pattern + " ";
+  for (int i = 0; i + 3 <= padded.length(); i++) {
+    uint32_t hash = 2166136261u;
+    for (int j = 0; j < 3; j++) {
+      hash ^= (uint8_t)padded.charAt(i + j);
+      hash *= 16777619u;
+    }
+    int bit = hash % (SKILL_SIGNATURE_WORDS * 32);
+    signature[bit / 32] |= 1u << (bit % 32);
+  }
+}
+
+/**
+ * Jaccard similarity of two trigram signatures
+ * @return 0 (nothing shared) to 1 (same trigrams)
+ */
+float skillSimilarity(const uint32_t* a, const uint32_t* b) {
+  int both = 0;
+  int either = 0;
+  for (int i = 0; i < SKILL_SIGNATURE_WORDS; i++) {
+    both += __builtin_popcount(a[i] & b[i]);
+    either += __builtin_popcount(a[i] | b[i]);
+  }
+  return either > 0 ? (float)both / either : 0;
+}
+
+/**
+ * Build the NVS key for a slot field, e.g. "p3" for slot 3's pattern
+ */
+void skillSlotKey(char* key, size_t size, char field, int slot) {
+  snprintf(key, size, "%c%d", field, slot);
+}
+
+/**
+ * Load the skill index (patterns and use counts) from NVS
+ * Steps are only read when a skill is replayed.
+ */
+void loadSkillLibrary() {
+  Preferences prefs;
+  bool opened = prefs.begin(SKILL_NAMESPACE, true);
+  char key[8];
+  int count = 0;
+
+  for (int slot = 0; slot < SKILL_LIBRARY_SLOTS; slot++) {
+    SkillIndexEntry& entry = skillIndex[slot];
+    entry.pattern = "";
+    entry.shape = "";
+    entry.uses = 0;
+    entry.stored = false;
+    if (!opened) {
+      continue;
+    }
+    skillSlotKey(key, sizeof(key), 'p', slot);
+    entry.pattern = prefs.getString(key, "");
+    if (entry.pattern.length() == 0) {
+      continue;
+    }
+    skillSlotKey(key, sizeof(key), 'u', slot);
+    entry.uses = prefs.getUInt(key, 0);
+    entry.shape = skillShape(entry.pattern);
+    skillSignature(entry.pattern, entry.signature);
+    entry.stored = true;
+    count++;
+  }
+  if (opened) {
+    prefs.end();
+  }
+  logToRobotLogs("Skill library: " + String(count) + " skills stored");
+}
+
+/**
+ * Find the stored skill for an objective pattern
+ * Shapes must be equal; of those, the skill with the most similar pattern
+ * wins if it reaches SKILL_MATCH_THRESHOLD.
+ * @return Slot index, or -1 if no skill matches
+ */
+int findSkill(const String& pattern) {
+  String shape = skillShape(pattern);
+  uint32_t signature[SKILL_SIGNATURE_WORDS];
+  skillSignature(pattern, signature);
+
+  int best = -1;
+  float bestScore = 0;
+  for (int slot = 0; slot < SKILL_LIBRARY_SLOTS; slot++) {
+    const SkillIndexEntry& entry = skillIndex[slot];
+    if (!entry.stored || entry.shape != shape) {
+      continue;
+    }
+    float score = entry.pattern == pattern ? 1.0 : skillSimilarity(signature, entry.signature);
+    if (score >= SKILL_MATCH_THRESHOLD && score > bestScore) {
+      best = slot;
+      bestScore = score;
+    }
+  }
+  return best;
+}
+
+/**
+ * Pick the slot a skill is written to: the one holding the same pattern,
+ * an empty one, or the one replayed least
+ */
+int chooseSkillSlot(const String& pattern) {
+  int victim = 0;
+  for (int slot = 0; slot < SKILL_LIBRARY_SLOTS; slot++) {
+    if (skillIndex[slot].stored && skillIndex[slot].pattern == pattern) {
+      return slot;
+    }
+  }
+  for (int slot = 0; slot < SKILL_LIBRARY_SLOTS; slot++) {
+    if (!skillIndex[slot].stored) {
+      return slot;
+    }
+    if (skillIndex[slot].uses < skillIndex[victim].uses) {
+      victim = slot;
+    }
+  }
+  return victim;
+}
+
+/**
+ * Read a skill's steps from NVS and verify their CRC
+ * @param slot Slot to read
+ * @param replay Receives the recorded objective and steps
+ * @return false if the steps are missing or corrupt
+ */
+bool loadSkillSteps(int slot, SkillReplay& replay) {
+  Preferences prefs;
+  if (!prefs.begin(SKILL_NAMESPACE, true)) {
+    return false;
+  }
+  char key[8];
+  skillSlotKey(key, sizeof(key), 'k', slot);
+  String json = prefs.getString(key, "");
+  skillSlotKey(key, sizeof(key), 'c', slot);
+  uint32_t crc = prefs.getUInt(key, 0);
+  prefs.end();
+
+  if (json.length() == 0 || promptCrc32(json) != crc) {
+    return false;
+  }
+  DynamicJsonDocument doc(SKILL_DOC_SIZE);
+  if (deserializeJson(doc, json) || !doc.containsKey("steps")) {
+    return false;
+  }
+
+  replay.objective = doc["objective"].as<String>();
+  replay.startCm = doc.containsKey("start_cm") ? doc["start_cm"].as<int>() : -1;
+  JsonArray steps = doc["steps"];
+  replay.count = min((int)steps.size(), SKILL_MAX_STEPS);
+  for (int i = 0; i < replay.count; i++) {
+    JsonArray step = steps[i];
+    replay.steps[i].group = step[0].as<int>();
+    replay.steps[i].tool = step[1].as<String>();
+    replay.steps[i].params = step[2].as<String>();
+    replay.steps[i].expectCm = step[3].as<int>();
+  }
+  return replay.count > 0;
+}
+
+/**
+ * Read the sonar at the start of an objective
+ * A skill stores this reading; a replay only starts from about the same spot.
+ * @return Distance in cm, LOCAL_OUT_OF_RANGE_CM for no echo, -1 if the read failed
+ */
+int readSkillStartDistance() {
+  return parseDistanceResult(executeTool("get_sonar_distance", ""));
+}
+
+/**
+ * End a replay and hand the objective over to the LLM
+ */
+static void endSkillReplay(SkillReplay& replay, const String& deviation) {
+  logToRobotLogs("Skill replay deviated: " + deviation);
+  replay.deviation = deviation;
+  replay.active = false;
+  skillStats.deviations++;
+}
+
+/**
+ * Start replaying the stored skill that matches an objective, if there is one
+ * The first recorded decision drives from where the recording started, so
+ * the replay only starts if the car is about as far from the obstacle now.
+ * @param objective Objective being planned
+ * @param startCm readSkillStartDistance() for this objective
+ * @return true if a skill is being replayed (skillReplay.active); false with
+ *         skillReplay.deviation set if a skill matched but the start differs
+ */
+bool beginSkillReplay(const String& objective, int startCm) {
+  skillReplay.active = false;
+  skillReplay.slot = -1;
+  skillReplay.deviation = "";
+
+  String pattern = normalizeObjective(objective, skillReplay.params);
+  int slot = findSkill(pattern);
+  if (slot < 0) {
+    return false;
+  }
+  if (!loadSkillSteps(slot, skillReplay)) {
+    logToRobotLogs("Skill library: slot " + String(slot) + " is missing or corrupt, ignored");
+    return false;
+  }
+
+  skillReplay.slot = slot;
+  skillStats.matches++;
+  logToRobotLogs("Skill library: '" + pattern + "' matches slot " + String(slot) + " ('" + skillIndex[slot].pattern + "')");
+  if (skillReplay.startCm < 0) {
+    endSkillReplay(skillReplay, "no starting distance recorded");
+    return false;
+  }
+  if (startCm < 0 || abs(startCm - skillReplay.startCm) > SKILL_DISTANCE_TOLERANCE_CM) {
+    endSkillReplay(skillReplay, "started at " + (startCm < 0 ? String("no distance") : String(startCm) + " cm") +
+                                ", recorded " + String(skillReplay.startCm) + " cm");
+    return false;
+  }
+
+  skillReplay.next = 0;
+  skillReplay.groupStart = 0;
+  skillReplay.groupEnd = 0;
+  skillReplay.lastCm = startCm;
+  skillReplay.active = true;
+  sendMqttMessage("[SKILL] Replaying the stored skill for '" + skillReplay.objective + "' (" + String(skillReplay.count) +
+                  " tool calls); the LLM is only asked if a result deviates");
+  return true;
+}
+
+/**
+ * The result text of one tool call in executePlanningToolCalls() output
+ * @param results Tool results of a decision
+ * @param index Index of the call in the decision
+ * @param tool Tool name
+ * @return Result, "" if the call didn't run
+ */
+String skillResultLine(const String& results, int index, const String& tool) {
+  String marker = "[" + String(index + 1) + "] " + tool + ": ";
+  int start = results.indexOf(marker);
+  if (start < 0) {
+    return "";
+  }
+  start += marker.length();
+  int end = results.indexOf('\n', start);
+  return results.substring(start, end < 0 ? results.length() : end);
+}
+
+/**
+ * Compare the results of the last replayed decision with the recording
+ * @return Why they deviate, "" if they match
+ */
+String checkSkillResults(const SkillReplay& replay, const String& latestResults) {
+  for (int i = replay.groupStart; i < replay.groupEnd; i++) {
+    const SkillStep& step = replay.steps[i];
+    String result = skillResultLine(latestResults, i - replay.groupStart, step.tool);
+    if (result.length() == 0) {
+      return step.tool + " didn't run";
+    }
+    if (result.startsWith("Error")) {
+      return step.tool + " failed: " + result;
+    }
+    if (step.expectCm >= 0) {
+      int cm = parseDistanceResult(result);
+      if (cm < 0 || abs(cm - step.expectCm) > SKILL_DISTANCE_TOLERANCE_CM) {
+        return step.tool + " read " + (cm < 0 ? String("no distance") : String(cm) + " cm") +
+               ", recorded " + String(step.expectCm) + " cm";
+      }
+    }
+  }
+  return "";
+}
+
+/**
+ * Check a distance against an objective's condition
+ * @param params Numbers of the objective
+ * @param cm Distance read, -1 if none
+ * @return true if the objective has no condition or the distance meets it
+ */
+bool skillConditionMet(const SkillParams& params, int cm) {
+  if (params.conditionCm < 0) {
+    return true;
+  }
+  if (cm < 0) {
+    return false;
+  }
+  return params.conditionAtLeast ? cm >= params.conditionCm : cm <= params.conditionCm;
+}
+
+/**
+ * Decision JSON for a replayed decision, so conversation mode has a turn to
+ * show the LLM if it takes over
+ */
+String skillDecisionJson(const PlanningDecision& decision) {
+  String json = "{\"tool_calls\":[";
+  for (int i = 0; i < decision.numToolCalls; i++) {
+    json += i > 0 ? ",{\"tool\":" : "{\"tool\":";
+    appendJsonString(json, decision.toolCalls[i].tool);
+    json += ",\"params\":";
+    appendJsonString(json, decision.toolCalls[i].params);
+    json += ",\"confidence\":1.0}";
+  }
+  json += "],\"should_continue\":";
+  json += decision.shouldContinue ? "true" : "false";
+  json += ",\"objective_complete\":";
+  json += decision.objectiveComplete ? "true" : "false";
+  json += ",\"reasoning\":";
+  appendJsonString(json, decision.reasoning);
+  json += '}';
+  return json;
+}
+
+/**
+ * Next planning decision of a skill replay
+ * Checks the previous decision's results against the recording, then
+ * replays the next recorded iteration. Once every step has run and matched,
+ * and the last distance meets the objective's condition, the objective is
+ * complete.
+ * @param replay Replay from beginSkillReplay(); progress is kept in it
+ * @param latestResults Tool results of the previous decision
+ * @param decision Receives the decision
+ * @return false if the results deviate; the replay ends and replay.deviation says why
+ */
+bool nextSkillDecision(SkillReplay& replay, const String& latestResults, PlanningDecision& decision) {
+  String deviation = checkSkillResults(replay, latestResults);
+  if (deviation.length() > 0) {
+    endSkillReplay(replay, deviation);
+    return false;
+  }
+  if (replay.groupEnd > replay.groupStart) {
+    int cm = parseDistanceResult(latestResults);
+    if (cm >= 0) {
+      replay.lastCm = cm;
+    }
+  }
+  if (replay.next >= replay.count && !skillConditionMet(replay.params, replay.lastCm)) {
+    endSkillReplay(replay, "ended at " + (replay.lastCm < 0 ? String("no distance") : String(replay.lastCm) + " cm") +
+                           ", objective needs " + (replay.params.conditionAtLeast ? "at least " : "within ") +
+                           String((int)replay.params.conditionCm) + " cm");
+    return false;
+  }
+
+  decision.numToolCalls = 0;
+  decision.shouldContinue = true;
+  decision.objectiveComplete = false;
+  decision.nextContext = "";
+  decision.estimatedPromptTokens = 0;
+  decision.promptTokens = -1;
+  decision.completionTokens = 0;
+  decision.requestFailed = false;
+  decision.fromLocalPlanner = false;
+  decision.fromSkill = true;
+  decision.jsonRepairs = 0;
+  decision.schemaError = "";
+  decision.truncated = false;
+  decision.maxTokens = 0;
+  decision.generationMs = 0;
+  decision.lengthRetried = false;
+  skillStats.savedRequests++;
+
+  if (replay.next >= replay.count) {
+    decision.shouldContinue = false;
+    decision.objectiveComplete = true;
+    decision.reasoning = "Skill replay complete, every result matched the recording for '" + replay.objective + "'";
+    decision.rawContent = skillDecisionJson(decision);
+    replay.active = false;
+    return true;
+  }
+
+  const int maxCalls = sizeof(decision.toolCalls) / sizeof(decision.toolCalls[0]);
+  int group = replay.steps[replay.next].group;
+  replay.groupStart = replay.next;
+  while (replay.next < replay.count && replay.steps[replay.next].group == group && decision.numToolCalls < maxCalls) {
+    const SkillStep& step = replay.steps[replay.next];
+    addLocalToolCall(decision, step.tool.c_str(), fillSkillParams(step.params, replay.params));
+    replay.next++;
+  }
+  replay.groupEnd = replay.next;
+  decision.reasoning = "Skill replay, tool calls " + String(replay.groupStart + 1) + "-" + String(replay.next) + " of " +
+                       String(replay.count) + " recorded for '" + replay.objective + "'";
+  decision.rawContent = skillDecisionJson(decision);
+  return true;
+}
+
+/**
+ * Substitute an objective's numbers into stored params
+ * "{N}" is parameter N, "{N*factor}" parameter N times factor. Forward and
+ * backward durations are kept off the values moveCar() reads as degrees.
+ */
+String fillSkillParams(const String& params, const SkillParams& values) {
+  bool duration = params.startsWith("forward") || params.startsWith("backward");
+  String out = "";
+  int i = 0;
+  while (i < params.length()) {
+    int close = params.charAt(i) == '{' ? params.indexOf('}', i) : -1;
+    if (close < 0) {
+      out += params.charAt(i);
+      i++;
+      continue;
+    }
+    String ref = params.substring(i + 1, close);
+    int star = ref.indexOf('*');
+    int index = (star < 0 ? ref : ref.substring(0, star)).toInt();
+    float factor = star < 0 ? 1 : ref.substring(star + 1).toFloat();
+    if (index < values.count) {
+      int amount = (int)(values.values[index] * factor + 0.5);
+      out += String(duration ? moveCarDuration(amount) : amount);
+    } else {
+      out += params.substring(i, close + 1);
+    }
+    i = close + 1;
+  }
+  return out;
+}
+
+/**
+ * Shortest decimal form of a scale factor, e.g. "40" or "12.5"
+ */
+String formatSkillFactor(float factor) {
+  String text = String(factor, 3);
+  while (text.endsWith("0")) {
+    text.remove(text.length() - 1);
+  }
+  if (text.endsWith(".")) {
+    text.remove(text.length() - 1);
+  }
+  return text;
+}
+
+/**
+ * Turn a recorded move_car call into a template
+ * A turn angle equal to a degree (or unitless) parameter becomes "{N}"; a
+ * duration equal to a time parameter becomes "{N}" or "{N*1000}"; any other
+ * forward/backward duration scales with the objective's distance to drive,
+ * if it has exactly one. Other tools are stored as called.
+ * @param tool Tool name
+ * @param params Params as called
+ * @param values Numbers in the recorded objective
+ */
+String parameterizeSkillParams(const String& tool, const String& params, const SkillParams& values) {
+  int space = params.indexOf(' ');
+  if (tool != "move_car" || values.count == 0 || space < 0) {
+    return params;
+  }
+  String direction = params.substring(0, space);
+  String amountText = params.substring(space + 1);
+  amountText.trim();
+  if (amountText.length() == 0 || !isDigit(amountText.charAt(0))) {
+    return params;
+  }
+  float amount = amountText.toFloat();
+  bool turn = direction == "left" || direction == "right";
+
+  int travelIndex = -1;
+  int travelCount = 0;
+  for (int i = 0; i < values.count; i++) {
+    float value = values.values[i];
+    const String& unit = values.units[i];
+    String placeholder = direction + " {" + String(i);
+    if (turn) {
+      if ((unit == "deg" || unit == "") && fabs(amount - value) < 0.5) {
+        return placeholder + "}";
+      }
+      continue;
+    }
+    if ((unit == "ms" || unit == "") && fabs(amount - value) < 0.5) {
+      return placeholder + "}";
+    }
+    if ((unit == "s" || unit == "") && fabs(amount - value * 1000) < 0.5) {
+      return placeholder + "*1000}";
+    }
+    if (values.travel[i]) {
+      travelIndex = i;
+      travelCount++;
+    }
+  }
+  if (!turn && travelCount == 1 && values.values[travelIndex] > 0) {
+    return direction + " {" + String(travelIndex) + "*" + formatSkillFactor(amount / values.values[travelIndex]) + "}";
+  }
+  return params;
+}
+
+void resetSkillRecording(SkillRecording& recording) {
+  recording.count = 0;
+  recording.groups = 0;
+  recording.overflow = false;
+  recording.startCm = -1;
+}
+
+/**
+ * Add an executed decision's tool calls to the recording
+ * Calls that were skipped or returned an error had no effect and are left out.
+ * @param recording Recording of the current objective
+ * @param decision Decision that was executed
+ * @param executionResults executePlanningToolCalls() output for it
+ */
+void recordSkillIteration(SkillRecording& recording, const PlanningDecision& decision, const String& executionResults) {
+  bool recorded = false;
+  for (int i = 0; i < decision.numToolCalls; i++) {
+    const ToolCall& call = decision.toolCalls[i];
+    if (!call.isValid) {
+      continue;
+    }
+    String result = skillResultLine(executionResults, i, call.tool);
+    if (result.length() == 0 || result.startsWith("Error")) {
+      continue;
+    }
+    if (recording.count == SKILL_MAX_STEPS) {
+      recording.overflow = true;
+      break;
+    }
+    SkillStep& step = recording.steps[recording.count++];
+    step.group = recording.groups;
+    step.tool = call.tool;
+    step.params = call.params;
+    step.expectCm = parseDistanceResult(result);
+    recorded = true;
+  }
+  if (recorded) {
+    recording.groups++;
+  }
+}
+
+/**
+ * Store a recording as the skill for an objective
+ * The slot's pattern is removed first, so an interrupted write never leaves
+ * an index entry pointing at half-written steps.
+ * @param objective Objective that was completed
+ * @param recording Its tool calls
+ * @param note Receives what happened, for the planning summary
+ * @return true if the skill was written
+ */
+bool saveSkill(const String& objective, const SkillRecording& recording, String& note) {
+  if (recording.count == 0) {
+    note = "not stored, no tool calls";
+    return false;
+  }
+  if (recording.startCm < 0) {
+    note = "not stored, no starting distance";
+    return false;
+  }
+  if (recording.overflow || recording.groups > SKILL_MAX_GROUPS) {
+    note = "not stored, longer than " + String(SKILL_MAX_STEPS) + " tool calls or " + String(SKILL_MAX_GROUPS) + " iterations";
+    return false;
+  }
+  for (int i = 0; i < recording.count; i++) {
+    if (!isSkillWord(recording.steps[i].tool, SKILL_TOOLS, sizeof(SKILL_TOOLS) / sizeof(SKILL_TOOLS[0]))) {
+      note = "not stored, " + recording.steps[i].tool + " needs the LLM";
+      return false;
+    }
+  }
+
+  SkillParams params;
+  String pattern = normalizeObjective(objective, params);
+  String json = "{\"objective\":";
+  appendJsonString(json, objective);
+  json += ",\"steps\":[";
+  for (int i = 0; i < recording.count; i++) {
+    const SkillStep& step = recording.steps[i];
+    json += i > 0 ? ",[" : "[";
+    json += String(step.group) + ",";
+    appendJsonString(json, step.tool);
+    json += ',';
+    appendJsonString(json, parameterizeSkillParams(step.tool, step.params, params));
+    json += "," + String(step.expectCm) + "]";
+  }
+  json += "],\"start_cm\":" + String(recording.startCm) + "}";
+
+  Preferences prefs;
+  if (!prefs.begin(SKILL_NAMESPACE, false)) {
+    note = "not stored, NVS unavailable";
+    return false;
+  }
+  int slot = chooseSkillSlot(pattern);
+  SkillIndexEntry& entry = skillIndex[slot];
+  entry.stored = false;
+
+  char key[8];
+  skillSlotKey(key, sizeof(key), 'p', slot);
+  prefs.remove(key);
+  skillSlotKey(key, sizeof(key), 'k', slot);
+  size_t written = prefs.putString(key, json);
+  skillSlotKey(key, sizeof(key), 'c', slot);
+  prefs.putUInt(key, promptCrc32(json));
+  skillSlotKey(key, sizeof(key), 'u', slot);
+  prefs.putUInt(key, 0);
+  if (written != json.length()) {
+    prefs.end();
+    note = "not stored, NVS write failed";
+    return false;
+  }
+  skillSlotKey(key, sizeof(key), 'p', slot);
+  prefs.putString(key, pattern);
+  prefs.end();
+
+  entry.pattern = pattern;
+  entry.shape = skillShape(pattern);
+  skillSignature(pattern, entry.signature);
+  entry.uses = 0;
+  entry.stored = true;
+  skillStats.recorded++;
+  note = "recorded '" + pattern + "' in slot " + String(slot) + " (" + String(recording.count) + " tool calls)";
+  return true;
+}
+
+/**
+ * Wrap up the skill library's part in an objective
+ * A replay that finished the objective counts as a use of its skill. An
+ * objective completed with the LLM (from the start, or after a replay
+ * deviated) is stored as a skill, unless the offline planner was involved.
+ * @param objective Objective that was planned
+ * @param achieved The objective was completed, not abandoned or timed out
+ * @param recordable skillRecording holds only LLM and replayed decisions
+ * @return Summary line, "" if the library wasn't involved
+ */
+String finishSkillSession(const String& objective, bool achieved, bool recordable) {
+  String note = "";
+  bool matched = skillReplay.slot >= 0;
+  skillReplay.active = false;
+
+  if (matched && skillReplay.deviation.length() == 0) {
+    if (!achieved) {
+      return "replay of slot " + String(skillReplay.slot) + " stopped before the objective was complete";
+    }
+    SkillIndexEntry& entry = skillIndex[skillReplay.slot];
+    entry.uses++;
+    Preferences prefs;
+    if (prefs.begin(SKILL_NAMESPACE, false)) {
+      char key[8];
+      skillSlotKey(key, sizeof(key), 'u', skillReplay.slot);
+      prefs.putUInt(key, entry.uses);
+      prefs.end();
+    }
+    skillStats.completed++;
+    return "replayed slot " + String(skillReplay.slot) + " ('" + entry.pattern + "') without the LLM, " +
+           String(entry.uses) + " replays so far";
+  }
+
+  if (achieved && recordable) {
+    saveSkill(objective, skillRecording, note);
+  }
+  if (matched) {
+    note = "replay of slot " + String(skillReplay.slot) + " deviated (" + skillReplay.deviation + ")" +
+           (note.length() > 0 ? "; " + note : String(""));
+  }
+  return note;
+}
+
+/**
+ * Stored skills, one per line, e.g. "\n2: 'drive square side # cm', 5 replays"
+ */
+String listSkills() {
+  String out = "";
+  for (int slot = 0; slot < SKILL_LIBRARY_SLOTS; slot++) {
+    if (skillIndex[slot].stored) {
+      out += "\n" + String(slot) + ": '" + skillIndex[slot].pattern + "', " + String(skillIndex[slot].uses) + " replays";
+    }
+  }
+  return out.length() > 0 ? out : " none";
+}
+
+/**
+ * Remove a skill from NVS and the index
+ */
+String forgetSkill(int slot) {
+  if (slot < 0 || slot >= SKILL_LIBRARY_SLOTS || !skillIndex[slot].stored) {
+    return "Error: No skill in slot " + String(slot);
+  }
+  Preferences prefs;
+  if (!prefs.begin(SKILL_NAMESPACE, false)) {
+    return "Error: NVS unavailable";
+  }
+  const char fields[] = {'p', 'k', 'c', 'u'};
+  char key[8];
+  for (int i = 0; i < 4; i++) {
+    skillSlotKey(key, sizeof(key), fields[i], slot);
+    prefs.remove(key);
+  }
+  prefs.end();
+  skillIndex[slot].stored = false;
+  return "Forgot skill " + String(slot) + " ('" + skillIndex[slot].pattern + "')";
+}
+
+/**
+ * One-line summary, e.g. "5 replays (4 completed, 1 deviated), 23 LLM decisions saved, 3 skills recorded"
+ */
+String formatSkillStats() {
+  return String(skillStats.matches) + " replays (" + String(skillStats.completed) + " completed, " +
+         String(skillStats.deviations) + " deviated), " + String(skillStats.savedRequests) + " LLM decisions saved, " +
+         String(skillStats.recorded) + " skills recorded";
+}
+
+/**
+ * Tool: Skill Library
+ * Lists or removes the tool sequences stored for repeated objectives
+ * @param params "list", "forget <slot>" or "clear"
+ * @return String result
+ */
+String skillLibrary(String params) {
+  params.trim();
+
+  if (params == "" || params == "list") {
+    return "Skills (" + formatSkillStats() + "):" + listSkills();
+  }
+  if (params.startsWith("forget ")) {
+    return forgetSkill(params.substring(7).toInt());
+  }
+  if (params == "clear") {
+    int count = 0;
+    for (int slot = 0; slot < SKILL_LIBRARY_SLOTS; slot++) {
+      if (skillIndex[slot].stored) {
+        forgetSkill(slot);
+        count++;
+      }
+    }
+    return "Forgot " + String(count) + " skills";
+  }
+
+  return "Error: Usage 'list', 'forget <slot>' or 'clear'";
+}
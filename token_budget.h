@@ -0,0 +1,52 @@
+#ifndef TOKEN_BUDGET_H
+#define TOKEN_BUDGET_H
+
+#include <Arduino.h>
+
+#define TOKEN_MESSAGE_OVERHEAD 4       // Tokens the chat format adds per message
+#define TOKEN_SUMMARY_REASONING_CHARS 80 // Reasoning kept when an iteration is summarized
+#define TOKEN_EMA_WEIGHT 0.3           // Weight of the newest observation in running averages
+#define RESPONSE_TOKENS_HEADROOM 1.5   // max_tokens over the expected decision length...
+#define RESPONSE_TOKENS_MARGIN 64      // ...plus this, so a decision that runs long isn't cut off
+
+// Objective kinds, sized separately because their decisions differ in length
+enum ObjectiveKind {
+  OBJECTIVE_MOVE,      // Timed moves and turns
+  OBJECTIVE_APPROACH,  // Distance-conditional ("until within 20 cm")
+  OBJECTIVE_SCAN,      // Sonar sweeps, finding open space
+  OBJECTIVE_VISION,    // Uses the camera; decisions describe what was seen
+  OBJECTIVE_OTHER,
+  OBJECTIVE_KINDS
+};
+
+// Response styles for max_tokens sizing (index into the per-kind averages)
+#define RESPONSE_STYLE_FULL 0
+#define RESPONSE_STYLE_TERSE 1
+
+// Token usage accumulated over one objective
+struct TokenUsage {
+  unsigned long promptTokens;      // Prompt tokens, from usage or estimated
+  unsigned long completionTokens;  // Completion tokens, from usage or estimated
+  int requests;                    // LLM requests made
+  int estimatedRequests;           // Requests whose response had no usage block
+  int historyCompactions;          // Iterations summarized or dropped to fit the budget
+};
+
+// Function declarations
+int estimateTokens(const String& text);
+int estimateRawTokens(const char* text, unsigned int length);
+int estimateChatPromptTokens(const String& systemPrompt, const String& userContent);
+int fitHistoryToTokenBudget(String& history, int fixedTokens, int targetTokens);
+bool summarizeOldestIteration(String& history);
+ObjectiveKind classifyObjective(const String& objective);
+const char* objectiveKindName(ObjectiveKind kind);
+bool useTerseResponse(int iteration, const String& latestResults);
+const char* responseStyleNote(bool terse);
+int chooseMaxTokens(ObjectiveKind kind, bool terse);
+void recordResponseTokens(ObjectiveKind kind, bool terse, int completionTokens);
+void resetTokenUsage(TokenUsage& usage);
+void recordTokenUsage(TokenUsage& usage, int estimatedPromptTokens, int promptTokens, int completionTokens);
+float tokenUsageCost(const TokenUsage& usage);
+String formatTokenUsage(const TokenUsage& usage);
+
+#endif // TOKEN_BUDGET_H
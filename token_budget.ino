@@ -0,0 +1,324 @@
+#include "token_budget.h"
+#include "robot_tools.h"
+#include "config.h"
+
+// Correction applied to raw estimates, learned from the usage block of responses
+float tokenEstimateScale = 1.0;
+
+// Running average of complete decisions' completion tokens per objective
+// kind and response style, 0 until the first one
+float averageCompletionTokens[OBJECTIVE_KINDS][2];
+
+const char* OBJECTIVE_KIND_NAMES[OBJECTIVE_KINDS] = {"move", "approach", "scan", "vision", "other"};
+
+// Sent after the prompt on terse iterations
+const char* TERSE_RESPONSE_NOTE =
+  "Keep it short: reasoning in at most 12 words, next_context in at most 25 words.";
+
+/**
+ * Approximate BPE token count of a run of text
+ * Follows how GPT tokenizers split English and JSON: a word with its
+ * leading space is one token (long words split about every 5 letters),
+ * digits group in threes, line breaks and indentation runs are one token,
+ * and punctuation merges in pairs (JSON's {" and ": are single tokens).
+ * @param text Text to estimate
+ * @param length Number of bytes
+ * @return Unscaled token estimate
+ */
+int estimateRawTokens(const char* text, unsigned int length) {
+  int tokens = 0;
+  unsigned int i = 0;
+
+  while (i < length) {
+    unsigned char c = (unsigned char)text[i];
+    unsigned int runStart = i;
+
+    if (isalpha(c) || c >= 0x80) {
+      while (i < length && (isalpha((unsigned char)text[i]) || (unsigned char)text[i] >= 0x80)) {
+        i++;
+      }
+      tokens += 1 + (i - runStart - 1) / 5;
+    } else if (isdigit(c)) {
+      while (i < length && isdigit((unsigned char)text[i])) {
+        i++;
+      }
+      tokens += (i - runStart + 2) / 3;
+    } else if (c == ' ') {
+      // A single space belongs to the next word
+      while (i < length && text[i] == ' ') {
+        i++;
+      }
+      if (i - runStart > 1 || i >= length || !isalnum((unsigned char)text[i])) {
+        tokens++;
+      }
+    } else if (isspace(c)) {
+      while (i < length && isspace((unsigned char)text[i])) {
+        i++;
+      }
+      tokens++;
+    } else {
+      i++;
+      while (i < length && ispunct((unsigned char)text[i])) {
+        i++;
+      }
+      tokens += 1 + (i - runStart - 1) / 2;
+    }
+  }
+
+  return tokens;
+}
+
+/**
+ * Estimate the token count of text, corrected by observed usage
+ * @param text Text to estimate
+ * @return Estimated tokens
+ */
+int estimateTokens(const String& text) {
+  return (int)(estimateRawTokens(text.c_str(), text.length()) * tokenEstimateScale + 0.5);
+}
+
+/**
+ * Estimate the prompt tokens of a system + user chat request
+ */
+int estimateChatPromptTokens(const String& systemPrompt, const String& userContent) {
+  return estimateTokens(systemPrompt) + estimateTokens(userContent) + 3 * TOKEN_MESSAGE_OVERHEAD;
+}
+
+/**
+ * Replace the oldest full iteration in an execution history with a
+ * one-line summary that keeps its reasoning and tool count
+ * @param history Execution history built by updatePlanningSession()
+ * @return false if fewer than two full iterations remain
+ */
+bool summarizeOldestIteration(String& history) {
+  int start = history.indexOf("--- Iteration ");
+  if (start == -1) {
+    return false;
+  }
+
+  int next = history.indexOf("\n--- Iteration ", start + 1);
+  if (next == -1) {
+    return false;
+  }
+
+  String block = history.substring(start, next);
+
+  int numberEnd = block.indexOf(" ---");
+  String number = numberEnd > 14 ? block.substring(14, numberEnd) : "?";
+
+  String reasoning = "";
+  int reasoningStart = block.indexOf("Reasoning: ");
+  if (reasoningStart != -1) {
+    int reasoningEnd = block.indexOf('\n', reasoningStart);
+    if (reasoningEnd == -1) {
+      reasoningEnd = block.length();
+    }
+    reasoning = block.substring(reasoningStart + 11, reasoningEnd);
+    if (reasoning.length() > TOKEN_SUMMARY_REASONING_CHARS) {
+      reasoning = reasoning.substring(0, TOKEN_SUMMARY_REASONING_CHARS) + "...";
+    }
+  }
+
+  // Executed tools are listed as "[n] tool: result"
+  int toolCount = 0;
+  for (int i = block.indexOf("\n["); i != -1; i = block.indexOf("\n[", i + 1)) {
+    toolCount++;
+  }
+
+  String summary = "Iteration " + number + " (summarized, " + String(toolCount) + " tools): " + reasoning + "\n";
+  history = history.substring(0, start) + summary + history.substring(next + 1);
+  return true;
+}
+
+/**
+ * Shrink an execution history until the prompt fits a token target
+ * Oldest iterations are summarized first, then the oldest summaries are
+ * dropped, and as a last resort the remaining history is cut from the front.
+ * @param history Execution history to shrink in place
+ * @param fixedTokens Estimated tokens of everything in the prompt except the history
+ * @param targetTokens Prompt token target
+ * @return Number of compaction steps applied
+ */
+int fitHistoryToTokenBudget(String& history, int fixedTokens, int targetTokens) {
+  int allowed = targetTokens - fixedTokens;
+  int historyTokens = estimateTokens(history);
+  int steps = 0;
+
+  while (historyTokens > allowed && summarizeOldestIteration(history)) {
+    historyTokens = estimateTokens(history);
+    steps++;
+  }
+
+  // Drop summary lines, oldest first
+  while (historyTokens > allowed && history.startsWith("Iteration ")) {
+    int lineEnd = history.indexOf('\n');
+    history = lineEnd == -1 ? String("") : history.substring(lineEnd + 1);
+    historyTokens = estimateTokens(history);
+    steps++;
+  }
+
+  if (historyTokens > allowed) {
+    int keepChars = allowed > 0 ? (int)((long)history.length() * allowed / historyTokens) : 0;
+    history = "...(earlier history truncated)\n" + history.substring(history.length() - keepChars);
+    steps++;
+  }
+
+  if (steps > 0) {
+    logToRobotLogs("Token budget: history compacted in " + String(steps) + " steps to ~" +
+                   String(estimateTokens(history)) + " tokens (allowed " + String(allowed) + ")");
+  }
+
+  return steps;
+}
+
+/**
+ * Classify an objective for response sizing, by its first matching keyword group
+ */
+ObjectiveKind classifyObjective(const String& objective) {
+  String text = objective;
+  text.toLowerCase();
+  if (text.indexOf("photo") != -1 || text.indexOf("picture") != -1 || text.indexOf("image") != -1 ||
+      text.indexOf("camera") != -1 || text.indexOf("see") != -1 || text.indexOf("describe") != -1) {
+    return OBJECTIVE_VISION;
+  }
+  if (text.indexOf("until") != -1 || text.indexOf("within") != -1 || text.indexOf("approach") != -1) {
+    return OBJECTIVE_APPROACH;
+  }
+  if (text.indexOf("scan") != -1 || text.indexOf("look around") != -1 || text.indexOf("open") != -1 ||
+      text.indexOf("explore") != -1) {
+    return OBJECTIVE_SCAN;
+  }
+  if (text.indexOf("forward") != -1 || text.indexOf("back") != -1 || text.indexOf("turn") != -1 ||
+      text.indexOf("left") != -1 || text.indexOf("right") != -1 || text.indexOf("move") != -1) {
+    return OBJECTIVE_MOVE;
+  }
+  return OBJECTIVE_OTHER;
+}
+
+const char* objectiveKindName(ObjectiveKind kind) {
+  return OBJECTIVE_KIND_NAMES[kind];
+}
+
+/**
+ * Whether to ask for terse reasoning this iteration
+ * Not on the first iteration, which plans the approach, nor after a tool
+ * error; never with RESPONSE_VERBOSE.
+ * @param iteration Iteration about to be planned (1-based)
+ * @param latestResults Tool results of the previous iteration
+ */
+bool useTerseResponse(int iteration, const String& latestResults) {
+  return !RESPONSE_VERBOSE && iteration > 1 && latestResults.indexOf("Error") == -1;
+}
+
+/**
+ * Instruction sent after the prompt for a response style, or nullptr for none
+ */
+const char* responseStyleNote(bool terse) {
+  return terse ? TERSE_RESPONSE_NOTE : nullptr;
+}
+
+/**
+ * Size max_tokens to the expected planning decision
+ * Uses the running average for this objective kind and style with
+ * headroom. Kinds without a complete decision yet use the mean of the
+ * other kinds in the same style.
+ * @param kind classifyObjective() of the objective
+ * @param terse Whether terse reasoning is asked for
+ * @return max_tokens for the next request
+ */
+int chooseMaxTokens(ObjectiveKind kind, bool terse) {
+  int style = terse ? RESPONSE_STYLE_TERSE : RESPONSE_STYLE_FULL;
+  float expected = averageCompletionTokens[kind][style];
+  if (expected <= 0) {
+    int kinds = 0;
+    for (int k = 0; k < OBJECTIVE_KINDS; k++) {
+      if (averageCompletionTokens[k][style] > 0) {
+        expected += averageCompletionTokens[k][style];
+        kinds++;
+      }
+    }
+    if (kinds == 0) {
+      return RESPONSE_TOKENS_MAX;
+    }
+    expected /= kinds;
+  }
+
+  int maxTokens = (int)(expected * RESPONSE_TOKENS_HEADROOM) + RESPONSE_TOKENS_MARGIN;
+  return constrain(maxTokens, RESPONSE_TOKENS_MIN, RESPONSE_TOKENS_MAX);
+}
+
+/**
+ * Add a complete decision's length to the running average for its kind and style
+ * Decisions cut off at max_tokens aren't recorded: they'd pull the estimate
+ * down to the limit that cut them off.
+ */
+void recordResponseTokens(ObjectiveKind kind, bool terse, int completionTokens) {
+  if (completionTokens <= 0) {
+    return;
+  }
+  float& average = averageCompletionTokens[kind][terse ? RESPONSE_STYLE_TERSE : RESPONSE_STYLE_FULL];
+  if (average <= 0) {
+    average = completionTokens;
+  } else {
+    average += TOKEN_EMA_WEIGHT * (completionTokens - average);
+  }
+}
+
+void resetTokenUsage(TokenUsage& usage) {
+  usage.promptTokens = 0;
+  usage.completionTokens = 0;
+  usage.requests = 0;
+  usage.estimatedRequests = 0;
+  usage.historyCompactions = 0;
+}
+
+/**
+ * Add one request to an objective's token totals
+ * When the response reported usage, the estimator is recalibrated against it.
+ * @param usage Totals to update
+ * @param estimatedPromptTokens Prompt estimate made before sending
+ * @param promptTokens usage.prompt_tokens, or -1 if the response had none
+ * @param completionTokens usage.completion_tokens, or an estimate of the content
+ */
+void recordTokenUsage(TokenUsage& usage, int estimatedPromptTokens, int promptTokens, int completionTokens) {
+  usage.requests++;
+
+  if (promptTokens > 0) {
+    if (estimatedPromptTokens > 0) {
+      float observedScale = tokenEstimateScale * promptTokens / estimatedPromptTokens;
+      tokenEstimateScale += TOKEN_EMA_WEIGHT * (observedScale - tokenEstimateScale);
+    }
+    usage.promptTokens += promptTokens;
+  } else {
+    usage.estimatedRequests++;
+    usage.promptTokens += estimatedPromptTokens;
+  }
+
+  if (completionTokens > 0) {
+    usage.completionTokens += completionTokens;
+  }
+}
+
+/**
+ * Cost in USD of an objective's tokens at the configured prices
+ */
+float tokenUsageCost(const TokenUsage& usage) {
+  return usage.promptTokens * LLM_INPUT_COST_PER_MTOK / 1000000.0 +
+         usage.completionTokens * LLM_OUTPUT_COST_PER_MTOK / 1000000.0;
+}
+
+/**
+ * One-line summary of an objective's token usage
+ */
+String formatTokenUsage(const TokenUsage& usage) {
+  String line = String(usage.promptTokens) + " prompt + " + String(usage.completionTokens) +
+                " completion tokens over " + String(usage.requests) + " requests, ~$" +
+                String(tokenUsageCost(usage), 5);
+  if (usage.estimatedRequests > 0) {
+    line += " (" + String(usage.estimatedRequests) + " estimated)";
+  }
+  if (usage.historyCompactions > 0) {
+    line += ", history compacted " + String(usage.historyCompactions) + "x";
+  }
+  return line;
+}
@@ -0,0 +1,43 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <Arduino.h>
+
+#define TRACE_BUFFER_SIZE 128          // Completed spans kept in the ring buffer
+#define TRACE_MAX_DEPTH 8              // Maximum span nesting
+#define TRACE_TOPIC "ajlisy/robottrace" // MQTT topic trace dumps are published to
+
+// A completed span
+struct TraceSpan {
+  uint32_t traceId;            // Command the span belongs to
+  uint16_t spanId;
+  uint16_t parentId;           // 0 for root spans
+  const char* name;            // Static span name
+  unsigned long startMicros;
+  unsigned long durationMicros;
+};
+
+// Function declarations
+uint32_t startTrace();
+uint32_t getCurrentTraceId();
+void traceBegin(const char* name);
+void traceEnd();
+String buildChromeTrace(uint32_t traceId);
+String dumpTrace(String params);
+
+/**
+ * Records a span for the lifetime of the object
+ * Usage: ScopedTrace span("llm_request");
+ */
+class ScopedTrace {
+public:
+  ScopedTrace(const char* name) {
+    traceBegin(name);
+  }
+
+  ~ScopedTrace() {
+    traceEnd();
+  }
+};
+
+#endif // TRACE_H
@@ -0,0 +1,150 @@
+#include "trace.h"
+#include "robot_tools.h"
+
+// Ring buffer of completed spans
+TraceSpan traceBuffer[TRACE_BUFFER_SIZE];
+int traceHead = 0;       // Next slot to write
+int traceCount = 0;      // Valid spans in the buffer
+
+// Current trace and the stack of open spans
+uint32_t currentTraceId = 0;
+uint32_t lastTraceId = 0;
+uint16_t nextSpanId = 1;
+
+struct OpenSpan {
+  uint16_t spanId;
+  const char* name;
+  unsigned long startMicros;
+};
+OpenSpan traceStack[TRACE_MAX_DEPTH];
+int traceDepth = 0;
+
+/**
+ * Start a new trace for an incoming command
+ * @return The new trace id
+ */
+uint32_t startTrace() {
+  lastTraceId = currentTraceId;
+  currentTraceId++;
+  traceDepth = 0;
+  return currentTraceId;
+}
+
+/**
+ * Get the id of the trace currently being recorded
+ */
+uint32_t getCurrentTraceId() {
+  return currentTraceId;
+}
+
+/**
+ * Open a span nested under the current one
+ * @param name Static span name
+ */
+void traceBegin(const char* name) {
+  if (traceDepth >= TRACE_MAX_DEPTH) {
+    traceDepth++; // Keep begin/end balanced, but don't record
+    return;
+  }
+
+  traceStack[traceDepth].spanId = nextSpanId++;
+  if (nextSpanId == 0) {
+    nextSpanId = 1;
+  }
+  traceStack[traceDepth].name = name;
+  traceStack[traceDepth].startMicros = micros();
+  traceDepth++;
+}
+
+/**
+ * Close the innermost open span and store it in the ring buffer
+ */
+void traceEnd() {
+  if (traceDepth == 0) {
+    return;
+  }
+
+  traceDepth--;
+  if (traceDepth >= TRACE_MAX_DEPTH) {
+    return;
+  }
+
+  OpenSpan& open = traceStack[traceDepth];
+  TraceSpan& span = traceBuffer[traceHead];
+  span.traceId = currentTraceId;
+  span.spanId = open.spanId;
+  span.parentId = traceDepth > 0 ? traceStack[traceDepth - 1].spanId : 0;
+  span.name = open.name;
+  span.startMicros = open.startMicros;
+  span.durationMicros = micros() - open.startMicros;
+
+  traceHead = (traceHead + 1) % TRACE_BUFFER_SIZE;
+  if (traceCount < TRACE_BUFFER_SIZE) {
+    traceCount++;
+  }
+}
+
+/**
+ * Build a Chrome trace-event JSON document from the ring buffer
+ * Open the output in chrome://tracing or https://ui.perfetto.dev
+ * @param traceId Trace to export, or 0 for every buffered span
+ * @return JSON string in trace-event format
+ */
+String buildChromeTrace(uint32_t traceId) {
+  String json = "{\"traceEvents\":[";
+  json.reserve(96 * traceCount + 64);
+
+  bool first = true;
+  int oldest = (traceHead - traceCount + TRACE_BUFFER_SIZE) % TRACE_BUFFER_SIZE;
+  for (int i = 0; i < traceCount; i++) {
+    TraceSpan& span = traceBuffer[(oldest + i) % TRACE_BUFFER_SIZE];
+    if (traceId != 0 && span.traceId != traceId) {
+      continue;
+    }
+
+    if (!first) {
+      json += ",";
+    }
+    first = false;
+
+    json += "{\"name\":\"" + String(span.name) + "\",\"ph\":\"X\",\"pid\":1,\"tid\":" + String(span.traceId) +
+            ",\"ts\":" + String(span.startMicros) + ",\"dur\":" + String(span.durationMicros) +
+            ",\"args\":{\"span\":" + String(span.spanId) + ",\"parent\":" + String(span.parentId) + "}}";
+  }
+
+  json += "],\"displayTimeUnit\":\"ms\"}";
+  return json;
+}
+
+/**
+ * Tool: Dump Trace
+ * Prints a trace to serial and publishes it on TRACE_TOPIC in Chrome
+ * trace-event format
+ * @param params "" for the previous command, a trace id, or "all"
+ * @return String summary of what was dumped
+ */
+String dumpTrace(String params) {
+  params.trim();
+
+  // The dump command itself is the current trace, so default to the one before it
+  uint32_t traceId = lastTraceId;
+  if (params == "all") {
+    traceId = 0;
+  } else if (params.length() > 0) {
+    traceId = params.toInt();
+  }
+
+  String json = buildChromeTrace(traceId);
+
+  Serial.println("[TRACE] " + json);
+
+  if (client.connected()) {
+    // Stream the payload so it isn't limited by the MQTT buffer size
+    client.beginPublish(TRACE_TOPIC, json.length(), false);
+    client.write((const uint8_t*)json.c_str(), json.length());
+    client.endPublish();
+  }
+
+  String which = traceId == 0 ? String("all traces") : "trace " + String(traceId);
+  return "Dumped " + which + " (" + String(json.length()) + " bytes) to serial and " + String(TRACE_TOPIC);
+}
@@ -0,0 +1,273 @@
+#!/usr/bin/env python3
+"""
+Fleet load test: many cars against one MQTT broker and one LLM endpoint.
+
+Drives a command mix at N cars over the shared command topic, addressing
+each command with {"target": <robot id>} and matching the car's final
+"Command executed" status by command_id. Reports broker throughput,
+command latency percentiles (overall and per prompt_version, for A/B runs
+of prompt variants pushed with prompt_push.py) and (if the LLM endpoint is
+the stub server) its peak concurrency.
+
+Cars can be real (pass their ids with --cars) or simulated (--simulate N).
+Simulated cars speak the same MQTT protocol as the firmware and run a
+Python re-implementation of the planning loop: one chat-completions call
+per iteration to --llm-url, simulated tool execution time, and the same
+status/update messages. They are a load model, not the firmware itself.
+
+Typical local run:
+  mosquitto -p 1883 &
+  python3 llm_stub_server.py replay --latency lognormal:900,0.4 --on-miss stop --quiet &
+  python3 fleet_load_test.py --broker localhost --topic test/robot --simulate 200 \\
+      --llm-url http://localhost:8080/v1/chat/completions --rate 20 --duration 120
+
+Requires: pip install paho-mqtt
+"""
+
+import argparse
+import json
+import random
+import threading
+import time
+import urllib.error
+import urllib.request
+import uuid
+
+import paho.mqtt.client as mqtt
+
+# Command mix: (weight, objective)
+DEFAULT_COMMAND_MIX = [
+    (40, "move forward 1 second"),
+    (20, "turn left 90 degrees then move forward 2 seconds"),
+    (20, "move forward until you are within 20cm of an obstacle"),
+    (10, "measure the distance ahead"),
+    (10, "move forward 1 second then backward 1 second then stop"),
+]
+
+
+def make_client(client_id):
+    try:
+        return mqtt.Client(mqtt.CallbackAPIVersion.VERSION2, client_id=client_id)
+    except AttributeError:
+        # paho-mqtt < 2.0
+        return mqtt.Client(client_id=client_id)
+
+
+def percentile(values, p):
+    if not values:
+        return None
+    ordered = sorted(values)
+    index = min(len(ordered) - 1, int(round(p / 100.0 * (len(ordered) - 1))))
+    return ordered[index]
+
+
+class SimulatedCar:
+    """Protocol-compatible stand-in for one car."""
+
+    def __init__(self, robot_id, args):
+        self.robot_id = robot_id
+        self.args = args
+        self.busy = threading.Lock()
+        self.client = make_client(robot_id + "_client")
+        self.client.on_message = self.on_message
+        self.client.connect(args.broker, args.port)
+        self.client.subscribe(args.topic)
+        self.client.loop_start()
+
+    def publish(self, payload):
+        payload["robot_id"] = self.robot_id
+        payload["timestamp"] = str(int(time.time() * 1000))
+        payload["prompt_version"] = 0
+        self.client.publish(self.args.topic, json.dumps(payload))
+
+    def on_message(self, client, userdata, msg):
+        try:
+            doc = json.loads(msg.payload)
+        except ValueError:
+            return
+        if "robot_id" in doc or doc.get("target") != self.robot_id or "content" not in doc:
+            return
+        threading.Thread(target=self.execute, args=(doc,), daemon=True).start()
+
+    def llm_call(self, objective, history):
+        body = json.dumps({
+            "model": "gpt-4o-mini",
+            "max_tokens": 500,
+            "temperature": 0.1,
+            "messages": [
+                {"role": "system", "content": "You are a robot assistant."},
+                {"role": "user", "content": "OBJECTIVE: %s\nHISTORY:\n%s" % (objective, history)},
+            ],
+        }).encode("utf-8")
+        req = urllib.request.Request(self.args.llm_url, data=body, method="POST")
+        req.add_header("Content-Type", "application/json")
+        try:
+            with urllib.request.urlopen(req, timeout=10) as resp:
+                data = json.loads(resp.read())
+            content = data["choices"][0]["message"]["content"]
+            if "```json" in content:
+                content = content.split("```json", 1)[1].rsplit("```", 1)[0]
+            return json.loads(content)
+        except (urllib.error.URLError, ValueError, KeyError, IndexError, OSError) as e:
+            return {"tool_calls": [], "should_continue": False, "reasoning": "LLM error: %s" % e}
+
+    def execute(self, doc):
+        with self.busy:
+            objective = doc["content"]
+            history = ""
+            self.publish({"message_type": "status_update", "content": "Starting iterative planning for objective: " + objective})
+            for iteration in range(1, self.args.iterations + 1):
+                decision = self.llm_call(objective, history)
+                for call in decision.get("tool_calls", [])[:5]:
+                    # Simulated tool time: move durations scaled down, sonar ~0.3 s
+                    params = str(call.get("params", ""))
+                    digits = "".join(c for c in params if c.isdigit())
+                    duration = int(digits) / 1000.0 if call.get("tool") == "move_car" and digits else 0.3
+                    time.sleep(duration * self.args.time_scale)
+                history += "--- Iteration %d ---\n%s\n" % (iteration, decision.get("reasoning", ""))
+                self.publish({"message_type": "status_update", "content": "Planning decision: %d tool calls" % len(decision.get("tool_calls", []))})
+                if not decision.get("should_continue") and iteration >= self.args.min_iterations:
+                    break
+                time.sleep(0.5 * self.args.time_scale)
+            self.publish({"status": "Command executed: " + objective, "command_id": doc.get("id", "unknown")})
+
+
+class LoadDriver:
+    def __init__(self, args, car_ids):
+        self.args = args
+        self.car_ids = car_ids
+        self.lock = threading.Lock()
+        self.pending = {}
+        self.latencies = []
+        self.latencies_by_version = {}
+        self.messages_seen = 0
+        self.sent = 0
+        self.dropped = 0
+        self.client = make_client("fleet_load_driver_" + uuid.uuid4().hex[:6])
+        self.client.on_message = self.on_message
+        self.client.connect(args.broker, args.port)
+        self.client.subscribe(args.topic)
+        self.client.loop_start()
+
+    def on_message(self, client, userdata, msg):
+        with self.lock:
+            self.messages_seen += 1
+        try:
+            doc = json.loads(msg.payload)
+        except ValueError:
+            return
+        command_id = doc.get("command_id")
+        if command_id and str(doc.get("status", "")).startswith("Command executed"):
+            with self.lock:
+                sent_at = self.pending.pop(command_id, None)
+                if sent_at is not None:
+                    latency = time.time() - sent_at
+                    self.latencies.append(latency)
+                    version = str(doc.get("prompt_version", "unknown"))
+                    self.latencies_by_version.setdefault(version, []).append(latency)
+
+    def run(self):
+        weights = [w for w, _ in self.args.command_mix]
+        objectives = [o for _, o in self.args.command_mix]
+        interval = 1.0 / self.args.rate
+        start = time.time()
+        next_send = start
+        while time.time() - start < self.args.duration:
+            now = time.time()
+            if now < next_send:
+                time.sleep(next_send - now)
+            next_send += interval
+            command_id = uuid.uuid4().hex[:12]
+            payload = {
+                "target": random.choice(self.car_ids),
+                "content": random.choices(objectives, weights)[0],
+                "sender": "fleet_load_test",
+                "id": command_id,
+            }
+            with self.lock:
+                self.pending[command_id] = time.time()
+                self.sent += 1
+            self.client.publish(self.args.topic, json.dumps(payload))
+
+        # Let in-flight commands finish
+        deadline = time.time() + self.args.drain
+        while time.time() < deadline:
+            with self.lock:
+                if not self.pending:
+                    break
+            time.sleep(0.2)
+        elapsed = time.time() - start
+        with self.lock:
+            self.dropped = len(self.pending)
+        return elapsed
+
+    def report(self, elapsed):
+        lat = [l * 1000.0 for l in self.latencies]
+        result = {
+            "cars": len(self.car_ids),
+            "commands_sent": self.sent,
+            "commands_completed": len(lat),
+            "commands_unfinished": self.dropped,
+            "elapsed_s": round(elapsed, 1),
+            "broker_msgs_per_s": round(self.messages_seen / elapsed, 1),
+            "latency_ms": {
+                "p50": percentile(lat, 50),
+                "p90": percentile(lat, 90),
+                "p99": percentile(lat, 99),
+                "max": max(lat) if lat else None,
+            },
+        }
+        result["latency_ms_by_prompt_version"] = {
+            version: {
+                "commands": len(values),
+                "p50": percentile([v * 1000.0 for v in values], 50),
+                "p90": percentile([v * 1000.0 for v in values], 90),
+            }
+            for version, values in sorted(self.latencies_by_version.items())
+        }
+        stats_url = self.args.llm_url.split("/v1/")[0] + "/stats"
+        try:
+            with urllib.request.urlopen(stats_url, timeout=2) as resp:
+                stub = json.loads(resp.read())
+            result["llm_stub"] = {k: stub.get(k) for k in ("requests", "max_in_flight", "faults", "misses")}
+        except (urllib.error.URLError, ValueError, OSError):
+            result["llm_stub"] = None
+        return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Fleet load test for the arduino car MQTT/LLM pipeline")
+    parser.add_argument("--broker", default="localhost")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--topic", required=True, help="MQTT_TOPIC the cars listen on")
+    parser.add_argument("--cars", default="", help="comma-separated ids of real cars")
+    parser.add_argument("--simulate", type=int, default=0, help="number of simulated cars to start")
+    parser.add_argument("--llm-url", default="http://localhost:8080/v1/chat/completions")
+    parser.add_argument("--rate", type=float, default=5.0, help="commands per second across the fleet")
+    parser.add_argument("--duration", type=float, default=60.0, help="seconds to send commands")
+    parser.add_argument("--drain", type=float, default=90.0, help="seconds to wait for in-flight commands")
+    parser.add_argument("--iterations", type=int, default=10, help="max planning iterations per simulated command")
+    parser.add_argument("--min-iterations", type=int, default=1, help="LLM calls per simulated command before stop is honored")
+    parser.add_argument("--time-scale", type=float, default=1.0, help="scale simulated tool and sleep time")
+    parser.add_argument("--mix", default="", help="JSON list of [weight, objective] pairs")
+    args = parser.parse_args()
+
+    args.command_mix = json.loads(args.mix) if args.mix else DEFAULT_COMMAND_MIX
+    car_ids = [c for c in args.cars.split(",") if c]
+
+    sims = []
+    for i in range(args.simulate):
+        car = SimulatedCar("sim_%04d" % i, args)
+        sims.append(car)
+        car_ids.append(car.robot_id)
+    if not car_ids:
+        parser.error("no cars: pass --cars and/or --simulate")
+
+    time.sleep(1.0)  # Let subscriptions settle
+    driver = LoadDriver(args, car_ids)
+    elapsed = driver.run()
+    print(json.dumps(driver.report(elapsed), indent=2))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,396 @@
+#!/usr/bin/env python3
+"""
+LLM stub server for deterministic planning-loop benchmarks.
+
+Speaks the OpenAI chat-completions API (POST /v1/chat/completions) so the car
+can be pointed at it with an LLM_PROVIDERS entry in config.h whose url is
+http://<laptop-ip>:8080/v1/chat/completions (auth LLM_AUTH_NONE).
+
+Modes:
+  record  - forward every request to the real API, return its response and
+            append {hash, request, response, latency_ms} to the transcript file
+  replay  - answer from the transcript file, keyed by request hash, with a
+            synthetic latency model and optional fault injection
+
+Request hash = sha256 of the canonical JSON of {model, messages}. Volatile
+substrings (timestamps, uptime) can be masked before hashing with --ignore.
+
+Examples:
+  python3 llm_stub_server.py record --transcripts runs.jsonl
+  python3 llm_stub_server.py replay --transcripts runs.jsonl --latency lognormal:900,0.4
+  python3 llm_stub_server.py replay --transcripts runs.jsonl --ttft 300 --tokens-per-sec 60 --fault-rate 0.05
+
+GET /stats returns request counts, hit/miss/fault counters and concurrency.
+
+Camera / vision (capture_image tool):
+  GET  /camera/frame.jpg  - next JPEG from --frames DIR, round-robin (fake camera)
+  POST /v1/images         - raw image/jpeg body; returns {"url": ".../images/N.jpg"}
+  GET  /images/N.jpg      - an uploaded image
+Uploaded image URLs and inline data URLs are masked before hashing, and in
+record mode uploaded URLs are inlined as base64 data URLs so the upstream API
+never needs to reach the stub.
+
+  python3 llm_stub_server.py replay --transcripts runs.jsonl --frames ./frames
+"""
+
+import argparse
+import base64
+import glob
+import hashlib
+import json
+import os
+import random
+import re
+import sys
+import threading
+import time
+import urllib.error
+import urllib.request
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+DEFAULT_UPSTREAM = "https://api.openai.com/v1/chat/completions"
+
+# Returned on a replay miss when --on-miss=stop, so the planning loop ends cleanly
+STOP_DECISION = {
+    "tool_calls": [],
+    "should_continue": False,
+    "objective_complete": False,
+    "reasoning": "stub: no recorded response for this request",
+    "next_context": "",
+}
+
+
+# Image URLs handed out by POST /v1/images; the number changes every run
+IMAGE_URL_RE = re.compile(r"https?://[^\"\s]*/images/(\d+)\.jpg")
+# Inline frames (VISION_INLINE_IMAGES); camera noise changes them every capture
+DATA_URL_RE = re.compile(r"data:image/[a-z]+;base64,[A-Za-z0-9+/=]*")
+
+
+def request_hash(body, ignore_patterns):
+    """Hash the parts of a request that determine the model's answer."""
+    key = {"model": body.get("model"), "messages": body.get("messages", [])}
+    text = json.dumps(key, sort_keys=True, separators=(",", ":"))
+    text = IMAGE_URL_RE.sub("<image>", text)
+    text = DATA_URL_RE.sub("<image>", text)
+    for pattern in ignore_patterns:
+        text = pattern.sub("<masked>", text)
+    return hashlib.sha256(text.encode("utf-8")).hexdigest()
+
+
+def parse_latency(spec):
+    """
+    Build a latency sampler (milliseconds) from a spec string:
+      fixed:MS | uniform:LO,HI | normal:MEAN,SD | lognormal:MEDIAN,SIGMA | recorded
+    """
+    kind, _, args = spec.partition(":")
+    values = [float(v) for v in args.split(",")] if args else []
+    if kind == "fixed":
+        return lambda recorded: values[0]
+    if kind == "uniform":
+        return lambda recorded: random.uniform(values[0], values[1])
+    if kind == "normal":
+        return lambda recorded: max(0.0, random.gauss(values[0], values[1]))
+    if kind == "lognormal":
+        import math
+        mu = math.log(values[0])
+        return lambda recorded: random.lognormvariate(mu, values[1])
+    if kind == "recorded":
+        return lambda recorded: recorded or 0.0
+    raise ValueError("Unknown latency spec: " + spec)
+
+
+def completion_tokens(response):
+    usage = response.get("usage") or {}
+    if "completion_tokens" in usage:
+        return usage["completion_tokens"]
+    try:
+        return max(1, len(response["choices"][0]["message"]["content"]) // 4)
+    except (KeyError, IndexError, TypeError):
+        return 1
+
+
+def make_completion(content, model):
+    return {
+        "id": "chatcmpl-stub",
+        "object": "chat.completion",
+        "created": int(time.time()),
+        "model": model or "stub",
+        "choices": [{
+            "index": 0,
+            "message": {"role": "assistant", "content": content},
+            "finish_reason": "stop",
+        }],
+        "usage": {"prompt_tokens": 0, "completion_tokens": len(content) // 4, "total_tokens": len(content) // 4},
+    }
+
+
+class StubState:
+    def __init__(self, args):
+        self.args = args
+        self.lock = threading.Lock()
+        self.transcripts = {}
+        self.ignore = [re.compile(p) for p in args.ignore]
+        self.latency = parse_latency(args.latency)
+        self.stats = {"requests": 0, "hits": 0, "misses": 0, "faults": 0,
+                      "recorded": 0, "in_flight": 0, "max_in_flight": 0,
+                      "frames_served": 0, "images_uploaded": 0}
+        self.frames = []
+        self.next_frame = 0
+        self.images = {}
+        self.next_image = 0
+        if args.frames:
+            for path in sorted(glob.glob(os.path.join(args.frames, "*.jp*g"))):
+                with open(path, "rb") as f:
+                    self.frames.append(f.read())
+            print("Loaded %d camera frames from %s" % (len(self.frames), args.frames))
+        if os.path.exists(args.transcripts):
+            with open(args.transcripts) as f:
+                for line in f:
+                    line = line.strip()
+                    if line:
+                        entry = json.loads(line)
+                        self.transcripts[entry["hash"]] = entry
+        print("Loaded %d transcripts from %s" % (len(self.transcripts), args.transcripts))
+
+    def enter(self):
+        with self.lock:
+            self.stats["requests"] += 1
+            self.stats["in_flight"] += 1
+            self.stats["max_in_flight"] = max(self.stats["max_in_flight"], self.stats["in_flight"])
+
+    def leave(self):
+        with self.lock:
+            self.stats["in_flight"] -= 1
+
+    def count(self, key):
+        with self.lock:
+            self.stats[key] += 1
+
+    def take_frame(self):
+        with self.lock:
+            if not self.frames:
+                return None
+            frame = self.frames[self.next_frame % len(self.frames)]
+            self.next_frame += 1
+            self.stats["frames_served"] += 1
+            return frame
+
+    def store_image(self, data):
+        with self.lock:
+            self.next_image += 1
+            self.images[self.next_image] = data
+            # Keep only the most recent uploads
+            for old in sorted(self.images)[:-self.args.max_images]:
+                del self.images[old]
+            self.stats["images_uploaded"] += 1
+            return self.next_image
+
+    def inline_images(self, raw):
+        """Replace stub image URLs with data URLs so the upstream API can see them."""
+        def data_url(match):
+            with self.lock:
+                data = self.images.get(int(match.group(1)))
+            if data is None:
+                return match.group(0)
+            return "data:image/jpeg;base64," + base64.b64encode(data).decode("ascii")
+        return IMAGE_URL_RE.sub(data_url, raw.decode("utf-8")).encode("utf-8")
+
+    def save(self, entry):
+        with self.lock:
+            self.transcripts[entry["hash"]] = entry
+            self.stats["recorded"] += 1
+            with open(self.args.transcripts, "a") as f:
+                f.write(json.dumps(entry) + "\n")
+
+
+class StubHandler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    state = None
+
+    def log_message(self, fmt, *args):
+        if not self.state.args.quiet:
+            sys.stderr.write("[stub] " + (fmt % args) + "\n")
+
+    def send_json(self, code, payload):
+        data = json.dumps(payload).encode("utf-8")
+        self.send_response(code)
+        self.send_header("Content-Type", "application/json")
+        self.send_header("Content-Length", str(len(data)))
+        self.end_headers()
+        self.wfile.write(data)
+
+    def send_jpeg(self, data):
+        self.send_response(200)
+        self.send_header("Content-Type", "image/jpeg")
+        self.send_header("Content-Length", str(len(data)))
+        self.end_headers()
+        self.wfile.write(data)
+
+    def do_GET(self):
+        image = re.match(r"^/images/(\d+)\.jpg$", self.path)
+        if self.path.rstrip("/") == "/stats":
+            with self.state.lock:
+                stats = dict(self.state.stats)
+            stats["transcripts"] = len(self.state.transcripts)
+            self.send_json(200, stats)
+        elif self.path == "/camera/frame.jpg":
+            frame = self.state.take_frame()
+            if frame is None:
+                self.send_json(404, {"error": {"message": "stub: no frames (start with --frames DIR)"}})
+            else:
+                self.send_jpeg(frame)
+        elif image:
+            with self.state.lock:
+                data = self.state.images.get(int(image.group(1)))
+            if data is None:
+                self.send_json(404, {"error": {"message": "stub: image expired"}})
+            else:
+                self.send_jpeg(data)
+        else:
+            self.send_json(404, {"error": {"message": "not found"}})
+
+    def do_POST(self):
+        length = int(self.headers.get("Content-Length", 0))
+        raw = self.rfile.read(length)
+        if self.path.rstrip("/") == "/v1/images":
+            number = self.state.store_image(raw)
+            host = self.headers.get("Host") or "%s:%d" % (self.state.args.host, self.state.args.port)
+            self.send_json(200, {"url": "http://%s/images/%d.jpg" % (host, number)})
+            return
+        try:
+            body = json.loads(raw)
+        except ValueError:
+            self.send_json(400, {"error": {"message": "invalid JSON body"}})
+            return
+
+        self.state.enter()
+        try:
+            if self.state.args.mode == "record":
+                self.handle_record(body, raw)
+            else:
+                self.handle_replay(body)
+        finally:
+            self.state.leave()
+
+    def handle_record(self, body, raw):
+        args = self.state.args
+        req = urllib.request.Request(args.upstream, data=self.state.inline_images(raw), method="POST")
+        req.add_header("Content-Type", "application/json")
+        req.add_header("Authorization", self.headers.get("Authorization")
+                       or "Bearer " + os.environ.get("OPENAI_API_KEY", ""))
+        start = time.time()
+        try:
+            with urllib.request.urlopen(req, timeout=args.upstream_timeout) as resp:
+                status, data = resp.status, resp.read()
+        except urllib.error.HTTPError as e:
+            status, data = e.code, e.read()
+        latency_ms = (time.time() - start) * 1000.0
+
+        if status == 200:
+            self.state.save({
+                "hash": request_hash(body, self.state.ignore),
+                "request": body,
+                "response": json.loads(data),
+                "latency_ms": round(latency_ms, 1),
+            })
+        self.send_response(status)
+        self.send_header("Content-Type", "application/json")
+        self.send_header("Content-Length", str(len(data)))
+        self.end_headers()
+        self.wfile.write(data)
+
+    def handle_replay(self, body):
+        args = self.state.args
+        entry = self.state.transcripts.get(request_hash(body, self.state.ignore))
+
+        if entry is None:
+            self.state.count("misses")
+            if args.on_miss == "error":
+                self.send_json(404, {"error": {"message": "stub: no recorded response for this request"}})
+                return
+            response = make_completion("```json\n" + json.dumps(STOP_DECISION) + "\n```", body.get("model"))
+            recorded_ms = None
+        else:
+            self.state.count("hits")
+            response = entry["response"]
+            recorded_ms = entry.get("latency_ms")
+
+        # Latency model: either sampled total, or TTFT + tokens / throughput
+        if args.tokens_per_sec > 0:
+            delay_ms = args.ttft + 1000.0 * completion_tokens(response) / args.tokens_per_sec
+        else:
+            delay_ms = args.ttft + self.state.latency(recorded_ms)
+
+        if random.random() < args.fault_rate:
+            self.state.count("faults")
+            self.inject_fault(delay_ms)
+            return
+
+        time.sleep(delay_ms / 1000.0)
+        self.send_json(200, response)
+
+    def inject_fault(self, delay_ms):
+        fault = random.choice(self.state.args.faults.split(","))
+        if fault == "timeout":
+            time.sleep(self.state.args.timeout_fault_s)
+            self.send_json(504, {"error": {"message": "stub: injected timeout"}})
+        elif fault == "429":
+            self.send_json(429, {"error": {"message": "stub: injected rate limit"}})
+        elif fault == "500":
+            time.sleep(delay_ms / 1000.0)
+            self.send_json(500, {"error": {"message": "stub: injected server error"}})
+        elif fault == "drop":
+            time.sleep(delay_ms / 1000.0)
+            self.close_connection = True
+            self.connection.close()
+        elif fault == "truncate":
+            time.sleep(delay_ms / 1000.0)
+            data = b'{"choices":[{"message":{"content":"```json\\n{\\"tool_calls\\": [{\\"tool\\": \\"move_'
+            self.send_response(200)
+            self.send_header("Content-Type", "application/json")
+            self.send_header("Content-Length", str(len(data)))
+            self.end_headers()
+            self.wfile.write(data)
+        else:
+            self.send_json(500, {"error": {"message": "stub: unknown fault " + fault}})
+
+
+def main():
+    parser = argparse.ArgumentParser(description="OpenAI-compatible record/replay stub for the arduino car")
+    parser.add_argument("mode", choices=["record", "replay"])
+    parser.add_argument("--host", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--transcripts", default="llm_transcripts.jsonl")
+    parser.add_argument("--ignore", action="append", default=[],
+                        help="regex of volatile text masked before hashing (repeatable)")
+    parser.add_argument("--upstream", default=DEFAULT_UPSTREAM)
+    parser.add_argument("--upstream-timeout", type=float, default=30.0)
+    parser.add_argument("--latency", default="recorded",
+                        help="fixed:MS | uniform:LO,HI | normal:MEAN,SD | lognormal:MEDIAN,SIGMA | recorded")
+    parser.add_argument("--ttft", type=float, default=0.0, help="time to first token in ms")
+    parser.add_argument("--tokens-per-sec", type=float, default=0.0,
+                        help="generation throughput; overrides --latency when > 0")
+    parser.add_argument("--fault-rate", type=float, default=0.0)
+    parser.add_argument("--faults", default="500,429,timeout,drop,truncate")
+    parser.add_argument("--timeout-fault-s", type=float, default=12.0)
+    parser.add_argument("--on-miss", choices=["error", "stop"], default="stop")
+    parser.add_argument("--frames", default=None, help="directory of JPEGs served at /camera/frame.jpg")
+    parser.add_argument("--max-images", type=int, default=32, help="uploaded images kept for /images/N.jpg")
+    parser.add_argument("--seed", type=int, default=None)
+    parser.add_argument("--quiet", action="store_true")
+    args = parser.parse_args()
+
+    if args.seed is not None:
+        random.seed(args.seed)
+
+    StubHandler.state = StubState(args)
+    server = ThreadingHTTPServer((args.host, args.port), StubHandler)
+    print("LLM stub (%s) listening on http://%s:%d/v1/chat/completions" % (args.mode, args.host, args.port))
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,401 @@
+#!/usr/bin/env python3
+"""
+Planner gateway: runs the planning LLM loop on a LAN host for cars in gateway mode.
+
+With GATEWAY_ENABLED in config.h a car doesn't build prompts or talk to the
+LLM itself. For each planning iteration it publishes a compact request on
+ajlisy/robotplanner/request:
+
+  {"robot_id": "car_a1b2c3", "boot": 2739011, "session": 123, "seq": 2, "objective": "...",
+   "prompt_version": 3, "prompt_crc": 1234567,
+   "results": "Iteration tool calls:\\n[1] get_sonar_distance: ...", "world": "pose: ...",
+   "pose": [x, y, heading]}
+
+"world" is the car's world state (pose, filtered distance, progress, errors)
+for the {{WORLD_STATE}} slot of the prompt. "boot" is drawn at random when
+the car boots; session ids restart from 0 after a reboot, so sessions are
+keyed on both.
+
+The gateway keeps the prompt, context and history per (robot_id, boot, session),
+calls the LLM and replies on ajlisy/robotplanner/reply/<robot_id> with a
+ready-to-execute batch that fits the car's 1024-byte MQTT buffer:
+
+  {"session": 123, "seq": 2, "calls": [["move_car", "forward 500", 0.95]],
+   "continue": true, "complete": false, "reasoning": "...", "context": "...",
+   "usage": {"prompt": 1650, "completion": 70}}
+
+or {"session": 123, "seq": 2, "error": "..."}; the car then falls back to
+planning on board. {"robot_id": ..., "boot": ..., "session": ..., "done": true}
+ends a session. Requests from different cars are planned concurrently on a
+worker pool, each with a persistent connection to the LLM endpoint.
+
+The gateway plans with the template whose CRC32 matches "prompt_crc", the
+car's active prompt version: the built-in one from prompts_data.h, or one
+committed to the car's prompt store and passed with --prompt-file (the exact
+text uploaded). A request for a template the gateway doesn't have gets an
+error reply, so the car plans on board with its own prompt.
+
+Local test against the stub LLM:
+  mosquitto -p 1883 &
+  python3 llm_stub_server.py replay --transcripts runs.jsonl --quiet &
+  python3 planner_gateway.py --broker localhost --llm-url http://localhost:8080/v1/chat/completions
+
+Against the real API:
+  OPENAI_API_KEY=sk-... python3 planner_gateway.py --broker localhost \\
+      --llm-url https://api.openai.com/v1/chat/completions
+
+Requires: pip install paho-mqtt
+"""
+
+import argparse
+import http.client
+import json
+import os
+import re
+import threading
+import time
+import urllib.parse
+import zlib
+from concurrent.futures import ThreadPoolExecutor
+
+import paho.mqtt.client as mqtt
+
+REQUEST_TOPIC = "ajlisy/robotplanner/request"
+REPLY_TOPIC_PREFIX = "ajlisy/robotplanner/reply/"
+MAX_REPLY_BYTES = 960  # Car's MQTT buffer is 1024 bytes including the topic
+MAX_CALLS = 5
+SYSTEM_PROMPT = "You are a robot assistant. All commands will be processed through the iterative planning system."
+DEFAULT_PROMPTS_FILE = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "prompts_data.h")
+
+
+def make_client(client_id):
+    try:
+        return mqtt.Client(mqtt.CallbackAPIVersion.VERSION2, client_id=client_id)
+    except AttributeError:
+        # paho-mqtt < 2.0
+        return mqtt.Client(client_id=client_id)
+
+
+def percentile(values, p):
+    if not values:
+        return None
+    ordered = sorted(values)
+    index = min(len(ordered) - 1, int(round(p / 100.0 * (len(ordered) - 1))))
+    return ordered[index]
+
+
+def load_planning_prompt(path):
+    """Extract ITERATIVE_PLANNING_PROMPT from prompts_data.h."""
+    with open(path, encoding="utf-8") as f:
+        source = f.read()
+    match = re.search(r'ITERATIVE_PLANNING_PROMPT\s*=\s*R"\((.*?)\)"', source, re.S)
+    if not match:
+        raise ValueError("ITERATIVE_PLANNING_PROMPT not found in " + path)
+    return match.group(1)
+
+
+def load_templates(builtin, prompt_files):
+    """Index the planning templates by CRC32, as the car reports them in "prompt_crc"."""
+    templates = {}
+    for text in [builtin] + [open(path, encoding="utf-8").read() for path in prompt_files]:
+        # Files saved by an editor usually gain a trailing newline the uploaded text didn't have
+        for variant in (text, text.rstrip("\n")):
+            templates[zlib.crc32(variant.encode("utf-8"))] = variant
+    return templates
+
+
+def render_prompt(template, objective, context, history, world=""):
+    prompt = (template.replace("{{OBJECTIVE}}", objective)
+                      .replace("{{CONTEXT}}", context)
+                      .replace("{{EXECUTION_HISTORY}}", history))
+    # Same as the car: a template without the slot gets the world state at the end
+    if "{{WORLD_STATE}}" not in prompt:
+        return prompt + "\n\nWORLD STATE:\n" + world
+    return prompt.replace("{{WORLD_STATE}}", world)
+
+
+def extract_decision(content):
+    """Parse the decision JSON out of the model's reply (plain or in a ```json block)."""
+    if "```json" in content:
+        content = content.split("```json", 1)[1].rsplit("```", 1)[0]
+    start = content.find("{")
+    end = content.rfind("}")
+    if start == -1 or end < start:
+        raise ValueError("no JSON object in model reply")
+    return json.loads(content[start:end + 1])
+
+
+def build_reply(session_id, seq, decision, usage):
+    """Compact reply for the car, trimmed to MAX_REPLY_BYTES."""
+    calls = []
+    for call in decision.get("tool_calls", [])[:MAX_CALLS]:
+        if not isinstance(call, dict) or not call.get("tool"):
+            continue
+        calls.append([str(call["tool"]), str(call.get("params", "")), float(call.get("confidence", 0))])
+    reply = {
+        "session": session_id,
+        "seq": seq,
+        "calls": calls,
+        "continue": bool(decision.get("should_continue", False)),
+        "complete": bool(decision.get("objective_complete", False)),
+        "reasoning": str(decision.get("reasoning", "")),
+        "context": str(decision.get("next_context", "")),
+    }
+    if usage:
+        reply["usage"] = {"prompt": usage.get("prompt_tokens", -1), "completion": usage.get("completion_tokens", 0)}
+
+    # Context is only needed if the car falls back; reasoning shows in status messages
+    for field in ("context", "reasoning"):
+        while len(json.dumps(reply).encode("utf-8")) > MAX_REPLY_BYTES and reply[field]:
+            reply[field] = reply[field][:len(reply[field]) * 3 // 4]
+    if len(json.dumps(reply).encode("utf-8")) > MAX_REPLY_BYTES:
+        return {"session": session_id, "seq": seq, "error": "reply too large for the car's MQTT buffer"}
+    return reply
+
+
+class Session:
+    """Prompt state for one objective on one car."""
+
+    def __init__(self, objective):
+        self.objective = objective
+        self.context = "Starting fresh. Objective: " + objective
+        self.history = ""
+        self.last_reasoning = ""
+        self.seq = 0
+        self.last_reply = None
+        self.last_seen = time.time()
+        self.lock = threading.Lock()
+
+    def add_results(self, seq, results, history_chars):
+        """Record the results of the previous batch, formatted like the car's execution history."""
+        if seq <= 1 or not results:
+            return
+        if self.history:
+            self.history += "\n"
+        self.history += "--- Iteration %d ---\nReasoning: %s\n%s" % (seq - 1, self.last_reasoning, results)
+        if len(self.history) > history_chars:
+            self.history = "[earlier iterations trimmed]\n" + self.history[-history_chars:]
+
+
+class LlmEndpoint:
+    """Chat completions client with one persistent connection per worker thread."""
+
+    def __init__(self, url, api_key, timeout):
+        parsed = urllib.parse.urlsplit(url)
+        self.https = parsed.scheme == "https"
+        self.host = parsed.hostname
+        self.port = parsed.port
+        self.path = parsed.path or "/"
+        self.api_key = api_key
+        self.timeout = timeout
+        self.local = threading.local()
+
+    def connection(self):
+        conn = getattr(self.local, "conn", None)
+        if conn is None:
+            cls = http.client.HTTPSConnection if self.https else http.client.HTTPConnection
+            conn = cls(self.host, self.port, timeout=self.timeout)
+            self.local.conn = conn
+        return conn
+
+    def post(self, body):
+        """POST a request body; returns (status, parsed JSON or None). Retries once on a stale connection."""
+        headers = {"Content-Type": "application/json"}
+        if self.api_key:
+            headers["Authorization"] = "Bearer " + self.api_key
+        data = json.dumps(body).encode("utf-8")
+        for attempt in range(2):
+            conn = self.connection()
+            try:
+                conn.request("POST", self.path, body=data, headers=headers)
+                resp = conn.getresponse()
+                raw = resp.read()
+                try:
+                    return resp.status, json.loads(raw)
+                except ValueError:
+                    return resp.status, None
+            except (http.client.HTTPException, OSError):
+                conn.close()
+                self.local.conn = None
+                if attempt == 1:
+                    raise
+        return None, None
+
+
+class Gateway:
+    def __init__(self, args, publish):
+        self.args = args
+        self.publish = publish
+        self.builtin_template = load_planning_prompt(args.prompts)
+        self.templates = load_templates(self.builtin_template, args.prompt_file)
+        self.llm = LlmEndpoint(args.llm_url, args.api_key, args.llm_timeout)
+        self.pool = ThreadPoolExecutor(max_workers=args.workers)
+        self.lock = threading.Lock()
+        self.sessions = {}
+        self.cars = set()
+        self.requests = 0
+        self.errors = 0
+        self.duplicates = 0
+        self.llm_latencies = []
+
+    def on_message(self, client, userdata, msg):
+        try:
+            request = json.loads(msg.payload)
+            key = (str(request["robot_id"]), int(request.get("boot", 0)), int(request["session"]))
+        except (ValueError, KeyError, TypeError):
+            return
+        if request.get("done"):
+            with self.lock:
+                self.sessions.pop(key, None)
+            return
+        self.pool.submit(self.plan, key, request)
+
+    def session_for(self, key, seq, objective):
+        with self.lock:
+            self.cars.add(key[0])
+            session = self.sessions.get(key)
+            # Firmware without a boot id reuses session ids after a reboot; a first request starts over
+            if session is None or (seq == 1 and session.seq > 1) or session.objective != objective:
+                session = Session(objective)
+                self.sessions[key] = session
+            session.last_seen = time.time()
+            return session
+
+    def plan(self, key, request):
+        robot_id, _, session_id = key
+        try:
+            seq = int(request["seq"])
+        except (KeyError, TypeError, ValueError):
+            return
+
+        # Firmware that doesn't report its prompt runs the built-in one
+        template = self.builtin_template
+        if "prompt_crc" in request:
+            try:
+                template = self.templates.get(int(request["prompt_crc"]))
+            except (TypeError, ValueError):
+                template = None
+        if template is None:
+            with self.lock:
+                self.requests += 1
+                self.errors += 1
+            self.reply(robot_id, {"session": session_id, "seq": seq,
+                                  "error": "prompt version %s (crc %s) not loaded on the gateway"
+                                           % (request.get("prompt_version"), request.get("prompt_crc"))})
+            return
+
+        session = self.session_for(key, seq, str(request.get("objective", "")))
+
+        with session.lock:
+            # A duplicate delivery of the request gets the same answer
+            if seq == session.seq and session.last_reply is not None:
+                with self.lock:
+                    self.duplicates += 1
+                self.reply(robot_id, session.last_reply)
+                return
+
+            session.add_results(seq, str(request.get("results", "")), self.args.history_chars)
+            prompt = render_prompt(template, session.objective, session.context, session.history,
+                                   str(request.get("world", "")))
+            body = {
+                "model": self.args.model,
+                "max_tokens": self.args.max_tokens,
+                "temperature": 0.1,
+                "messages": [
+                    {"role": "system", "content": SYSTEM_PROMPT},
+                    {"role": "user", "content": prompt},
+                ],
+            }
+
+            started = time.time()
+            try:
+                status, data = self.llm.post(body)
+                latency = time.time() - started
+                if status != 200 or data is None:
+                    raise ValueError("LLM returned HTTP %s" % status)
+                decision = extract_decision(data["choices"][0]["message"]["content"])
+                reply = build_reply(session_id, seq, decision, data.get("usage"))
+                session.last_reasoning = str(decision.get("reasoning", ""))
+                if decision.get("next_context"):
+                    session.context = str(decision["next_context"])
+            except (ValueError, KeyError, IndexError, TypeError, http.client.HTTPException, OSError) as e:
+                latency = time.time() - started
+                reply = {"session": session_id, "seq": seq, "error": str(e)[:200]}
+
+            session.seq = seq
+            session.last_reply = reply
+
+        with self.lock:
+            self.requests += 1
+            self.llm_latencies.append(latency)
+            if "error" in reply:
+                self.errors += 1
+        self.reply(robot_id, reply)
+
+    def reply(self, robot_id, reply):
+        self.publish(REPLY_TOPIC_PREFIX + robot_id, json.dumps(reply, separators=(",", ":")))
+
+    def expire_sessions(self):
+        cutoff = time.time() - self.args.session_ttl
+        with self.lock:
+            for key in [k for k, s in self.sessions.items() if s.last_seen < cutoff]:
+                del self.sessions[key]
+
+    def stats(self):
+        with self.lock:
+            latencies = self.llm_latencies
+            self.llm_latencies = []
+            p50 = percentile(latencies, 50)
+            p90 = percentile(latencies, 90)
+            return {
+                "cars": len(self.cars),
+                "sessions": len(self.sessions),
+                "requests": self.requests,
+                "errors": self.errors,
+                "duplicates": self.duplicates,
+                "llm_p50_ms": round(p50 * 1000) if p50 is not None else None,
+                "llm_p90_ms": round(p90 * 1000) if p90 is not None else None,
+            }
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Plan for cars in gateway mode over MQTT")
+    parser.add_argument("--broker", default="localhost")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--llm-url", default="http://localhost:8080/v1/chat/completions")
+    parser.add_argument("--api-key", default=os.environ.get("OPENAI_API_KEY", ""))
+    parser.add_argument("--model", default="gpt-4o-mini")
+    parser.add_argument("--max-tokens", type=int, default=500)
+    parser.add_argument("--llm-timeout", type=float, default=15.0,
+                        help="seconds; keep below GATEWAY_TIMEOUT_MS on the car")
+    parser.add_argument("--prompts", default=DEFAULT_PROMPTS_FILE, help="prompts_data.h to read the planning prompt from")
+    parser.add_argument("--prompt-file", action="append", default=[],
+                        help="planning template committed to a car's prompt store (repeatable)")
+    parser.add_argument("--workers", type=int, default=16, help="requests planned concurrently")
+    parser.add_argument("--history-chars", type=int, default=6000, help="execution history kept per session")
+    parser.add_argument("--session-ttl", type=float, default=600.0, help="seconds before an idle session is dropped")
+    parser.add_argument("--stats-interval", type=float, default=30.0)
+    args = parser.parse_args()
+
+    client = make_client("planner_gateway_%d" % os.getpid())
+    gateway = Gateway(args, lambda topic, payload: client.publish(topic, payload))
+    client.on_message = gateway.on_message
+    client.connect(args.broker, args.port)
+    client.subscribe(REQUEST_TOPIC)
+    client.loop_start()
+    print("Planner gateway on %s:%d, LLM %s" % (args.broker, args.port, args.llm_url))
+
+    try:
+        while True:
+            time.sleep(args.stats_interval)
+            gateway.expire_sessions()
+            print(json.dumps(gateway.stats()))
+    except KeyboardInterrupt:
+        pass
+    finally:
+        client.loop_stop()
+        client.disconnect()
+
+
+if __name__ == "__main__":
+    main()
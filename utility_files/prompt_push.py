@@ -0,0 +1,133 @@
+#!/usr/bin/env python3
+"""
+Push, activate and roll back planning prompt versions over MQTT.
+
+Cars keep up to three prompt versions in NVS next to the built-in one
+(version 0). A push uploads a template in chunks on the prompt topic;
+the car checks the length and CRC32, checks the template still has its
+{{OBJECTIVE}} and {{EXECUTION_HISTORY}} placeholders, and stores it. Pushing
+does not activate; run "activate" afterwards (per car with --target, so
+a fleet can be split between variants for A/B runs).
+
+Examples:
+  python3 prompt_push.py push my_prompt.txt --version 3 --target car_a1b2c3
+  python3 prompt_push.py activate --version 3 --target car_a1b2c3
+  python3 prompt_push.py rollback
+  python3 prompt_push.py list
+
+Without --target every car on the broker acts on the message.
+Replies from cars are printed until --wait seconds pass.
+
+Requires: pip install paho-mqtt
+"""
+
+import argparse
+import json
+import sys
+import time
+import zlib
+
+import paho.mqtt.client as mqtt
+
+PROMPT_TOPIC = "ajlisy/robotprompt"
+# Serialized chunk message; the car's 1024-byte MQTT buffer also holds the
+# topic and packet header
+MESSAGE_BYTES = 900
+
+
+def make_client():
+    try:
+        return mqtt.Client(mqtt.CallbackAPIVersion.VERSION2)
+    except AttributeError:
+        # paho-mqtt < 2.0
+        return mqtt.Client()
+
+
+def chunk_messages(text, make_chunk, max_bytes):
+    """Split text into chunk messages whose JSON is at most max_bytes, never inside a character.
+
+    make_chunk(offset, data) builds one message. Sizes are taken after
+    json.dumps escaping, where quotes and newlines double and non-ASCII
+    characters grow to 6-12 bytes, so the raw UTF-8 length is not enough.
+    """
+    messages = []
+    offset = 0
+    current = ""
+    size = len(json.dumps(make_chunk(offset, "")))
+    for ch in text:
+        cost = len(json.dumps(ch)) - 2
+        if current and size + cost > max_bytes:
+            messages.append(make_chunk(offset, current))
+            offset += len(current.encode("utf-8"))
+            current = ""
+            size = len(json.dumps(make_chunk(offset, "")))
+        current += ch
+        size += cost
+    if current:
+        messages.append(make_chunk(offset, current))
+    return messages
+
+
+def build_messages(args):
+    base = {"target": args.target} if args.target else {}
+
+    if args.op != "push":
+        msg = dict(base, op=args.op)
+        if args.version is not None:
+            msg["version"] = args.version
+        return [msg]
+
+    with open(args.file, encoding="utf-8") as f:
+        text = f.read()
+    data = text.encode("utf-8")
+    messages = [dict(base, op="begin", version=args.version, length=len(data), crc32=zlib.crc32(data))]
+    messages += chunk_messages(
+        text, lambda offset, chunk: dict(base, op="chunk", version=args.version, offset=offset, data=chunk), MESSAGE_BYTES
+    )
+    messages.append(dict(base, op="commit", version=args.version))
+    return messages
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Manage planning prompt versions on the cars")
+    parser.add_argument("op", choices=["push", "activate", "rollback", "list"])
+    parser.add_argument("file", nargs="?", help="template file for push")
+    parser.add_argument("--version", type=int, help="prompt version (1 or higher for push)")
+    parser.add_argument("--target", default="", help="robot id to address; default is every car")
+    parser.add_argument("--broker", default="broker.hivemq.com")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--wait", type=float, default=5.0, help="seconds to print replies")
+    args = parser.parse_args()
+
+    if args.op == "push" and (not args.file or not args.version):
+        parser.error("push needs a file and --version >= 1")
+    if args.op == "activate" and args.version is None:
+        parser.error("activate needs --version")
+
+    def on_message(client, userdata, msg):
+        try:
+            doc = json.loads(msg.payload)
+        except ValueError:
+            return
+        if "robot_id" in doc:
+            print("%s: %s" % (doc["robot_id"], doc.get("message", "")))
+
+    client = make_client()
+    client.on_message = on_message
+    client.connect(args.broker, args.port)
+    client.subscribe(PROMPT_TOPIC)
+    client.loop_start()
+    time.sleep(0.5)
+
+    for message in build_messages(args):
+        client.publish(PROMPT_TOPIC, json.dumps(message), qos=1).wait_for_publish()
+        # Cars handle one message per loop() pass, about every 100 ms
+        time.sleep(0.15)
+
+    time.sleep(args.wait)
+    client.loop_stop()
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
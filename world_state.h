@@ -0,0 +1,45 @@
+#ifndef WORLD_STATE_H
+#define WORLD_STATE_H
+
+#include <Arduino.h>
+#include "odometry.h"
+
+#define WORLD_DISTANCE_SMOOTHING 0.5  // Weight of a new reading when the car hasn't moved since the previous one
+#define WORLD_MOVED_CM 2.0            // Pose change after which the last reading is only an estimate
+#define WORLD_TURNED_DEG 5.0          // Heading change after which the last reading no longer applies
+#define WORLD_ERROR_MAX_CHARS 80      // Of the last error kept
+
+// What the car knows about itself and its surroundings during an objective
+// Kept by the firmware from tool results and odometry, and sent with every
+// planning prompt, so the planner doesn't have to re-derive it from prose.
+struct WorldState {
+  float distanceCm;          // Filtered distance ahead, -1 until measured
+  int readings;              // Readings merged into distanceCm since the car last moved
+  unsigned long distanceAt;  // millis() of the latest reading
+  Pose distancePose;         // Pose at the latest reading
+  String lastMove;           // Params of the last move_car that ran, "" if none
+  int moves;                 // Forward/backward moves this objective
+  int turns;
+  float drivenCm;            // Odometry totals this objective
+  float turnedDeg;
+  int toolCalls;
+  int sonarReadings;
+  int errors;
+  String lastError;          // "tool: result" of the last failed call, "" if none
+  int lastErrorIteration;
+  int iteration;             // Planning iteration the tool calls belong to
+};
+
+// State of the objective being planned (world_state.ino)
+extern WorldState worldState;
+
+// Function declarations
+void resetWorldState(WorldState& state);
+int parseWorldDistance(const String& tool, const String& result);
+void recordWorldToolResult(WorldState& state, const String& tool, const String& params, const String& result,
+                           const Pose& before);
+void recordWorldDistance(WorldState& state, int cm, const Pose& pose, unsigned long at);
+float estimatedDistanceCm(const WorldState& state, const Pose& pose);
+String formatWorldState(const WorldState& state);
+
+#endif // WORLD_STATE_H
@@ -0,0 +1,170 @@
+#include "world_state.h"
+#include "local_planner.h"
+
+WorldState worldState;
+
+/**
+ * Start an objective with nothing known but the pose
+ */
+void resetWorldState(WorldState& state) {
+  state.distanceCm = -1;
+  state.readings = 0;
+  state.distanceAt = 0;
+  state.distancePose = getPose();
+  state.lastMove = "";
+  state.moves = 0;
+  state.turns = 0;
+  state.drivenCm = 0;
+  state.turnedDeg = 0;
+  state.toolCalls = 0;
+  state.sonarReadings = 0;
+  state.errors = 0;
+  state.lastError = "";
+  state.lastErrorIteration = 0;
+  state.iteration = 0;
+}
+
+/**
+ * Distance ahead reported by a tool result
+ * @return Distance in cm, LOCAL_OUT_OF_RANGE_CM for no echo, -1 if the result has none
+ */
+int parseWorldDistance(const String& tool, const String& result) {
+  if (tool == "get_environment_info") {
+    // Single raw ping; 0 means no echo
+    int index = result.indexOf("Distance ahead: ");
+    if (index == -1) {
+      return -1;
+    }
+    int cm = result.substring(index + 16, index + 24).toInt();
+    return cm > 0 ? cm : LOCAL_OUT_OF_RANGE_CM;
+  }
+  return parseDistanceResult(result);
+}
+
+/**
+ * Update the state with one executed tool call
+ * Moves and turns are measured from the odometry pose.
+ * @param state State to update
+ * @param tool Tool name
+ * @param params Params it was called with
+ * @param result What it returned
+ * @param before Pose before the call
+ */
+void recordWorldToolResult(WorldState& state, const String& tool, const String& params, const String& result,
+                           const Pose& before) {
+  state.toolCalls++;
+  if (result.startsWith("Error")) {
+    state.errors++;
+    state.lastError = tool + ": " + result.substring(0, WORLD_ERROR_MAX_CHARS);
+    state.lastErrorIteration = state.iteration;
+    return;
+  }
+
+  Pose after = getPose();
+  if (tool == "move_car") {
+    String command = params;
+    command.trim();
+    if (command != "stop") {
+      state.lastMove = command;
+    }
+    float driven = hypot(after.x - before.x, after.y - before.y);
+    float turned = fabs(normalizeHeading(after.heading - before.heading));
+    if (command.startsWith("left") || command.startsWith("right")) {
+      state.turns++;
+      state.turnedDeg += turned;
+    } else if (command.startsWith("forward") || command.startsWith("backward")) {
+      state.moves++;
+      state.drivenCm += driven;
+    }
+    return;
+  }
+
+  int cm = parseWorldDistance(tool, result);
+  if (cm >= 0) {
+    recordWorldDistance(state, cm, after, millis());
+  }
+}
+
+/**
+ * Merge one distance reading
+ * A reading taken where the previous one was is smoothed into it; after a
+ * move, or when either one is "no echo", it replaces it.
+ * @param state State to update
+ * @param cm Distance ahead, LOCAL_OUT_OF_RANGE_CM for no echo
+ * @param pose Pose the reading was taken at
+ * @param at millis() of the reading
+ */
+void recordWorldDistance(WorldState& state, int cm, const Pose& pose, unsigned long at) {
+  state.sonarReadings++;
+  // No echo isn't a distance; averaging it with a real reading gives neither
+  bool echo = cm < LOCAL_OUT_OF_RANGE_CM && state.distanceCm < LOCAL_OUT_OF_RANGE_CM;
+  bool samePlace = state.distanceCm >= 0 && echo &&
+                   hypot(pose.x - state.distancePose.x, pose.y - state.distancePose.y) < WORLD_MOVED_CM &&
+                   fabs(normalizeHeading(pose.heading - state.distancePose.heading)) < WORLD_TURNED_DEG;
+  if (samePlace) {
+    state.distanceCm += WORLD_DISTANCE_SMOOTHING * (cm - state.distanceCm);
+    state.readings++;
+  } else {
+    state.distanceCm = cm;
+    state.readings = 1;
+  }
+  state.distanceAt = at;
+  state.distancePose = pose;
+}
+
+/**
+ * Distance ahead now, from the last reading and the odometry since
+ * @param state State with a reading
+ * @param pose Current pose
+ * @return Estimated distance in cm, -1 if the car has turned since the reading
+ */
+float estimatedDistanceCm(const WorldState& state, const Pose& pose) {
+  if (fabs(normalizeHeading(pose.heading - state.distancePose.heading)) >= WORLD_TURNED_DEG) {
+    return -1;
+  }
+  float heading = state.distancePose.heading * PI / 180.0;
+  float progress = (pose.x - state.distancePose.x) * cos(heading) + (pose.y - state.distancePose.y) * sin(heading);
+  return max(state.distanceCm - progress, 0.0f);
+}
+
+/**
+ * Compact text for the {{WORLD_STATE}} prompt slot, e.g.
+ * pose: x=66.4 cm, y=0.0 cm, heading=0 deg, stopped
+ * distance ahead: 54 cm (2 readings, 3.1 s ago; ~20 cm now after moving since)
+ * last move: forward 500
+ * progress: 2 moves (66 cm), 0 turns (0 deg), 3 distance readings, 6 tool calls
+ * errors: none
+ */
+String formatWorldState(const WorldState& state) {
+  Pose pose = getPose();
+  String out = "pose: " + formatPose(pose) + (isMoving() ? ", moving" : ", stopped") + "\n";
+
+  out += "distance ahead: ";
+  if (state.distanceCm < 0) {
+    out += "not measured yet\n";
+  } else {
+    out += state.distanceCm >= LOCAL_OUT_OF_RANGE_CM ? String("out of range") : String((int)round(state.distanceCm)) + " cm";
+    out += " (" + String(state.readings) + (state.readings == 1 ? " reading, " : " readings, ") +
+           String((millis() - state.distanceAt) / 1000.0, 1) + " s ago";
+    bool moved = hypot(pose.x - state.distancePose.x, pose.y - state.distancePose.y) >= WORLD_MOVED_CM ||
+                 fabs(normalizeHeading(pose.heading - state.distancePose.heading)) >= WORLD_TURNED_DEG;
+    if (moved) {
+      float estimate = estimatedDistanceCm(state, pose);
+      out += estimate < 0 ? String("; turned since, no longer ahead") :
+                            "; ~" + String((int)round(estimate)) + " cm now after moving since";
+    }
+    out += ")\n";
+  }
+
+  out += "last move: " + (state.lastMove.length() > 0 ? state.lastMove : String("none")) + "\n";
+  out += "progress: " + String(state.moves) + " moves (" + String((int)round(state.drivenCm)) + " cm), " +
+         String(state.turns) + " turns (" + String((int)round(state.turnedDeg)) + " deg), " +
+         String(state.sonarReadings) + " distance readings, " + String(state.toolCalls) + " tool calls\n";
+  out += "errors: ";
+  if (state.errors == 0) {
+    out += "none";
+  } else {
+    out += String(state.errors) + ", last in iteration " + String(state.lastErrorIteration) + ": " + state.lastError;
+  }
+  return out;
+}